@@ -0,0 +1,174 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "asm_cache.h"
+#include "assembler.h"
+#include "isa.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//=========================================================
+// Keys
+//=========================================================
+
+#define FNV64_OFFSET 0xcbf29ce484222325ull
+#define FNV64_PRIME  0x100000001b3ull
+
+static uint64_t fnv64(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * FNV64_PRIME;
+    }
+    return h;
+}
+
+// Hash of everything the assembled bytes depend on
+static uint64_t cache_key(const uint8_t *source, size_t len) {
+    uint64_t h = fnv64(FNV64_OFFSET, ASM_VERSION, sizeof(ASM_VERSION));
+    for (size_t i = 0; i < isa_insn_count; i++) {
+        const IsaInsn *insn = &isa_insns[i];
+        h = fnv64(h, insn->mnemonic, strlen(insn->mnemonic) + 1);
+        h = fnv64(h, &insn->opcode, 1);
+        h = fnv64(h, &insn->format, 1);
+    }
+    uint64_t size = len;
+    h = fnv64(h, &size, sizeof(size));
+    return fnv64(h, source, len);
+}
+
+// "<dir>/<key>.bin", malloc'd
+static char *entry_path(const char *dir, uint64_t key) {
+    size_t len = strlen(dir) + 1 + 16 + 4 + 1;
+    char *path = malloc(len);
+    if (path) {
+        snprintf(path, len, "%s/%016llx.bin", dir, (unsigned long long)key);
+    }
+    return path;
+}
+
+//=========================================================
+// Storage
+//=========================================================
+
+// mkdir -p
+static int make_dirs(const char *dir) {
+    if (!*dir) return -1;
+    char *path = strdup(dir);
+    if (!path) return -1;
+
+    int rc = 0;
+    for (char *p = path + 1; ; p++) {
+        if (*p != '/' && *p != '\0') continue;
+        char saved = *p;
+        *p = '\0';
+        if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+            rc = -1;
+            break;
+        }
+        *p = saved;
+        if (saved == '\0') break;
+    }
+    free(path);
+    return rc;
+}
+
+// Write 'image' as the entry at 'path'; failures leave no entry
+static void store_entry(const char *dir, const char *path, const ProgramImage *image) {
+    if (make_dirs(dir) < 0) return;
+
+    size_t len = strlen(path) + 32;
+    char *tmp = malloc(len);
+    if (!tmp) return;
+    snprintf(tmp, len, "%s.%ld.tmp", path, (long)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        free(tmp);
+        return;
+    }
+    size_t done = 0;
+    while (done < image->size) {
+        ssize_t n = write(fd, image->data + done, image->size - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += (size_t)n;
+    }
+    if (close(fd) < 0 || done != image->size || rename(tmp, path) < 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+//=========================================================
+// Lookup
+//=========================================================
+
+// Assemble source[0, len) into 'image'
+static int assemble_image(const uint8_t *source, size_t len, ProgramImage *image) {
+    Assembler *asm_ctx = malloc(sizeof(Assembler));
+    if (!asm_ctx) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    asm_init(asm_ctx);
+
+    int rc = asm_assemble_buffer(asm_ctx, (const char *)source, len);
+    if (rc == 0 && asm_build_image(asm_ctx, image) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        rc = -1;
+    }
+    asm_free(asm_ctx);
+    free(asm_ctx);
+    return rc;
+}
+
+int asm_cache_assemble(const char *cache_dir, const char *asm_file,
+                       ProgramImage *image, bool *hit) {
+    memset(image, 0, sizeof(*image));
+    *hit = false;
+
+    ProgramImage source;
+    if (image_map_file(asm_file, &source) < 0) {
+        fprintf(stderr, "%s: %s\n", source.error, asm_file);
+        return -1;
+    }
+    if (!cache_dir) {
+        int rc = assemble_image(source.data, source.size, image);
+        image_release(&source);
+        return rc;
+    }
+
+    char *path = entry_path(cache_dir, cache_key(source.data, source.size));
+    if (!path) {
+        image_release(&source);
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        int rc = image_map_fd(fd, image);
+        close(fd);
+        if (rc == 0) {
+            *hit = true;
+            free(path);
+            image_release(&source);
+            return 0;
+        }
+        image_release(image);       // unreadable entry: rebuild it
+    }
+
+    int rc = assemble_image(source.data, source.size, image);
+    if (rc == 0) {
+        store_entry(cache_dir, path, image);
+    }
+    free(path);
+    image_release(&source);
+    return rc;
+}
@@ -0,0 +1,47 @@
+#ifndef ASM_CACHE_H
+#define ASM_CACHE_H
+
+#include <stdbool.h>
+#include "image.h"
+
+//=========================================================
+// Assembled-image cache
+//=========================================================
+//
+// asm-run assembles the same sources over and over. The cache keeps
+// each assembled image (an executable, exe.h) in a file named after a 64-bit FNV-1a hash of
+// the source bytes, ASM_VERSION and the instruction table
+// (isa.h), so an edit to the source, the language or the encoding
+// simply misses and the stale entry is never looked at again. A hit
+// maps the cached image instead of assembling; a miss assembles and
+// stores the result.
+//
+// Entries are written to a temporary file and renamed into place, so
+// concurrent runs of the same source never see a partial image. A
+// cache that cannot be created or written is not an error: the
+// source is assembled as if there were no cache. Sources that fail
+// to assemble are never cached, so their errors are reported on
+// every run. Removing the directory empties the cache.
+//
+
+// Default location, next to the build output
+#ifndef ASM_CACHE_DIR
+#define ASM_CACHE_DIR "build/asm-cache"
+#endif
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// asm_cache_assemble:
+//   Produce the assembled image of 'asm_file', through the cache in
+//   'cache_dir' (created on demand), or by plain assembly when
+//   'cache_dir' is NULL. *hit tells whether the cache supplied it.
+//   Returns 0 on success; -1 if the source cannot be read or does
+//   not assemble (reported on stderr). Release the image with
+//   image_release.
+//
+int asm_cache_assemble(const char *cache_dir, const char *asm_file,
+                       ProgramImage *image, bool *hit);
+
+#endif // ASM_CACHE_H
@@ -1,14 +1,17 @@
+// Enable strdup on some systems (must precede any system header)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "assembler.h"
 #include "cpu.h"
+#include "isa.h"
+#include "exe.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
-
-// Enable strdup on some systems
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE
-#endif
+#include <stdarg.h>
 
 //=========================================================
 // Assembler initialization / helpers
@@ -19,9 +22,33 @@ void asm_init(Assembler *asm_ctx) {
     // Clear all fields in the Assembler struct
     memset(asm_ctx, 0, sizeof(Assembler));
     asm_ctx->output_size = 0;     // no bytes emitted yet
-    asm_ctx->label_count = 0;     // no labels yet
     asm_ctx->current_line = 0;    // current line index for error messages
     asm_ctx->has_errors = false;  // no errors so far
+    asm_ctx->origin = PROGRAM_BASE;
+    asm_ctx->entry = PROGRAM_BASE;
+}
+
+void asm_set_error_handler(Assembler *asm_ctx, CpuErrorFn fn, void *ctx) {
+    asm_ctx->error = fn;
+    asm_ctx->error_ctx = ctx;
+}
+
+// Report a diagnostic (one line, no newline) to the error handler,
+// or to stderr if none is set
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((format(printf, 2, 3)))
+#endif
+static void asm_error(Assembler *asm_ctx, const char *fmt, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof message, fmt, args);
+    va_end(args);
+    if (asm_ctx->error) {
+        asm_ctx->error(asm_ctx->error_ctx, message);
+    } else {
+        fprintf(stderr, "%s\n", message);
+    }
 }
 
 // Parse register name (A, B, C, D, SP, PC) into numeric code
@@ -60,37 +87,138 @@ int asm_parse_number(const char *str, uint16_t *value) {
 // Label table management
 //=========================================================
 
+// Block of interned label names
+struct LabelArena {
+    LabelArena *next;
+    size_t      used;
+    size_t      size;
+    char        data[];
+};
+
+#define LABEL_ARENA_BLOCK 4096
+
+// Initial number of slots
+#define LABEL_TABLE_MIN 64
+
+// FNV-1a
+static uint32_t label_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    }
+    return h;
+}
+
+// Copy 'name' into the table's arena; NULL if out of memory
+static const char *label_intern(LabelTable *table, const char *name) {
+    size_t len = strlen(name) + 1;
+    LabelArena *block = table->arena;
+    if (!block || block->size - block->used < len) {
+        size_t size = len > LABEL_ARENA_BLOCK ? len : LABEL_ARENA_BLOCK;
+        block = malloc(sizeof(LabelArena) + size);
+        if (!block) return NULL;
+        block->next = table->arena;
+        block->used = 0;
+        block->size = size;
+        table->arena = block;
+    }
+    char *copy = &block->data[block->used];
+    memcpy(copy, name, len);
+    block->used += len;
+    return copy;
+}
+
+// Slot holding 'name', or the empty slot where it would go
+static Label *label_slot(const LabelTable *table, const char *name, uint32_t hash) {
+    size_t mask = table->capacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        Label *slot = &table->slots[i];
+        if (!slot->name || (slot->hash == hash && strcmp(slot->name, name) == 0)) {
+            return slot;
+        }
+    }
+}
+
+// Double the slot array (or allocate the first one)
+static int label_grow(LabelTable *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : LABEL_TABLE_MIN;
+    Label *slots = calloc(capacity, sizeof(Label));
+    if (!slots) return -1;
+
+    LabelTable grown = { slots, capacity, table->count, table->arena };
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].name) {
+            *label_slot(&grown, table->slots[i].name, table->slots[i].hash) = table->slots[i];
+        }
+    }
+    free(table->slots);
+    *table = grown;
+    return 0;
+}
+
+// Release the label table's slots and interned names
+void asm_free(Assembler *asm_ctx) {
+    LabelTable *table = &asm_ctx->labels;
+    free(table->slots);
+    while (table->arena) {
+        LabelArena *next = table->arena->next;
+        free(table->arena);
+        table->arena = next;
+    }
+    memset(table, 0, sizeof(*table));
+
+    free(asm_ctx->fixups);
+    asm_ctx->fixups = NULL;
+    asm_ctx->fixup_count = 0;
+    asm_ctx->fixup_cap = 0;
+}
+
 // Add a label to the symbol table with its address
 int asm_add_label(Assembler *asm_ctx, const char *name, uint16_t address) {
-    // Check label capacity
-    if (asm_ctx->label_count >= MAX_LABELS) {
-        fprintf(stderr, "Error: Too many labels\n");
+    LabelTable *table = &asm_ctx->labels;
+
+    // Keep the load factor at or below 3/4
+    if ((table->count + 1) * 4 > table->capacity * 3 && label_grow(table) < 0) {
+        asm_error(asm_ctx, "Error: Out of memory for labels");
         return -1;
     }
-    
-    for (int i = 0; i < asm_ctx->label_count; i++) {
-        if (strcmp(asm_ctx->labels[i].name, name) == 0) {
-            return 0;
-        }
+
+    uint32_t hash = label_hash(name);
+    Label *slot = label_slot(table, name, hash);
+    if (slot->name) {
+        asm_error(asm_ctx, "Line %d: Duplicate label '%s' (first defined on line %d)",
+                asm_ctx->current_line, name, slot->line);
+        return -1;
     }
-    
+
     // Store label name and address
-    strncpy(asm_ctx->labels[asm_ctx->label_count].name, name, MAX_LABEL_LEN - 1);
-    asm_ctx->labels[asm_ctx->label_count].address = address;
-    asm_ctx->label_count++;
-    
+    const char *interned = label_intern(table, name);
+    if (!interned) {
+        asm_error(asm_ctx, "Error: Out of memory for labels");
+        return -1;
+    }
+    slot->name = interned;
+    slot->hash = hash;
+    slot->address = address;
+    slot->line = asm_ctx->current_line;
+    table->count++;
+
     return 0;
 }
 
 // Find label by name and return its address through 'address'
 int asm_find_label(Assembler *asm_ctx, const char *name, uint16_t *address) {
-    for (int i = 0; i < asm_ctx->label_count; i++) {
-        if (strcmp(asm_ctx->labels[i].name, name) == 0) {
-            *address = asm_ctx->labels[i].address;
-            return 0;
-        }
+    const LabelTable *table = &asm_ctx->labels;
+    if (table->count == 0) {
+        return -1;
+    }
+
+    const Label *slot = label_slot(table, name, label_hash(name));
+    if (!slot->name) {
+        return -1; // not found
     }
-    return -1; // not found
+    *address = slot->address;
+    return 0;
 }
 
 //=========================================================
@@ -111,6 +239,60 @@ static void emit_word(Assembler *asm_ctx, uint16_t word) {
     emit_byte(asm_ctx, (word >> 8) & 0xFF);
 }
 
+// Emit the address of label 'name', or a placeholder plus a fixup if
+// the label is not defined yet
+static int emit_label_ref(Assembler *asm_ctx, const char *name) {
+    uint16_t addr;
+    if (asm_find_label(asm_ctx, name, &addr) == 0) {
+        emit_word(asm_ctx, addr);
+        return 0;
+    }
+
+    // Past the end of the output nothing would be patched
+    if (asm_ctx->output_size + 2 <= MAX_PROGRAM_SIZE) {
+        if (asm_ctx->fixup_count == asm_ctx->fixup_cap) {
+            size_t cap = asm_ctx->fixup_cap ? asm_ctx->fixup_cap * 2 : 64;
+            Fixup *grown = realloc(asm_ctx->fixups, cap * sizeof(Fixup));
+            if (!grown) {
+                asm_error(asm_ctx, "Error: Out of memory for labels");
+                return -1;
+            }
+            asm_ctx->fixups = grown;
+            asm_ctx->fixup_cap = cap;
+        }
+        const char *interned = label_intern(&asm_ctx->labels, name);
+        if (!interned) {
+            asm_error(asm_ctx, "Error: Out of memory for labels");
+            return -1;
+        }
+        Fixup *fix = &asm_ctx->fixups[asm_ctx->fixup_count++];
+        fix->name = interned;
+        fix->offset = (uint16_t)asm_ctx->output_size;
+        fix->line = asm_ctx->current_line;
+    }
+    emit_word(asm_ctx, 0);
+    return 0;
+}
+
+// Patch every forward reference. Reports each undefined label and
+// returns -1 if there was any.
+static int resolve_fixups(Assembler *asm_ctx) {
+    int rc = 0;
+    for (size_t i = 0; i < asm_ctx->fixup_count; i++) {
+        const Fixup *fix = &asm_ctx->fixups[i];
+        uint16_t addr;
+        if (asm_find_label(asm_ctx, fix->name, &addr) < 0) {
+            asm_error(asm_ctx, "Line %d: Undefined label '%s'", fix->line, fix->name);
+            rc = -1;
+            continue;
+        }
+        asm_ctx->output[fix->offset]     = addr & 0xFF;
+        asm_ctx->output[fix->offset + 1] = (addr >> 8) & 0xFF;
+    }
+    asm_ctx->fixup_count = 0;
+    return rc;
+}
+
 //=========================================================
 // String / parsing utilities
 //=========================================================
@@ -119,13 +301,13 @@ static void emit_word(Assembler *asm_ctx, uint16_t word) {
 // Returns pointer to first non-space character.
 static char *trim(char *str) {
     // Skip leading spaces
-    while (isspace(*str)) str++;
+    while (isspace((unsigned char)*str)) str++;
     // If all spaces, this returns pointer to '\0' at end
     
     // Find end of string
     char *end = str + strlen(str) - 1;
     // Move backward over trailing spaces
-    while (end > str && isspace(*end)) end--;
+    while (end > str && isspace((unsigned char)*end)) end--;
     // Null-terminate right after last non-space
     *(end + 1) = '\0';
     return str;
@@ -135,12 +317,77 @@ static char *trim(char *str) {
 // Core line parser: one line of assembly → emitted bytes
 //=========================================================
 
-static int asm_parse_line(Assembler *asm_ctx, char *line) {
-    char line_copy[MAX_LINE_LEN];
-    strncpy(line_copy, line, MAX_LINE_LEN - 1);
-    line_copy[MAX_LINE_LEN - 1] = '\0';
-    line = line_copy;
+// Uppercase a register name or label; numeric literals and memory
+// operands keep their spelling
+static void normalize_operand(char *arg) {
+    if (arg[0] != '0' && arg[0] != '[') {
+        for (char *p = arg; *p; p++) *p = toupper(*p);
+    }
+}
+
+// Parse a "[addr]" operand (the caller has checked the '[')
+static int parse_mem_operand(Assembler *asm_ctx, char *arg, uint16_t *addr) {
+    char *end = strchr(arg, ']');
+    if (!end) {
+        asm_error(asm_ctx, "Line %d: Missing ']'", asm_ctx->current_line);
+        return -1;
+    }
+    *end = '\0';
+    if (asm_parse_number(arg + 1, addr) < 0) {
+        asm_error(asm_ctx, "Line %d: Invalid address", asm_ctx->current_line);
+        return -1;
+    }
+    return 0;
+}
+
+// Handle a directive line (name uppercased, leading '.')
+static int asm_parse_directive(Assembler *asm_ctx, const char *name, const char *arg) {
+    int line_no = asm_ctx->current_line;
+    uint16_t value;
+    
+    if (strcmp(name, ".ORG") == 0) {
+        // Labels and code already placed would move
+        if (asm_ctx->output_size || asm_ctx->labels.count) {
+            asm_error(asm_ctx, "Line %d: .org must come before any code or label", line_no);
+            return -1;
+        }
+        if (!*arg || asm_parse_number(arg, &value) < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid address", line_no);
+            return -1;
+        }
+        asm_ctx->origin = value;
+        return 0;
+    }
     
+    if (strcmp(name, ".ENTRY") == 0) {
+        if (!*arg) {
+            asm_error(asm_ctx, "Line %d: Missing entry point", line_no);
+            return -1;
+        }
+        asm_ctx->has_entry = true;
+        asm_ctx->entry_label = NULL;
+        if (asm_parse_number(arg, &value) == 0) {
+            asm_ctx->entry = value;
+            return 0;
+        }
+        // A label, possibly defined further down
+        asm_ctx->entry_label = label_intern(&asm_ctx->labels, arg);
+        if (!asm_ctx->entry_label) {
+            asm_error(asm_ctx, "Error: Out of memory for labels");
+            return -1;
+        }
+        asm_ctx->entry_line = line_no;
+        return 0;
+    }
+    
+    asm_error(asm_ctx, "Line %d: Unknown directive '%s'", line_no, name);
+    return -1;
+}
+
+// Assemble one line. The line is taken apart in place: comments,
+// the label and the operands are split off by writing NULs into it,
+// so it may be of any length.
+static int asm_parse_line(Assembler *asm_ctx, char *line) {
     line = trim(line);
     
     // Skip empty lines
@@ -172,9 +419,9 @@ static int asm_parse_line(Assembler *asm_ctx, char *line) {
         char *label = trim(line);
         // Normalize label to uppercase to avoid case issues
         for (char *p = label; *p; p++) *p = toupper(*p);
-        // Compute label address as base program address (0x0100)
-        // plus current output size (instruction bytes so far).
-        uint16_t label_addr = 0x0100 + asm_ctx->output_size;
+        // Compute label address as the load address (.org) plus
+        // current output size (instruction bytes so far).
+        uint16_t label_addr = asm_ctx->origin + asm_ctx->output_size;
         if (asm_add_label(asm_ctx, label, label_addr) < 0) {
             return -1;
         }
@@ -186,19 +433,14 @@ static int asm_parse_line(Assembler *asm_ctx, char *line) {
     //------------------------------
     // Split into instruction and arguments
     //------------------------------
-    char instr[32] = {0};
-    char args[MAX_LINE_LEN] = {0};
+    char *instr = line;
+    char *args = line + strlen(line);   // empty unless there are operands
     
-    // Find first space to split mnemonic from argument string
-    char *space = strchr(line, ' ');
+    // First blank separates the mnemonic from the argument string
+    char *space = strpbrk(line, " \t");
     if (space) {
-        size_t instr_len = space - line;
-        strncpy(instr, line, instr_len);
-        instr[instr_len] = '\0';
-        strcpy(args, trim(space + 1));  // everything after mnemonic is args
-    } else {
-        // No space → whole line is instruction (no arguments)
-        strcpy(instr, line);
+        *space = '\0';
+        args = trim(space + 1);
     }
     
     // Normalize instruction mnemonic to uppercase
@@ -207,350 +449,169 @@ static int asm_parse_line(Assembler *asm_ctx, char *line) {
     //------------------------------
     // Split arguments into arg1, arg2 (comma-separated)
     //------------------------------
-    char arg1[64] = {0}, arg2[64] = {0};
-    if (args[0]) {
-        char *comma = strchr(args, ',');
-        if (comma) {
-            // Two-operand instruction: split at comma
-            size_t len = comma - args;
-            strncpy(arg1, args, len);
-            arg1[len] = '\0';
-            strcpy(arg2, comma + 1);
-            // Trim both arguments
-            char *t1 = trim(arg1);
-            char *t2 = trim(arg2);
-            if (t1 != arg1) memmove(arg1, t1, strlen(t1) + 1);
-            if (t2 != arg2) memmove(arg2, t2, strlen(t2) + 1);
-            // Uppercase non-literal arguments (register names, labels)
-            if (arg1[0] != '0' && arg1[0] != '[') {
-                for (char *p = arg1; *p; p++) *p = toupper(*p);
-            }
-            if (arg2[0] != '0' && arg2[0] != '[') {
-                for (char *p = arg2; *p; p++) *p = toupper(*p);
-            }
-        } else {
-            // Single-operand instruction: whole args string is arg1
-            strcpy(arg1, args);
-            char *t1 = trim(arg1);
-            if (t1 != arg1) memmove(arg1, t1, strlen(t1) + 1);
-            // Uppercase if not a numeric literal or memory address
-            if (arg1[0] != '0' && arg1[0] != '[') {
-                for (char *p = arg1; *p; p++) *p = toupper(*p);
-            }
-        }
+    char *arg1 = args;
+    char *arg2 = args + strlen(args);
+    char *comma = strchr(args, ',');
+    if (comma) {
+        // Two-operand instruction: split at comma
+        *comma = '\0';
+        arg2 = trim(comma + 1);
+    }
+    arg1 = trim(arg1);
+    normalize_operand(arg1);
+    normalize_operand(arg2);
+    
+    if (instr[0] == '.') {
+        return asm_parse_directive(asm_ctx, instr, arg1);
     }
     
     //------------------------------
     // Instruction encoding
     //------------------------------
 
-    if (strcmp(instr, "NOP") == 0) {
-        emit_byte(asm_ctx, OP_NOP);
-    }
-    else if (strcmp(instr, "HLT") == 0) {
-        emit_byte(asm_ctx, OP_HLT);
-    }
-    //--------------- LOAD r, imm / LOAD r, [addr] ---------------
-    else if (strcmp(instr, "LOAD") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register '%s'\n", asm_ctx->current_line, arg1);
-            return -1;
-        }
-        
-        // Memory load: LOAD r, [addr]
-        if (arg2[0] == '[') {
-            char *end = strchr(arg2, ']');
-            if (!end) {
-                fprintf(stderr, "Line %d: Missing ']'\n", asm_ctx->current_line);
-                return -1;
-            }
-            *end = '\0';
-            uint16_t addr;
-            if (asm_parse_number(arg2 + 1, &addr) < 0) {
-                fprintf(stderr, "Line %d: Invalid address\n", asm_ctx->current_line);
-                return -1;
-            }
-            emit_byte(asm_ctx, OP_LOAD_MEM);
-            emit_byte(asm_ctx, reg);
-            emit_word(asm_ctx, addr);
-        } else {
-            // Immediate load: LOAD r, imm
-            uint16_t imm;
-            if (asm_parse_number(arg2, &imm) < 0) {
-                fprintf(stderr, "Line %d: Invalid immediate value '%s'\n", asm_ctx->current_line, arg2);
-                return -1;
-            }
-            emit_byte(asm_ctx, OP_LOAD_IMM);
-            emit_byte(asm_ctx, reg);
-            emit_word(asm_ctx, imm);
-        }
-    }
-    //--------------- STORE [addr], r ---------------
-    else if (strcmp(instr, "STORE") == 0) {
-        // Destination must be [addr]
-        if (arg1[0] != '[') {
-            fprintf(stderr, "Line %d: STORE requires [addr] format\n", asm_ctx->current_line);
-            return -1;
-        }
-        char *end = strchr(arg1, ']');
-        if (!end) {
-            fprintf(stderr, "Line %d: Missing ']'\n", asm_ctx->current_line);
-            return -1;
-        }
-        *end = '\0';
-        uint16_t addr;
-        if (asm_parse_number(arg1 + 1, &addr) < 0) {
-            fprintf(stderr, "Line %d: Invalid address\n", asm_ctx->current_line);
-            return -1;
-        }
-        int reg = asm_parse_register(arg2);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register '%s'\n", asm_ctx->current_line, arg2);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_STORE);
-        emit_word(asm_ctx, addr);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- MOV r1, r2 ---------------
-    else if (strcmp(instr, "MOV") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_MOV);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- PUSH r ---------------
-    else if (strcmp(instr, "PUSH") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_PUSH);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- POP r ---------------
-    else if (strcmp(instr, "POP") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_POP);
-        emit_byte(asm_ctx, reg);
+    const IsaInsn *insn = isa_lookup(instr, strlen(instr));
+    if (!insn) {
+        asm_error(asm_ctx, "Line %d: Unknown instruction '%s'", asm_ctx->current_line, instr);
+        return -1;
     }
-    //--------------- ADD r1, r2 ---------------
-    else if (strcmp(instr, "ADD") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_ADD);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
+    // "LOAD r, [addr]" is a separate opcode under the same mnemonic
+    if (arg2[0] == '[') {
+        const IsaInsn *mem = isa_variant(insn, ISA_FMT_REG_MEM);
+        if (mem) insn = mem;
     }
-    //--------------- ADDI r, imm ---------------
-    else if (strcmp(instr, "ADDI") == 0) {
-        int reg = asm_parse_register(arg1);
-        uint16_t imm;
-        if (reg < 0 || asm_parse_number(arg2, &imm) < 0) {
-            fprintf(stderr, "Line %d: Invalid ADDI arguments\n", asm_ctx->current_line);
+
+    int line_no = asm_ctx->current_line;
+    int r1, r2;
+    uint16_t value;
+
+    switch ((IsaFormat)insn->format) {
+    //--------------- NOP, RET, HLT ---------------
+    case ISA_FMT_NONE:
+        emit_byte(asm_ctx, insn->opcode);
+        break;
+
+    //--------------- PUSH/POP/INC/DEC/NOT r ---------------
+    case ISA_FMT_REG:
+        r1 = asm_parse_register(arg1);
+        if (r1 < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid register", line_no);
             return -1;
         }
-        emit_byte(asm_ctx, OP_ADDI);
-        emit_byte(asm_ctx, reg);
-        emit_word(asm_ctx, imm);
-    }
-    //--------------- SUB r1, r2 ---------------
-    else if (strcmp(instr, "SUB") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
+        emit_byte(asm_ctx, insn->opcode);
+        emit_byte(asm_ctx, r1);
+        break;
+
+    //--------------- MOV/ALU/CMP r1, r2 ---------------
+    case ISA_FMT_REG_REG:
+        r1 = asm_parse_register(arg1);
+        r2 = asm_parse_register(arg2);
         if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
+            asm_error(asm_ctx, "Line %d: Invalid registers", line_no);
             return -1;
         }
-        emit_byte(asm_ctx, OP_SUB);
+        emit_byte(asm_ctx, insn->opcode);
         emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- SUBI r, imm ---------------
-    else if (strcmp(instr, "SUBI") == 0) {
-        int reg = asm_parse_register(arg1);
-        uint16_t imm;
-        if (reg < 0 || asm_parse_number(arg2, &imm) < 0) {
-            fprintf(stderr, "Line %d: Invalid SUBI arguments\n", asm_ctx->current_line);
+        break;
+
+    //--------------- SHL/SHR r, imm8 ---------------
+    case ISA_FMT_REG_IMM8:
+        r1 = asm_parse_register(arg1);
+        if (r1 < 0 || asm_parse_number(arg2, &value) < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid %s arguments", line_no, insn->mnemonic);
             return -1;
         }
-        emit_byte(asm_ctx, OP_SUBI);
-        emit_byte(asm_ctx, reg);
-        emit_word(asm_ctx, imm);
-    }
-    //--------------- MUL r1, r2 ---------------
-    else if (strcmp(instr, "MUL") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
+        emit_byte(asm_ctx, insn->opcode);
+        emit_byte(asm_ctx, r1);
+        emit_byte(asm_ctx, value & 0xFF); // 8-bit immediate
+        break;
+
+    //--------------- Jumps/CALL label_or_addr ---------------
+    case ISA_FMT_ADDR:
+        emit_byte(asm_ctx, insn->opcode);
+        if (asm_parse_number(arg1, &value) == 0) {
+            emit_word(asm_ctx, value);
+        } else if (emit_label_ref(asm_ctx, arg1) < 0) {
             return -1;
         }
-        emit_byte(asm_ctx, OP_MUL);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- DIV r1, r2 ---------------
-    else if (strcmp(instr, "DIV") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
+        break;
+
+    //--------------- LOAD/ADDI/SUBI/CMPI r, imm ---------------
+    case ISA_FMT_REG_IMM16:
+        r1 = asm_parse_register(arg1);
+        if (r1 < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid register '%s'", line_no, arg1);
             return -1;
         }
-        emit_byte(asm_ctx, OP_DIV);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- INC r ---------------
-    else if (strcmp(instr, "INC") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
+        if (asm_parse_number(arg2, &value) < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid immediate value '%s'", line_no, arg2);
             return -1;
         }
-        emit_byte(asm_ctx, OP_INC);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- DEC r ---------------
-    else if (strcmp(instr, "DEC") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
+        emit_byte(asm_ctx, insn->opcode);
+        emit_byte(asm_ctx, r1);
+        emit_word(asm_ctx, value);
+        break;
+
+    //--------------- LOAD r, [addr] ---------------
+    case ISA_FMT_REG_MEM:
+        r1 = asm_parse_register(arg1);
+        if (r1 < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid register '%s'", line_no, arg1);
             return -1;
         }
-        emit_byte(asm_ctx, OP_DEC);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- AND/OR/XOR r1, r2 ---------------
-    else if (strcmp(instr, "AND") == 0 || strcmp(instr, "OR") == 0 || 
-             strcmp(instr, "XOR") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
+        if (parse_mem_operand(asm_ctx, arg2, &value) < 0) {
             return -1;
         }
-        uint8_t op = (strcmp(instr, "AND") == 0) ? OP_AND :
-                     (strcmp(instr, "OR") == 0)  ? OP_OR  : OP_XOR;
-        emit_byte(asm_ctx, op);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- NOT r ---------------
-    else if (strcmp(instr, "NOT") == 0) {
-        int reg = asm_parse_register(arg1);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
+        emit_byte(asm_ctx, insn->opcode);
+        emit_byte(asm_ctx, r1);
+        emit_word(asm_ctx, value);
+        break;
+
+    //--------------- IN r, port ---------------
+    case ISA_FMT_REG_PORT:
+        r1 = asm_parse_register(arg1);
+        if (r1 < 0 || asm_parse_number(arg2, &value) < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid %s arguments", line_no, insn->mnemonic);
             return -1;
         }
-        emit_byte(asm_ctx, OP_NOT);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- SHL/SHR r, imm8 ---------------
-    else if (strcmp(instr, "SHL") == 0 || strcmp(instr, "SHR") == 0) {
-        int reg = asm_parse_register(arg1);
-        uint16_t shift;
-        if (reg < 0 || asm_parse_number(arg2, &shift) < 0) {
-            fprintf(stderr, "Line %d: Invalid shift arguments\n", asm_ctx->current_line);
+        emit_byte(asm_ctx, insn->opcode);
+        emit_byte(asm_ctx, r1);
+        emit_word(asm_ctx, value);
+        break;
+
+    //--------------- STORE [addr], r ---------------
+    case ISA_FMT_MEM_REG:
+        if (arg1[0] != '[') {
+            asm_error(asm_ctx, "Line %d: %s requires [addr] format", line_no, insn->mnemonic);
             return -1;
         }
-        emit_byte(asm_ctx, strcmp(instr, "SHL") == 0 ? OP_SHL : OP_SHR);
-        emit_byte(asm_ctx, reg);
-        emit_byte(asm_ctx, shift & 0xFF); // shift amount as 8-bit immediate
-    }
-    //--------------- CMP r1, r2 ---------------
-    else if (strcmp(instr, "CMP") == 0) {
-        int r1 = asm_parse_register(arg1);
-        int r2 = asm_parse_register(arg2);
-        if (r1 < 0 || r2 < 0) {
-            fprintf(stderr, "Line %d: Invalid registers\n", asm_ctx->current_line);
+        if (parse_mem_operand(asm_ctx, arg1, &value) < 0) {
             return -1;
         }
-        emit_byte(asm_ctx, OP_CMP);
-        emit_byte(asm_ctx, (r1 << 4) | r2);
-    }
-    //--------------- CMPI r, imm ---------------
-    else if (strcmp(instr, "CMPI") == 0) {
-        int reg = asm_parse_register(arg1);
-        uint16_t imm;
-        if (reg < 0 || asm_parse_number(arg2, &imm) < 0) {
-            fprintf(stderr, "Line %d: Invalid CMPI arguments\n", asm_ctx->current_line);
+        r1 = asm_parse_register(arg2);
+        if (r1 < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid register '%s'", line_no, arg2);
             return -1;
         }
-        emit_byte(asm_ctx, OP_CMPI);
-        emit_byte(asm_ctx, reg);
-        emit_word(asm_ctx, imm);
-    }
-    //--------------- Jumps/CALL label_or_addr ---------------
-    else if (strcmp(instr, "JMP") == 0 || strcmp(instr, "JZ") == 0 ||
-             strcmp(instr, "JNZ") == 0 || strcmp(instr, "JC") == 0 ||
-             strcmp(instr, "JNC") == 0 || strcmp(instr, "CALL") == 0) {
-        uint8_t op = (strcmp(instr, "JMP") == 0) ? OP_JMP :
-                     (strcmp(instr, "JZ")  == 0) ? OP_JZ  :
-                     (strcmp(instr, "JNZ") == 0) ? OP_JNZ :
-                     (strcmp(instr, "JC")  == 0) ? OP_JC  :
-                     (strcmp(instr, "JNC") == 0) ? OP_JNC : OP_CALL;
-        
-        uint16_t addr;
-        if (asm_parse_number(arg1, &addr) < 0) {
-            if (asm_find_label(asm_ctx, arg1, &addr) < 0) {
-                fprintf(stderr, "Line %d: Undefined label '%s'\n", 
-                        asm_ctx->current_line, arg1);
-                return -1;
-            }
-            emit_byte(asm_ctx, op);
-            emit_word(asm_ctx, addr);
-        } else {
-            emit_byte(asm_ctx, op);
-            emit_word(asm_ctx, addr);
-        }
-    }
-    //--------------- RET ---------------
-    else if (strcmp(instr, "RET") == 0) {
-        emit_byte(asm_ctx, OP_RET);
-    }
+        emit_byte(asm_ctx, insn->opcode);
+        emit_word(asm_ctx, value);
+        emit_byte(asm_ctx, r1);
+        break;
+
     //--------------- OUT port, r ---------------
-    else if (strcmp(instr, "OUT") == 0) {
-        uint16_t port;
-        if (asm_parse_number(arg1, &port) < 0) {
-            fprintf(stderr, "Line %d: Invalid port number\n", asm_ctx->current_line);
+    case ISA_FMT_PORT_REG:
+        if (asm_parse_number(arg1, &value) < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid port number", line_no);
             return -1;
         }
-        int reg = asm_parse_register(arg2);
-        if (reg < 0) {
-            fprintf(stderr, "Line %d: Invalid register\n", asm_ctx->current_line);
+        r1 = asm_parse_register(arg2);
+        if (r1 < 0) {
+            asm_error(asm_ctx, "Line %d: Invalid register", line_no);
             return -1;
         }
-        emit_byte(asm_ctx, OP_OUT);
-        emit_word(asm_ctx, port);
-        emit_byte(asm_ctx, reg);
-    }
-    //--------------- IN r, port ---------------
-    else if (strcmp(instr, "IN") == 0) {
-        int reg = asm_parse_register(arg1);
-        uint16_t port;
-        if (reg < 0 || asm_parse_number(arg2, &port) < 0) {
-            fprintf(stderr, "Line %d: Invalid IN arguments\n", asm_ctx->current_line);
-            return -1;
-        }
-        emit_byte(asm_ctx, OP_IN);
-        emit_byte(asm_ctx, reg);
-        emit_word(asm_ctx, port);
-    }
-    //--------------- Unknown instruction ---------------
-    else {
-        fprintf(stderr, "Line %d: Unknown instruction '%s'\n", asm_ctx->current_line, instr);
-        return -1;
+        emit_byte(asm_ctx, insn->opcode);
+        emit_word(asm_ctx, value);
+        emit_byte(asm_ctx, r1);
+        break;
     }
     
     return 0; // Success for this line
@@ -560,150 +621,244 @@ static int asm_parse_line(Assembler *asm_ctx, char *line) {
 // High-level assembly entry points
 //=========================================================
 
-// Assemble from an in-memory string (used by tests or tools)
-int asm_assemble_string(Assembler *asm_ctx, const char *source) {
-    // Make a modifiable copy for strtok
-    char *source_copy = strdup(source);
-    char *line = strtok(source_copy, "\n");
-    
-    asm_ctx->current_line = 0;
-    
-    // Process each line until strtok returns NULL
-    while (line != NULL) {
+// Size of the first file read; the buffer doubles for a line that
+// does not fit
+#define ASM_READ_CHUNK (1u << 20)
+
+// Assemble the complete lines in text[0, len). The last line may
+// lack a newline only when 'last' is set, in which case text[len]
+// must be writable. Lines are parsed where they lie, with the
+// newline overwritten. *consumed is set to the bytes used up.
+static int assemble_lines(Assembler *asm_ctx, char *text, size_t len, bool last,
+                          size_t *consumed) {
+    size_t pos = 0;
+    while (pos < len) {
+        char *start = text + pos;
+        char *newline = memchr(start, '\n', len - pos);
+        if (!newline) {
+            if (!last) break;
+            newline = text + len;
+        }
+        *newline = '\0';
         asm_ctx->current_line++;
-        if (asm_parse_line(asm_ctx, line) < 0) {
+        if (asm_parse_line(asm_ctx, start) < 0) {
             asm_ctx->has_errors = true;
-            free(source_copy);
             return -1;
         }
-        line = strtok(NULL, "\n");
+        pos = (size_t)(newline - text) + 1;
     }
-    
-    free(source_copy);
+    *consumed = pos < len ? pos : len;
     return 0;
 }
 
-// Assemble from a file on disk
-static int scan_labels_only(Assembler *asm_ctx, char *line) {
-    char line_copy[MAX_LINE_LEN];
-    strncpy(line_copy, line, MAX_LINE_LEN - 1);
-    line_copy[MAX_LINE_LEN - 1] = '\0';
-    line = line_copy;
-    
-    line = trim(line);
-    if (line[0] == '\0') return 0;
-    
-    char *comment = strchr(line, ';');
-    if (comment) *comment = '\0';
-    comment = strchr(line, '#');
-    if (comment) *comment = '\0';
-    line = trim(line);
-    if (line[0] == '\0') return 0;
+// Patch forward references now that every label is known
+static int finish_assembly(Assembler *asm_ctx) {
+    int rc = resolve_fixups(asm_ctx);
     
-    char *colon = strchr(line, ':');
-    if (colon) {
-        *colon = '\0';
-        char *label = trim(line);
-        for (char *p = label; *p; p++) *p = toupper(*p);
-        uint16_t label_addr = 0x0100 + asm_ctx->output_size;
-        if (asm_add_label(asm_ctx, label, label_addr) < 0) {
-            return -1;
-        }
-        line = trim(colon + 1);
-        if (line[0] == '\0') return 0;
+    if (!asm_ctx->has_entry) {
+        asm_ctx->entry = asm_ctx->origin;
+    } else if (asm_ctx->entry_label &&
+               asm_find_label(asm_ctx, asm_ctx->entry_label, &asm_ctx->entry) < 0) {
+        asm_error(asm_ctx, "Line %d: Undefined label '%s'",
+                asm_ctx->entry_line, asm_ctx->entry_label);
+        rc = -1;
     }
     
-    char instr[32] = {0};
-    char *space = strchr(line, ' ');
-    if (space) {
-        size_t len = space - line;
-        strncpy(instr, line, len);
-        instr[len] = '\0';
-    } else {
-        strcpy(instr, line);
+    if (rc < 0) {
+        asm_ctx->has_errors = true;
+        return -1;
+    }
+    return 0;
+}
+
+// Assemble from an in-memory string (used by tests or tools)
+int asm_assemble_string(Assembler *asm_ctx, const char *source) {
+    return asm_assemble_buffer(asm_ctx, source, strlen(source));
+}
+
+// Assemble a counted source buffer
+int asm_assemble_buffer(Assembler *asm_ctx, const char *source, size_t len) {
+    // Lines are split in place, so work on a copy
+    char *source_copy = malloc(len + 1);
+    if (!source_copy) {
+        asm_error(asm_ctx, "Out of memory");
+        return -1;
     }
+    if (len) memcpy(source_copy, source, len);
+    source_copy[len] = '\0';
     
-    for (char *p = instr; *p; p++) *p = toupper(*p);
+    asm_ctx->current_line = 0;
     
-    if (strcmp(instr, "NOP") == 0 || strcmp(instr, "HLT") == 0 || strcmp(instr, "RET") == 0) {
-        asm_ctx->output_size += 1;
-    } else if (strcmp(instr, "LOAD") == 0 || strcmp(instr, "ADDI") == 0 || 
-               strcmp(instr, "SUBI") == 0 || strcmp(instr, "CMPI") == 0 ||
-               strcmp(instr, "OUT") == 0 || strcmp(instr, "IN") == 0) {
-        asm_ctx->output_size += 4;
-    } else if (strcmp(instr, "JMP") == 0 || strcmp(instr, "JZ") == 0 || 
-               strcmp(instr, "JNZ") == 0 || strcmp(instr, "JC") == 0 || 
-               strcmp(instr, "JNC") == 0 || strcmp(instr, "CALL") == 0 ||
-               strcmp(instr, "STORE") == 0 || strcmp(instr, "SHL") == 0 || 
-               strcmp(instr, "SHR") == 0) {
-        asm_ctx->output_size += 3;
-    } else {
-        asm_ctx->output_size += 2;
+    size_t used;
+    int rc = assemble_lines(asm_ctx, source_copy, len, true, &used);
+    free(source_copy);
+    if (rc < 0) {
+        return -1;
     }
-    
-    return 0;
+    return finish_assembly(asm_ctx);
 }
 
+// Assemble from a file on disk. The file is read in large chunks and
+// each chunk's lines are assembled in the read buffer itself; only a
+// line cut off at the end of a chunk is moved, to the buffer start.
 int asm_assemble_file(Assembler *asm_ctx, const char *filename) {
-    FILE *f = fopen(filename, "r");
+    FILE *f = fopen(filename, "rb");
     if (!f) {
-        fprintf(stderr, "Cannot open file: %s\n", filename);
+        asm_error(asm_ctx, "Cannot open file: %s", filename);
         return -1;
     }
     
-    char **lines = malloc(1000 * sizeof(char*));
-    int line_count = 0;
-    char line[MAX_LINE_LEN];
-    
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\r\n")] = '\0';
-        lines[line_count++] = strdup(line);
+    size_t cap = ASM_READ_CHUNK, filled = 0;
+    char *buf = malloc(cap + 1);    // +1 for the last line's terminator
+    if (!buf) {
+        fclose(f);
+        asm_error(asm_ctx, "Out of memory");
+        return -1;
     }
-    fclose(f);
     
-    asm_ctx->label_count = 0;
+    asm_free(asm_ctx);
     asm_ctx->output_size = 0;
     asm_ctx->current_line = 0;
     
-    for (int i = 0; i < line_count; i++) {
-        asm_ctx->current_line = i + 1;
-        if (scan_labels_only(asm_ctx, lines[i]) < 0) {
-            for (int j = 0; j < line_count; j++) free(lines[j]);
-            free(lines);
-            return -1;
+    int rc = 0;
+    for (;;) {
+        // A line longer than the buffer: make room for more of it
+        if (filled == cap) {
+            char *grown = realloc(buf, cap * 2 + 1);
+            if (!grown) {
+                asm_error(asm_ctx, "Out of memory");
+                rc = -1;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
         }
-    }
-    
-    asm_ctx->output_size = 0;
-    asm_ctx->current_line = 0;
-    
-    for (int i = 0; i < line_count; i++) {
-        asm_ctx->current_line = i + 1;
-        if (asm_parse_line(asm_ctx, lines[i]) < 0) {
-            for (int j = 0; j < line_count; j++) free(lines[j]);
-            free(lines);
-            return -1;
+        
+        size_t got = fread(buf + filled, 1, cap - filled, f);
+        if (got == 0 && ferror(f)) {
+            asm_error(asm_ctx, "Cannot read file: %s", filename);
+            rc = -1;
+            break;
         }
+        filled += got;
+        
+        bool last = (got == 0);
+        size_t used;
+        if (assemble_lines(asm_ctx, buf, filled, last, &used) < 0) {
+            rc = -1;
+            break;
+        }
+        memmove(buf, buf + used, filled - used);
+        filled -= used;
+        if (last) break;
     }
     
-    for (int i = 0; i < line_count; i++) free(lines[i]);
-    free(lines);
-    
-    return 0;
+    free(buf);
+    fclose(f);
+    if (rc < 0) {
+        return -1;
+    }
+    return finish_assembly(asm_ctx);
 }
 
 // Write assembled program to a binary file
 int asm_write_binary(Assembler *asm_ctx, const char *filename) {
+    if (asm_ctx->origin != PROGRAM_BASE || asm_ctx->entry != asm_ctx->origin) {
+        asm_error(asm_ctx, "Warning: a flat binary loads and starts at 0x%04X; "
+                        "write a .scx executable to keep .org/.entry", PROGRAM_BASE);
+    }
+    
     FILE *f = fopen(filename, "wb");
     if (!f) {
-        fprintf(stderr, "Cannot write file: %s\n", filename);
+        asm_error(asm_ctx, "Cannot write file: %s", filename);
         return -1;
     }
     
     // Dump the raw output buffer to disk
-    fwrite(asm_ctx->output, 1, asm_ctx->output_size, f);
-    fclose(f);
+    bool complete = fwrite(asm_ctx->output, 1, asm_ctx->output_size, f) == asm_ctx->output_size;
+    if (fclose(f) != 0) complete = false;
+    if (!complete) {
+        asm_error(asm_ctx, "Cannot write file: %s", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// Labels by address (then name), for the symbol section
+static int compare_labels(const void *a, const void *b) {
+    const Label *x = *(const Label *const *)a, *y = *(const Label *const *)b;
+    if (x->address != y->address) return x->address < y->address ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+// Build the executable image of the assembled program
+int asm_build_image(Assembler *asm_ctx, ProgramImage *image) {
+    memset(image, 0, sizeof(*image));
+    const LabelTable *table = &asm_ctx->labels;
+    
+    // Trailing zero bytes need not be stored: the loader zero-fills
+    size_t code_size = asm_ctx->output_size;
+    while (code_size && asm_ctx->output[code_size - 1] == 0) code_size--;
+    
+    const Label **sorted = malloc((table->count ? table->count : 1) * sizeof(*sorted));
+    if (!sorted) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].name) sorted[n++] = &table->slots[i];
+    }
+    qsort(sorted, n, sizeof(*sorted), compare_labels);
+    
+    ExeBuffer symbols = { 0 };
+    int rc = 0;
+    for (size_t i = 0; i < n && rc == 0; i++) {
+        rc = exe_symbol_append(&symbols, sorted[i]->name, sorted[i]->address);
+    }
+    free(sorted);
+    
+    if (rc == 0) {
+        ExeImage exe = {
+            .load_addr    = asm_ctx->origin,
+            .entry        = asm_ctx->entry,
+            .code         = asm_ctx->output,
+            .code_size    = (uint32_t)code_size,
+            .bss_size     = (uint32_t)(asm_ctx->output_size - code_size),
+            .symbols      = symbols.len ? symbols.data : NULL,
+            .symbols_size = (uint32_t)symbols.len,
+        };
+        size_t len;
+        uint8_t *bytes = exe_build(&exe, &len);
+        if (bytes) {
+            image->owned = bytes;
+            image->data = bytes;
+            image->size = len;
+        } else {
+            rc = -1;
+        }
+    }
+    free(symbols.data);
+    return rc;
+}
+
+// Write assembled program as an executable
+int asm_write_executable(Assembler *asm_ctx, const char *filename) {
+    ProgramImage image;
+    if (asm_build_image(asm_ctx, &image) < 0) {
+        asm_error(asm_ctx, "Out of memory");
+        return -1;
+    }
     
-    printf("Assembled %zu bytes to %s\n", asm_ctx->output_size, filename);
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        image_release(&image);
+        asm_error(asm_ctx, "Cannot write file: %s", filename);
+        return -1;
+    }
+    bool complete = fwrite(image.data, 1, image.size, f) == image.size;
+    if (fclose(f) != 0) complete = false;
+    image_release(&image);
+    if (!complete) {
+        asm_error(asm_ctx, "Cannot write file: %s", filename);
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -4,36 +4,59 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "image.h"
 
 //=========================================================
 // Assembler configuration constants
 //=========================================================
 
-// Maximum number of distinct labels allowed in a single program
-#define MAX_LABELS 256
-
-// Maximum length (in characters) of a label name, including '\0'
-#define MAX_LABEL_LEN 64
-
-// Maximum length of a single source line (for reading from file)
-#define MAX_LINE_LEN 256
-
 // Maximum size of assembled program in bytes (64 KB, matches MEMORY_SIZE)
 #define MAX_PROGRAM_SIZE 0x10000
 
+// Version of the source language and its encoding. Bump it whenever
+// the same source would assemble to different bytes, or the built
+// image (asm_build_image) changes shape; assembled images cached
+// under the old version are then no longer used.
+#define ASM_VERSION "2"
+
 //=========================================================
-// Label structure
+// Label table
 //=========================================================
 //
+// Open-addressing hash table (linear probing) mapping label names to
+// addresses. It doubles whenever it gets 3/4 full, so the number of
+// labels is limited only by memory. Names are interned: copied once
+// into arena blocks owned by the table, which the slots point into.
+//
 // Each label has:
 //   - name: its textual identifier in the assembly source
-//   - address: its resolved 16-bit address in memory (e.g., 0x0100 + offset)
+//   - address: its resolved 16-bit address in memory (origin + offset)
+//   - line: the source line defining it (for duplicate reports)
 //
 typedef struct {
-    char name[MAX_LABEL_LEN];
-    uint16_t address;
+    const char *name;        // interned; NULL marks an empty slot
+    uint32_t    hash;
+    uint16_t    address;
+    int         line;
 } Label;
 
+typedef struct LabelArena LabelArena;
+
+typedef struct {
+    Label      *slots;
+    size_t      capacity;    // power of two, 0 until the first label
+    size_t      count;
+    LabelArena *arena;       // interned names, newest block first
+} LabelTable;
+
+// A label reference not yet resolved: the 16-bit operand at
+// output[offset] is patched once the whole source has been read.
+typedef struct {
+    const char *name;        // interned in the label table's arena
+    uint16_t    offset;
+    int         line;        // source line of the reference
+} Fixup;
+
 //=========================================================
 // Assembler state
 //=========================================================
@@ -43,19 +66,34 @@ typedef struct {
 //   - output:   raw machine code bytes being generated
 //   - output_size: number of bytes currently in 'output'
 //   - labels:   the symbol table mapping label names → addresses
-//   - label_count: how many labels have been defined so far
+//   - fixups:   references to labels not defined yet
+//   - origin:   load address of output[0] (.org, default PROGRAM_BASE)
+//   - entry:    entry point (.entry, default the origin); an entry
+//               label is resolved with the fixups
 //   - current_line: 1-based line number in the source (for errors)
 //   - has_errors: set to true if any error occurred while assembling
+//   - error:    where diagnostics go (asm_set_error_handler)
 //
 typedef struct {
     uint8_t output[MAX_PROGRAM_SIZE];  // machine code buffer
     size_t  output_size;               // number of valid bytes in 'output'
     
-    Label labels[MAX_LABELS];          // label symbol table
-    int   label_count;                 // number of labels currently stored
+    LabelTable labels;                 // label symbol table
+    Fixup  *fixups;                    // forward references to patch
+    size_t  fixup_count;
+    size_t  fixup_cap;
+    
+    uint16_t    origin;                // load address
+    uint16_t    entry;                 // entry point, final after assembly
+    bool        has_entry;             // .entry seen
+    const char *entry_label;           // .entry LABEL, interned
+    int         entry_line;
     
     int  current_line;                 // current source line (for diagnostics)
     bool has_errors;                   // flag: did any error occur?
+    
+    CpuErrorFn error;                  // NULL: diagnostics go to stderr
+    void      *error_ctx;
 } Assembler;
 
 //=========================================================
@@ -65,19 +103,64 @@ typedef struct {
 // asm_init:
 //   Initialize an Assembler struct to a clean state.
 //
+// asm_set_error_handler:
+//   Send this Assembler's diagnostics (one line each, without a
+//   newline) to 'fn' instead of stderr; NULL goes back to stderr.
+//   Set it after asm_init, which clears it.
+//
+// asm_free:
+//   Release the label table and fixups. Call it when done with an
+//   Assembler, or before asm_init reuses one.
+//
 // asm_assemble_file:
 //   Parse and assemble a program from a file on disk into asm_ctx->output.
 //
 // asm_assemble_string:
 //   Parse and assemble a program from an in-memory string.
 //
+// asm_assemble_buffer:
+//   Same for the 'len' bytes at 'source', which need not be
+//   NUL-terminated (e.g. a mapped file).
+//
+// All of them read the source once: code is emitted as it is parsed, a
+// reference to a label not seen yet leaves a placeholder and a
+// fixup, and all fixups are patched at the end (an undefined label
+// is reported there, with the line referring to it).
+//
+// Besides instructions the source may hold two directives:
+//   .org ADDR       load address, before any code or label
+//   .entry WHERE    entry point, a label or an address
+//
 // asm_write_binary:
-//   Write the assembled bytes in asm_ctx->output to a binary file.
+//   Write the assembled bytes in asm_ctx->output to a flat binary
+//   file. A flat binary always loads and starts at PROGRAM_BASE, so
+//   .org / .entry elsewhere draw a warning.
+//
+// asm_write_executable:
+//   Write the program as an executable (exe.h): header with load
+//   address and entry point, the code with trailing zero bytes
+//   turned into BSS, and the labels as a symbol section.
+//
+// Both return 0 on success, -1 (reported through the error handler)
+// if the file cannot be written in full. Neither prints anything
+// else.
+//
+// asm_build_image:
+//   Build the same executable in memory, as an image that
+//   image_load accepts. Returns 0 on success, -1 if memory runs out.
+//
+// The label table must still be alive (asm_free not yet called) for
+// asm_write_executable and asm_build_image.
 //
 void asm_init(Assembler *asm_ctx);
+void asm_set_error_handler(Assembler *asm_ctx, CpuErrorFn fn, void *ctx);
+void asm_free(Assembler *asm_ctx);
 int  asm_assemble_file(Assembler *asm_ctx, const char *filename);
 int  asm_assemble_string(Assembler *asm_ctx, const char *source);
+int  asm_assemble_buffer(Assembler *asm_ctx, const char *source, size_t len);
 int  asm_write_binary(Assembler *asm_ctx, const char *filename);
+int  asm_write_executable(Assembler *asm_ctx, const char *filename);
+int  asm_build_image(Assembler *asm_ctx, ProgramImage *image);
 
 //=========================================================
 // Helper functions (also part of the public API)
@@ -92,8 +175,10 @@ int  asm_write_binary(Assembler *asm_ctx, const char *filename);
 //   Returns 0 on success, -1 on parse error.
 //
 // asm_add_label:
-//   Store a label and its address in the assembler's symbol table.
-//   Returns 0 on success, -1 on error (duplicate or table full).
+//   Store a label and its address in the assembler's symbol table,
+//   defined on asm_ctx->current_line. Returns 0 on success, -1 on
+//   error: the label is defined already (both lines are reported) or
+//   memory ran out.
 //
 // asm_find_label:
 //   Look up a label name and return its address via 'address'.
@@ -0,0 +1,625 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "batch.h"
+#include "decode.h"
+#include "image.h"
+#include "jit.h"
+#include "snapshot.h"
+#include "wide.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//=========================================================
+// Per-job I/O
+//=========================================================
+
+// Growable buffer receiving a job's PORT_STDOUT bytes
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+    size_t   cap;
+    bool     oom;            // an append failed; output is truncated
+} Capture;
+
+static void capture_write(void *ctx, const uint8_t *data, size_t len) {
+    Capture *cap = ctx;
+    if (cap->oom) return;
+    if (cap->len + len > cap->cap) {
+        size_t new_cap = cap->cap ? cap->cap : 256;
+        while (new_cap < cap->len + len) new_cap *= 2;
+        uint8_t *grown = realloc(cap->data, new_cap);
+        if (!grown) {
+            cap->oom = true;
+            return;
+        }
+        cap->data = grown;
+        cap->cap = new_cap;
+    }
+    memcpy(cap->data + cap->len, data, len);
+    cap->len += len;
+}
+
+// A job's PORT_STDIN bytes
+typedef struct {
+    const uint8_t *data;
+    size_t         len;
+    size_t         pos;
+} Input;
+
+static uint8_t input_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)cpu; (void)port;
+    Input *in = ctx;
+    return (in->pos < in->len) ? in->data[in->pos++] : 0;
+}
+
+//=========================================================
+// Shared program images
+//=========================================================
+//
+// Each distinct program of a batch is mapped once, by the first
+// worker that needs it, and every worker loads from that one
+// read-only mapping: a binary run by a thousand jobs is opened and
+// mapped once, and its pages sit in memory once, however many
+// workers copy it into their CPUs. A program that cannot be read is
+// reported once and fails each of its jobs.
+//
+
+typedef struct {
+    const char  *path;           // NULL = empty slot
+    uint32_t     hash;
+    int          status;         // 0 = mapped, -1 = unreadable
+    ProgramImage image;
+} SharedImage;
+
+typedef struct {
+    pthread_mutex_t lock;
+    SharedImage    *slots;
+    size_t          capacity;    // power of two
+    size_t          count;
+} ImageTable;
+
+// FNV-1a over a path
+static uint32_t path_hash(const char *path) {
+    uint32_t h = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    return h;
+}
+
+// Slot holding 'path', or the empty slot where it belongs
+static SharedImage *image_slot(SharedImage *slots, size_t capacity,
+                               const char *path, uint32_t hash) {
+    size_t i = hash & (capacity - 1);
+    while (slots[i].path &&
+           (slots[i].hash != hash || strcmp(slots[i].path, path) != 0)) {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &slots[i];
+}
+
+// Double the table (called with the lock held)
+static int image_table_grow(ImageTable *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 64;
+    SharedImage *slots = calloc(capacity, sizeof(SharedImage));
+    if (!slots) return -1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        const SharedImage *old = &table->slots[i];
+        if (old->path) *image_slot(slots, capacity, old->path, old->hash) = *old;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+    return 0;
+}
+
+// The shared image of 'path', mapped on first use. Returns 0 and
+// sets *image (valid until image_table_destroy), or -1.
+static int image_table_get(ImageTable *table, const char *path, ProgramImage *image) {
+    uint32_t hash = path_hash(path);
+    int rc = -1;
+
+    pthread_mutex_lock(&table->lock);
+    if ((table->count + 1) * 4 > table->capacity * 3 && image_table_grow(table) < 0) {
+        fprintf(stderr, "Out of memory\n");
+    } else {
+        SharedImage *slot = image_slot(table->slots, table->capacity, path, hash);
+        if (!slot->path) {
+            slot->path = path;
+            slot->hash = hash;
+            slot->status = image_map_file(path, &slot->image);
+            if (slot->status < 0) {
+                fprintf(stderr, "%s: %s\n", slot->image.error, path);
+            }
+            table->count++;
+        }
+        rc = slot->status;
+        *image = slot->image;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return rc;
+}
+
+static void image_table_destroy(ImageTable *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].path) image_release(&table->slots[i].image);
+    }
+    free(table->slots);
+    pthread_mutex_destroy(&table->lock);
+}
+
+//=========================================================
+// Job queues (work stealing)
+//=========================================================
+//
+// Each worker's queue holds a contiguous range of job indices
+// [head, tail). The owner pops from the tail; thieves take from the
+// head, so an owner and a thief only meet on the very last job. The
+// job list is fixed before the workers start, which keeps this a
+// pair of indices under a mutex: no job is ever pushed. With lanes
+// (BatchOptions.lanes) both take up to that many adjacent jobs at a
+// time.
+//
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t          head;
+    size_t          tail;
+} JobQueue;
+
+// Take up to 'max' jobs, [*first, *first + n); returns n (0 = empty)
+static size_t queue_pop(JobQueue *q, size_t max, size_t *first) {
+    pthread_mutex_lock(&q->lock);
+    size_t n = q->tail - q->head < max ? q->tail - q->head : max;
+    q->tail -= n;
+    *first = q->tail;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+static size_t queue_steal(JobQueue *q, size_t max, size_t *first) {
+    pthread_mutex_lock(&q->lock);
+    size_t n = q->tail - q->head < max ? q->tail - q->head : max;
+    *first = q->head;
+    q->head += n;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+//=========================================================
+// Workers
+//=========================================================
+
+// Size of each worker's output staging buffer
+#define BATCH_OUTPUT_BUFFER 4096
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch    *batch;
+    unsigned  index;
+    JobQueue  queue;
+    pthread_t thread;
+} Worker;
+
+struct Batch {
+    const BatchJob *jobs;
+    BatchResult    *results;
+    CpuEngine       engine;
+    uint64_t        max_instructions;    // CPU_BUDGET_NONE = no limit
+    uint64_t        timeout_ns;          // 0 = no limit
+    unsigned        lanes;               // 1 = no lockstep groups
+    Worker         *workers;
+    unsigned        nworkers;
+    ImageTable      images;
+};
+
+// A worker's machine, reused for every job the worker runs. After
+// the first job of a program the loaded CPU is kept as a snapshot, so
+// further jobs of that program restore it (copying back only the
+// pages the previous job wrote) instead of reloading the binary.
+typedef struct {
+    CPU         *cpu;
+    DecodeCache *dcache;
+    Jit         *jit;
+    uint8_t     *outbuf;
+    Input        input;
+    Capture      capture;
+    CpuSnapshot *loaded;         // state right after loading 'program'
+    const char  *program;
+} Machine;
+
+// Fresh CPU with 'path' loaded, snapshotted as m->loaded.
+// Returns 0 on success, -1 if the program cannot be loaded.
+static int load_program(Machine *m, ImageTable *images, const char *path) {
+    cpu_snapshot_destroy(m->loaded);
+    m->loaded = NULL;
+    m->program = NULL;
+
+    ProgramImage program;
+    if (image_table_get(images, path, &program) < 0) return -1;
+
+    CPU *cpu = m->cpu;
+    cpu_init(cpu);
+    if (m->dcache) cpu_attach_decode_cache(cpu, m->dcache);
+    if (m->jit) cpu_attach_jit(cpu, m->jit);
+    cpu_register_device(cpu, PORT_STDIN, 1, input_port_read, NULL, &m->input);
+    cpu_set_output(cpu, capture_write, &m->capture, m->outbuf, BATCH_OUTPUT_BUFFER);
+
+    if (image_load(cpu, &program, NULL) < 0) return -1;
+
+    // Without a snapshot every job simply reloads the program
+    m->loaded = cpu_snapshot_create(cpu);
+    if (m->loaded) m->program = path;
+    return 0;
+}
+
+// Get a job started on the worker's machine: the program loaded (or
+// restored) and its input attached. Returns false, leaving the result
+// BATCH_LOAD_ERROR, if the job cannot run.
+static bool job_begin(Machine *m, Batch *b, const BatchJob *job, BatchResult *res,
+                      ProgramImage *input) {
+    memset(res, 0, sizeof(*res));
+    res->status = BATCH_LOAD_ERROR;
+
+    *input = (ProgramImage){ 0 };
+    if (job->input && image_map_file(job->input, input) < 0) {
+        fprintf(stderr, "%s: %s\n", input->error, job->input);
+        return false;
+    }
+
+    if (m->program && strcmp(m->program, job->program) == 0) {
+        cpu_snapshot_restore(m->cpu, m->loaded);
+    } else if (load_program(m, &b->images, job->program) < 0) {
+        image_release(input);
+        return false;
+    }
+
+    m->input = (Input){ input->data, input->size, 0 };
+    m->capture = (Capture){ NULL, 0, 0, false };
+    return true;
+}
+
+// Fill in the result of a job that stopped with 'stop'
+static void job_end(Machine *m, const BatchJob *job, BatchResult *res, CpuStop stop,
+                    ProgramImage *input) {
+    CPU *cpu = m->cpu;
+    cpu_flush_output(cpu);
+
+    if (m->capture.oom) {
+        fprintf(stderr, "Out of memory: output of %s truncated\n", job->program);
+    }
+
+    res->status = stop == CPU_STOP_HALT  ? BATCH_HALTED
+                : stop == CPU_STOP_FAULT ? BATCH_FAULT : BATCH_BUDGET;
+    memcpy(res->regs, cpu->regs, sizeof(res->regs));
+    res->flags = cpu_get_flags(cpu);
+    res->cycles = cpu->cycles;
+    res->output = m->capture.data;
+    res->output_len = m->capture.len;
+
+    m->input = (Input){ NULL, 0, 0 };
+    image_release(input);
+}
+
+// Run one job on the worker's machine and fill in its result
+static void run_job(Machine *m, Batch *b, const BatchJob *job, BatchResult *res) {
+    ProgramImage input;
+    if (!job_begin(m, b, job, res, &input)) return;
+
+    CPU *cpu = m->cpu;
+    CpuStop stop = b->timeout_ns
+        ? cpu_run_engine_until(cpu, b->engine, b->max_instructions,
+                               cpu_clock_ns() + b->timeout_ns)
+        : cpu_run_engine_for(cpu, b->engine, b->max_instructions);
+    job_end(m, job, res, stop, &input);
+}
+
+// Run 'count' jobs of one program in lockstep, job i on machines[i]
+static void run_group(Machine *machines, DecodeCache *cache, Batch *b,
+                      size_t first, size_t count) {
+    CPU         *lanes[WIDE_LANES];
+    Machine     *lane_machine[WIDE_LANES];
+    size_t       lane_job[WIDE_LANES];
+    ProgramImage inputs[WIDE_LANES];
+    CpuStop      stops[WIDE_LANES];
+    unsigned     n = 0;
+
+    for (size_t k = 0; k < count; k++) {
+        Machine *m = &machines[k];
+        size_t job = first + k;
+        if (!job_begin(m, b, &b->jobs[job], &b->results[job], &inputs[n])) continue;
+        lanes[n] = m->cpu;
+        lane_machine[n] = m;
+        lane_job[n++] = job;
+    }
+    if (n == 0) return;
+
+    WideOptions opts = { .engine = b->engine, .max_instructions = b->max_instructions,
+                         .deadline_ns = b->timeout_ns ? cpu_clock_ns() + b->timeout_ns : 0 };
+    wide_run(lanes, n, cache, &opts, stops);
+
+    for (unsigned i = 0; i < n; i++) {
+        size_t job = lane_job[i];
+        job_end(lane_machine[i], &b->jobs[job], &b->results[job], stops[i], &inputs[i]);
+    }
+}
+
+// Run jobs [first, first + count): adjacent jobs of the same program
+// as one lockstep group, any other job alone
+static void run_jobs(Machine *machines, DecodeCache *cache, Batch *b,
+                     size_t first, size_t count) {
+    while (count) {
+        size_t n = 1;
+        while (n < count &&
+               strcmp(b->jobs[first + n].program, b->jobs[first].program) == 0) {
+            n++;
+        }
+        if (n == 1) {
+            run_job(&machines[0], b, &b->jobs[first], &b->results[first]);
+        } else {
+            run_group(machines, cache, b, first, n);
+        }
+        first += n;
+        count -= n;
+    }
+}
+
+// A machine's CPU and output buffer; its caches are the worker's
+static bool machine_create(Machine *m, DecodeCache *dcache, Jit *jit) {
+    *m = (Machine){ .dcache = dcache, .jit = jit };
+    m->cpu = malloc(sizeof(CPU));
+    m->outbuf = malloc(BATCH_OUTPUT_BUFFER);
+    return m->cpu && m->outbuf;
+}
+
+static void machine_destroy(Machine *m) {
+    cpu_snapshot_destroy(m->loaded);
+    if (m->cpu) {
+        cpu_attach_jit(m->cpu, NULL);
+        cpu_attach_decode_cache(m->cpu, NULL);
+    }
+    free(m->outbuf);
+    free(m->cpu);
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Batch *b = w->batch;
+
+    // Machine 0 runs single jobs; lockstep groups use machines[0] to
+    // machines[lanes - 1], which share the decode cache (a lane runs
+    // alone only after a split, one lane at a time) but not the JIT
+    DecodeCache *dcache = b->engine != CPU_ENGINE_SWITCH ? decode_cache_create() : NULL;
+    Jit         *jit    = b->engine == CPU_ENGINE_JIT ? jit_create(0) : NULL;
+    DecodeCache *group  = b->lanes > 1 ? decode_cache_create() : NULL;
+
+    Machine machines[WIDE_LANES];
+    unsigned nmachines = 0;
+    bool ready = b->lanes <= 1 || group;
+    while (ready && nmachines < b->lanes) {
+        ready = machine_create(&machines[nmachines], dcache, nmachines ? NULL : jit);
+        nmachines++;
+    }
+
+    // A worker that cannot get memory leaves its jobs to the others
+    if (ready) {
+        for (;;) {
+            size_t first;
+            size_t count = queue_pop(&w->queue, b->lanes, &first);
+            for (unsigned i = 1; count == 0 && i < b->nworkers; i++) {
+                count = queue_steal(&b->workers[(w->index + i) % b->nworkers].queue,
+                                    b->lanes, &first);
+            }
+            if (count == 0) break;
+            run_jobs(machines, group, b, first, count);
+        }
+    }
+
+    for (unsigned i = 0; i < nmachines; i++) {
+        machine_destroy(&machines[i]);
+    }
+    if (jit) jit_destroy(jit);
+    if (dcache) decode_cache_destroy(dcache);
+    if (group) decode_cache_destroy(group);
+    return NULL;
+}
+
+//=========================================================
+// Public API
+//=========================================================
+
+int batch_run(const BatchJob *jobs, size_t count, BatchResult *results,
+              const BatchOptions *opts) {
+    unsigned nworkers = opts->threads;
+    if (nworkers == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = (online > 0) ? (unsigned)online : 1;
+    }
+
+    // Jobs are dealt out in whole lockstep groups
+    unsigned lanes = opts->lanes < 1 ? 1
+                   : opts->lanes > WIDE_LANES ? WIDE_LANES : opts->lanes;
+    size_t groups = (count + lanes - 1) / lanes;
+    if (nworkers > groups) nworkers = groups ? (unsigned)groups : 1;
+
+    // Results of jobs no worker reaches (every worker out of memory)
+    for (size_t i = 0; i < count; i++) {
+        memset(&results[i], 0, sizeof(results[i]));
+        results[i].status = BATCH_LOAD_ERROR;
+    }
+
+    Worker *workers = calloc(nworkers, sizeof(Worker));
+    if (!workers) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    Batch batch = { .jobs = jobs, .results = results, .engine = opts->engine,
+                    .max_instructions = opts->max_instructions
+                                      ? opts->max_instructions : CPU_BUDGET_NONE,
+                    .timeout_ns = opts->timeout_ns,
+                    .lanes = lanes,
+                    .workers = workers, .nworkers = nworkers };
+    pthread_mutex_init(&batch.images.lock, NULL);
+
+    // Deal the jobs out in contiguous runs
+    for (unsigned i = 0; i < nworkers; i++) {
+        workers[i].batch = &batch;
+        workers[i].index = i;
+        size_t head = groups * i / nworkers * lanes;
+        size_t tail = groups * (i + 1) / nworkers * lanes;
+        workers[i].queue.head = head < count ? head : count;
+        workers[i].queue.tail = tail < count ? tail : count;
+        pthread_mutex_init(&workers[i].queue.lock, NULL);
+    }
+
+    // Start the pool; if only some threads start they share the work
+    unsigned started = 0;
+    for (unsigned i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) break;
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Cannot start batch worker threads\n");
+    } else {
+        for (unsigned i = 0; i < started; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+
+    for (unsigned i = 0; i < nworkers; i++) {
+        pthread_mutex_destroy(&workers[i].queue.lock);
+    }
+    image_table_destroy(&batch.images);
+    free(workers);
+    return started ? 0 : -1;
+}
+
+void batch_free_results(BatchResult *results, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(results[i].output);
+        results[i].output = NULL;
+        results[i].output_len = 0;
+    }
+}
+
+// Duplicate [start, end) as a NUL-terminated string
+static char *dup_range(const char *start, const char *end) {
+    size_t len = (size_t)(end - start);
+    char *s = malloc(len + 1);
+    if (s) {
+        memcpy(s, start, len);
+        s[len] = '\0';
+    }
+    return s;
+}
+
+int batch_load_manifest(const char *path, BatchJob **jobs, size_t *count) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open file: %s\n", path);
+        return -1;
+    }
+
+    BatchJob *list = NULL;
+    size_t n = 0, cap = 0;
+    char line[4096];
+    int line_num = 0;
+    int rc = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        line_num++;
+
+        // Split into up to two whitespace-separated fields
+        const char *field[3] = { NULL, NULL, NULL };
+        const char *field_end[3] = { NULL, NULL, NULL };
+        int nfields = 0;
+        char *p = line;
+        while (*p && nfields < 3) {
+            while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+            if (!*p) break;
+            field[nfields] = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+            field_end[nfields++] = p;
+        }
+
+        if (nfields == 0 || field[0][0] == '#') continue;
+        if (nfields > 2) {
+            fprintf(stderr, "%s:%d: expected \"<program> [input]\"\n", path, line_num);
+            rc = -1;
+            break;
+        }
+
+        if (n == cap) {
+            size_t new_cap = cap ? cap * 2 : 16;
+            BatchJob *grown = realloc(list, new_cap * sizeof(BatchJob));
+            if (!grown) {
+                fprintf(stderr, "Out of memory\n");
+                rc = -1;
+                break;
+            }
+            list = grown;
+            cap = new_cap;
+        }
+
+        char *program = dup_range(field[0], field_end[0]);
+        char *input = (nfields == 2) ? dup_range(field[1], field_end[1]) : NULL;
+        if (!program || (nfields == 2 && !input)) {
+            free(program);
+            free(input);
+            fprintf(stderr, "Out of memory\n");
+            rc = -1;
+            break;
+        }
+        list[n].program = program;
+        list[n].input = input;
+        n++;
+    }
+    fclose(f);
+
+    if (rc < 0) {
+        batch_free_jobs(list, n);
+        return -1;
+    }
+    *jobs = list;
+    *count = n;
+    return 0;
+}
+
+void batch_free_jobs(BatchJob *jobs, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free((char *)jobs[i].program);
+        free((char *)jobs[i].input);
+    }
+    free(jobs);
+}
+
+static const char *status_name(BatchStatus status) {
+    switch (status) {
+    case BATCH_HALTED: return "halted";
+    case BATCH_FAULT:  return "fault";
+    case BATCH_BUDGET: return "budget";
+    default:           return "load-error";
+    }
+}
+
+int batch_write_results(FILE *out, const BatchJob *jobs,
+                        const BatchResult *results, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const BatchResult *r = &results[i];
+        fprintf(out, "job=%zu program=%s input=%s status=%s cycles=%llu "
+                     "A=%04X B=%04X C=%04X D=%04X SP=%04X PC=%04X FLAGS=%02X "
+                     "output=%zu\n",
+                i, jobs[i].program, jobs[i].input ? jobs[i].input : "-",
+                status_name(r->status), (unsigned long long)r->cycles,
+                r->regs[REG_A], r->regs[REG_B], r->regs[REG_C], r->regs[REG_D],
+                r->regs[REG_SP], r->regs[REG_PC], r->flags, r->output_len);
+        if (r->output_len) fwrite(r->output, 1, r->output_len, out);
+        fputc('\n', out);
+    }
+    fflush(out);
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,111 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "cpu.h"
+
+//=========================================================
+// Batch runner
+//=========================================================
+//
+// Runs many independent programs in parallel, one CPU per job, on a
+// pool of worker threads. Each job names a binary (see image_load)
+// and optionally a file whose bytes the program reads from
+// PORT_STDIN; at EOF the port reads 0, like the interactive console.
+// Everything the program writes to PORT_STDOUT is captured into the
+// job's result instead of going to the host stdout. Binaries and
+// inputs are mmap'd (image.h); each distinct binary is mapped once
+// per batch and every worker loads from that shared read-only copy.
+//
+// Jobs are dealt out in contiguous runs, one per worker. A worker
+// takes jobs from the back of its own queue and, once that is empty,
+// steals from the front of the others', so long-running jobs do not
+// leave the remaining cores idle. Every worker owns one CPU (plus
+// the decode cache / JIT its engine needs) and reuses it job after
+// job; jobs never share state. Consecutive jobs of the same program
+// start from a snapshot of the loaded CPU (snapshot.h), so only the
+// pages the previous job wrote are reset, and cached decodes and
+// translations of the program carry over.
+//
+// With BatchOptions.lanes > 1, adjacent jobs of the same program (as
+// with batch --program) are taken that many at a time and run as the
+// lanes of one lockstep group (wide.h): each instruction is decoded
+// once and executed for all of them together. Results are the same
+// as running every job alone.
+//
+// Jobs run to HLT or a fault, or until they use up the instruction
+// budget or time limit in BatchOptions (cpu.h, "Execution budgets").
+// Without either, a program that never halts keeps its worker busy
+// forever.
+//
+
+typedef struct {
+    const char *program;     // path of the binary to run
+    const char *input;       // path of the PORT_STDIN input, NULL = none
+} BatchJob;
+
+typedef enum {
+    BATCH_HALTED,            // stopped at HLT
+    BATCH_FAULT,             // stopped on an error (bad opcode, DIV by zero)
+    BATCH_BUDGET,            // stopped at its instruction or time limit
+    BATCH_LOAD_ERROR,        // the program or input could not be loaded
+} BatchStatus;
+
+typedef struct {
+    BatchStatus status;
+    uint16_t    regs[6];     // final A, B, C, D, SP, PC
+    uint8_t     flags;
+    uint64_t    cycles;
+    uint8_t    *output;      // captured PORT_STDOUT bytes (malloc'd)
+    size_t      output_len;
+} BatchResult;
+
+typedef struct {
+    unsigned  threads;       // worker threads, 0 = one per online core
+    CpuEngine engine;
+    uint64_t  max_instructions;  // per job, 0 = no limit
+    uint64_t  timeout_ns;        // wall clock per job, 0 = no limit
+    unsigned  lanes;             // jobs per lockstep group (up to
+                                 // WIDE_LANES), 0 or 1 = one at a time
+} BatchOptions;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// batch_run:
+//   Run 'count' jobs and store their outcome in results[i] (which
+//   the caller provides, one per job). Returns 0 once every job has
+//   finished, -1 if the worker pool could not be started. A job that
+//   fails to load only marks its own result BATCH_LOAD_ERROR.
+//
+// batch_free_results:
+//   Release the captured output of 'count' results.
+//
+// batch_load_manifest:
+//   Read a manifest: one job per line, "<program.bin> [input-file]".
+//   Blank lines and lines starting with '#' are skipped. On success
+//   *jobs (free with batch_free_jobs) and *count are set and 0 is
+//   returned; -1 on error.
+//
+// batch_free_jobs:
+//   Release jobs from batch_load_manifest.
+//
+// batch_write_results:
+//   Write one record per job to 'out': a header line with the job's
+//   index, program, input, status, cycles, registers, flags and the
+//   output size, followed by exactly that many output bytes and a
+//   newline. Returns 0 on success, -1 on a write error.
+//
+int  batch_run(const BatchJob *jobs, size_t count, BatchResult *results,
+               const BatchOptions *opts);
+void batch_free_results(BatchResult *results, size_t count);
+int  batch_load_manifest(const char *path, BatchJob **jobs, size_t *count);
+void batch_free_jobs(BatchJob *jobs, size_t count);
+int  batch_write_results(FILE *out, const BatchJob *jobs,
+                         const BatchResult *results, size_t count);
+
+#endif // BATCH_H
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "bench.h"
+#include "decode.h"
+#include "jit.h"
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Console output is discarded
+static void discard_write(void *ctx, const uint8_t *data, size_t len) {
+    (void)ctx; (void)data; (void)len;
+}
+
+// PORT_STDIN always reads as EOF
+static uint8_t eof_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)cpu; (void)port; (void)ctx;
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Host timestamp counter, 0 where there is none
+static uint64_t host_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+int bench_program(const ProgramImage *image, const BenchOptions *opts,
+                  BenchResult *result) {
+    memset(result, 0, sizeof(*result));
+    unsigned iterations = opts->iterations ? opts->iterations : 1;
+
+    static uint8_t output_buf[4096];
+    CPU *cpu = malloc(sizeof(CPU));
+    uint64_t *sample_ns = malloc(iterations * sizeof(uint64_t));
+    uint64_t *sample_tsc = malloc(iterations * sizeof(uint64_t));
+    DecodeCache *dcache = NULL;
+    Jit *jit = NULL;
+    CpuSnapshot *loaded = NULL;
+    int rc = -1;
+
+    if (!cpu || !sample_ns || !sample_tsc) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    cpu_init(cpu);
+    if (opts->engine != CPU_ENGINE_SWITCH) {
+        dcache = decode_cache_create();
+        cpu_attach_decode_cache(cpu, dcache);
+    }
+    if (opts->engine == CPU_ENGINE_JIT) {
+        jit = jit_create(0);
+        cpu_attach_jit(cpu, jit);
+    }
+    cpu_register_device(cpu, PORT_STDIN, 1, eof_port_read, NULL, NULL);
+    cpu_set_output(cpu, discard_write, NULL, output_buf, sizeof(output_buf));
+    if (image_load(cpu, image, NULL) < 0) goto done;
+
+    loaded = cpu_snapshot_create(cpu);
+    if (!loaded) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    // Warm-up run
+    cpu_run_engine(cpu, opts->engine);
+    result->halted = !cpu->running;
+    result->instructions = cpu->cycles;
+
+    // Size the samples: double the runs until they take a measurable
+    // share of BENCH_SAMPLE_NS, then scale up to the full sample
+    uint64_t batch = 1, elapsed;
+    for (;;) {
+        uint64_t t0 = now_ns();
+        for (uint64_t r = 0; r < batch; r++) {
+            cpu_snapshot_restore(cpu, loaded);
+            cpu_run_engine(cpu, opts->engine);
+        }
+        elapsed = now_ns() - t0;
+        if (elapsed >= BENCH_SAMPLE_NS / 8) break;
+        batch *= 2;
+    }
+    result->runs = batch * BENCH_SAMPLE_NS / elapsed;
+    if (result->runs == 0) result->runs = 1;
+
+    for (unsigned i = 0; i < iterations; i++) {
+        uint64_t t0 = now_ns(), c0 = host_cycles();
+        for (uint64_t r = 0; r < result->runs; r++) {
+            cpu_snapshot_restore(cpu, loaded);
+            cpu_run_engine(cpu, opts->engine);
+        }
+        sample_tsc[i] = host_cycles() - c0;
+        sample_ns[i] = now_ns() - t0;
+    }
+
+    qsort(sample_ns, iterations, sizeof(uint64_t), compare_u64);
+    qsort(sample_tsc, iterations, sizeof(uint64_t), compare_u64);
+    size_t p99 = (iterations * 99 + 99) / 100 - 1;
+    double runs = (double)result->runs;
+    result->median_ns = sample_ns[iterations / 2] / runs;
+    result->p99_ns = sample_ns[p99] / runs;
+    if (result->median_ns > 0) {
+        result->mips = result->instructions / result->median_ns * 1000.0;
+    }
+    if (result->instructions) {
+        result->host_cycles = sample_tsc[iterations / 2] / runs / result->instructions;
+    }
+    rc = 0;
+
+done:
+    cpu_snapshot_destroy(loaded);
+    if (cpu) {
+        cpu_attach_jit(cpu, NULL);
+        cpu_attach_decode_cache(cpu, NULL);
+    }
+    if (jit) jit_destroy(jit);
+    if (dcache) decode_cache_destroy(dcache);
+    free(sample_tsc);
+    free(sample_ns);
+    free(cpu);
+    return rc;
+}
@@ -0,0 +1,50 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "image.h"
+
+//=========================================================
+// Benchmark harness
+//=========================================================
+//
+// Measures how fast an engine runs a program. The program is loaded
+// once and snapshotted (snapshot.h); every run restores the snapshot
+// and runs to HLT with console output discarded and PORT_STDIN at
+// EOF. One untimed warm-up run comes first, so decode caches and JIT
+// translations are hot and the numbers describe steady-state speed.
+//
+// Most example programs finish in well under a microsecond, below
+// what a clock read can resolve, so each sample times as many
+// back-to-back runs as fill BENCH_SAMPLE_NS and divides. Median and
+// p99 are taken over the per-run times of 'iterations' samples.
+//
+
+// Target duration of one sample
+#define BENCH_SAMPLE_NS 1000000ull
+
+typedef struct {
+    unsigned  iterations;    // samples to take (>= 1)
+    CpuEngine engine;
+} BenchOptions;
+
+typedef struct {
+    bool     halted;         // false if the program faulted
+    uint64_t instructions;   // guest instructions per run
+    uint64_t runs;           // runs per sample
+    double   median_ns;      // wall time per run
+    double   p99_ns;
+    double   mips;           // instructions / median time
+    double   host_cycles;    // host timestamp-counter cycles per guest
+                             // instruction, 0 if the host has none
+} BenchResult;
+
+// Benchmark the program in 'image' (image_load). Returns 0 on
+// success, -1 if the program cannot be loaded or memory runs out.
+int bench_program(const ProgramImage *image, const BenchOptions *opts,
+                  BenchResult *result);
+
+#endif // BENCH_H
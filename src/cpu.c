@@ -1,12 +1,23 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cpu.h"
+#include "cpu_internal.h"
+#include "decode.h"
+#include "host_input.h"
+#include "idle.h"
+#include "jit.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 //=========================================================
 // Core CPU lifecycle
 //=========================================================
 
+static void register_builtin_devices(CPU *cpu);
+
 // Initialize CPU registers, memory, and control flags
 void cpu_init(CPU *cpu) {
     // Clear entire CPU state (registers, flags, memory, etc.)
@@ -19,16 +30,44 @@ void cpu_init(CPU *cpu) {
     // Set initial program counter:
     // We treat 0x0000–0x00FF as a vector/metadata area and
     // load programs starting at 0x0100.
-    cpu->regs[REG_PC] = 0x0100;  // Program starts after vector table
+    cpu->regs[REG_PC] = PROGRAM_BASE;  // Program starts after vector table
 
     cpu->running = false;
     cpu->halted  = false;
     cpu->cycles  = 0;            // instruction cycle counter
+    cpu->event_cycle = UINT64_MAX;  // nothing scheduled
+    cpu->dma_rate    = DMA_DEFAULT_RATE;
+
+    // Console and timer ports
+    register_builtin_devices(cpu);
 }
 
-// Reset CPU to initial state (same as fresh init)
+// Reset CPU to initial state (same as fresh init, but keeps the
+// device map, the output sink, the error handler, the DMA rate and
+// any attached decode
+// cache or JIT, which is flushed since memory was cleared)
 void cpu_reset(CPU *cpu) {
+    struct DecodeCache *dcache = cpu->dcache;
+    struct Jit *jit = cpu->jit;
+    cpu_flush_output(cpu);
+    CpuOutput output = cpu->output;
+    CpuErrorFn error = cpu->error;
+    void *error_ctx = cpu->error_ctx;
+    uint16_t dma_rate = cpu->dma_rate;
+    CpuPort ports[IO_PAGE_PORTS];
+    memcpy(ports, cpu->ports, sizeof(ports));
     cpu_init(cpu);
+    cpu->output = output;
+    cpu->error = error;
+    cpu->error_ctx = error_ctx;
+    cpu->dma_rate = dma_rate;
+    memcpy(cpu->ports, ports, sizeof(ports));
+    if (dcache) {
+        cpu_attach_decode_cache(cpu, dcache);
+    }
+    if (jit) {
+        cpu_attach_jit(cpu, jit);
+    }
 }
 
 //=========================================================
@@ -39,75 +78,758 @@ void cpu_reset(CPU *cpu) {
 int cpu_load_program(CPU *cpu, const uint8_t *program, size_t size, uint16_t start_addr) {
     // Bounds check: program must fit into memory
     if (start_addr + size > MEMORY_SIZE) {
-        fprintf(stderr, "Program too large for memory\n");
+        cpu_error(cpu, "Program too large for memory");
         return -1;
     }
     
     // Copy program bytes into the CPU's memory
-    memcpy(&cpu->memory[start_addr], program, size);
+    if (size) {
+        memcpy(&cpu->memory[start_addr], program, size);
+        memset(&cpu->dirty_pages[start_addr >> 8], 1,
+               ((start_addr + size - 1) >> 8) - (start_addr >> 8) + 1);
+    }
+    if (cpu->dcache) {
+        decode_invalidate(cpu->dcache, start_addr, size);
+    }
+    if (cpu->jit) {
+        jit_flush(cpu->jit);
+    }
 
     // Set PC to start of program
     cpu->regs[REG_PC] = start_addr;
     return 0;
 }
 
+// Zero a range of memory, skipping the parts that are zero already
+int cpu_clear_memory(CPU *cpu, uint16_t start_addr, size_t size) {
+    if (start_addr + size > MEMORY_SIZE) {
+        cpu_error(cpu, "Program too large for memory");
+        return -1;
+    }
+
+    size_t addr = start_addr, end = start_addr + size;
+    while (addr < end) {
+        size_t chunk_end = ((addr >> 8) + 1) << 8;
+        if (chunk_end > end) chunk_end = end;
+
+        for (size_t i = addr; i < chunk_end; i++) {
+            if (cpu->memory[i]) {
+                memset(&cpu->memory[addr], 0, chunk_end - addr);
+                cpu->dirty_pages[addr >> 8] = 1;
+                if (cpu->dcache) {
+                    decode_invalidate(cpu->dcache, (uint16_t)addr, chunk_end - addr);
+                }
+                if (cpu->jit) {
+                    jit_flush(cpu->jit);
+                }
+                break;
+            }
+        }
+        addr = chunk_end;
+    }
+    return 0;
+}
+
+//=========================================================
+// Error reporting
+//=========================================================
+
+void cpu_set_error_handler(CPU *cpu, CpuErrorFn fn, void *ctx) {
+    cpu->error     = fn;
+    cpu->error_ctx = ctx;
+}
+
+// Formatted on the stack: reporting a fault allocates nothing
+CPU_NOINLINE void cpu_error(CPU *cpu, const char *fmt, ...) {
+    char message[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(message, sizeof(message), fmt, args);
+    va_end(args);
+
+    if (cpu->error) {
+        cpu->error(cpu->error_ctx, message);
+    } else {
+        fprintf(stderr, "%s\n", message);
+    }
+}
+
+//=========================================================
+// Console output
+//=========================================================
+
+// Default sink: host stdout, flushed after every chunk
+static void stdout_write(void *ctx, const uint8_t *data, size_t len) {
+    (void)ctx;
+    fwrite(data, 1, len, stdout);
+    fflush(stdout);
+}
+
+// Select the output sink and buffer
+void cpu_set_output(CPU *cpu, CpuWriteFn write, void *ctx, uint8_t *buf, size_t size) {
+    cpu_flush_output(cpu);
+    cpu->output.write = write;
+    cpu->output.ctx   = ctx;
+    cpu->output.buf   = size ? buf : NULL;
+    cpu->output.size  = buf ? size : 0;
+    cpu->output.len   = 0;
+}
+
+// Hand buffered bytes to the sink
+void cpu_flush_output(CPU *cpu) {
+    CpuOutput *out = &cpu->output;
+    if (out->len == 0) {
+        return;
+    }
+    (out->write ? out->write : stdout_write)(out->ctx, out->buf, out->len);
+    out->len = 0;
+}
+
+// Bytes for the sink: buffered like single bytes, but handed over
+// in one piece when they do not fit the buffer
+static void output_bytes(CPU *cpu, const uint8_t *data, size_t len) {
+    CpuOutput *out = &cpu->output;
+    if (len == 0) {
+        return;
+    }
+    if (len > out->size - out->len) {
+        cpu_flush_output(cpu);
+        if (len >= out->size) {
+            (out->write ? out->write : stdout_write)(out->ctx, data, len);
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+    if (out->len == out->size || memchr(data, '\n', len)) {
+        cpu_flush_output(cpu);
+    }
+}
+
+// One byte written to PORT_STDOUT
+static void output_byte(CPU *cpu, uint8_t value) {
+    CpuOutput *out = &cpu->output;
+    if (out->size == 0) {
+        // Unbuffered: write through immediately
+        (out->write ? out->write : stdout_write)(out->ctx, &value, 1);
+        return;
+    }
+    out->buf[out->len++] = value;
+    if (value == '\n' || out->len == out->size) {
+        cpu_flush_output(cpu);
+    }
+}
+
+//=========================================================
+// I/O devices
+//=========================================================
+
+// Map handlers onto the ports [first, first + count) of the I/O page
+int cpu_register_device(CPU *cpu, uint16_t first, size_t count,
+                        CpuPortRead read, CpuPortWrite write, void *ctx) {
+    if (first < IO_PAGE_BASE || count > (size_t)(MEMORY_SIZE - first)) {
+        cpu_error(cpu, "Device ports 0x%04X+%zu outside the I/O page", first, count);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        CpuPort *port = &cpu->ports[first - IO_PAGE_BASE + i];
+        port->read  = read;
+        port->write = write;
+        port->ctx   = ctx;
+    }
+    return 0;
+}
+
+// PORT_STDOUT: write a character to the output sink
+static void stdout_port_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)port; (void)ctx;
+    output_byte(cpu, value);
+}
+
+// PORT_WRITE_ADDR / PORT_WRITE_LEN / PORT_PRINT_DEC: the registers,
+// low byte first
+static uint16_t *bulk_reg(CPU *cpu, uint16_t port) {
+    switch (port & ~1u) {
+        case PORT_WRITE_ADDR: return &cpu->write_addr;
+        case PORT_WRITE_LEN:  return &cpu->write_len;
+        default:              return &cpu->print_value;
+    }
+}
+
+static uint8_t bulk_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)ctx;
+    uint16_t reg = *bulk_reg(cpu, port);
+    return (port & 1) ? (uint8_t)(reg >> 8) : (uint8_t)(reg & 0xFF);
+}
+
+// Storing the high byte of the length or the decimal value outputs
+static void bulk_port_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)ctx;
+    uint16_t *reg = bulk_reg(cpu, port);
+    if (!(port & 1)) {
+        *reg = (uint16_t)((*reg & 0xFF00) | value);
+        return;
+    }
+    *reg = (uint16_t)((*reg & 0x00FF) | (value << 8));
+
+    if (port == PORT_WRITE_LEN + 1) {
+        size_t len = cpu->write_len;
+        if (cpu->write_addr + len > IO_PAGE_BASE) {
+            len = cpu->write_addr < IO_PAGE_BASE ? IO_PAGE_BASE - cpu->write_addr : 0;
+        }
+        output_bytes(cpu, &cpu->memory[cpu->write_addr], len);
+    } else if (port == PORT_PRINT_DEC + 1) {
+        uint8_t digits[5];
+        size_t  n = sizeof(digits);
+        uint16_t v = cpu->print_value;
+        do {
+            digits[--n] = (uint8_t)('0' + v % 10);
+            v /= 10;
+        } while (v);
+        output_bytes(cpu, &digits[n], sizeof(digits) - n);
+    }
+}
+
+//=========================================================
+// Scheduled events
+//=========================================================
+
+// An interrupt is waiting and may be taken now
+static bool irq_ready(const CPU *cpu) {
+    return cpu->irq_enabled && (cpu->irq_pending & cpu->irq_mask) != 0;
+}
+
+// Recompute when the engines must next call cpu_run_events
+static void events_rearm(CPU *cpu) {
+    cpu->event_cycle = irq_ready(cpu)    ? 0
+                     : cpu->event_count ? cpu->events[0].cycle : UINT64_MAX;
+}
+
+static void event_remove(CPU *cpu, size_t i) {
+    memmove(&cpu->events[i], &cpu->events[i + 1],
+            (cpu->event_count - i - 1) * sizeof(CpuEvent));
+    cpu->event_count--;
+    events_rearm(cpu);
+}
+
+void cpu_cancel(CPU *cpu, CpuEventFn fn, void *ctx) {
+    for (size_t i = 0; i < cpu->event_count; i++) {
+        if (cpu->events[i].fn == fn && cpu->events[i].ctx == ctx) {
+            event_remove(cpu, i);
+            return;
+        }
+    }
+}
+
+int cpu_schedule(CPU *cpu, uint64_t cycle, CpuEventFn fn, void *ctx) {
+    cpu_cancel(cpu, fn, ctx);
+    if (cpu->event_count == CPU_MAX_EVENTS) {
+        cpu_error(cpu, "More than %d events pending", CPU_MAX_EVENTS);
+        return -1;
+    }
+
+    // Keep the queue sorted; events due together run in the order
+    // they were scheduled
+    size_t i = cpu->event_count++;
+    while (i > 0 && cpu->events[i - 1].cycle > cycle) {
+        cpu->events[i] = cpu->events[i - 1];
+        i--;
+    }
+    cpu->events[i] = (CpuEvent){ .cycle = cycle, .fn = fn, .ctx = ctx };
+    events_rearm(cpu);
+    return 0;
+}
+
+static void irq_take(CPU *cpu);
+
+// Run every event that is due, then take an interrupt if one is
+// ready. Called by the engines when cycles reaches event_cycle,
+// before the next instruction.
+void cpu_run_events(CPU *cpu) {
+    while (cpu->event_count && cpu->events[0].cycle <= cpu->cycles) {
+        CpuEvent ev = cpu->events[0];
+        event_remove(cpu, 0);
+        ev.fn(cpu, ev.ctx);     // may schedule again
+    }
+    if (irq_ready(cpu)) {
+        irq_take(cpu);
+    }
+}
+
+//=========================================================
+// Interrupts
+//=========================================================
+
+void cpu_raise_irq(CPU *cpu, unsigned line) {
+    if (line < CPU_IRQ_LINES) {
+        cpu->irq_pending |= (uint8_t)(1u << line);
+        events_rearm(cpu);
+    }
+}
+
+void cpu_set_interrupts(CPU *cpu, bool enabled) {
+    cpu->irq_enabled = enabled;
+    events_rearm(cpu);
+}
+
+// Enter the handler of the lowest ready line
+static void irq_take(CPU *cpu) {
+    uint8_t  ready = cpu->irq_pending & cpu->irq_mask;
+    unsigned line  = 0;
+    while (!(ready & (1u << line))) {
+        line++;
+    }
+    cpu->irq_pending &= (uint8_t)~(1u << line);
+    cpu->irq_enabled  = false;
+    cpu_push(cpu, cpu->regs[REG_PC]);
+    cpu_push(cpu, cpu_get_flags(cpu));
+    cpu->regs[REG_PC] = cpu_read_word(cpu, (uint16_t)(IRQ_VECTOR_BASE + 2 * line));
+    events_rearm(cpu);
+}
+
+uint16_t cpu_irq_return(CPU *cpu) {
+    cpu->flags   = (uint8_t)cpu_pop(cpu);
+    cpu->lazy_op = FLAGS_LAZY_NONE;
+    uint16_t pc  = cpu_pop(cpu);
+    cpu_set_interrupts(cpu, true);
+    return pc;
+}
+
+// PORT_IRQ_PENDING / PORT_IRQ_MASK: one bit per line
+static uint8_t irq_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)ctx;
+    return port == PORT_IRQ_PENDING ? cpu->irq_pending : cpu->irq_mask;
+}
+
+static void stdin_watch(CPU *cpu);
+
+// Writing 1 bits to PORT_IRQ_PENDING clears those lines; writing
+// PORT_IRQ_MASK selects the lines that may interrupt
+static void irq_port_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)ctx;
+    if (port == PORT_IRQ_PENDING) {
+        cpu->irq_pending &= (uint8_t)~value;
+    } else {
+        bool watch = (value & ~cpu->irq_mask) & (1u << IRQ_STDIN);
+        cpu->irq_mask = value;
+        if (watch) {
+            stdin_watch(cpu);
+        }
+    }
+    events_rearm(cpu);
+}
+
+//=========================================================
+// Console input
+//=========================================================
+//
+// Until the guest asks for input asynchronously, PORT_STDIN reads
+// host stdin directly. After that the background reader owns stdin
+// (host_input.h), and a poll event raises IRQ_STDIN while the line
+// is enabled and input is waiting.
+
+// The poll event: raise IRQ_STDIN for waiting input or its end, and
+// look again later unless the line was masked or input has ended
+static void stdin_poll(CPU *cpu, void *ctx) {
+    (void)ctx;
+    if (!(cpu->irq_mask & (1u << IRQ_STDIN))) {
+        return;
+    }
+    // Ask whichever device serves the status port, so a console
+    // mapped over the built-in one drives the line the same way
+    uint8_t status = cpu_read_byte(cpu, PORT_STDIN_STATUS);
+    if (status & (STDIN_STATUS_READY | STDIN_STATUS_EOF)) {
+        cpu_raise_irq(cpu, IRQ_STDIN);
+    }
+    if (!(status & STDIN_STATUS_EOF)) {
+        cpu_schedule(cpu, cpu->cycles + STDIN_POLL_CYCLES, stdin_poll, NULL);
+    }
+}
+
+// IRQ_STDIN was just enabled: poll at once (reading the built-in
+// status port starts the reader)
+static void stdin_watch(CPU *cpu) {
+    cpu_schedule(cpu, cpu->cycles, stdin_poll, NULL);
+}
+
+// PORT_STDIN: read a character from host stdin (0 at EOF). Pending
+// output is shown first: the guest may be prompting for this input.
+// With the reader running, a further waiting byte raises IRQ_STDIN
+// again straight away rather than at the next poll.
+static uint8_t stdin_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)port; (void)ctx;
+    cpu_flush_output(cpu);
+    if (!host_input_started()) {
+        int ch = getchar();
+        return (ch == EOF) ? 0 : (uint8_t)ch;
+    }
+    int ch = host_input_getc(true);
+    if ((cpu->irq_mask & (1u << IRQ_STDIN)) && (host_input_poll() & HOST_INPUT_READY)) {
+        cpu_raise_irq(cpu, IRQ_STDIN);
+    }
+    return ch < 0 ? 0 : (uint8_t)ch;
+}
+
+// PORT_STDIN_STATUS: STDIN_STATUS_* bits, without waiting
+static uint8_t stdin_status_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)port; (void)ctx;
+    if (host_input_start() < 0) {
+        cpu_error(cpu, "Cannot start the input thread: console input unavailable");
+        return STDIN_STATUS_EOF;
+    }
+    int state = host_input_poll();
+    return (uint8_t)(((state & HOST_INPUT_READY) ? STDIN_STATUS_READY : 0) |
+                     ((state & HOST_INPUT_EOF)   ? STDIN_STATUS_EOF   : 0));
+}
+
+//=========================================================
+// Timer
+//=========================================================
+//
+// The count is derived from cycles when read, so a running timer
+// costs the engines nothing; only the compare needs an event.
+
+uint16_t cpu_timer_value(const CPU *cpu) {
+    if (!cpu->timer_enabled) {
+        return cpu->timer_value;
+    }
+    return (uint16_t)(cpu->cycles - cpu->timer_start);
+}
+
+// The compare event: the count has reached timer_compare
+static void timer_match(CPU *cpu, void *ctx) {
+    (void)ctx;
+    cpu->timer_status |= TIMER_STATUS_MATCH;
+    cpu->timer_armed = false;
+    cpu_raise_irq(cpu, IRQ_TIMER);
+}
+
+// Schedule the compare for the current count and settings
+static void timer_schedule(CPU *cpu) {
+    if (!cpu->timer_enabled || !cpu->timer_armed) {
+        cpu_cancel(cpu, timer_match, NULL);
+        return;
+    }
+    // The count reaches the compare value in 1 to 65536 instructions
+    uint16_t ahead = (uint16_t)(cpu->timer_compare - cpu_timer_value(cpu));
+    cpu_schedule(cpu, cpu->cycles + (ahead ? ahead : 0x10000), timer_match, NULL);
+}
+
+// Give the count a new value, counting on from it if enabled
+static void timer_set(CPU *cpu, uint16_t value) {
+    cpu->timer_value = value;
+    cpu->timer_start = cpu->cycles - value;
+    timer_schedule(cpu);
+}
+
+// PORT_TIMER_CTRL: 1 = enabled, 0 = disabled
+static uint8_t timer_ctrl_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)port; (void)ctx;
+    return cpu->timer_enabled ? 1 : 0;
+}
+
+// PORT_TIMER_CTRL: non-zero enables (and resets) the timer, zero
+// stops it at its current count
+static void timer_ctrl_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)port; (void)ctx;
+    if (value != 0) {
+        cpu->timer_enabled = true;
+        timer_set(cpu, 0);      // reset timer when enabled
+    } else {
+        cpu->timer_value = cpu_timer_value(cpu);
+        cpu->timer_enabled = false;
+        timer_schedule(cpu);
+    }
+}
+
+// PORT_TIMER_VALUE: low byte of the timer, latching the high byte;
+// PORT_TIMER_HIGH: the latched high byte
+static uint8_t timer_value_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)ctx;
+    if (port == PORT_TIMER_HIGH) {
+        return cpu->timer_latch;
+    }
+    uint16_t value = cpu_timer_value(cpu);
+    cpu->timer_latch = (uint8_t)(value >> 8);
+    return (uint8_t)(value & 0xFF);
+}
+
+// PORT_TIMER_VALUE: set the timer directly (high byte cleared);
+// PORT_TIMER_HIGH: set its high byte
+static void timer_value_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)ctx;
+    if (port == PORT_TIMER_HIGH) {
+        timer_set(cpu, (uint16_t)((cpu_timer_value(cpu) & 0x00FF) | (value << 8)));
+    } else {
+        timer_set(cpu, value);
+    }
+}
+
+// PORT_TIMER_CMP / PORT_TIMER_CMP_HIGH: the compare value
+static uint8_t timer_compare_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)ctx;
+    return port == PORT_TIMER_CMP ? (uint8_t)(cpu->timer_compare & 0xFF)
+                                  : (uint8_t)(cpu->timer_compare >> 8);
+}
+
+// Writing either byte (re)arms the compare
+static void timer_compare_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)ctx;
+    if (port == PORT_TIMER_CMP) {
+        cpu->timer_compare = (uint16_t)((cpu->timer_compare & 0xFF00) | value);
+    } else {
+        cpu->timer_compare = (uint16_t)((cpu->timer_compare & 0x00FF) | (value << 8));
+    }
+    cpu->timer_armed = true;
+    timer_schedule(cpu);
+}
+
+// PORT_TIMER_STATUS: TIMER_STATUS_* bits; any write clears them
+static uint8_t timer_status_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)port; (void)ctx;
+    return cpu->timer_status;
+}
+
+static void timer_status_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)port; (void)value; (void)ctx;
+    cpu->timer_status = 0;
+}
+
+//=========================================================
+// DMA
+//=========================================================
+
+void cpu_set_dma_rate(CPU *cpu, uint16_t bytes_per_cycle) {
+    cpu->dma_rate = bytes_per_cycle;
+}
+
+// RAM [addr, addr + len) was rewritten without cpu_write_byte: mark
+// it dirty and drop the decodes and translations it held
+static void ram_changed(CPU *cpu, uint16_t addr, size_t len) {
+    size_t first = addr >> 8, last = (addr + len - 1) >> 8;
+    memset(&cpu->dirty_pages[first], 1, last - first + 1);
+    if (cpu->dcache) {
+        decode_invalidate(cpu->dcache, addr, len);
+    }
+    if (cpu->jit) {
+        for (size_t page = first; page <= last; page++) {
+            if (!cpu->jit->code_pages[page]) {
+                continue;
+            }
+            size_t from = page << 8 > addr ? page << 8 : addr;
+            size_t to   = (page + 1) << 8 < addr + len ? (page + 1) << 8 : addr + len;
+            for (size_t a = from; a < to; a++) {
+                jit_invalidate(cpu->jit, (uint16_t)a);
+            }
+        }
+    }
+}
+
+// The transfer's charged time is over
+static void dma_done(CPU *cpu, void *ctx) {
+    (void)ctx;
+    cpu->dma_status &= (uint8_t)~DMA_STATUS_BUSY;
+    cpu_raise_irq(cpu, IRQ_DMA);
+}
+
+// Run a DMA_CMD_* with the current registers
+static void dma_start(CPU *cpu, uint8_t cmd) {
+    size_t len = cpu->dma_len;
+    bool copy = cmd == DMA_CMD_COPY;
+    if ((!copy && cmd != DMA_CMD_FILL) ||
+        cpu->dma_dst + len > IO_PAGE_BASE || (copy && cpu->dma_src + len > IO_PAGE_BASE)) {
+        cpu->dma_status = DMA_STATUS_ERROR;
+        cpu_raise_irq(cpu, IRQ_DMA);
+        return;
+    }
+
+    if (len) {
+        if (copy) {
+            memmove(&cpu->memory[cpu->dma_dst], &cpu->memory[cpu->dma_src], len);
+        } else {
+            memset(&cpu->memory[cpu->dma_dst], cpu->dma_src & 0xFF, len);
+        }
+        ram_changed(cpu, cpu->dma_dst, len);
+    }
+
+    cpu->dma_status = 0;
+    if (cpu->dma_rate == 0) {
+        dma_done(cpu, NULL);
+        return;
+    }
+    uint64_t cost = DMA_SETUP_CYCLES + (len + cpu->dma_rate - 1) / cpu->dma_rate;
+    cpu->dma_status = DMA_STATUS_BUSY;
+    if (cpu_schedule(cpu, cpu->cycles + cost, dma_done, NULL) < 0) {
+        dma_done(cpu, NULL);    // no room to wait: finish now
+    }
+}
+
+// PORT_DMA_SRC/DST/LEN: the registers, low byte first;
+// PORT_DMA_CTRL: DMA_STATUS_*
+static uint8_t dma_port_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)ctx;
+    uint16_t reg;
+    switch (port & ~1u) {
+        case PORT_DMA_SRC: reg = cpu->dma_src; break;
+        case PORT_DMA_DST: reg = cpu->dma_dst; break;
+        case PORT_DMA_LEN: reg = cpu->dma_len; break;
+        default:           return cpu->dma_status;
+    }
+    return (port & 1) ? (uint8_t)(reg >> 8) : (uint8_t)(reg & 0xFF);
+}
+
+// Set a register byte, or start a command
+static void dma_port_write(CPU *cpu, uint16_t port, uint8_t value, void *ctx) {
+    (void)ctx;
+    uint16_t *reg;
+    switch (port & ~1u) {
+        case PORT_DMA_SRC: reg = &cpu->dma_src; break;
+        case PORT_DMA_DST: reg = &cpu->dma_dst; break;
+        case PORT_DMA_LEN: reg = &cpu->dma_len; break;
+        default:
+            if (port == PORT_DMA_CTRL && !(cpu->dma_status & DMA_STATUS_BUSY)) {
+                dma_start(cpu, value);
+            }
+            return;
+    }
+    if (port & 1) {
+        *reg = (uint16_t)((*reg & 0x00FF) | (value << 8));
+    } else {
+        *reg = (uint16_t)((*reg & 0xFF00) | value);
+    }
+}
+
+bool cpu_builtin_port(const CPU *cpu, uint16_t port) {
+    CpuPortRead read = cpu->ports[port - IO_PAGE_BASE].read;
+    switch (port) {
+        case PORT_TIMER_CTRL:   return read == timer_ctrl_read;
+        case PORT_TIMER_VALUE:
+        case PORT_TIMER_HIGH:   return read == timer_value_read;
+        case PORT_TIMER_CMP:
+        case PORT_TIMER_CMP_HIGH: return read == timer_compare_read;
+        case PORT_TIMER_STATUS: return read == timer_status_read;
+        case PORT_DMA_CTRL:     return read == dma_port_read;
+        default:                return false;
+    }
+}
+
+// The built-in devices' events, numbered for checkpoint files
+static const CpuEventFn builtin_events[] = { stdin_poll, timer_match, dma_done };
+
+#define BUILTIN_EVENT_COUNT (sizeof(builtin_events) / sizeof(builtin_events[0]))
+
+int cpu_event_id(CpuEventFn fn) {
+    for (size_t i = 0; i < BUILTIN_EVENT_COUNT; i++) {
+        if (builtin_events[i] == fn) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+CpuEventFn cpu_event_fn(unsigned id) {
+    return id < BUILTIN_EVENT_COUNT ? builtin_events[id] : NULL;
+}
+
+// Map the console, bulk output, timer, interrupt controller and DMA
+// onto their ports
+static void register_builtin_devices(CPU *cpu) {
+    cpu_register_device(cpu, PORT_STDOUT,       1, NULL,               stdout_port_write,   NULL);
+    cpu_register_device(cpu, PORT_STDIN,        1, stdin_port_read,    NULL,                NULL);
+    cpu_register_device(cpu, PORT_STDIN_STATUS, 1, stdin_status_read,  NULL,                NULL);
+    cpu_register_device(cpu, PORT_WRITE_ADDR,   6, bulk_port_read,     bulk_port_write,     NULL);
+    cpu_register_device(cpu, PORT_TIMER_CTRL,   1, timer_ctrl_read,    timer_ctrl_write,    NULL);
+    cpu_register_device(cpu, PORT_TIMER_VALUE,  2, timer_value_read,   timer_value_write,   NULL);
+    cpu_register_device(cpu, PORT_TIMER_CMP,    2, timer_compare_read, timer_compare_write, NULL);
+    cpu_register_device(cpu, PORT_TIMER_STATUS, 1, timer_status_read,  timer_status_write,  NULL);
+    cpu_register_device(cpu, PORT_IRQ_PENDING,  2, irq_port_read,      irq_port_write,      NULL);
+    cpu_register_device(cpu, PORT_DMA_SRC,      7, dma_port_read,      dma_port_write,      NULL);
+}
+
 //=========================================================
 // Memory access (with memory-mapped I/O)
 //=========================================================
 
 // Read a single byte from memory or I/O port
 uint8_t cpu_read_byte(CPU *cpu, uint16_t addr) {
-    // Handle memory-mapped I/O
-    if (addr == PORT_STDIN) {
-        // STDIN: read character from host stdin
-        int ch = getchar();
-        return (ch == EOF) ? 0 : (uint8_t)ch;
-    } else if (addr == PORT_TIMER_VALUE) {
-        // Timer value register (low byte)
-        return (uint8_t)(cpu->timer_value & 0xFF);
-    } else if (addr == PORT_TIMER_CTRL) {
-        // Timer control: 1 = enabled, 0 = disabled
-        return cpu->timer_enabled ? 1 : 0;
+    // One compare for the I/O page; unmapped ports read as RAM
+    if (addr >= IO_PAGE_BASE) {
+        const CpuPort *port = &cpu->ports[addr - IO_PAGE_BASE];
+        if (port->read) {
+            return port->read(cpu, addr, port->ctx);
+        }
     }
-    
-    // Default: normal RAM access
     return cpu->memory[addr];
 }
 
+// Highest address at which a word lies wholly below the I/O page,
+// and so can neither reach a port nor wrap past 0xFFFF
+#define WORD_FAST_LIMIT (IO_PAGE_BASE - 2)
+
 // Read a 16-bit word from memory (little-endian)
 uint16_t cpu_read_word(CPU *cpu, uint16_t addr) {
+    // Plain RAM: one (unaligned) load; compilers fuse the two bytes
+    if (addr <= WORD_FAST_LIMIT) {
+        const uint8_t *p = &cpu->memory[addr];
+        return (uint16_t)(p[0] | (p[1] << 8));
+    }
     uint8_t low  = cpu_read_byte(cpu, addr);
     uint8_t high = cpu_read_byte(cpu, addr + 1);
     return (high << 8) | low;
 }
 
+// A RAM byte in a page holding cached code changed. Kept out of line
+// so the common write path needs no stack frame.
+static CPU_NOINLINE void code_written(CPU *cpu, uint16_t addr) {
+    if (cpu->dcache && cpu->dcache->live_pages[addr >> 8]) {
+        decode_invalidate(cpu->dcache, addr, 1);
+    }
+    if (cpu->jit && cpu->jit->code_pages[addr >> 8]) {
+        jit_invalidate(cpu->jit, addr);
+    }
+}
+
 // Write a single byte to memory or I/O port
 void cpu_write_byte(CPU *cpu, uint16_t addr, uint8_t value) {
-    // Handle memory-mapped I/O
-    if (addr == PORT_STDOUT) {
-        // STDOUT: write character to host stdout
-        putchar(value);
-        fflush(stdout);
-        return;
-    } else if (addr == PORT_TIMER_CTRL) {
-        // Timer control register: non-zero = enable, zero = disable
-        cpu->timer_enabled = (value != 0);
-        if (cpu->timer_enabled) {
-            cpu->timer_value = 0;   // reset timer when enabled
+    // One compare for the I/O page; unmapped ports write to RAM
+    if (addr >= IO_PAGE_BASE) {
+        const CpuPort *port = &cpu->ports[addr - IO_PAGE_BASE];
+        if (port->write) {
+            port->write(cpu, addr, value, port->ctx);
+            return;
         }
-        return;
-    } else if (addr == PORT_TIMER_VALUE) {
-        // Directly set timer value
-        cpu->timer_value = value;
-        return;
     }
-    
+
     // Default: normal RAM write
     cpu->memory[addr] = value;
+    cpu->dirty_pages[addr >> 8] = 1;
+
+    // Keep pre-decoded / translated code coherent (self-modifying code)
+    if ((cpu->dcache && cpu->dcache->live_pages[addr >> 8]) ||
+        (cpu->jit && cpu->jit->code_pages[addr >> 8])) {
+        code_written(cpu, addr);
+    }
 }
 
 // Write a 16-bit word to memory (little-endian)
 void cpu_write_word(CPU *cpu, uint16_t addr, uint16_t value) {
+    // Plain RAM: one (unaligned) store, with the bookkeeping of
+    // cpu_write_byte done once per page the word touches
+    if (addr <= WORD_FAST_LIMIT) {
+        uint8_t *p = &cpu->memory[addr];
+        p[0] = (uint8_t)value;
+        p[1] = (uint8_t)(value >> 8);
+
+        unsigned lo = addr >> 8, hi = (addr + 1u) >> 8;
+        cpu->dirty_pages[lo] = 1;
+        cpu->dirty_pages[hi] = 1;
+        if ((cpu->dcache && (cpu->dcache->live_pages[lo] | cpu->dcache->live_pages[hi])) ||
+            (cpu->jit && (cpu->jit->code_pages[lo] | cpu->jit->code_pages[hi]))) {
+            code_written(cpu, addr);
+            code_written(cpu, addr + 1);
+        }
+        return;
+    }
     cpu_write_byte(cpu, addr,     value & 0xFF);
     cpu_write_byte(cpu, addr + 1, (value >> 8) & 0xFF);
 }
@@ -137,6 +859,9 @@ void cpu_set_reg(CPU *cpu, uint8_t reg, uint16_t value) {
 // carry:  carry flag from the operation (unsigned overflow/borrow)
 // overflow: signed overflow flag
 void cpu_set_flags_arithmetic(CPU *cpu, uint16_t result, bool carry, bool overflow) {
+    // All four flags are overwritten, so a pending lazy record is moot
+    cpu->lazy_op = FLAGS_LAZY_NONE;
+
     // Zero flag: set if result is 0
     cpu_set_flag(cpu, FLAG_ZERO, (result & 0xFFFF) == 0);
     
@@ -152,6 +877,7 @@ void cpu_set_flags_arithmetic(CPU *cpu, uint16_t result, bool carry, bool overfl
 
 // Set or clear a specific status flag bit
 void cpu_set_flag(CPU *cpu, uint8_t flag, bool value) {
+    flags_sync(cpu);
     if (value) {
         cpu->flags |= flag;
     } else {
@@ -161,7 +887,13 @@ void cpu_set_flag(CPU *cpu, uint8_t flag, bool value) {
 
 // Read a specific status flag bit
 bool cpu_get_flag(CPU *cpu, uint8_t flag) {
-    return (cpu->flags & flag) != 0;
+    return (flags_eval(cpu) & flag) != 0;
+}
+
+// Read the whole FLAGS register, folding in any pending lazy record
+uint8_t cpu_get_flags(CPU *cpu) {
+    flags_sync(cpu);
+    return cpu->flags;
 }
 
 //=========================================================
@@ -182,6 +914,29 @@ uint16_t cpu_pop(CPU *cpu) {
     return value;
 }
 
+//=========================================================
+// Instruction fetch fast path
+//=========================================================
+//
+// Code almost never runs from the I/O page, so cpu_step decides once
+// per instruction whether the whole instruction (at most
+// MAX_INSTR_LEN bytes) lies below it. If so, opcode and operand bytes
+// are read straight from memory[]; otherwise every byte goes through
+// cpu_read_byte so memory-mapped ports keep their semantics.
+
+// Fetch one code byte
+static inline uint8_t fetch_byte(CPU *cpu, uint16_t addr, bool fast) {
+    return fast ? cpu->memory[addr] : cpu_read_byte(cpu, addr);
+}
+
+// Fetch a 16-bit little-endian code word
+static inline uint16_t fetch_word(CPU *cpu, uint16_t addr, bool fast) {
+    if (fast) {
+        return (uint16_t)(cpu->memory[addr] | (cpu->memory[addr + 1] << 8));
+    }
+    return cpu_read_word(cpu, addr);
+}
+
 //=========================================================
 // Fetch–Decode–Execute: single step
 //=========================================================
@@ -195,15 +950,17 @@ int cpu_step(CPU *cpu) {
         // Once halted, step is a no-op
         return 0;
     }
+
+    // Devices due to act do so before this instruction
+    if (cpu->cycles >= cpu->event_cycle) {
+        cpu_run_events(cpu);
+    }
     
     // ===== FETCH =====
     uint16_t pc = cpu->regs[REG_PC];      // local copy of PC
-    uint8_t opcode = cpu_read_byte(cpu, pc++);  // fetch opcode and advance PC
+    bool fast = pc <= FETCH_FAST_LIMIT;   // one range check per instruction
+    uint8_t opcode = fetch_byte(cpu, pc++, fast);  // fetch opcode and advance PC
     
-    // Update timer each instruction if enabled
-    if (cpu->timer_enabled) {
-        cpu->timer_value++;
-    }
     
     // ===== DECODE & EXECUTE =====
     switch (opcode) {
@@ -213,8 +970,8 @@ int cpu_step(CPU *cpu) {
             
         //------------- LOAD r, imm16 -------------
         case OP_LOAD_IMM: {
-            uint8_t  reg = cpu_read_byte(cpu, pc++);
-            uint16_t imm = cpu_read_word(cpu, pc);
+            uint8_t  reg = fetch_byte(cpu, pc++, fast);
+            uint16_t imm = fetch_word(cpu, pc, fast);
             pc += 2;
             cpu_set_reg(cpu, reg, imm);
             break;
@@ -222,8 +979,8 @@ int cpu_step(CPU *cpu) {
         
         //------------- LOAD r, [addr] -------------
         case OP_LOAD_MEM: {
-            uint8_t  reg  = cpu_read_byte(cpu, pc++);
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint8_t  reg  = fetch_byte(cpu, pc++, fast);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
             // LOAD reads a 16-bit word from memory into the register
             uint16_t value = cpu_read_word(cpu, addr);
@@ -233,16 +990,16 @@ int cpu_step(CPU *cpu) {
         
         //------------- STORE [addr], r -------------
         case OP_STORE: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
-            uint8_t reg  = cpu_read_byte(cpu, pc++);
+            uint8_t reg  = fetch_byte(cpu, pc++, fast);
             cpu_write_word(cpu, addr, cpu_get_reg(cpu, reg));
             break;
         }
         
         //------------- MOV r1, r2 -------------
         case OP_MOV: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             cpu_set_reg(cpu, r1, cpu_get_reg(cpu, r2));
@@ -251,14 +1008,14 @@ int cpu_step(CPU *cpu) {
         
         //------------- PUSH r -------------
         case OP_PUSH: {
-            uint8_t reg = cpu_read_byte(cpu, pc++);
+            uint8_t reg = fetch_byte(cpu, pc++, fast);
             cpu_push(cpu, cpu_get_reg(cpu, reg));
             break;
         }
         
         //------------- POP r -------------
         case OP_POP: {
-            uint8_t reg = cpu_read_byte(cpu, pc++);
+            uint8_t reg = fetch_byte(cpu, pc++, fast);
             cpu_set_reg(cpu, reg, cpu_pop(cpu));
             break;
         }
@@ -267,76 +1024,69 @@ int cpu_step(CPU *cpu) {
         // ARITHMETIC
         //=================================================
         case OP_ADD: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint32_t a   = cpu_get_reg(cpu, r1);
             uint32_t b   = cpu_get_reg(cpu, r2);
             uint32_t result = a + b;
             cpu_set_reg(cpu, r1, result & 0xFFFF);
-            bool carry    = result > 0xFFFF;
-            bool overflow = ((a ^ result) & (b ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_add(cpu, a, b, result);
             break;
         }
         
         case OP_ADDI: {
-            uint8_t  reg = cpu_read_byte(cpu, pc++);
-            uint16_t imm = cpu_read_word(cpu, pc);
+            uint8_t  reg = fetch_byte(cpu, pc++, fast);
+            uint16_t imm = fetch_word(cpu, pc, fast);
             pc += 2;
             uint32_t a      = cpu_get_reg(cpu, reg);
             uint32_t result = a + imm;
             cpu_set_reg(cpu, reg, result & 0xFFFF);
-            bool carry    = result > 0xFFFF;
-            bool overflow = ((a ^ result) & (imm ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_add(cpu, a, imm, result);
             break;
         }
         
         case OP_SUB: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint32_t a   = cpu_get_reg(cpu, r1);
             uint32_t b   = cpu_get_reg(cpu, r2);
             uint32_t result = a - b;
             cpu_set_reg(cpu, r1, result & 0xFFFF);
-            bool carry    = a < b;  // borrow in subtraction
-            bool overflow = ((a ^ b) & (a ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_sub(cpu, a, b, result);  // carry = borrow
             break;
         }
         
         case OP_SUBI: {
-            uint8_t  reg = cpu_read_byte(cpu, pc++);
-            uint16_t imm = cpu_read_word(cpu, pc);
+            uint8_t  reg = fetch_byte(cpu, pc++, fast);
+            uint16_t imm = fetch_word(cpu, pc, fast);
             pc += 2;
             uint32_t a      = cpu_get_reg(cpu, reg);
             uint32_t result = a - imm;
             cpu_set_reg(cpu, reg, result & 0xFFFF);
-            bool carry    = a < imm;
-            bool overflow = ((a ^ imm) & (a ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_sub(cpu, a, imm, result);
             break;
         }
         
         case OP_MUL: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint32_t result = (uint32_t)cpu_get_reg(cpu, r1) * cpu_get_reg(cpu, r2);
             cpu_set_reg(cpu, r1, result & 0xFFFF);
-            cpu_set_flags_arithmetic(cpu, result, result > 0xFFFF, false);
+            flags_lazy_result(cpu, result, result > 0xFFFF);
             break;
         }
         
         case OP_DIV: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint16_t divisor = cpu_get_reg(cpu, r2);
             if (divisor == 0) {
-                fprintf(stderr, "Division by zero at PC=0x%04X\n", cpu->regs[REG_PC]);
+                cpu_flush_output(cpu);
+                cpu_error(cpu, "Division by zero at PC=0x%04X", cpu->regs[REG_PC]);
                 cpu->halted = true;
                 return -1;
             }
@@ -345,23 +1095,23 @@ int cpu_step(CPU *cpu) {
             uint16_t remainder = dividend % divisor;
             cpu_set_reg(cpu, r1, quotient);
             cpu_set_reg(cpu, r2, remainder);
-            cpu_set_flags_arithmetic(cpu, quotient, false, false);
+            flags_lazy_result(cpu, quotient, false);
             break;
         }
         
         case OP_INC: {
-            uint8_t  reg   = cpu_read_byte(cpu, pc++);
+            uint8_t  reg   = fetch_byte(cpu, pc++, fast);
             uint16_t value = cpu_get_reg(cpu, reg) + 1;
             cpu_set_reg(cpu, reg, value);
-            cpu_set_flags_arithmetic(cpu, value, false, false);
+            flags_lazy_result(cpu, value, false);
             break;
         }
         
         case OP_DEC: {
-            uint8_t  reg   = cpu_read_byte(cpu, pc++);
+            uint8_t  reg   = fetch_byte(cpu, pc++, fast);
             uint16_t value = cpu_get_reg(cpu, reg) - 1;
             cpu_set_reg(cpu, reg, value);
-            cpu_set_flags_arithmetic(cpu, value, false, false);
+            flags_lazy_result(cpu, value, false);
             break;
         }
         
@@ -369,64 +1119,62 @@ int cpu_step(CPU *cpu) {
         // LOGIC
         //=================================================
         case OP_AND: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint16_t result = cpu_get_reg(cpu, r1) & cpu_get_reg(cpu, r2);
             cpu_set_reg(cpu, r1, result);
-            cpu_set_flags_arithmetic(cpu, result, false, false);
+            flags_lazy_result(cpu, result, false);
             break;
         }
         
         case OP_OR: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint16_t result = cpu_get_reg(cpu, r1) | cpu_get_reg(cpu, r2);
             cpu_set_reg(cpu, r1, result);
-            cpu_set_flags_arithmetic(cpu, result, false, false);
+            flags_lazy_result(cpu, result, false);
             break;
         }
         
         case OP_XOR: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint16_t result = cpu_get_reg(cpu, r1) ^ cpu_get_reg(cpu, r2);
             cpu_set_reg(cpu, r1, result);
-            cpu_set_flags_arithmetic(cpu, result, false, false);
+            flags_lazy_result(cpu, result, false);
             break;
         }
         
         case OP_NOT: {
-            uint8_t  reg    = cpu_read_byte(cpu, pc++);
+            uint8_t  reg    = fetch_byte(cpu, pc++, fast);
             uint16_t result = ~cpu_get_reg(cpu, reg);
             cpu_set_reg(cpu, reg, result);
-            cpu_set_flags_arithmetic(cpu, result, false, false);
+            flags_lazy_result(cpu, result, false);
             break;
         }
         
         case OP_SHL: {
-            uint8_t reg   = cpu_read_byte(cpu, pc++);
-            uint8_t shift = cpu_read_byte(cpu, pc++);
-            uint16_t value  = cpu_get_reg(cpu, reg);
-            uint16_t result = value << shift;
-            cpu_set_reg(cpu, reg, result);
+            uint8_t reg   = fetch_byte(cpu, pc++, fast);
+            uint8_t shift = fetch_byte(cpu, pc++, fast);
             // Carry: bit that falls off the left when shifting
-            bool carry = shift > 0 && (value & (1 << (16 - shift))) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, false);
+            bool carry;
+            uint16_t result = shift_left(cpu_get_reg(cpu, reg), shift, &carry);
+            cpu_set_reg(cpu, reg, result);
+            flags_lazy_result(cpu, result, carry);
             break;
         }
         
         case OP_SHR: {
-            uint8_t reg   = cpu_read_byte(cpu, pc++);
-            uint8_t shift = cpu_read_byte(cpu, pc++);
-            uint16_t value  = cpu_get_reg(cpu, reg);
-            uint16_t result = value >> shift;
-            cpu_set_reg(cpu, reg, result);
+            uint8_t reg   = fetch_byte(cpu, pc++, fast);
+            uint8_t shift = fetch_byte(cpu, pc++, fast);
             // Carry: bit that falls off the right when shifting
-            bool carry = shift > 0 && (value & (1 << (shift - 1))) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, false);
+            bool carry;
+            uint16_t result = shift_right(cpu_get_reg(cpu, reg), shift, &carry);
+            cpu_set_reg(cpu, reg, result);
+            flags_lazy_result(cpu, result, carry);
             break;
         }
         
@@ -434,27 +1182,23 @@ int cpu_step(CPU *cpu) {
         // COMPARISON (sets flags, no writeback)
         //=================================================
         case OP_CMP: {
-            uint8_t byte = cpu_read_byte(cpu, pc++);
+            uint8_t byte = fetch_byte(cpu, pc++, fast);
             uint8_t r1   = (byte >> 4) & 0x0F;
             uint8_t r2   = byte & 0x0F;
             uint32_t a   = cpu_get_reg(cpu, r1);
             uint32_t b   = cpu_get_reg(cpu, r2);
             uint32_t result = a - b;
-            bool carry    = a < b;
-            bool overflow = ((a ^ b) & (a ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_sub(cpu, a, b, result);
             break;
         }
         
         case OP_CMPI: {
-            uint8_t  reg = cpu_read_byte(cpu, pc++);
-            uint16_t imm = cpu_read_word(cpu, pc);
+            uint8_t  reg = fetch_byte(cpu, pc++, fast);
+            uint16_t imm = fetch_word(cpu, pc, fast);
             pc += 2;
             uint32_t a      = cpu_get_reg(cpu, reg);
             uint32_t result = a - imm;
-            bool carry    = a < imm;
-            bool overflow = ((a ^ imm) & (a ^ result) & 0x8000) != 0;
-            cpu_set_flags_arithmetic(cpu, result, carry, overflow);
+            flags_lazy_sub(cpu, a, imm, result);
             break;
         }
         
@@ -462,49 +1206,49 @@ int cpu_step(CPU *cpu) {
         // CONTROL FLOW
         //=================================================
         case OP_JMP: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc = addr;
             break;
         }
         
         case OP_JZ: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
-            if (cpu_get_flag(cpu, FLAG_ZERO)) {
+            if (flag_zero(cpu)) {
                 pc = addr;
             }
             break;
         }
         
         case OP_JNZ: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
-            if (!cpu_get_flag(cpu, FLAG_ZERO)) {
+            if (!flag_zero(cpu)) {
                 pc = addr;
             }
             break;
         }
         
         case OP_JC: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
-            if (cpu_get_flag(cpu, FLAG_CARRY)) {
+            if (flag_carry(cpu)) {
                 pc = addr;
             }
             break;
         }
         
         case OP_JNC: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
-            if (!cpu_get_flag(cpu, FLAG_CARRY)) {
+            if (!flag_carry(cpu)) {
                 pc = addr;
             }
             break;
         }
         
         case OP_CALL: {
-            uint16_t addr = cpu_read_word(cpu, pc);
+            uint16_t addr = fetch_word(cpu, pc, fast);
             pc += 2;
             // Push return address (next instruction) on stack
             cpu_push(cpu, pc);
@@ -523,8 +1267,8 @@ int cpu_step(CPU *cpu) {
         // I/O
         //=================================================
         case OP_IN: {
-            uint8_t  reg  = cpu_read_byte(cpu, pc++);
-            uint16_t port = cpu_read_word(cpu, pc);
+            uint8_t  reg  = fetch_byte(cpu, pc++, fast);
+            uint16_t port = fetch_word(cpu, pc, fast);
             pc += 2;
             uint8_t value = cpu_read_byte(cpu, port);
             cpu_set_reg(cpu, reg, value);
@@ -532,25 +1276,42 @@ int cpu_step(CPU *cpu) {
         }
         
         case OP_OUT: {
-            uint16_t port = cpu_read_word(cpu, pc);
+            uint16_t port = fetch_word(cpu, pc, fast);
             pc += 2;
-            uint8_t  reg  = cpu_read_byte(cpu, pc++);
+            uint8_t  reg  = fetch_byte(cpu, pc++, fast);
             uint16_t value = cpu_get_reg(cpu, reg);
             cpu_write_byte(cpu, port, value & 0xFF);
             break;
         }
         
+        //=================================================
+        // INTERRUPTS
+        //=================================================
+        case OP_EI:
+            cpu_set_interrupts(cpu, true);
+            break;
+
+        case OP_DI:
+            cpu_set_interrupts(cpu, false);
+            break;
+
+        case OP_IRET:
+            pc = cpu_irq_return(cpu);
+            break;
+
         //=================================================
         // SYSTEM
         //=================================================
         case OP_HLT:
             cpu->halted  = true;
             cpu->running = false;
+            cpu_flush_output(cpu);
             break;
             
         // Unknown opcode: treat as fatal error
         default:
-            fprintf(stderr, "Unknown opcode 0x%02X at PC=0x%04X\n", opcode, cpu->regs[REG_PC]);
+            cpu_flush_output(cpu);
+            cpu_error(cpu, "Unknown opcode 0x%02X at PC=0x%04X", opcode, cpu->regs[REG_PC]);
             cpu->halted = true;
             return -1;
     }
@@ -562,19 +1323,396 @@ int cpu_step(CPU *cpu) {
     return 1;
 }
 
+//=========================================================
+// Fetch–Decode–Execute: pre-decoded single step
+//=========================================================
+
+// Execute one pre-decoded instruction. Mirrors cpu_step exactly:
+// same register/flag results, same event and cycle accounting, same
+// error reporting.
+int cpu_step_decoded(CPU *cpu) {
+    if (cpu->halted) {
+        return 0;
+    }
+    if (cpu->cycles >= cpu->event_cycle) {
+        cpu_run_events(cpu);
+    }
+
+    uint16_t pc = cpu->regs[REG_PC];
+    const DecodedInsn *entry = &cpu->dcache->insns[pc];
+    if (entry->length == 0) {
+        // Miss: decode now
+        entry = decode_at(cpu, pc);
+        if (!entry) {
+            // Near the I/O page: use the reference path
+            return cpu_step(cpu);
+        }
+    }
+
+    // Invalidation only clears 'length', so the operands stay readable
+    // even if this instruction overwrites itself
+    uint8_t  r1  = entry->r1;
+    uint8_t  r2  = entry->r2;
+    uint16_t imm = entry->imm;
+    pc += entry->length;
+    int rc = 1;
+
+    switch (entry->handler) {
+        case OP_NOP:
+            break;
+
+        //------------- Data movement -------------
+        case OP_LOAD_IMM:
+            cpu_set_reg(cpu, r1, imm);
+            break;
+
+        case OP_LOAD_MEM:
+            cpu_set_reg(cpu, r1, cpu_read_word(cpu, imm));
+            break;
+
+        case OP_STORE:
+            cpu_write_word(cpu, imm, cpu_get_reg(cpu, r1));
+            break;
+
+        case OP_MOV:
+            cpu_set_reg(cpu, r1, cpu_get_reg(cpu, r2));
+            break;
+
+        case OP_PUSH:
+            cpu_push(cpu, cpu_get_reg(cpu, r1));
+            break;
+
+        case OP_POP:
+            cpu_set_reg(cpu, r1, cpu_pop(cpu));
+            break;
+
+        //------------- Arithmetic -------------
+        case OP_ADD: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t b = cpu_get_reg(cpu, r2);
+            uint32_t result = a + b;
+            cpu_set_reg(cpu, r1, result & 0xFFFF);
+            flags_lazy_add(cpu, a, b, result);
+            break;
+        }
+
+        case OP_ADDI: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t result = a + imm;
+            cpu_set_reg(cpu, r1, result & 0xFFFF);
+            flags_lazy_add(cpu, a, imm, result);
+            break;
+        }
+
+        case OP_SUB: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t b = cpu_get_reg(cpu, r2);
+            uint32_t result = a - b;
+            cpu_set_reg(cpu, r1, result & 0xFFFF);
+            flags_lazy_sub(cpu, a, b, result);
+            break;
+        }
+
+        case OP_SUBI: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t result = a - imm;
+            cpu_set_reg(cpu, r1, result & 0xFFFF);
+            flags_lazy_sub(cpu, a, imm, result);
+            break;
+        }
+
+        case OP_MUL: {
+            uint32_t result = (uint32_t)cpu_get_reg(cpu, r1) * cpu_get_reg(cpu, r2);
+            cpu_set_reg(cpu, r1, result & 0xFFFF);
+            flags_lazy_result(cpu, result, result > 0xFFFF);
+            break;
+        }
+
+        case OP_DIV: {
+            uint16_t divisor = cpu_get_reg(cpu, r2);
+            if (divisor == 0) {
+                cpu_flush_output(cpu);
+                cpu_error(cpu, "Division by zero at PC=0x%04X", cpu->regs[REG_PC]);
+                cpu->halted = true;
+                return -1;
+            }
+            uint16_t dividend  = cpu_get_reg(cpu, r1);
+            uint16_t quotient  = dividend / divisor;
+            uint16_t remainder = dividend % divisor;
+            cpu_set_reg(cpu, r1, quotient);
+            cpu_set_reg(cpu, r2, remainder);
+            flags_lazy_result(cpu, quotient, false);
+            break;
+        }
+
+        case OP_INC: {
+            uint16_t value = cpu_get_reg(cpu, r1) + 1;
+            cpu_set_reg(cpu, r1, value);
+            flags_lazy_result(cpu, value, false);
+            break;
+        }
+
+        case OP_DEC: {
+            uint16_t value = cpu_get_reg(cpu, r1) - 1;
+            cpu_set_reg(cpu, r1, value);
+            flags_lazy_result(cpu, value, false);
+            break;
+        }
+
+        //------------- Logic -------------
+        case OP_AND: {
+            uint16_t result = cpu_get_reg(cpu, r1) & cpu_get_reg(cpu, r2);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, false);
+            break;
+        }
+
+        case OP_OR: {
+            uint16_t result = cpu_get_reg(cpu, r1) | cpu_get_reg(cpu, r2);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, false);
+            break;
+        }
+
+        case OP_XOR: {
+            uint16_t result = cpu_get_reg(cpu, r1) ^ cpu_get_reg(cpu, r2);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, false);
+            break;
+        }
+
+        case OP_NOT: {
+            uint16_t result = ~cpu_get_reg(cpu, r1);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, false);
+            break;
+        }
+
+        case OP_SHL: {
+            bool carry;
+            uint16_t result = shift_left(cpu_get_reg(cpu, r1), (uint8_t)imm, &carry);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, carry);
+            break;
+        }
+
+        case OP_SHR: {
+            bool carry;
+            uint16_t result = shift_right(cpu_get_reg(cpu, r1), (uint8_t)imm, &carry);
+            cpu_set_reg(cpu, r1, result);
+            flags_lazy_result(cpu, result, carry);
+            break;
+        }
+
+        //------------- Comparison -------------
+        case OP_CMP: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t b = cpu_get_reg(cpu, r2);
+            uint32_t result = a - b;
+            flags_lazy_sub(cpu, a, b, result);
+            break;
+        }
+
+        case OP_CMPI: {
+            uint32_t a = cpu_get_reg(cpu, r1);
+            uint32_t result = a - imm;
+            flags_lazy_sub(cpu, a, imm, result);
+            break;
+        }
+
+        //------------- Control flow -------------
+        case OP_JMP:
+            pc = imm;
+            break;
+
+        case OP_JZ:
+        case OP_JNZ:
+            if (flag_zero(cpu) == (entry->handler == OP_JZ)) {
+                pc = imm;
+                if (entry->flags & DECODED_LOOP_END) {
+                    rc = STEP_LOOP;
+                }
+            }
+            break;
+
+        case OP_JC:
+            if (flag_carry(cpu)) pc = imm;
+            break;
+
+        case OP_JNC:
+            if (!flag_carry(cpu)) pc = imm;
+            break;
+
+        case OP_CALL:
+            cpu_push(cpu, pc);
+            pc = imm;
+            break;
+
+        case OP_RET:
+            pc = cpu_pop(cpu);
+            break;
+
+        //------------- I/O -------------
+        case OP_IN:
+            cpu_set_reg(cpu, r1, cpu_read_byte(cpu, imm));
+            break;
+
+        case OP_OUT:
+            cpu_write_byte(cpu, imm, cpu_get_reg(cpu, r1) & 0xFF);
+            break;
+
+        //------------- Interrupts -------------
+        case OP_EI:
+            cpu_set_interrupts(cpu, true);
+            break;
+
+        case OP_DI:
+            cpu_set_interrupts(cpu, false);
+            break;
+
+        case OP_IRET:
+            pc = cpu_irq_return(cpu);
+            break;
+
+        //------------- System -------------
+        case OP_HLT:
+            cpu->halted  = true;
+            cpu->running = false;
+            cpu_flush_output(cpu);
+            break;
+
+        default:
+            cpu_flush_output(cpu);
+            cpu_error(cpu, "Unknown opcode 0x%02X at PC=0x%04X", entry->handler, cpu->regs[REG_PC]);
+            cpu->halted = true;
+            return -1;
+    }
+
+    cpu->regs[REG_PC] = pc;
+    cpu->cycles++;
+
+    return rc;
+}
+
 //=========================================================
 // High-level execution
 //=========================================================
 
+// Step until HLT, an error or 'limit' cycles, without resetting the
+// run state
+static void step_until(CPU *cpu, uint64_t limit) {
+    if (cpu->dcache) {
+        // Pre-decoded path: each instruction is decoded once
+        while (cpu->running && !cpu->halted && cpu->cycles < limit) {
+            int rc = cpu_step_decoded(cpu);
+            if (rc < 0) {
+                break;
+            }
+            if (rc == STEP_LOOP) {
+                idle_skip(cpu, limit);
+            }
+        }
+        return;
+    }
+
+    while (cpu->running && !cpu->halted && cpu->cycles < limit) {
+        if (cpu_step(cpu) < 0) {
+            // Error (e.g., divide by zero, unknown opcode)
+            break;
+        }
+    }
+}
+
+void cpu_run_limit(CPU *cpu, uint64_t limit) {
+    cpu->running = true;
+    cpu->halted  = false;
+    step_until(cpu, limit);
+}
+
 // Run until a HLT instruction or an error occurs
 void cpu_run(CPU *cpu) {
+    cpu_run_limit(cpu, UINT64_MAX);
+}
+
+// The engine's entry point, stopping near 'limit'
+static void run_engine_limit(CPU *cpu, CpuEngine engine, uint64_t limit) {
+    switch (engine) {
+    case CPU_ENGINE_JIT:      cpu_run_jit_limit(cpu, limit);  break;
+    case CPU_ENGINE_THREADED: cpu_run_fast_limit(cpu, limit); break;
+    default:                  cpu_run_limit(cpu, limit);      break;
+    }
+}
+
+// Run with the engine's entry point; the caller attached its caches
+void cpu_run_engine(CPU *cpu, CpuEngine engine) {
+    run_engine_limit(cpu, engine, UINT64_MAX);
+}
+
+//=========================================================
+// Execution budgets
+//=========================================================
+
+// HLT clears running; a fault stops with it still set
+static CpuStop stop_reason(const CPU *cpu) {
+    if (!cpu->halted) {
+        return CPU_STOP_BUDGET;
+    }
+    return cpu->running ? CPU_STOP_FAULT : CPU_STOP_HALT;
+}
+
+// The cycle count after 'max_instructions' more (saturating)
+static uint64_t budget_end(const CPU *cpu, uint64_t max_instructions) {
+    uint64_t limit = cpu->cycles + max_instructions;
+    return limit < cpu->cycles ? UINT64_MAX : limit;
+}
+
+uint64_t cpu_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+CpuStop cpu_run_engine_for(CPU *cpu, CpuEngine engine, uint64_t max_instructions) {
+    uint64_t limit = budget_end(cpu, max_instructions);
     cpu->running = true;
     cpu->halted  = false;
-    
-    while (cpu->running && !cpu->halted) {
-        if (cpu_step(cpu) < 0) {
-            // Error (e.g., divide by zero, unknown opcode)
-            break;
+
+    // Each coarse engine stops early enough for the next, finer one
+    // to reach the limit without overshooting it: JIT, then
+    // threaded, then single steps
+    if (engine == CPU_ENGINE_JIT && limit - cpu->cycles > JIT_RUN_OVERSHOOT) {
+        cpu_run_jit_limit(cpu, limit - JIT_RUN_OVERSHOOT);
+    }
+    if ((engine == CPU_ENGINE_JIT || engine == CPU_ENGINE_THREADED) && !cpu->halted &&
+        limit - cpu->cycles > CPU_RUN_OVERSHOOT) {
+        cpu_run_fast_limit(cpu, limit - CPU_RUN_OVERSHOOT);
+    }
+    if (!cpu->halted) {
+        step_until(cpu, limit);
+    }
+    return stop_reason(cpu);
+}
+
+CpuStop cpu_run_for(CPU *cpu, uint64_t max_instructions) {
+    return cpu_run_engine_for(cpu, CPU_ENGINE_DECODED, max_instructions);
+}
+
+CpuStop cpu_run_engine_until(CPU *cpu, CpuEngine engine, uint64_t max_instructions,
+                             uint64_t deadline_ns) {
+    uint64_t limit = budget_end(cpu, max_instructions);
+    uint64_t overshoot = engine == CPU_ENGINE_JIT      ? JIT_RUN_OVERSHOOT
+                       : engine == CPU_ENGINE_THREADED ? CPU_RUN_OVERSHOOT : 0;
+    for (;;) {
+        if (limit - cpu->cycles <= CPU_CLOCK_SLICE + overshoot) {
+            // The instruction budget ends within this slice
+            return cpu_run_engine_for(cpu, engine, limit - cpu->cycles);
+        }
+        run_engine_limit(cpu, engine, cpu->cycles + CPU_CLOCK_SLICE);
+        if (cpu->halted) {
+            return stop_reason(cpu);
+        }
+        if (cpu_clock_ns() >= deadline_ns) {
+            return CPU_STOP_BUDGET;
         }
     }
 }
@@ -597,7 +1735,7 @@ void cpu_dump_registers(CPU *cpu) {
            cpu_get_flag(cpu, FLAG_CARRY)    ? 'C' : '-',
            cpu_get_flag(cpu, FLAG_NEGATIVE) ? 'N' : '-',
            cpu_get_flag(cpu, FLAG_OVERFLOW) ? 'O' : '-',
-           cpu->flags);
+           cpu_get_flags(cpu));
     printf("Cycles: %llu\n", (unsigned long long)cpu->cycles);
     printf("=====================\n\n");
 }
@@ -605,7 +1743,7 @@ void cpu_dump_registers(CPU *cpu) {
 // Dump a block of memory as hex
 void cpu_dump_memory(CPU *cpu, uint16_t start, uint16_t end) {
     printf("\n=== Memory Dump [0x%04X - 0x%04X] ===\n", start, end);
-    for (uint16_t addr = start; addr <= end; addr += 16) {
+    for (uint32_t addr = start; addr <= end; addr += 16) {
         printf("0x%04X: ", addr);
         for (int i = 0; i < 16 && addr + i <= end; i++) {
             printf("%02X ", cpu->memory[addr + i]);
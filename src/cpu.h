@@ -12,6 +12,10 @@
 // Total memory size: 64KB (0x0000–0xFFFF)
 #define MEMORY_SIZE 0x10000
 
+// Default load address and entry point: flat binaries always load
+// here, executables (exe.h) unless their header says otherwise
+#define PROGRAM_BASE 0x0100
+
 //=========================================================
 // Register indices
 //=========================================================
@@ -50,22 +54,155 @@
 #define FLAG_NEGATIVE 0x20  // Bit 5
 #define FLAG_OVERFLOW 0x10  // Bit 4
 
+// Kinds of pending lazy-flag record (CPU.lazy_op, see cpu_internal.h)
+#define FLAGS_LAZY_NONE   0   // flags is up to date
+#define FLAGS_LAZY_ADD    1   // lazy_res = lazy_a + lazy_b
+#define FLAGS_LAZY_SUB    2   // lazy_res = lazy_a - lazy_b
+#define FLAGS_LAZY_RESULT 3   // Z/N from lazy_res, C = lazy_a, O = 0
+
 //=========================================================
 // Memory-mapped I/O ports
 //=========================================================
 //
-// These addresses live in the top of the address space and are
-// interpreted specially by cpu_read_byte / cpu_write_byte.
+// The top page 0xFF00–0xFFFF is the I/O page. Each of its 256 ports
+// can have a device attached (cpu_register_device); accesses to
+// ports without a handler behave like RAM. cpu_init attaches these
+// built-in devices:
 //
 //  0xFF00: PORT_STDOUT      - write a character to host stdout
 //  0xFF01: PORT_STDIN       - read a character from host stdin
-//  0xFF02: PORT_TIMER_CTRL  - enable/disable timer (non-zero = on)
-//  0xFF03: PORT_TIMER_VALUE - current timer value (incremented each step)
+//  0xFF02: PORT_TIMER_CTRL     - enable/disable timer (non-zero = on)
+//  0xFF03: PORT_TIMER_VALUE    - timer value, low byte (counts instructions)
+//  0xFF04: PORT_TIMER_HIGH     - timer value, high byte
+//  0xFF05: PORT_TIMER_CMP      - compare value, low byte
+//  0xFF06: PORT_TIMER_CMP_HIGH - compare value, high byte
+//  0xFF07: PORT_TIMER_STATUS   - TIMER_STATUS_MATCH once the timer
+//                                reaches the compare value
+//  0xFF08: PORT_IRQ_PENDING    - interrupt lines raised and not yet taken
+//  0xFF09: PORT_IRQ_MASK       - interrupt lines allowed through
+//  0xFF0A: PORT_STDIN_STATUS   - STDIN_STATUS_* for asynchronous input
+//  0xFF10: PORT_DMA_SRC        - DMA source address (word), or fill byte
+//  0xFF12: PORT_DMA_DST        - DMA destination address (word)
+//  0xFF14: PORT_DMA_LEN        - DMA length in bytes (word)
+//  0xFF16: PORT_DMA_CTRL       - write DMA_CMD_*, read DMA_STATUS_*
+//  0xFF18: PORT_WRITE_ADDR     - address of a string to output (word)
+//  0xFF1A: PORT_WRITE_LEN      - its length; storing it outputs the string
+//  0xFF1C: PORT_PRINT_DEC      - storing a word outputs it in decimal
+//
+// The timer is a 16-bit count of instructions executed since it was
+// enabled. Reading the low byte latches the high byte, so a word
+// read at PORT_TIMER_VALUE sees one consistent value. Writing either
+// byte of the compare value arms it: when the running count next
+// reaches it, TIMER_STATUS_MATCH is set (once) before the
+// instruction that would read that count executes. Any write to
+// PORT_TIMER_STATUS clears it, and the match also raises IRQ_TIMER.
+//
+// PORT_STDIN waits for a byte as before. A guest that would rather
+// not block polls PORT_STDIN_STATUS or enables IRQ_STDIN; either
+// starts a host thread that reads stdin in the background
+// (host_input.h), and IRQ_STDIN is raised while PORT_STDIN_STATUS
+// reports a byte waiting (checked every STDIN_POLL_CYCLES
+// instructions) and once at end of input. A device mapped over both
+// console ports drives IRQ_STDIN through its status port the same way.
+//
+// The bulk output ports are word registers that act when their high
+// byte is written, i.e. on a STORE: PORT_WRITE_LEN outputs that many
+// bytes from PORT_WRITE_ADDR (stopping at the I/O page) as one chunk,
+// PORT_PRINT_DEC the unsigned decimal digits of the word. Both go to
+// the same sink as PORT_STDOUT.
+//
+#define PORT_STDOUT         0xFF00
+#define PORT_STDIN          0xFF01
+#define PORT_TIMER_CTRL     0xFF02
+#define PORT_TIMER_VALUE    0xFF03
+#define PORT_TIMER_HIGH     0xFF04
+#define PORT_TIMER_CMP      0xFF05
+#define PORT_TIMER_CMP_HIGH 0xFF06
+#define PORT_TIMER_STATUS   0xFF07
+#define PORT_IRQ_PENDING    0xFF08
+#define PORT_IRQ_MASK       0xFF09
+#define PORT_STDIN_STATUS   0xFF0A
+#define PORT_DMA_SRC        0xFF10
+#define PORT_DMA_DST        0xFF12
+#define PORT_DMA_LEN        0xFF14
+#define PORT_DMA_CTRL       0xFF16
+#define PORT_WRITE_ADDR     0xFF18
+#define PORT_WRITE_LEN      0xFF1A
+#define PORT_PRINT_DEC      0xFF1C
+
+#define TIMER_STATUS_MATCH 0x01
+
+#define STDIN_STATUS_READY 0x01   // PORT_STDIN has a byte without waiting
+#define STDIN_STATUS_EOF   0x02   // host input ended
+
+// Instructions between checks for host input while IRQ_STDIN is enabled
+#define STDIN_POLL_CYCLES (1u << 16)
+
+//=========================================================
+// DMA
+//=========================================================
+//
+// Moves or fills a block of RAM natively instead of through a guest
+// LOAD/STORE loop. Write the source, destination and length words,
+// then a command to PORT_DMA_CTRL:
+//
+//   DMA_CMD_COPY - copy LEN bytes from SRC to DST (overlap allowed)
+//   DMA_CMD_FILL - set LEN bytes at DST to the low byte of SRC
+//
+// The bytes move at once, but the transfer is charged
+// DMA_SETUP_CYCLES + ceil(LEN / dma_rate) instructions:
+// DMA_STATUS_BUSY stays set that long, and IRQ_DMA is raised when it
+// clears. Guests that wait for it therefore see the same timing on
+// every engine. A range that reaches the I/O page or wraps past
+// 0xFFFF is refused with DMA_STATUS_ERROR (and IRQ_DMA); a command
+// written while BUSY is ignored.
 //
-#define PORT_STDOUT      0xFF00
-#define PORT_STDIN       0xFF01
-#define PORT_TIMER_CTRL  0xFF02
-#define PORT_TIMER_VALUE 0xFF03
+#define DMA_CMD_COPY 0x01
+#define DMA_CMD_FILL 0x02
+
+#define DMA_STATUS_BUSY  0x01
+#define DMA_STATUS_ERROR 0x02
+
+// Cycles charged per transfer on top of its length
+#define DMA_SETUP_CYCLES 4
+
+// Bytes moved per cycle unless cpu_set_dma_rate says otherwise
+#define DMA_DEFAULT_RATE 8
+
+//=========================================================
+// Interrupts
+//=========================================================
+//
+// Devices raise one of CPU_IRQ_LINES lines (cpu_raise_irq); the line
+// stays pending until it is taken or cleared through
+// PORT_IRQ_PENDING (writing 1 bits clears those lines). A pending
+// line whose PORT_IRQ_MASK bit is set is taken before the next
+// instruction once interrupts are enabled (EI): the CPU pushes PC,
+// then FLAGS, disables interrupts, clears the line and jumps to the
+// handler address stored in the vector table, the word at
+// IRQ_VECTOR_BASE + 2 * line. The lowest line wins. IRET pops FLAGS
+// and PC and enables interrupts again. Taking an interrupt costs no
+// cycle, so it lands before the same instruction on every engine.
+//
+// cpu_init leaves interrupts disabled with every line masked.
+//
+#define CPU_IRQ_LINES   8
+#define IRQ_VECTOR_BASE 0x0000
+
+#define IRQ_TIMER 0              // timer compare matched
+#define IRQ_STDIN 1              // host input waiting (or ended)
+#define IRQ_DMA   2              // DMA transfer finished
+
+// I/O page bounds
+#define IO_PAGE_BASE     0xFF00
+#define IO_PAGE_PORTS    256
+
+// Longest instruction encoding in bytes (e.g. LOAD r, imm16)
+#define MAX_INSTR_LEN    4
+
+// Highest PC at which a whole instruction is guaranteed to lie below
+// the I/O page, so it can be fetched without the port checks.
+#define FETCH_FAST_LIMIT (PORT_STDOUT - MAX_INSTR_LEN)
 
 //=========================================================
 // Opcode definitions (ISA)
@@ -120,9 +257,89 @@
 #define OP_IN         0x50   // IN r, port
 #define OP_OUT        0x51   // OUT port, r
 
+// Interrupts
+#define OP_EI         0x60   // EI
+#define OP_DI         0x61   // DI
+#define OP_IRET       0x62   // IRET
+
 // System
 #define OP_HLT        0xFF   // HLT
 
+//=========================================================
+// Console output sink
+//=========================================================
+//
+// Bytes written to PORT_STDOUT go to the CPU's output sink. With a
+// buffer attached (cpu_set_output) they are collected and handed to
+// the sink when a newline is written, the buffer fills, the CPU halts
+// or faults, or the guest reads PORT_STDIN. Without a buffer (the
+// default after cpu_init) every byte is written and flushed at once.
+//
+typedef void (*CpuWriteFn)(void *ctx, const uint8_t *data, size_t len);
+
+//
+// Faults (unknown opcode, division by zero) and rejected calls (a
+// program that does not fit, a full event queue) are reported as one
+// line of text, without a newline, to the CPU's error handler. The
+// default after cpu_init prints it to stderr.
+//
+typedef void (*CpuErrorFn)(void *ctx, const char *message);
+
+typedef struct CPU CPU;
+
+//=========================================================
+// I/O devices
+//=========================================================
+//
+// A device is a pair of port handlers plus a context pointer. 'port'
+// is the full address (0xFFxx). A NULL handler leaves that direction
+// to RAM, e.g. a write-only device still reads back memory[].
+//
+typedef uint8_t (*CpuPortRead)(CPU *cpu, uint16_t port, void *ctx);
+typedef void    (*CpuPortWrite)(CPU *cpu, uint16_t port, uint8_t value, void *ctx);
+
+typedef struct {
+    CpuPortRead  read;
+    CpuPortWrite write;
+    void        *ctx;
+} CpuPort;
+
+//=========================================================
+// Scheduled events
+//=========================================================
+//
+// A device that must act at a given instruction count (a timer
+// compare, a transfer finishing) schedules an event instead of being
+// polled every instruction. The event runs just before the
+// instruction that starts with cycles == 'cycle' executes, on every
+// engine. Only the reference steppers and the threaded engine look
+// at the queue per instruction; the JIT runs no translated block
+// that could cross the next event.
+//
+typedef void (*CpuEventFn)(CPU *cpu, void *ctx);
+
+#define CPU_MAX_EVENTS 8
+
+typedef struct {
+    uint64_t   cycle;
+    CpuEventFn fn;
+    void      *ctx;
+} CpuEvent;
+
+typedef struct {
+    CpuWriteFn write;    // NULL = host stdout (fwrite + fflush)
+    void      *ctx;      // passed to write
+    uint8_t   *buf;      // caller-owned buffer; NULL = unbuffered
+    size_t     size;     // capacity of buf
+    size_t     len;      // bytes pending in buf
+} CpuOutput;
+
+// Pre-decoded instruction cache (see decode.h)
+struct DecodeCache;
+
+// Basic-block translator (see jit.h)
+struct Jit;
+
 //=========================================================
 // CPU State Structure
 //=========================================================
@@ -131,7 +348,7 @@
 // registers, flags, memory, execution status, and a very simple
 // timer. The emulator operates purely by mutating this struct.
 //
-typedef struct {
+struct CPU {
     // ---------------- Registers ----------------
     // A, B, C, D: general-purpose 16-bit registers
     // SP:  stack pointer (16-bit)
@@ -139,7 +356,14 @@ typedef struct {
     uint16_t regs[6];    // [A, B, C, D, SP, PC] in that order
 
     // Status flags (Z, C, N, O)
+    // ALU instructions do not update 'flags' directly: they record
+    // the operation below, and Z/N/C/O are computed only when read.
+    // Use cpu_get_flag / cpu_get_flags rather than 'flags' itself.
     uint8_t  flags;
+    uint8_t  lazy_op;        // FLAGS_LAZY_*
+    uint16_t lazy_res;       // result of the last flag-setting op
+    uint16_t lazy_a;         // its operands
+    uint16_t lazy_b;
 
     // ---------------- Memory ----------------
     // Flat 64KB byte-addressable memory.
@@ -153,22 +377,104 @@ typedef struct {
     uint64_t cycles;     // number of instructions executed
 
     // ---------------- Timer ----------------
-    // Simple software timer that increments each instruction
-    // while timer_enabled is true. Exposed via memory-mapped I/O.
-    uint16_t timer_value;
+    // Instruction counter exposed via memory-mapped I/O. Nothing
+    // updates it per instruction: while enabled its value is
+    // cycles - timer_start (truncated to 16 bits), while disabled it
+    // is frozen in timer_value. Use cpu_timer_value to read it.
     bool     timer_enabled;
+    uint16_t timer_value;
+    uint64_t timer_start;
+    uint8_t  timer_latch;        // high byte latched by a low-byte read
+    uint16_t timer_compare;
+    bool     timer_armed;        // compare pending
+    uint8_t  timer_status;       // TIMER_STATUS_*
+
+    // ---------------- Bulk output ----------------
+    uint16_t write_addr;         // PORT_WRITE_ADDR
+    uint16_t write_len;          // PORT_WRITE_LEN
+    uint16_t print_value;        // PORT_PRINT_DEC
+
+    // ---------------- DMA ----------------
+    uint16_t dma_src;
+    uint16_t dma_dst;
+    uint16_t dma_len;
+    uint8_t  dma_status;         // DMA_STATUS_*
+    uint16_t dma_rate;           // bytes per cycle; 0 = no charge
+
+    // ---------------- Interrupts ----------------
+    bool     irq_enabled;        // EI/DI
+    uint8_t  irq_pending;        // raised lines, one bit per line
+    uint8_t  irq_mask;           // lines PORT_IRQ_MASK lets through
+
+    // ---------------- Events ----------------
+    // Pending cpu_schedule events, earliest first, and the cycle at
+    // which the engines must call cpu_run_events: the first event's
+    // (UINT64_MAX when there are none), or 0 while an interrupt can
+    // be taken.
+    CpuEvent events[CPU_MAX_EVENTS];
+    uint8_t  event_count;
+    uint64_t event_cycle;
+
+    // ---------------- Snapshots ----------------
+    // RAM pages written since the CPU last took or was restored from
+    // a snapshot (see snapshot.h), and that snapshot's id (0 = none).
+    // Every engine marks its writes, translated JIT code included.
+    uint8_t  dirty_pages[MEMORY_SIZE >> 8];
+    uint64_t snapshot_id;
+
+    // ---------------- Devices ----------------
+    // Handlers for the I/O page, indexed by port - IO_PAGE_BASE.
+    CpuPort ports[IO_PAGE_PORTS];
+
+    // Where PORT_STDOUT bytes go (see cpu_set_output).
+    CpuOutput output;
+
+    // Where errors go (see cpu_set_error_handler); NULL = stderr.
+    CpuErrorFn error;
+    void      *error_ctx;
+
+    // ---------------- Acceleration ----------------
+    // Optional decoded-instruction cache. Not architectural state:
+    // it is owned by the caller, attached with cpu_attach_decode_cache
+    // and kept coherent on every RAM write.
+    struct DecodeCache *dcache;
+
+    // Optional JIT (cpu_attach_jit). Writes into pages holding
+    // translated code drop the affected blocks.
+    struct Jit *jit;
+
+};
 
-} CPU;
+//=========================================================
+// Execution engines
+//=========================================================
+//
+// All engines produce identical results; they differ only in how
+// instructions are dispatched, which makes them easy to A/B:
+//   CPU_ENGINE_SWITCH   - reference cpu_step loop (decodes every instruction)
+//   CPU_ENGINE_DECODED  - cpu_step_decoded loop over the decode cache
+//   CPU_ENGINE_THREADED - cpu_run_fast, computed-goto dispatch in one loop
+//   CPU_ENGINE_JIT      - cpu_run_jit, hot basic blocks translated to host code
+//
+typedef enum {
+    CPU_ENGINE_SWITCH,
+    CPU_ENGINE_DECODED,
+    CPU_ENGINE_THREADED,
+    CPU_ENGINE_JIT,
+} CpuEngine;
 
 //=========================================================
 // Public API: Core CPU functions
 //=========================================================
 
 // Initialize a CPU struct to a known reset state.
-// Sets registers, flags, memory, PC, SP, and timer.
+// Sets registers, flags, memory, PC, SP, and timer; no events.
 void cpu_init(CPU *cpu);
 
 // Reset CPU to initial state (wrapper around cpu_init).
+// An attached decode cache or JIT stays attached but is flushed.
+// The output sink and error handler are kept; pending output is
+// flushed first.
 void cpu_reset(CPU *cpu);
 
 // Load a program into memory starting at 'start_addr' and
@@ -176,13 +482,79 @@ void cpu_reset(CPU *cpu);
 int  cpu_load_program(CPU *cpu, const uint8_t *program,
                       size_t size, uint16_t start_addr);
 
+// Zero memory [start_addr, start_addr + size), e.g. a program's BSS.
+// Only pages holding non-zero bytes are written (and marked dirty),
+// so on a fresh CPU this costs no writes. Returns 0 on success, -1
+// if the range does not fit.
+int  cpu_clear_memory(CPU *cpu, uint16_t start_addr, size_t size);
+
 // Run the CPU until a HLT instruction or an error occurs.
+// Uses the decode cache when one is attached.
 void cpu_run(CPU *cpu);
 
+// Threaded-dispatch engine: run from the attached decode cache inside
+// one loop until HLT or an error. Results match cpu_run exactly.
+// Without a decode cache this is the same as cpu_run.
+void cpu_run_fast(CPU *cpu);
+
+// Run with the given engine until HLT or an error. The caller
+// attaches what the engine needs: a decode cache for DECODED and
+// THREADED, a JIT (and decode cache) for JIT. SWITCH and DECODED
+// both run cpu_run, which uses a decode cache when one is attached.
+void cpu_run_engine(CPU *cpu, CpuEngine engine);
+
+//=========================================================
+// Execution budgets
+//=========================================================
+//
+// cpu_run stops only at HLT or an error, so a guest that loops
+// forever never returns. The budgeted variants also stop once the
+// CPU has executed a given number of further instructions, or once
+// the wall clock passes a deadline, and say why they stopped.
+//
+// The engines do not compare against the budget per instruction:
+// the threaded engine checks it at control-flow instructions, the
+// JIT between blocks, and each may run somewhat past the point it
+// was given. cpu_run_engine_for therefore lets the engine run close
+// to the budget and steps the rest, so every engine stops after
+// exactly the same instruction. The clock is read once every
+// CPU_CLOCK_SLICE instructions, so a deadline may be overrun by
+// about that many.
+//
+typedef enum {
+    CPU_STOP_HALT,       // executed HLT
+    CPU_STOP_FAULT,      // unknown opcode or division by zero
+    CPU_STOP_BUDGET,     // instruction budget or deadline used up
+} CpuStop;
+
+// No instruction budget
+#define CPU_BUDGET_NONE UINT64_MAX
+
+// Instructions between clock reads in cpu_run_engine_until
+#define CPU_CLOCK_SLICE (1u << 20)
+
+// Like cpu_run / cpu_run_engine, but stop after at most
+// 'max_instructions' instructions (CPU_BUDGET_NONE = no limit).
+CpuStop cpu_run_for(CPU *cpu, uint64_t max_instructions);
+CpuStop cpu_run_engine_for(CPU *cpu, CpuEngine engine, uint64_t max_instructions);
+
+// Like cpu_run_engine_for, and also stop once cpu_clock_ns() reaches
+// 'deadline_ns'.
+CpuStop cpu_run_engine_until(CPU *cpu, CpuEngine engine, uint64_t max_instructions,
+                             uint64_t deadline_ns);
+
+// Monotonic host clock in nanoseconds, for deadlines
+uint64_t cpu_clock_ns(void);
+
 // Execute a single fetch–decode–execute step.
 // Return >0 on success, 0 if already halted, <0 on error.
 int  cpu_step(CPU *cpu);
 
+// Same contract and results as cpu_step, but executes from the
+// attached decode cache (see decode.h). Falls back to cpu_step for
+// instructions too close to the I/O page to be cached.
+int  cpu_step_decoded(CPU *cpu);
+
 //=========================================================
 // Memory operations
 //=========================================================
@@ -199,6 +571,66 @@ void     cpu_write_byte(CPU *cpu, uint16_t addr, uint8_t value);
 // Write a 16-bit little-endian word to memory.
 void     cpu_write_word(CPU *cpu, uint16_t addr, uint16_t value);
 
+//=========================================================
+// Devices and console output
+//=========================================================
+//
+// cpu_register_device:
+//   Attach 'read'/'write' (either may be NULL) with 'ctx' to the
+//   'count' ports starting at 'first'. Replaces whatever was mapped
+//   there, built-in devices included; NULL/NULL unmaps. Returns -1 if
+//   the range leaves the I/O page. cpu_reset keeps the mapping.
+//
+// cpu_set_output:
+//   Send PORT_STDOUT bytes to 'write' (NULL = host stdout), buffering
+//   up to 'size' bytes in the caller-owned 'buf' (NULL or 0 selects
+//   unbuffered output). Pending output is flushed first.
+//
+// cpu_flush_output:
+//   Hand any buffered bytes to the sink now.
+//
+// cpu_set_error_handler:
+//   Report errors to fn(ctx, message) instead (NULL restores stderr).
+//   cpu_reset keeps the handler.
+//
+// cpu_schedule:
+//   Run fn(cpu, ctx) once cycles reaches 'cycle' (before the next
+//   instruction if it already has). An event pending with the same
+//   fn and ctx is moved instead. Returns -1 if CPU_MAX_EVENTS are
+//   already pending.
+//
+// cpu_cancel:
+//   Drop the pending event with this fn and ctx, if any.
+//
+// cpu_run_events:
+//   Run every event that is due and take a pending interrupt, as
+//   each engine does before an instruction. Tools that look at the
+//   instruction about to run (trace, profile) call it first.
+//
+// cpu_raise_irq:
+//   Mark interrupt 'line' (0 to CPU_IRQ_LINES - 1) pending.
+//
+// cpu_timer_value:
+//   The current 16-bit timer count.
+//
+// cpu_set_dma_rate:
+//   Charge DMA transfers one cycle per 'bytes_per_cycle' bytes (plus
+//   DMA_SETUP_CYCLES); 0 makes them complete at once. cpu_reset
+//   keeps the setting.
+//
+int  cpu_register_device(CPU *cpu, uint16_t first, size_t count,
+                         CpuPortRead read, CpuPortWrite write, void *ctx);
+int  cpu_schedule(CPU *cpu, uint64_t cycle, CpuEventFn fn, void *ctx);
+void cpu_cancel(CPU *cpu, CpuEventFn fn, void *ctx);
+void cpu_run_events(CPU *cpu);
+void cpu_raise_irq(CPU *cpu, unsigned line);
+uint16_t cpu_timer_value(const CPU *cpu);
+void cpu_set_dma_rate(CPU *cpu, uint16_t bytes_per_cycle);
+void cpu_set_output(CPU *cpu, CpuWriteFn write, void *ctx,
+                    uint8_t *buf, size_t size);
+void cpu_flush_output(CPU *cpu);
+void cpu_set_error_handler(CPU *cpu, CpuErrorFn fn, void *ctx);
+
 //=========================================================
 // Register operations
 //=========================================================
@@ -220,11 +652,15 @@ void     cpu_set_reg(CPU *cpu, uint8_t reg, uint16_t value);
 // cpu_set_flag / cpu_get_flag:
 //   Manipulate individual bits in the FLAGS register.
 //
+// cpu_get_flags:
+//   Return the whole FLAGS register (evaluating pending lazy flags).
+//
 void cpu_set_flags_arithmetic(CPU *cpu, uint16_t result,
                               bool carry, bool overflow);
 
 void cpu_set_flag(CPU *cpu, uint8_t flag, bool value);
 bool cpu_get_flag(CPU *cpu, uint8_t flag);
+uint8_t cpu_get_flags(CPU *cpu);
 
 //=========================================================
 // Stack operations
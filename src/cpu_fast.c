@@ -0,0 +1,438 @@
+#include "cpu.h"
+#include "cpu_internal.h"
+#include "decode.h"
+#include "idle.h"
+#include <stdio.h>
+
+//=========================================================
+// Threaded-dispatch execution engine
+//=========================================================
+//
+// cpu_run_fast executes from the decode cache inside a single loop
+// until HLT or an error, instead of returning to cpu_run after every
+// instruction.
+//
+// With GCC/Clang each handler ends in its own indirect jump through a
+// label table ("computed goto"), so the branch predictor sees one
+// dispatch site per handler rather than the single shared branch of
+// a switch. Other compilers get the same handlers compiled as a plain
+// switch inside a loop.
+//
+// cpu_run_fast_limit also returns once cycles reaches a limit. It is
+// compared only when a control-flow instruction retires and on the
+// miss path, i.e. once per basic block, not per instruction.
+//
+// A taken JZ/JNZ the decoder flagged as closing an idle loop calls
+// idle_skip before going round again (see idle.h).
+//
+// Results must match cpu_step exactly: registers, flags, cycles and
+// the instruction before which each scheduled event runs and each
+// interrupt is taken (the one check made per instruction). In
+// particular regs[REG_PC] holds the address of the current
+// instruction while it executes (reading PC yields it, writes to PC
+// through a register operand are discarded), just as in cpu_step.
+//
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FAST_THREADED 1
+#else
+#define FAST_THREADED 0
+#endif
+
+// Miss path: decode the instruction at *pc, or single-step through
+// the reference interpreter while PC sits in the uncacheable window
+// near the I/O page. Returns NULL once the CPU halts or faults, or
+// cycles reach 'limit'.
+static const DecodedInsn *fast_miss(CPU *cpu, uint16_t *pc, uint64_t limit) {
+    for (;;) {
+        if (cpu->cycles >= limit) {
+            return NULL;
+        }
+        const DecodedInsn *in = decode_at(cpu, *pc);
+        if (in) {
+            return in;
+        }
+        if (cpu_step(cpu) <= 0 || cpu->halted) {
+            return NULL;
+        }
+        *pc = cpu->regs[REG_PC];
+    }
+}
+
+void cpu_run_fast(CPU *cpu) {
+    cpu_run_fast_limit(cpu, UINT64_MAX);
+}
+
+void cpu_run_fast_limit(CPU *cpu, uint64_t limit) {
+    DecodeCache *cache = cpu->dcache;
+    if (!cache) {
+        // Nothing to thread through: use the reference loop
+        cpu_run_limit(cpu, limit);
+        return;
+    }
+
+    cpu->running = true;
+    cpu->halted  = false;
+
+    uint16_t pc = cpu->regs[REG_PC];   // address of the current instruction
+    uint16_t next;                     // address of the following one
+    const DecodedInsn *in;
+
+// Run due events (taking an interrupt moves PC), then look up the
+// instruction at 'pc'
+#define FETCH()                                                     \
+    do {                                                            \
+        if (cpu->cycles >= cpu->event_cycle) {                      \
+            cpu_run_events(cpu);                                    \
+            pc = cpu->regs[REG_PC];                                 \
+        }                                                           \
+        in = &cache->insns[pc];                                     \
+        if (in->length == 0 && (in = fast_miss(cpu, &pc, limit)) == NULL) { \
+            goto done;                                              \
+        }                                                           \
+        next = pc + in->length;                                     \
+    } while (0)
+
+// Retire the current instruction
+#define COMMIT()                                                    \
+    do {                                                            \
+        pc = next;                                                  \
+        cpu->regs[REG_PC] = pc;                                     \
+        cpu->cycles++;                                              \
+    } while (0)
+
+// Retire a control-flow instruction, stopping at the limit
+#define NEXT_BLOCK()                                                \
+    if (cpu->cycles + 1 >= limit) {                                 \
+        COMMIT();                                                   \
+        goto done;                                                  \
+    }                                                               \
+    NEXT()
+
+// Retire a JZ/JNZ taken back to the head of a loop the decoder
+// flagged (DECODED_LOOP_END), then fast-forward over its idle
+// iterations before carrying on at the head
+#define LOOP_BRANCH()                                               \
+    if ((in->flags & DECODED_LOOP_END) && next == in->imm) {        \
+        COMMIT();                                                   \
+        idle_skip(cpu, limit);                                      \
+        if (cpu->cycles >= limit) {                                 \
+            goto done;                                              \
+        }                                                           \
+        FETCH();                                                    \
+        DISPATCH();                                                 \
+    }
+
+#if FAST_THREADED
+    // Every slot defaults to op_unknown; listed opcodes override it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+    static const void *dispatch[256] = {
+        [0 ... 255]   = &&op_unknown,
+        [OP_NOP]      = &&op_nop,
+        [OP_LOAD_IMM] = &&op_load_imm,
+        [OP_LOAD_MEM] = &&op_load_mem,
+        [OP_STORE]    = &&op_store,
+        [OP_MOV]      = &&op_mov,
+        [OP_PUSH]     = &&op_push,
+        [OP_POP]      = &&op_pop,
+        [OP_ADD]      = &&op_add,
+        [OP_ADDI]     = &&op_addi,
+        [OP_SUB]      = &&op_sub,
+        [OP_SUBI]     = &&op_subi,
+        [OP_MUL]      = &&op_mul,
+        [OP_DIV]      = &&op_div,
+        [OP_INC]      = &&op_inc,
+        [OP_DEC]      = &&op_dec,
+        [OP_AND]      = &&op_and,
+        [OP_OR]       = &&op_or,
+        [OP_XOR]      = &&op_xor,
+        [OP_NOT]      = &&op_not,
+        [OP_SHL]      = &&op_shl,
+        [OP_SHR]      = &&op_shr,
+        [OP_CMP]      = &&op_cmp,
+        [OP_CMPI]     = &&op_cmpi,
+        [OP_JMP]      = &&op_jmp,
+        [OP_JZ]       = &&op_jz,
+        [OP_JNZ]      = &&op_jnz,
+        [OP_JC]       = &&op_jc,
+        [OP_JNC]      = &&op_jnc,
+        [OP_CALL]     = &&op_call,
+        [OP_RET]      = &&op_ret,
+        [OP_IN]       = &&op_in,
+        [OP_OUT]      = &&op_out,
+        [OP_EI]       = &&op_ei,
+        [OP_DI]       = &&op_di,
+        [OP_IRET]     = &&op_iret,
+        [OP_HLT]      = &&op_hlt,
+    };
+#pragma GCC diagnostic pop
+#define HANDLER(label, op)  label:
+#define UNKNOWN_HANDLER     op_unknown:
+#define DISPATCH()          goto *dispatch[in->handler]
+#define NEXT()              do { COMMIT(); FETCH(); DISPATCH(); } while (0)
+
+    FETCH();
+    goto *dispatch[in->handler];
+#else
+#define HANDLER(label, op)  case op:
+#define UNKNOWN_HANDLER     default:
+#define DISPATCH()          continue
+#define NEXT()              break
+
+    FETCH();
+    for (;;) {
+    switch (in->handler) {
+#endif
+
+    HANDLER(op_nop, OP_NOP)
+        NEXT();
+
+    //------------- Data movement -------------
+    HANDLER(op_load_imm, OP_LOAD_IMM)
+        reg_write(cpu, in->r1, in->imm);
+        NEXT();
+
+    HANDLER(op_load_mem, OP_LOAD_MEM)
+        reg_write(cpu, in->r1, cpu_read_word(cpu, in->imm));
+        NEXT();
+
+    HANDLER(op_store, OP_STORE)
+        cpu_write_word(cpu, in->imm, reg_read(cpu, in->r1));
+        NEXT();
+
+    HANDLER(op_mov, OP_MOV)
+        reg_write(cpu, in->r1, reg_read(cpu, in->r2));
+        NEXT();
+
+    HANDLER(op_push, OP_PUSH)
+        cpu_push(cpu, reg_read(cpu, in->r1));
+        NEXT();
+
+    HANDLER(op_pop, OP_POP)
+        reg_write(cpu, in->r1, cpu_pop(cpu));
+        NEXT();
+
+    //------------- Arithmetic -------------
+    HANDLER(op_add, OP_ADD) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = reg_read(cpu, in->r2);
+        uint32_t result = a + b;
+        reg_write(cpu, in->r1, result & 0xFFFF);
+        flags_lazy_add(cpu, a, b, result);
+        NEXT();
+    }
+
+    HANDLER(op_addi, OP_ADDI) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = in->imm;
+        uint32_t result = a + b;
+        reg_write(cpu, in->r1, result & 0xFFFF);
+        flags_lazy_add(cpu, a, b, result);
+        NEXT();
+    }
+
+    HANDLER(op_sub, OP_SUB) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = reg_read(cpu, in->r2);
+        uint32_t result = a - b;
+        reg_write(cpu, in->r1, result & 0xFFFF);
+        flags_lazy_sub(cpu, a, b, result);
+        NEXT();
+    }
+
+    HANDLER(op_subi, OP_SUBI) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = in->imm;
+        uint32_t result = a - b;
+        reg_write(cpu, in->r1, result & 0xFFFF);
+        flags_lazy_sub(cpu, a, b, result);
+        NEXT();
+    }
+
+    HANDLER(op_mul, OP_MUL) {
+        uint32_t result = (uint32_t)reg_read(cpu, in->r1) * reg_read(cpu, in->r2);
+        reg_write(cpu, in->r1, result & 0xFFFF);
+        flags_lazy_result(cpu, result, result > 0xFFFF);
+        NEXT();
+    }
+
+    HANDLER(op_div, OP_DIV) {
+        uint16_t divisor = reg_read(cpu, in->r2);
+        if (divisor == 0) {
+            cpu_flush_output(cpu);
+            cpu_error(cpu, "Division by zero at PC=0x%04X", cpu->regs[REG_PC]);
+            cpu->halted = true;
+            goto done;
+        }
+        uint16_t dividend = reg_read(cpu, in->r1);
+        uint16_t quotient = dividend / divisor;
+        reg_write(cpu, in->r1, quotient);
+        reg_write(cpu, in->r2, dividend % divisor);
+        flags_lazy_result(cpu, quotient, false);
+        NEXT();
+    }
+
+    HANDLER(op_inc, OP_INC) {
+        uint16_t value = reg_read(cpu, in->r1) + 1;
+        reg_write(cpu, in->r1, value);
+        flags_lazy_result(cpu, value, false);
+        NEXT();
+    }
+
+    HANDLER(op_dec, OP_DEC) {
+        uint16_t value = reg_read(cpu, in->r1) - 1;
+        reg_write(cpu, in->r1, value);
+        flags_lazy_result(cpu, value, false);
+        NEXT();
+    }
+
+    //------------- Logic -------------
+    HANDLER(op_and, OP_AND) {
+        uint16_t result = reg_read(cpu, in->r1) & reg_read(cpu, in->r2);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, false);
+        NEXT();
+    }
+
+    HANDLER(op_or, OP_OR) {
+        uint16_t result = reg_read(cpu, in->r1) | reg_read(cpu, in->r2);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, false);
+        NEXT();
+    }
+
+    HANDLER(op_xor, OP_XOR) {
+        uint16_t result = reg_read(cpu, in->r1) ^ reg_read(cpu, in->r2);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, false);
+        NEXT();
+    }
+
+    HANDLER(op_not, OP_NOT) {
+        uint16_t result = ~reg_read(cpu, in->r1);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, false);
+        NEXT();
+    }
+
+    HANDLER(op_shl, OP_SHL) {
+        bool carry;
+        uint16_t result = shift_left(reg_read(cpu, in->r1), (uint8_t)in->imm, &carry);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, carry);
+        NEXT();
+    }
+
+    HANDLER(op_shr, OP_SHR) {
+        bool carry;
+        uint16_t result = shift_right(reg_read(cpu, in->r1), (uint8_t)in->imm, &carry);
+        reg_write(cpu, in->r1, result);
+        flags_lazy_result(cpu, result, carry);
+        NEXT();
+    }
+
+    //------------- Comparison -------------
+    HANDLER(op_cmp, OP_CMP) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = reg_read(cpu, in->r2);
+        uint32_t result = a - b;
+        flags_lazy_sub(cpu, a, b, result);
+        NEXT();
+    }
+
+    HANDLER(op_cmpi, OP_CMPI) {
+        uint32_t a = reg_read(cpu, in->r1);
+        uint32_t b = in->imm;
+        uint32_t result = a - b;
+        flags_lazy_sub(cpu, a, b, result);
+        NEXT();
+    }
+
+    //------------- Control flow -------------
+    HANDLER(op_jmp, OP_JMP)
+        next = in->imm;
+        NEXT_BLOCK();
+
+    HANDLER(op_jz, OP_JZ)
+        if (flag_zero(cpu)) next = in->imm;
+        LOOP_BRANCH();
+        NEXT_BLOCK();
+
+    HANDLER(op_jnz, OP_JNZ)
+        if (!flag_zero(cpu)) next = in->imm;
+        LOOP_BRANCH();
+        NEXT_BLOCK();
+
+    HANDLER(op_jc, OP_JC)
+        if (flag_carry(cpu)) next = in->imm;
+        NEXT_BLOCK();
+
+    HANDLER(op_jnc, OP_JNC)
+        if (!flag_carry(cpu)) next = in->imm;
+        NEXT_BLOCK();
+
+    HANDLER(op_call, OP_CALL)
+        cpu_push(cpu, next);
+        next = in->imm;
+        NEXT_BLOCK();
+
+    HANDLER(op_ret, OP_RET)
+        next = cpu_pop(cpu);
+        NEXT_BLOCK();
+
+    //------------- I/O -------------
+    HANDLER(op_in, OP_IN)
+        reg_write(cpu, in->r1, cpu_read_byte(cpu, in->imm));
+        NEXT();
+
+    HANDLER(op_out, OP_OUT)
+        cpu_write_byte(cpu, in->imm, reg_read(cpu, in->r1) & 0xFF);
+        NEXT();
+
+    //------------- Interrupts -------------
+    HANDLER(op_ei, OP_EI)
+        cpu_set_interrupts(cpu, true);
+        NEXT();
+
+    HANDLER(op_di, OP_DI)
+        cpu_set_interrupts(cpu, false);
+        NEXT();
+
+    HANDLER(op_iret, OP_IRET)
+        next = cpu_irq_return(cpu);
+        NEXT_BLOCK();
+
+    //------------- System -------------
+    HANDLER(op_hlt, OP_HLT)
+        cpu->halted  = true;
+        cpu->running = false;
+        COMMIT();
+        cpu_flush_output(cpu);
+        goto done;
+
+    UNKNOWN_HANDLER
+        cpu_flush_output(cpu);
+        cpu_error(cpu, "Unknown opcode 0x%02X at PC=0x%04X", in->handler, cpu->regs[REG_PC]);
+        cpu->halted = true;
+        goto done;
+
+#if !FAST_THREADED
+    }
+    COMMIT();
+    FETCH();
+    }
+#endif
+
+done:
+    return;
+
+#undef FETCH
+#undef COMMIT
+#undef HANDLER
+#undef UNKNOWN_HANDLER
+#undef NEXT
+#undef NEXT_BLOCK
+#undef LOOP_BRANCH
+#undef DISPATCH
+}
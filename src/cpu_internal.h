@@ -0,0 +1,199 @@
+#ifndef CPU_INTERNAL_H
+#define CPU_INTERNAL_H
+
+#include "cpu.h"
+
+//=========================================================
+// Internal helpers shared by the execution engines
+//=========================================================
+//
+// cpu.c keeps the public cpu_get_reg/cpu_set_reg/... entry points.
+// The engines (cpu.c, cpu_fast.c, jit.c) use these inline
+// equivalents so the hot loop does not pay a call per register
+// access. Semantics must stay identical to the cpu.c versions.
+// Not part of the public API.
+//
+
+// Keep a slow path out of its caller so the fast path stays a leaf
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_NOINLINE __attribute__((noinline))
+#else
+#define CPU_NOINLINE
+#endif
+
+// Check printf-style arguments where the compiler can
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_PRINTF(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define CPU_PRINTF(fmt, args)
+#endif
+
+// Format a message and hand it to the CPU's error handler
+void cpu_error(CPU *cpu, const char *fmt, ...) CPU_PRINTF(2, 3);
+
+// Read a register; invalid indices read as 0 (like cpu_get_reg)
+static inline uint16_t reg_read(const CPU *cpu, uint8_t reg) {
+    return reg < 6 ? cpu->regs[reg] : 0;
+}
+
+// Write a register; invalid indices are ignored (like cpu_set_reg)
+static inline void reg_write(CPU *cpu, uint8_t reg, uint16_t value) {
+    if (reg < 6) {
+        cpu->regs[reg] = value;
+    }
+}
+
+//=========================================================
+// Engine loops with an instruction limit
+//=========================================================
+//
+// Each runs like its public counterpart (cpu_run, cpu_run_fast,
+// cpu_run_jit) but also returns, with the CPU neither halted nor
+// faulted, once cycles reaches 'limit'. cpu_run_limit stops exactly
+// there; the others check only at block boundaries and may run up
+// to CPU_RUN_OVERSHOOT (threaded) or JIT_RUN_OVERSHOOT (jit.h)
+// instructions further. Straight-line code cannot run longer than
+// one pass over memory without reaching the I/O page window, where
+// the threaded engine checks again.
+//
+#define CPU_RUN_OVERSHOOT MEMORY_SIZE
+
+void cpu_run_limit(CPU *cpu, uint64_t limit);
+void cpu_run_fast_limit(CPU *cpu, uint64_t limit);
+void cpu_run_jit_limit(CPU *cpu, uint64_t limit);
+
+//=========================================================
+// Scheduled events
+//=========================================================
+//
+// Before executing an instruction, an engine that finds
+// cycles >= event_cycle calls cpu_run_events (cpu.h), which runs
+// every event due and takes a pending interrupt. Taking one moves
+// PC, so an engine holding PC in a local reloads it afterwards.
+//
+
+// EI / DI
+void cpu_set_interrupts(CPU *cpu, bool enabled);
+
+// IRET: restore FLAGS, enable interrupts and return the saved PC
+uint16_t cpu_irq_return(CPU *cpu);
+
+// True if reads of 'port' still reach the built-in timer or DMA
+// device, whose values change only at port writes and events
+bool cpu_builtin_port(const CPU *cpu, uint16_t port);
+
+// The built-in devices' events by number, for checkpoint files
+// (snapshot.h): cpu_event_id is -1 for any other event, cpu_event_fn
+// NULL for a number that names none. Their ctx is always NULL.
+int        cpu_event_id(CpuEventFn fn);
+CpuEventFn cpu_event_fn(unsigned id);
+
+// cpu_step_decoded's result after taking a branch the decoder flagged
+// as closing a possibly idle loop (DECODED_LOOP_END): the caller may
+// fast-forward with idle_skip
+#define STEP_LOOP 2
+
+//=========================================================
+// Shifts
+//=========================================================
+//
+// SHL/SHR take an 8-bit count. A count of 16 or more shifts every bit
+// out, and the carry is the last bit that fell off (none once the
+// count passes 16), so no count reaches an undefined C shift.
+//
+
+static inline uint16_t shift_left(uint16_t value, uint8_t shift, bool *carry) {
+    *carry = shift >= 1 && shift <= 16 && ((value >> (16 - shift)) & 1);
+    return shift < 16 ? (uint16_t)(value << shift) : 0;
+}
+
+static inline uint16_t shift_right(uint16_t value, uint8_t shift, bool *carry) {
+    *carry = shift >= 1 && shift <= 16 && ((value >> (shift - 1)) & 1);
+    return shift < 16 ? (uint16_t)(value >> shift) : 0;
+}
+
+//=========================================================
+// Lazy flags
+//=========================================================
+//
+// Flag-setting instructions record their operands and result
+// (flags_lazy_*) instead of computing Z/N/C/O. Most records are
+// replaced by the next ALU op before anything looks at them:
+// conditional jumps only need one bit (flag_zero / flag_carry), and
+// the whole register is evaluated only for cpu_get_flag(s), dumps and
+// state snapshots (flags_eval / flags_sync). Every derivation below
+// is bit-exact with cpu_set_flags_arithmetic.
+//
+
+// ADD/ADDI: res = a + b (truncated); carry iff the sum wrapped
+static inline void flags_lazy_add(CPU *cpu, uint16_t a, uint16_t b, uint16_t res) {
+    cpu->lazy_op  = FLAGS_LAZY_ADD;
+    cpu->lazy_a   = a;
+    cpu->lazy_b   = b;
+    cpu->lazy_res = res;
+}
+
+// SUB/SUBI/CMP/CMPI: res = a - b (truncated); carry = borrow
+static inline void flags_lazy_sub(CPU *cpu, uint16_t a, uint16_t b, uint16_t res) {
+    cpu->lazy_op  = FLAGS_LAZY_SUB;
+    cpu->lazy_a   = a;
+    cpu->lazy_b   = b;
+    cpu->lazy_res = res;
+}
+
+// Everything else: Z/N from the result, explicit carry, no overflow
+static inline void flags_lazy_result(CPU *cpu, uint16_t res, bool carry) {
+    cpu->lazy_op  = FLAGS_LAZY_RESULT;
+    cpu->lazy_a   = carry;
+    cpu->lazy_res = res;
+}
+
+// Z flag
+static inline bool flag_zero(const CPU *cpu) {
+    if (cpu->lazy_op == FLAGS_LAZY_NONE) {
+        return (cpu->flags & FLAG_ZERO) != 0;
+    }
+    return cpu->lazy_res == 0;
+}
+
+// C flag
+static inline bool flag_carry(const CPU *cpu) {
+    switch (cpu->lazy_op) {
+        case FLAGS_LAZY_NONE: return (cpu->flags & FLAG_CARRY) != 0;
+        case FLAGS_LAZY_ADD:  return cpu->lazy_res < cpu->lazy_a;
+        case FLAGS_LAZY_SUB:  return cpu->lazy_a < cpu->lazy_b;
+        default:              return cpu->lazy_a != 0;
+    }
+}
+
+// The FLAGS register value, without changing the CPU
+static inline uint8_t flags_eval(const CPU *cpu) {
+    if (cpu->lazy_op == FLAGS_LAZY_NONE) {
+        return cpu->flags;
+    }
+
+    uint16_t a = cpu->lazy_a, b = cpu->lazy_b, res = cpu->lazy_res;
+    bool overflow = false;
+    if (cpu->lazy_op == FLAGS_LAZY_ADD) {
+        overflow = ((a ^ res) & (b ^ res) & 0x8000) != 0;
+    } else if (cpu->lazy_op == FLAGS_LAZY_SUB) {
+        overflow = ((a ^ b) & (a ^ res) & 0x8000) != 0;
+    }
+
+    uint8_t f = cpu->flags & ~(FLAG_ZERO | FLAG_CARRY | FLAG_NEGATIVE | FLAG_OVERFLOW);
+    if (res == 0)         f |= FLAG_ZERO;
+    if (res & 0x8000)     f |= FLAG_NEGATIVE;
+    if (flag_carry(cpu))  f |= FLAG_CARRY;
+    if (overflow)         f |= FLAG_OVERFLOW;
+    return f;
+}
+
+// Fold a pending record into cpu->flags
+static inline void flags_sync(CPU *cpu) {
+    if (cpu->lazy_op != FLAGS_LAZY_NONE) {
+        cpu->flags   = flags_eval(cpu);
+        cpu->lazy_op = FLAGS_LAZY_NONE;
+    }
+}
+
+#endif // CPU_INTERNAL_H
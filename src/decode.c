@@ -0,0 +1,149 @@
+#include "decode.h"
+#include "idle.h"
+#include "isa.h"
+#include <stdlib.h>
+#include <string.h>
+
+//=========================================================
+// Cache lifecycle
+//=========================================================
+
+// Allocate an empty decode cache (all entries undecoded)
+DecodeCache *decode_cache_create(void) {
+    return calloc(1, sizeof(DecodeCache));
+}
+
+// Clear caller-owned storage into an empty cache
+void decode_cache_init(DecodeCache *cache) {
+    memset(cache, 0, sizeof(DecodeCache));
+}
+
+// Release a decode cache
+void decode_cache_destroy(DecodeCache *cache) {
+    free(cache);
+}
+
+// Drop every entry. Only pages marked live can hold entries, so a
+// cache that saw one small program is flushed in a few hundred bytes.
+void decode_cache_flush(DecodeCache *cache) {
+    for (size_t page = 0; page < sizeof(cache->live_pages); page++) {
+        if (cache->live_pages[page]) {
+            memset(&cache->insns[page << 8], 0, 256 * sizeof(DecodedInsn));
+            cache->live_pages[page] = 0;
+        }
+    }
+}
+
+// Attach (or detach with NULL) a decode cache to a CPU
+void cpu_attach_decode_cache(CPU *cpu, DecodeCache *cache) {
+    if (cache) {
+        decode_cache_flush(cache);
+    }
+    cpu->dcache = cache;
+}
+
+//=========================================================
+// Invalidation
+//=========================================================
+
+// Drop every decoded entry that overlaps [addr, addr + len).
+// An instruction starting up to MAX_INSTR_LEN - 1 bytes before 'addr'
+// may still cover it, so the scan starts that far back.
+void decode_invalidate(DecodeCache *cache, uint16_t addr, size_t len) {
+    size_t end   = (size_t)addr + len;
+    size_t start = addr >= MAX_INSTR_LEN - 1 ? addr - (MAX_INSTR_LEN - 1) : 0;
+    if (end > MEMORY_SIZE) end = MEMORY_SIZE;
+
+    for (size_t a = start; a < end; a++) {
+        DecodedInsn *in = &cache->insns[a];
+        if (in->length && a + in->length > addr) {
+            in->length = 0;
+        }
+    }
+}
+
+//=========================================================
+// Decoder
+//=========================================================
+
+// Decode the raw instruction at 'pc' into 'in'. The caller guarantees
+// the whole instruction lies below the I/O page, so memory[] is read
+// directly.
+void decode_insn(const uint8_t *mem, uint16_t pc, DecodedInsn *in) {
+    uint8_t opcode = mem[pc];
+
+    in->handler = opcode;
+    in->r1 = 0;
+    in->r2 = 0;
+    in->imm = 0;
+    in->flags = 0;
+
+    // Unknown opcodes (which fault on execution) are 1 byte
+    const IsaInsn *insn = isa_by_opcode(opcode);
+    in->length = insn ? insn->length : 1;
+    if (!insn) return;
+
+    switch ((IsaFormat)insn->format) {
+        case ISA_FMT_NONE:
+            break;
+
+        // single register byte
+        case ISA_FMT_REG:
+            in->r1 = mem[pc + 1];
+            break;
+
+        // r1:r2 packed into one byte (high nibble = r1)
+        case ISA_FMT_REG_REG:
+            in->r1 = (mem[pc + 1] >> 4) & 0x0F;
+            in->r2 = mem[pc + 1] & 0x0F;
+            break;
+
+        // reg, imm8
+        case ISA_FMT_REG_IMM8:
+            in->r1  = mem[pc + 1];
+            in->imm = mem[pc + 2];
+            break;
+
+        // addr16
+        case ISA_FMT_ADDR:
+            in->imm = mem[pc + 1] | (mem[pc + 2] << 8);
+            break;
+
+        // reg, imm16
+        case ISA_FMT_REG_IMM16:
+        case ISA_FMT_REG_MEM:
+        case ISA_FMT_REG_PORT:
+            in->r1  = mem[pc + 1];
+            in->imm = mem[pc + 2] | (mem[pc + 3] << 8);
+            break;
+
+        // imm16, reg
+        case ISA_FMT_MEM_REG:
+        case ISA_FMT_PORT_REG:
+            in->imm = mem[pc + 1] | (mem[pc + 2] << 8);
+            in->r1  = mem[pc + 3];
+            break;
+    }
+}
+
+// Look up (decoding on a miss) the instruction at 'pc'
+const DecodedInsn *decode_at(CPU *cpu, uint16_t pc) {
+    if (pc > FETCH_FAST_LIMIT) {
+        return NULL;
+    }
+
+    DecodeCache *cache = cpu->dcache;
+    DecodedInsn *in = &cache->insns[pc];
+    if (in->length == 0) {
+        decode_insn(cpu->memory, pc, in);
+        if ((in->handler == OP_JZ || in->handler == OP_JNZ) && in->imm < pc &&
+            idle_loop_closes(cpu->memory, in->imm, pc)) {
+            in->flags |= DECODED_LOOP_END;
+        }
+        // Mark the pages holding the first and last byte so writes
+        // there know to look for entries to invalidate
+        cache->live_pages[pc >> 8] = 1;
+        cache->live_pages[(pc + in->length - 1) >> 8] = 1;
+    }
+    return in;
+}
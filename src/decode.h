@@ -0,0 +1,93 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Decoded instruction
+//=========================================================
+//
+// One entry per PC. The raw bytes at that address are decoded
+// once into:
+//   - handler: selects the execution routine (the opcode byte)
+//   - r1, r2:  register operands (r1 is the destination). For
+//              single-register forms r1 holds the raw register byte.
+//   - length:  instruction length in bytes; 0 = not decoded yet
+//   - imm:     imm16 / address / port / shift amount
+//   - flags:   DECODED_* hints (set by decode_at only)
+//
+typedef struct {
+    uint8_t  handler;
+    uint8_t  r1;
+    uint8_t  r2;
+    uint8_t  length;
+    uint16_t imm;
+    uint16_t flags;      // also pads entries to 8 bytes for cheap indexing
+} DecodedInsn;
+
+// A JZ/JNZ that closes a loop idle_skip may fast-forward (idle.h).
+// Only a hint: idle_skip checks the code again when called.
+#define DECODED_LOOP_END 0x0001
+
+//=========================================================
+// Decode cache
+//=========================================================
+//
+// Indexed directly by PC. Instructions that reach into the I/O page
+// (PC > FETCH_FAST_LIMIT) are never cached; they always go through
+// the reference cpu_step so port reads keep their side effects.
+//
+// live_pages[] marks 256-byte pages that hold the first or last byte
+// of some decoded entry, so RAM writes to pages without code cost a
+// single byte test.
+//
+typedef struct DecodeCache {
+    DecodedInsn insns[MEMORY_SIZE];
+    uint8_t     live_pages[MEMORY_SIZE >> 8];
+} DecodeCache;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// decode_cache_create / decode_cache_destroy:
+//   Allocate an empty cache on the heap / release it.
+//
+// decode_cache_init:
+//   Make caller-owned storage (static, or part of a larger struct)
+//   an empty cache, for embedders that do not use the heap. Needed
+//   once; attaching flushes it after that.
+//
+// decode_cache_flush:
+//   Drop every entry (cost proportional to the pages that held code).
+//
+// cpu_attach_decode_cache:
+//   Make 'cache' the CPU's decode cache (NULL detaches). The cache
+//   is flushed, since it may hold entries for another memory image.
+//   Attach after cpu_init; cpu_reset keeps the attachment.
+//
+// decode_invalidate:
+//   Drop every entry overlapping [addr, addr + len). Called by
+//   cpu_write_byte and cpu_load_program.
+//
+// decode_at:
+//   Return the decoded instruction at 'pc', decoding it on a miss.
+//   Returns NULL when 'pc' is not cacheable.
+//
+// decode_insn:
+//   Decode the instruction at 'pc' into 'in' without touching any
+//   cache. 'pc' must be <= FETCH_FAST_LIMIT.
+//
+DecodeCache       *decode_cache_create(void);
+void               decode_cache_destroy(DecodeCache *cache);
+void               decode_cache_init(DecodeCache *cache);
+void               decode_cache_flush(DecodeCache *cache);
+void               cpu_attach_decode_cache(CPU *cpu, DecodeCache *cache);
+void               decode_invalidate(DecodeCache *cache, uint16_t addr, size_t len);
+const DecodedInsn *decode_at(CPU *cpu, uint16_t pc);
+void               decode_insn(const uint8_t *mem, uint16_t pc, DecodedInsn *in);
+
+#endif // DECODE_H
@@ -0,0 +1,168 @@
+#include "exe.h"
+#include <stdlib.h>
+#include <string.h>
+
+//=========================================================
+// Little-endian fields
+//=========================================================
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, v & 0xFFFF);
+    put16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+//=========================================================
+// Reading
+//=========================================================
+
+bool exe_detect(const uint8_t *data, size_t size) {
+    return size >= 4 && memcmp(data, EXE_MAGIC, 4) == 0;
+}
+
+static int malformed(ExeImage *exe, const char *why) {
+    exe->error = why;
+    return -1;
+}
+
+int exe_parse(const uint8_t *data, size_t size, ExeImage *exe) {
+    memset(exe, 0, sizeof(*exe));
+    if (size < EXE_HEADER_SIZE || !exe_detect(data, size)) {
+        return malformed(exe, "missing header");
+    }
+    if (get16(data + 4) != EXE_VERSION) {
+        return malformed(exe, "unsupported version");
+    }
+
+    unsigned sections = get16(data + 6);
+    exe->load_addr = get16(data + 8);
+    exe->entry     = get16(data + 10);
+    exe->code_size = get32(data + 12);
+    exe->bss_size  = get32(data + 16);
+    exe->code      = data + EXE_HEADER_SIZE;
+
+    if ((uint64_t)exe->load_addr + exe->code_size + exe->bss_size > MEMORY_SIZE) {
+        return malformed(exe, "program does not fit in memory");
+    }
+    if (exe->code_size > size - EXE_HEADER_SIZE) {
+        return malformed(exe, "truncated code");
+    }
+
+    size_t pos = EXE_HEADER_SIZE + exe->code_size;
+    for (unsigned i = 0; i < sections; i++) {
+        if (size - pos < 8) {
+            return malformed(exe, "truncated section header");
+        }
+        unsigned type = get16(data + pos);
+        uint32_t len  = get32(data + pos + 4);
+        pos += 8;
+        if (len > size - pos) {
+            return malformed(exe, "truncated section");
+        }
+        if (type == EXE_SECTION_SYMBOLS) {
+            exe->symbols = data + pos;
+            exe->symbols_size = len;
+        }
+        // other kinds are skipped
+        pos += len;
+    }
+    return 0;
+}
+
+int exe_load(CPU *cpu, const ExeImage *exe) {
+    if (cpu_load_program(cpu, exe->code, exe->code_size, exe->load_addr) < 0) {
+        return -1;
+    }
+    if (cpu_clear_memory(cpu, exe->load_addr + exe->code_size, exe->bss_size) < 0) {
+        return -1;
+    }
+    cpu->regs[REG_PC] = exe->entry;
+    return 0;
+}
+
+bool exe_next_symbol(const ExeImage *exe, size_t *pos, uint16_t *address,
+                     const char **name, size_t *name_len) {
+    if (!exe->symbols || *pos >= exe->symbols_size || exe->symbols_size - *pos < 4) {
+        return false;
+    }
+    const uint8_t *rec = exe->symbols + *pos;
+    size_t len = get16(rec + 2);
+    if (len > exe->symbols_size - *pos - 4) {
+        return false;                   // truncated record
+    }
+    *address  = get16(rec);
+    *name     = (const char *)rec + 4;
+    *name_len = len;
+    *pos += 4 + len;
+    return true;
+}
+
+//=========================================================
+// Writing
+//=========================================================
+
+static int buffer_reserve(ExeBuffer *buf, size_t more) {
+    if (buf->len + more <= buf->cap) return 0;
+    size_t cap = buf->cap ? buf->cap : 256;
+    while (cap < buf->len + more) cap *= 2;
+    uint8_t *grown = realloc(buf->data, cap);
+    if (!grown) return -1;
+    buf->data = grown;
+    buf->cap = cap;
+    return 0;
+}
+
+int exe_symbol_append(ExeBuffer *symbols, const char *name, uint16_t address) {
+    size_t len = strlen(name);
+    if (len > 0xFFFF) len = 0xFFFF;
+    if (buffer_reserve(symbols, 4 + len) < 0) return -1;
+
+    uint8_t *rec = symbols->data + symbols->len;
+    put16(rec, address);
+    put16(rec + 2, (uint16_t)len);
+    memcpy(rec + 4, name, len);
+    symbols->len += 4 + len;
+    return 0;
+}
+
+uint8_t *exe_build(const ExeImage *exe, size_t *len) {
+    unsigned sections = exe->symbols ? 1 : 0;
+    size_t total = EXE_HEADER_SIZE + exe->code_size;
+    if (exe->symbols) total += 8 + exe->symbols_size;
+
+    uint8_t *out = malloc(total);
+    if (!out) return NULL;
+
+    memcpy(out, EXE_MAGIC, 4);
+    put16(out + 4, EXE_VERSION);
+    put16(out + 6, (uint16_t)sections);
+    put16(out + 8, exe->load_addr);
+    put16(out + 10, exe->entry);
+    put32(out + 12, exe->code_size);
+    put32(out + 16, exe->bss_size);
+    if (exe->code_size) memcpy(out + EXE_HEADER_SIZE, exe->code, exe->code_size);
+
+    if (exe->symbols) {
+        uint8_t *sec = out + EXE_HEADER_SIZE + exe->code_size;
+        put16(sec, EXE_SECTION_SYMBOLS);
+        put16(sec + 2, 0);
+        put32(sec + 4, exe->symbols_size);
+        memcpy(sec + 8, exe->symbols, exe->symbols_size);
+    }
+
+    *len = total;
+    return out;
+}
@@ -0,0 +1,103 @@
+#ifndef EXE_H
+#define EXE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Executable format (.scx)
+//=========================================================
+//
+// A flat .bin is just code, loaded at PROGRAM_BASE and entered at its
+// first byte. An executable adds a header saying where to load it
+// and where to start, how many zero bytes follow the code (BSS,
+// zero-filled by the loader instead of stored), and optional
+// sections. All fields are little-endian:
+//
+//   0   "SCPU"              magic
+//   4   u16 version         EXE_VERSION
+//   6   u16 sections        number of sections after the code
+//   8   u16 load address
+//  10   u16 entry point
+//  12   u32 code size
+//  16   u32 BSS size
+//  20   code bytes
+//       sections: u16 type, u16 0, u32 size, then 'size' bytes
+//
+// Section types:
+//
+//   EXE_SECTION_SYMBOLS  the program's labels, sorted by address:
+//                        u16 address, u16 name length, name bytes
+//
+// Loaders skip sections they do not know, so new kinds can be added
+// without a version bump. "SCPU" cannot start a flat binary that
+// runs ('S' is not an opcode), so the two formats never clash.
+//
+
+#define EXE_MAGIC        "SCPU"
+#define EXE_VERSION      1
+#define EXE_HEADER_SIZE  20
+
+#define EXE_SECTION_SYMBOLS 1
+
+// A parsed executable; pointers refer into the parsed bytes
+typedef struct {
+    uint16_t       load_addr;
+    uint16_t       entry;
+    const uint8_t *code;
+    uint32_t       code_size;
+    uint32_t       bss_size;
+    const uint8_t *symbols;      // EXE_SECTION_SYMBOLS payload, NULL if none
+    uint32_t       symbols_size;
+    const char    *error;        // why exe_parse rejected it
+} ExeImage;
+
+// Growable byte buffer for building sections
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+    size_t   cap;
+} ExeBuffer;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// exe_detect:
+//   True if data[0, size) starts with the executable magic.
+//
+// exe_parse:
+//   Parse an executable into 'exe'. Returns 0 on success, -1 (with
+//   the reason in exe->error) if it is malformed or does not fit in
+//   memory.
+//
+// exe_load:
+//   Load a parsed executable into 'cpu': copy the code to its load
+//   address, zero the BSS after it and set PC to the entry point.
+//   Returns 0 on success, -1 on error.
+//
+// exe_next_symbol:
+//   Iterate over the symbol section: start with *pos = 0; each call
+//   returns true and fills in one symbol (name is not
+//   NUL-terminated), false at the end.
+//
+// exe_symbol_append:
+//   Append one symbol record to a symbol section being built.
+//   Returns 0 on success, -1 if memory runs out.
+//
+// exe_build:
+//   Serialize 'exe' (code, BSS size and, if present, symbols) into a
+//   malloc'd buffer. Returns it and its length in *len, or NULL if
+//   memory runs out.
+//
+bool     exe_detect(const uint8_t *data, size_t size);
+int      exe_parse(const uint8_t *data, size_t size, ExeImage *exe);
+int      exe_load(CPU *cpu, const ExeImage *exe);
+bool     exe_next_symbol(const ExeImage *exe, size_t *pos, uint16_t *address,
+                         const char **name, size_t *name_len);
+int      exe_symbol_append(ExeBuffer *symbols, const char *name, uint16_t address);
+uint8_t *exe_build(const ExeImage *exe, size_t *len);
+
+#endif // EXE_H
@@ -0,0 +1,99 @@
+#include "host_input.h"
+#include <pthread.h>
+#include <stdio.h>
+
+//=========================================================
+// Reader state
+//=========================================================
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  data;        // a byte arrived, or stdin ended
+    pthread_cond_t  space;       // a byte was taken
+    unsigned char   buf[HOST_INPUT_BUFFER];
+    size_t          head;        // next byte to take
+    size_t          len;         // bytes buffered
+    bool            eof;         // the reader saw end of input
+    bool            started;
+    bool            failed;      // the thread could not be created
+} input = {
+    .lock  = PTHREAD_MUTEX_INITIALIZER,
+    .data  = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+};
+
+// The thread: block in getchar (stdio keeps whatever the emulator
+// thread had already buffered) and hand each byte over
+static void *reader_main(void *arg) {
+    (void)arg;
+    for (;;) {
+        int ch = getchar();
+        pthread_mutex_lock(&input.lock);
+        if (ch == EOF) {
+            input.eof = true;
+            pthread_cond_broadcast(&input.data);
+            pthread_mutex_unlock(&input.lock);
+            return NULL;
+        }
+        while (input.len == HOST_INPUT_BUFFER) {
+            pthread_cond_wait(&input.space, &input.lock);
+        }
+        input.buf[(input.head + input.len++) % HOST_INPUT_BUFFER] = (unsigned char)ch;
+        pthread_cond_broadcast(&input.data);
+        pthread_mutex_unlock(&input.lock);
+    }
+}
+
+//=========================================================
+// Public API
+//=========================================================
+
+int host_input_start(void) {
+    pthread_mutex_lock(&input.lock);
+    int rc = 0;
+    if (input.failed) {
+        rc = -1;
+    } else if (!input.started) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, reader_main, NULL) != 0) {
+            input.failed = true;
+            rc = -1;
+        } else {
+            // Never joined: it may be blocked in getchar at exit
+            pthread_detach(thread);
+            input.started = true;
+        }
+    }
+    pthread_mutex_unlock(&input.lock);
+    return rc;
+}
+
+bool host_input_started(void) {
+    pthread_mutex_lock(&input.lock);
+    bool started = input.started;
+    pthread_mutex_unlock(&input.lock);
+    return started;
+}
+
+int host_input_poll(void) {
+    pthread_mutex_lock(&input.lock);
+    int state = input.len ? HOST_INPUT_READY : input.eof ? HOST_INPUT_EOF : 0;
+    pthread_mutex_unlock(&input.lock);
+    return state;
+}
+
+int host_input_getc(bool wait) {
+    pthread_mutex_lock(&input.lock);
+    while (wait && input.started && input.len == 0 && !input.eof) {
+        pthread_cond_wait(&input.data, &input.lock);
+    }
+    int ch = -1;
+    if (input.len) {
+        ch = input.buf[input.head];
+        input.head = (input.head + 1) % HOST_INPUT_BUFFER;
+        input.len--;
+        pthread_cond_signal(&input.space);
+    }
+    pthread_mutex_unlock(&input.lock);
+    return ch;
+}
@@ -0,0 +1,59 @@
+#ifndef HOST_INPUT_H
+#define HOST_INPUT_H
+
+#include <stdbool.h>
+
+//=========================================================
+// Background host input
+//=========================================================
+//
+// Reading PORT_STDIN used to call getchar() on the emulator thread,
+// which stalls the whole run until the user types. Once started, a
+// reader thread moves host stdin into a ring buffer instead, so the
+// console device can ask whether a byte is waiting without blocking
+// and raise IRQ_STDIN when one arrives. It is started on first use
+// by a guest that asks for input asynchronously (cpu.h: enabling
+// IRQ_STDIN in PORT_IRQ_MASK, or reading PORT_STDIN_STATUS); a
+// guest that only reads PORT_STDIN never starts it.
+//
+// Host stdin is one per process, so so is the reader: its state is
+// process-wide, every CPU polls the same one, and it is not one of
+// the caller-owned contexts of the library API. An embedder that
+// wants per-CPU input registers its own devices on the console
+// ports (cpu_register_device) and never starts this reader. Nothing
+// here prints; the console device reports a failed start through
+// the CPU's error handler.
+//
+
+// Bytes the reader buffers ahead of the guest
+#define HOST_INPUT_BUFFER 4096
+
+// host_input_poll results
+#define HOST_INPUT_READY 0x01    // a byte is waiting
+#define HOST_INPUT_EOF   0x02    // stdin ended and every byte was read
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// host_input_start:
+//   Start the reader thread if it is not running yet. Returns -1 if
+//   it cannot be started; it is not tried again, and later calls
+//   return -1 at once (input then stays unavailable).
+//
+// host_input_started:
+//   True once host_input_start has started the reader.
+//
+// host_input_poll:
+//   HOST_INPUT_* bits for the current state, without waiting.
+//
+// host_input_getc:
+//   Take the next byte: wait for one if 'wait', else return -1 when
+//   none is buffered. Returns -1 at end of input.
+//
+int  host_input_start(void);
+bool host_input_started(void);
+int  host_input_poll(void);
+int  host_input_getc(bool wait);
+
+#endif // HOST_INPUT_H
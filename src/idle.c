@@ -0,0 +1,285 @@
+#include "idle.h"
+#include "cpu_internal.h"
+#include "decode.h"
+
+//=========================================================
+// Loop analysis
+//=========================================================
+
+#define NO_REG 0xFF
+
+// What the analysis learned about a loop, from its code alone
+typedef struct {
+    uint8_t     length;          // instructions per iteration
+    uint8_t     reg;             // the one register written, or NO_REG
+    uint16_t    step;            // added to reg per iteration (no IN)
+    int         in_at;           // index of the IN into reg, -1 if none
+    uint16_t    in_port;
+    uint16_t    tail;            // added to reg from the IN to the end
+    DecodedInsn test;            // the last flag-setting instruction
+    uint16_t    test_offset;     // added to reg from the head (or the
+                                 // IN) up to the value the test sees
+    bool        exit_equal;      // JNZ: the loop ends once Z is set
+} IdleLoop;
+
+// Ports an idle loop may read: the built-in timer's and the DMA
+// status, which have no side effects beyond the timer latch
+static bool idle_port(uint16_t port) {
+    return port == PORT_TIMER_VALUE || port == PORT_TIMER_HIGH ||
+           port == PORT_TIMER_CTRL  || port == PORT_TIMER_STATUS ||
+           port == PORT_DMA_CTRL;
+}
+
+// Claim 'r' as the register the body writes; only one may be
+static bool write_reg(IdleLoop *loop, uint8_t r) {
+    if (r > REG_D || (loop->reg != NO_REG && loop->reg != r)) {
+        return false;
+    }
+    loop->reg = r;
+    return true;
+}
+
+static bool analyze(const uint8_t *mem, uint16_t head, uint16_t *branch, IdleLoop *loop) {
+    *loop = (IdleLoop){ .reg = NO_REG, .in_at = -1 };
+    uint16_t pc  = head;
+    uint16_t acc = 0;            // added to reg since the head or the IN
+    int      test_at = -1;
+
+    for (int k = 0; k < IDLE_MAX_INSNS; k++) {
+        if (pc > FETCH_FAST_LIMIT) {
+            return false;
+        }
+        DecodedInsn in;
+        decode_insn(mem, pc, &in);
+
+        switch (in.handler) {
+            case OP_NOP:
+                break;
+
+            case OP_INC: case OP_DEC: case OP_ADDI: case OP_SUBI:
+                if (!write_reg(loop, in.r1)) return false;
+                acc += in.handler == OP_INC  ? 1u
+                     : in.handler == OP_DEC  ? 0xFFFFu
+                     : in.handler == OP_ADDI ? in.imm : (uint16_t)-in.imm;
+                loop->test = in;
+                loop->test_offset = acc;
+                test_at = k;
+                break;
+
+            case OP_CMPI:
+                if (in.r1 > REG_SP) return false;
+                loop->test = in;
+                loop->test_offset = acc;
+                test_at = k;
+                break;
+
+            case OP_CMP:
+                if (in.r1 > REG_SP || in.r2 > REG_SP || in.r1 == in.r2) return false;
+                loop->test = in;
+                loop->test_offset = acc;
+                test_at = k;
+                break;
+
+            case OP_IN:
+                if (loop->in_at >= 0 || !idle_port(in.imm) || !write_reg(loop, in.r1)) {
+                    return false;
+                }
+                loop->in_at   = k;
+                loop->in_port = in.imm;
+                acc = 0;
+                break;
+
+            case OP_JZ: case OP_JNZ:
+                if (in.imm != head || test_at < 0) {
+                    return false;
+                }
+                loop->length     = (uint8_t)(k + 1);
+                loop->exit_equal = in.handler == OP_JNZ;
+                if (loop->in_at < 0) {
+                    loop->step = acc;
+                } else {
+                    loop->tail = acc;
+                    // The test must see this iteration's IN
+                    bool reads_reg = loop->test.r1 == loop->reg ||
+                                     (loop->test.handler == OP_CMP && loop->test.r2 == loop->reg);
+                    if (reads_reg && loop->in_at > test_at) {
+                        return false;
+                    }
+                }
+                *branch = pc;
+                return true;
+
+            default:
+                return false;
+        }
+        pc += in.length;
+    }
+    return false;
+}
+
+bool idle_loop_closes(const uint8_t *mem, uint16_t head, uint16_t branch) {
+    IdleLoop loop;
+    uint16_t end;
+    return analyze(mem, head, &end, &loop) && end == branch;
+}
+
+//=========================================================
+// Fast-forward
+//=========================================================
+
+// Smallest i >= 0 with u0 + i*e == t (mod 2^bits), or -1 if none
+static int64_t solve(uint32_t u0, uint32_t e, uint32_t t, unsigned bits) {
+    uint32_t mask = (1u << bits) - 1;
+    uint32_t diff = (t - u0) & mask;
+    e &= mask;
+    if (e == 0) {
+        return diff == 0 ? 0 : -1;
+    }
+
+    // gcd(e, 2^bits) is e's lowest set bit; divide it out and
+    // multiply by the inverse of the odd rest (Newton's iteration
+    // doubles the correct low bits each round)
+    uint32_t g = e & (0u - e);
+    if (diff % g != 0) {
+        return -1;
+    }
+    uint32_t odd = e / g, inv = odd;
+    for (int k = 0; k < 4; k++) {
+        inv *= 2 - odd * inv;
+    }
+    return ((diff / g) * inv) & (mask / g);
+}
+
+uint64_t idle_skip(CPU *cpu, uint64_t limit) {
+    uint16_t head = cpu->regs[REG_PC];
+    uint16_t branch;
+    IdleLoop loop;
+    if (head > FETCH_FAST_LIMIT || !analyze(cpu->memory, head, &branch, &loop)) {
+        return 0;
+    }
+    if (loop.in_at >= 0 && !cpu_builtin_port(cpu, loop.in_port)) {
+        return 0;                // another device was mapped there
+    }
+
+    // The register's source: u(i) = u0 + i*e (mod 2^bits) is its value
+    // at the head of iteration i, or what the IN reads in it
+    uint64_t c0 = cpu->cycles;
+    uint32_t u0, e = 0;
+    unsigned bits = 16;
+    bool     timer_running = false;
+    if (loop.in_at < 0) {
+        u0 = loop.reg != NO_REG ? cpu->regs[loop.reg] : 0;
+        e  = loop.step;
+    } else {
+        bits = 8;
+        if (loop.in_port == PORT_TIMER_VALUE) {
+            timer_running = cpu->timer_enabled;
+            u0 = timer_running ? (uint16_t)(c0 + loop.in_at - cpu->timer_start)
+                               : cpu->timer_value;
+            e  = timer_running ? loop.length : 0;
+        } else {
+            // Constant until the next event: reading it changes nothing
+            u0 = cpu_read_byte(cpu, loop.in_port);
+        }
+        u0 &= 0xFF;
+    }
+
+    // Z at the test is 'tested == target'. When the test reads the
+    // written register, tested = u(i) + test_offset; otherwise both
+    // sides are loop-invariant.
+    const DecodedInsn *test = &loop.test;
+    bool     moving = false;
+    uint16_t target = 0, fixed = 0;
+    switch (test->handler) {
+        case OP_CMPI:
+            moving = test->r1 == loop.reg;
+            fixed  = cpu->regs[test->r1];
+            target = test->imm;
+            break;
+        case OP_CMP:
+            moving = test->r1 == loop.reg || test->r2 == loop.reg;
+            if (test->r2 == loop.reg) {
+                fixed  = cpu->regs[test->r1];
+                target = fixed;
+            } else {
+                fixed  = cpu->regs[test->r1];
+                target = cpu->regs[test->r2];
+            }
+            break;
+        default:                 // INC/DEC/ADDI/SUBI: result == 0
+            moving = true;
+            break;
+    }
+
+    // First iteration whose test lets the branch fall through
+    int64_t leave;
+    uint32_t mask = (1u << bits) - 1;
+    if (moving) {
+        uint32_t t = (uint16_t)(target - loop.test_offset);
+        if (loop.exit_equal) {
+            leave = t <= mask ? solve(u0, e, t, bits) : -1;
+        } else {
+            leave = (u0 & mask) != t ? 0 : (e & mask) != 0 ? 1 : -1;
+        }
+    } else {
+        bool equal = fixed == target;
+        leave = equal == loop.exit_equal ? 0 : -1;
+    }
+
+    // Whole iterations to skip: up to the exiting one, but neither
+    // past the limit nor past the next event. A loop that never exits
+    // with neither ahead just spins: there is nothing to skip to.
+    uint64_t stop = limit < cpu->event_cycle ? limit : cpu->event_cycle;
+    if (leave < 0 && stop == UINT64_MAX) {
+        return 0;
+    }
+    uint64_t room = stop > c0 ? (stop - c0) / loop.length : 0;
+    uint64_t m = leave >= 0 && (uint64_t)leave < room ? (uint64_t)leave : room;
+    if (m < IDLE_MIN_SKIP) {
+        return 0;
+    }
+
+    // The state after iteration m - 1
+    uint64_t last = m - 1;
+    uint16_t src = (uint16_t)((u0 + last * e) & mask);
+    uint16_t tested = (uint16_t)(src + loop.test_offset);
+    if (loop.reg != NO_REG) {
+        cpu->regs[loop.reg] = loop.in_at < 0 ? (uint16_t)(u0 + m * e)
+                                             : (uint16_t)(src + loop.tail);
+    }
+    if (timer_running) {
+        uint16_t value = (uint16_t)(c0 + loop.in_at + last * loop.length - cpu->timer_start);
+        cpu->timer_latch = (uint8_t)(value >> 8);
+    } else if (loop.in_port == PORT_TIMER_VALUE) {
+        cpu->timer_latch = (uint8_t)(cpu->timer_value >> 8);
+    }
+
+    // Flags exactly as the test left them
+    switch (test->handler) {
+        case OP_INC:
+        case OP_DEC:
+            flags_lazy_result(cpu, tested, false);
+            break;
+        case OP_ADDI:
+            flags_lazy_add(cpu, (uint16_t)(tested - test->imm), test->imm, tested);
+            break;
+        case OP_SUBI:
+            flags_lazy_sub(cpu, (uint16_t)(tested + test->imm), test->imm, tested);
+            break;
+        case OP_CMPI: {
+            uint16_t a = moving ? tested : fixed;
+            flags_lazy_sub(cpu, a, test->imm, (uint16_t)(a - test->imm));
+            break;
+        }
+        default: {               // OP_CMP
+            uint16_t a = test->r1 == loop.reg ? tested : cpu->regs[test->r1];
+            uint16_t b = test->r2 == loop.reg ? tested : cpu->regs[test->r2];
+            flags_lazy_sub(cpu, a, b, (uint16_t)(a - b));
+            break;
+        }
+    }
+
+    uint64_t skipped = m * loop.length;
+    cpu->cycles += skipped;
+    return skipped;
+}
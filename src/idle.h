@@ -0,0 +1,66 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+
+//=========================================================
+// Idle-loop fast-forward
+//=========================================================
+//
+// Delay loops and busy-waits spend most of a run going round a few
+// instructions that change nothing but one register and the flags:
+//
+//   WAIT: DEC C              POLL: IN B, 0xFF03
+//         JNZ WAIT                 CMPI B, 200
+//                                  JNZ POLL
+//
+// Such a loop is a straight line of at most IDLE_MAX_INSNS
+// instructions from its head to a JZ/JNZ back to the head, made only
+// of NOP, INC/DEC/ADDI/SUBI on one register A-D, CMP/CMPI, and at
+// most one IN of a built-in timer or DMA status port into that
+// register. Nothing else is written, so the register the test looks
+// at is either its value at the head plus a constant per iteration,
+// the low byte of the running timer (which moves by the loop length
+// per iteration), or the same every time. The iteration at which
+// the test first lets the branch fall through is then a linear
+// congruence, and the state at its start follows in closed form: no
+// iteration has to run.
+//
+// idle_skip jumps straight there (or, for a loop that would spin
+// forever, as far as allowed), leaving registers, flags, cycles and
+// the timer latch exactly as single-stepping would. It never passes
+// the given instruction limit or the next scheduled event, since an
+// event may be what ends the wait. The decoder flags branches that
+// close such loops (DECODED_LOOP_END) so the decoded and threaded
+// engines and the JIT need only call idle_skip when one is taken;
+// the switch engine stays a plain reference and never skips.
+//
+
+// Longest loop considered, in instructions
+#define IDLE_MAX_INSNS 8
+
+// Fewest iterations worth analysing the loop for
+#define IDLE_MIN_SKIP 16
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// idle_loop_closes:
+//   True if the JZ/JNZ at 'branch' is the end of a loop of the form
+//   above starting at 'head' in 'mem'. Looks only at the code, so a
+//   true result only says idle_skip may be worth calling.
+//
+// idle_skip:
+//   With PC at the head of such a loop, advance the CPU over every
+//   whole iteration before the one that leaves the loop, stopping
+//   before 'limit' cycles or the next event. Returns the number of
+//   instructions skipped; 0 if PC is not at such a loop or fewer than
+//   IDLE_MIN_SKIP iterations could be skipped.
+//
+bool     idle_loop_closes(const uint8_t *mem, uint16_t head, uint16_t branch);
+uint64_t idle_skip(CPU *cpu, uint64_t limit);
+
+#endif // IDLE_H
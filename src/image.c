@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "image.h"
+#include "cpu_internal.h"
+#include "exe.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int image_map_fd(int fd, ProgramImage *image) {
+    memset(image, 0, sizeof(*image));
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;                       // nothing to map
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    image->map = map;
+    image->data = map;
+    image->size = (size_t)st.st_size;
+    return 0;
+}
+
+int image_map_file(const char *path, ProgramImage *image) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        memset(image, 0, sizeof(*image));
+        image->error = "Cannot open file";
+        return -1;
+    }
+    int rc = image_map_fd(fd, image);
+    close(fd);
+    if (rc < 0) {
+        image->error = "Cannot read file";
+    }
+    return rc;
+}
+
+int image_load(CPU *cpu, const ProgramImage *image, ImageLayout *layout) {
+    ImageLayout where = { PROGRAM_BASE, PROGRAM_BASE, image->size, 0 };
+
+    if (exe_detect(image->data, image->size)) {
+        ExeImage exe;
+        if (exe_parse(image->data, image->size, &exe) < 0) {
+            cpu_error(cpu, "Malformed executable: %s", exe.error);
+            return -1;
+        }
+        if (exe_load(cpu, &exe) < 0) {
+            return -1;
+        }
+        where = (ImageLayout){ exe.load_addr, exe.entry, exe.code_size, exe.bss_size };
+    } else if (cpu_load_program(cpu, image->data, image->size, PROGRAM_BASE) < 0) {
+        return -1;
+    }
+
+    if (layout) *layout = where;
+    return 0;
+}
+
+int image_load_file(CPU *cpu, const char *path, ImageLayout *layout) {
+    ProgramImage image;
+    if (image_map_file(path, &image) < 0) {
+        cpu_error(cpu, "%s: %s", image.error, path);
+        return -1;
+    }
+    int rc = image_load(cpu, &image, layout);
+    image_release(&image);
+    return rc;
+}
+
+void image_release(ProgramImage *image) {
+    if (image->map) {
+        munmap(image->map, image->size);
+    }
+    free(image->owned);
+    memset(image, 0, sizeof(*image));
+}
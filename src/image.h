@@ -0,0 +1,71 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Program images
+//=========================================================
+//
+// A read-only view of a program's bytes, as handed to
+// cpu_load_program. An image read from disk is mmap'd rather than
+// copied into a heap buffer, so the only copy made is the one into
+// the CPU's memory; an image built in memory (e.g. by the assembler,
+// asm_build_image) owns its malloc'd bytes. Either way image_release undoes it.
+//
+
+typedef struct {
+    const uint8_t *data;     // the program bytes (NULL when size is 0)
+    size_t         size;
+    void          *map;      // mmap'd file, NULL if none
+    uint8_t       *owned;    // malloc'd copy, NULL if none
+    const char    *error;    // why image_map_file failed, else NULL
+} ProgramImage;
+
+// Where image_load put a program
+typedef struct {
+    uint16_t load_addr;
+    uint16_t entry;
+    size_t   size;           // bytes copied to load_addr
+    size_t   bss_size;       // zero bytes after them
+} ImageLayout;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// image_map_file:
+//   Map the file at 'path'. Returns 0 on success, -1 (the reason in
+//   image->error, e.g. "Cannot open file") if it cannot be opened or
+//   read. Nothing is printed.
+//
+// image_map_fd:
+//   Map the open file 'fd' (which stays open and owned by the
+//   caller). Returns 0 on success, -1 on error without a message.
+//
+// image_load:
+//   Load an image into 'cpu': an executable (exe.h) where its header
+//   says, anything else as a flat binary at PROGRAM_BASE. PC is set
+//   to the entry point. If 'layout' is not NULL it receives where
+//   the program went. Returns 0 on success, -1 (reported to the
+//   CPU's error handler) if the image is malformed or does not fit
+//   in memory.
+//
+// image_load_file:
+//   Map the file at 'path', image_load it and unmap it again. A file
+//   that cannot be read is reported to the CPU's error handler too.
+//
+// image_release:
+//   Unmap or free the image and reset it to empty. Safe on an image
+//   that was never filled in, provided it was zeroed.
+//
+int  image_map_file(const char *path, ProgramImage *image);
+int  image_map_fd(int fd, ProgramImage *image);
+int  image_load(CPU *cpu, const ProgramImage *image, ImageLayout *layout);
+int  image_load_file(CPU *cpu, const char *path, ImageLayout *layout);
+void image_release(ProgramImage *image);
+
+#endif // IMAGE_H
@@ -0,0 +1,123 @@
+#include "isa.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+//=========================================================
+// Tables
+//=========================================================
+
+// Encoded length per format, as constants usable in initializers
+enum {
+#define ISA_FORMAT_LENGTH(name, length) ISA_LEN_##name = length,
+    ISA_FORMATS(ISA_FORMAT_LENGTH)
+#undef ISA_FORMAT_LENGTH
+};
+
+// Position of each instruction in isa_insns
+enum {
+#define ISA_INDEX(name, mnemonic, format) ISA_INDEX_##name,
+    ISA_INSNS(ISA_INDEX)
+#undef ISA_INDEX
+    ISA_INSN_COUNT
+};
+
+const IsaInsn isa_insns[] = {
+#define ISA_ENTRY(name, mnemonic, format) \
+    { mnemonic, OP_##name, ISA_FMT_##format, ISA_LEN_##format },
+    ISA_INSNS(ISA_ENTRY)
+#undef ISA_ENTRY
+};
+
+const size_t isa_insn_count = ISA_INSN_COUNT;
+
+const uint8_t isa_opcode_index[256] = {
+#define ISA_OPCODE_INDEX(name, mnemonic, format) \
+    [OP_##name] = ISA_INDEX_##name + 1,
+    ISA_INSNS(ISA_OPCODE_INDEX)
+#undef ISA_OPCODE_INDEX
+};
+
+// Every slot defaults to 1 byte; listed opcodes override it
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+const uint8_t isa_opcode_length[256] = {
+    [0 ... 255] = 1,
+#define ISA_OPCODE_LENGTH(name, mnemonic, format) \
+    [OP_##name] = ISA_LEN_##format,
+    ISA_INSNS(ISA_OPCODE_LENGTH)
+#undef ISA_OPCODE_LENGTH
+};
+#pragma GCC diagnostic pop
+
+//=========================================================
+// Mnemonic lookup
+//=========================================================
+//
+// A perfect hash over the distinct mnemonics: FNV-1a with a seed
+// folded in, masked to MNEMONIC_SLOTS. The first use searches for a
+// seed under which no two mnemonics share a slot (with ~30 names in
+// 256 slots a few tries suffice), so adding an instruction to
+// ISA_INSNS never needs a hand-tuned constant. A lookup is then one
+// hash, one slot read and one comparison.
+//
+
+#define MNEMONIC_SLOTS 256
+
+static uint32_t mnemonic_seed;
+static uint8_t  mnemonic_slots[MNEMONIC_SLOTS];      // isa_insns index + 1
+static pthread_once_t mnemonic_once = PTHREAD_ONCE_INIT;
+
+static unsigned mnemonic_hash(uint32_t seed, const char *name, size_t len) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return (h ^ (h >> 16)) & (MNEMONIC_SLOTS - 1);
+}
+
+// Try to place every mnemonic under 'seed'; false on a collision
+static bool mnemonic_place(uint32_t seed) {
+    memset(mnemonic_slots, 0, sizeof(mnemonic_slots));
+    for (size_t i = 0; i < ISA_INSN_COUNT; i++) {
+        const char *name = isa_insns[i].mnemonic;
+        unsigned slot = mnemonic_hash(seed, name, strlen(name));
+        uint8_t taken = mnemonic_slots[slot];
+        if (!taken) {
+            mnemonic_slots[slot] = (uint8_t)(i + 1);
+        } else if (strcmp(isa_insns[taken - 1].mnemonic, name) != 0) {
+            return false;
+        }
+        // else a later form of a mnemonic already placed
+    }
+    return true;
+}
+
+static void mnemonic_build(void) {
+    uint32_t seed = 0;
+    while (!mnemonic_place(seed)) seed++;
+    mnemonic_seed = seed;
+}
+
+const IsaInsn *isa_lookup(const char *name, size_t len) {
+    pthread_once(&mnemonic_once, mnemonic_build);
+
+    uint8_t index = mnemonic_slots[mnemonic_hash(mnemonic_seed, name, len)];
+    if (!index) return NULL;
+
+    const IsaInsn *insn = &isa_insns[index - 1];
+    if (strncmp(insn->mnemonic, name, len) != 0 || insn->mnemonic[len] != '\0') {
+        return NULL;
+    }
+    return insn;
+}
+
+const IsaInsn *isa_variant(const IsaInsn *insn, IsaFormat format) {
+    for (size_t i = 0; i < ISA_INSN_COUNT; i++) {
+        if (isa_insns[i].format == format &&
+            strcmp(isa_insns[i].mnemonic, insn->mnemonic) == 0) {
+            return &isa_insns[i];
+        }
+    }
+    return NULL;
+}
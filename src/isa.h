@@ -0,0 +1,128 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Instruction set table
+//=========================================================
+//
+// ISA_INSNS lists every instruction once: its OP_* opcode (cpu.h),
+// assembler mnemonic and operand format. The format fixes both the
+// operand syntax and the byte layout, and with it the length, so the
+// assembler (which encodes from this table) and the decoder (which
+// splits instructions with it) cannot disagree about a size.
+//
+// Several opcodes may share a mnemonic when their formats tell them
+// apart (LOAD r, imm / LOAD r, [addr]); the first listed is the one
+// a mnemonic lookup returns.
+//
+// Formats, with their encoded length (16-bit fields little-endian):
+//
+#define ISA_FORMATS(X)                                                \
+    X(NONE,      1)      /* OP                op                 */  \
+    X(REG,       2)      /* OP r              op, r              */  \
+    X(REG_REG,   2)      /* OP r1, r2         op, r1 << 4 | r2   */  \
+    X(REG_IMM8,  3)      /* OP r, imm8        op, r, imm8        */  \
+    X(ADDR,      3)      /* OP addr|label     op, addr           */  \
+    X(REG_IMM16, 4)      /* OP r, imm16       op, r, imm16       */  \
+    X(REG_MEM,   4)      /* OP r, [addr]      op, r, addr        */  \
+    X(REG_PORT,  4)      /* OP r, port        op, r, port        */  \
+    X(MEM_REG,   4)      /* OP [addr], r      op, addr, r        */  \
+    X(PORT_REG,  4)      /* OP port, r        op, port, r        */
+
+typedef enum {
+#define ISA_FORMAT_ENUM(name, length) ISA_FMT_##name,
+    ISA_FORMATS(ISA_FORMAT_ENUM)
+#undef ISA_FORMAT_ENUM
+} IsaFormat;
+
+#define ISA_INSNS(X)                    \
+    X(NOP,      "NOP",   NONE)          \
+    X(LOAD_IMM, "LOAD",  REG_IMM16)     \
+    X(LOAD_MEM, "LOAD",  REG_MEM)       \
+    X(STORE,    "STORE", MEM_REG)       \
+    X(MOV,      "MOV",   REG_REG)       \
+    X(PUSH,     "PUSH",  REG)           \
+    X(POP,      "POP",   REG)           \
+    X(ADD,      "ADD",   REG_REG)       \
+    X(ADDI,     "ADDI",  REG_IMM16)     \
+    X(SUB,      "SUB",   REG_REG)       \
+    X(SUBI,     "SUBI",  REG_IMM16)     \
+    X(MUL,      "MUL",   REG_REG)       \
+    X(DIV,      "DIV",   REG_REG)       \
+    X(INC,      "INC",   REG)           \
+    X(DEC,      "DEC",   REG)           \
+    X(AND,      "AND",   REG_REG)       \
+    X(OR,       "OR",    REG_REG)       \
+    X(XOR,      "XOR",   REG_REG)       \
+    X(NOT,      "NOT",   REG)           \
+    X(SHL,      "SHL",   REG_IMM8)      \
+    X(SHR,      "SHR",   REG_IMM8)      \
+    X(CMP,      "CMP",   REG_REG)       \
+    X(CMPI,     "CMPI",  REG_IMM16)     \
+    X(JMP,      "JMP",   ADDR)          \
+    X(JZ,       "JZ",    ADDR)          \
+    X(JNZ,      "JNZ",   ADDR)          \
+    X(JC,       "JC",    ADDR)          \
+    X(JNC,      "JNC",   ADDR)          \
+    X(CALL,     "CALL",  ADDR)          \
+    X(RET,      "RET",   NONE)          \
+    X(IN,       "IN",    REG_PORT)      \
+    X(OUT,      "OUT",   PORT_REG)      \
+    X(EI,       "EI",    NONE)          \
+    X(DI,       "DI",    NONE)          \
+    X(IRET,     "IRET",  NONE)          \
+    X(HLT,      "HLT",   NONE)
+
+typedef struct {
+    const char *mnemonic;
+    uint8_t     opcode;
+    uint8_t     format;          // IsaFormat
+    uint8_t     length;          // encoded bytes
+} IsaInsn;
+
+// The table, in ISA_INSNS order
+extern const IsaInsn isa_insns[];
+extern const size_t  isa_insn_count;
+
+// isa_insns index + 1 per opcode (0 = not an instruction)
+extern const uint8_t isa_opcode_index[256];
+
+// Encoded length per opcode; bytes that are not an instruction
+// decode as 1-byte instructions (which fault when executed)
+extern const uint8_t isa_opcode_length[256];
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// isa_by_opcode:
+//   Table entry for 'opcode', or NULL if it is not an instruction.
+//
+// isa_length:
+//   Encoded length of the instruction starting with 'opcode'.
+//
+// isa_lookup:
+//   Entry for the (uppercase) mnemonic of 'len' bytes at 'name', or
+//   NULL. Uses a perfect hash: one hash and one comparison per call.
+//
+// isa_variant:
+//   The entry sharing insn's mnemonic with operand format 'format',
+//   or NULL if there is none.
+//
+static inline const IsaInsn *isa_by_opcode(uint8_t opcode) {
+    uint8_t index = isa_opcode_index[opcode];
+    return index ? &isa_insns[index - 1] : NULL;
+}
+
+static inline uint8_t isa_length(uint8_t opcode) {
+    return isa_opcode_length[opcode];
+}
+
+const IsaInsn *isa_lookup(const char *name, size_t len);
+const IsaInsn *isa_variant(const IsaInsn *insn, IsaFormat format);
+
+#endif // ISA_H
@@ -0,0 +1,818 @@
+#define _DEFAULT_SOURCE   // MAP_ANONYMOUS
+#include "jit.h"
+#include "cpu_internal.h"
+#include "decode.h"
+#include "idle.h"
+#include <stdlib.h>
+#include <string.h>
+#if JIT_HOST_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+// Executable buffer size, and the space reserved for one block
+#define JIT_CODE_SIZE   (4u << 20)
+#define JIT_BLOCK_BYTES (16u << 10)
+
+// Highest address whose 16-bit access stays below the I/O page
+#define JIT_WORD_LIMIT  (PORT_STDOUT - 2)
+
+// Bytes before 'addr' where a block covering it may start
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_INSNS * MAX_INSTR_LEN)
+
+//=========================================================
+// JIT lifecycle
+//=========================================================
+
+// Allocate a JIT; the code buffer is mapped only on supported hosts
+Jit *jit_create(uint32_t threshold) {
+    Jit *jit = calloc(1, sizeof(Jit));
+    if (!jit) {
+        return NULL;
+    }
+    jit->threshold = threshold ? threshold : JIT_DEFAULT_THRESHOLD;
+
+#if JIT_HOST_SUPPORTED
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code != MAP_FAILED) {
+        jit->code      = code;
+        jit->code_size = JIT_CODE_SIZE;
+    }
+#endif
+    return jit;
+}
+
+// Release a JIT and its code buffer
+void jit_destroy(Jit *jit) {
+    if (!jit) {
+        return;
+    }
+#if JIT_HOST_SUPPORTED
+    if (jit->code) {
+        munmap(jit->code, jit->code_size);
+    }
+#endif
+    free(jit);
+}
+
+// Drop every translation and start counting from scratch. Only
+// pages marked used can hold counters or blocks.
+void jit_flush(Jit *jit) {
+    for (size_t page = 0; page < sizeof(jit->used_pages); page++) {
+        if (jit->used_pages[page]) {
+            memset(&jit->counters[page << 8], 0, 256 * sizeof(jit->counters[0]));
+            memset(&jit->blocks[page << 8], 0, 256 * sizeof(jit->blocks[0]));
+            jit->used_pages[page] = 0;
+        }
+    }
+    memset(jit->code_pages, 0, sizeof(jit->code_pages));
+    jit->code_used = 0;
+}
+
+// Attach (or detach with NULL) a JIT to a CPU
+void cpu_attach_jit(CPU *cpu, Jit *jit) {
+    if (jit) {
+        jit_flush(jit);
+    }
+    cpu->jit = jit;
+}
+
+//=========================================================
+// Invalidation
+//=========================================================
+
+// Drop every block whose guest bytes include 'addr'. The code space
+// is not reclaimed; it is recycled by the next full flush.
+void jit_invalidate(Jit *jit, uint16_t addr) {
+    size_t start = addr >= JIT_MAX_BLOCK_BYTES - 1 ? addr - (JIT_MAX_BLOCK_BYTES - 1) : 0;
+
+    for (size_t a = start; a <= addr; a++) {
+        JitBlock *block = &jit->blocks[a];
+        if (block->code && block->end > addr) {
+            block->code = NULL;
+            jit->counters[a] = 0;
+        }
+    }
+
+    // The instruction holding 'addr' may have become translatable
+    for (size_t a = addr >= MAX_INSTR_LEN - 1 ? addr - (MAX_INSTR_LEN - 1) : 0; a <= addr; a++) {
+        if (jit->counters[a] == JIT_NEVER) {
+            jit->counters[a] = 0;
+        }
+    }
+}
+
+#if JIT_HOST_SUPPORTED
+
+//=========================================================
+// Block analysis
+//=========================================================
+
+// Branches end a basic block (the branch belongs to the block)
+static bool ends_block(uint8_t opcode) {
+    return opcode >= OP_JMP && opcode <= OP_RET;
+}
+
+// Register operands the code generator keeps in host registers
+static bool reg_ok(uint8_t reg) {
+    return reg <= REG_SP;
+}
+
+// Can this instruction be translated? Everything else (I/O, EI/DI/
+// IRET, HLT, PC or invalid register operands, port addresses, odd
+// shift counts) ends the block and is left to the interpreter.
+static bool translatable(const DecodedInsn *in) {
+    switch (in->handler) {
+        case OP_NOP:
+        case OP_JMP: case OP_JZ: case OP_JNZ: case OP_JC: case OP_JNC:
+        case OP_CALL: case OP_RET:
+            return true;
+
+        case OP_LOAD_IMM: case OP_PUSH: case OP_POP:
+        case OP_ADDI: case OP_SUBI: case OP_CMPI:
+        case OP_INC: case OP_DEC: case OP_NOT:
+            return reg_ok(in->r1);
+
+        case OP_LOAD_MEM:
+        case OP_STORE:
+            return reg_ok(in->r1) && in->imm <= JIT_WORD_LIMIT;
+
+        case OP_MOV: case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_CMP:
+            return reg_ok(in->r1) && reg_ok(in->r2);
+
+        case OP_SHL:
+        case OP_SHR:
+            return reg_ok(in->r1) && in->imm >= 1 && in->imm <= 15;
+
+        default:
+            return false;
+    }
+}
+
+// Instructions that overwrite Z/N/C/O
+static bool sets_flags(uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_SUBI:
+        case OP_MUL: case OP_DIV: case OP_INC: case OP_DEC:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOT:
+        case OP_SHL: case OP_SHR: case OP_CMP: case OP_CMPI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions that may leave the block before executing
+static bool may_side_exit(uint8_t opcode) {
+    switch (opcode) {
+        case OP_STORE: case OP_PUSH: case OP_POP:
+        case OP_CALL: case OP_RET: case OP_DIV:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//=========================================================
+// x86-64 code generator
+//=========================================================
+//
+// Translated blocks are called as int block(CPU *cpu) (SysV ABI)
+// and make no calls themselves. Register assignment:
+//
+//   rdi        CPU pointer (whole block)
+//   r12w-r15w  A, B, C, D      (zero-extended to 32 bits)
+//   bx         SP
+//   bpl        FLAGS (materialized only where someone can see it)
+//   esi        guest instructions retired so far in this call
+//   r11        &jit->code_pages[0]
+//   rax, rcx, rdx, r8, r9  scratch
+//
+// Every exit jumps to a common epilogue with the next PC in ax and
+// the return code in ecx; it writes the guest registers back, adds
+// esi to cycles and returns.
+//
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Host register holding each guest register A, B, C, D, SP
+static const uint8_t host_reg[5] = { R12, R13, R14, R15, RBX };
+
+// x86 condition codes (low nibble of Jcc / SETcc)
+#define CC_O  0x0
+#define CC_B  0x2
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_A  0x7
+#define CC_S  0x8
+
+#define MAX_FIXUPS (JIT_MAX_BLOCK_INSNS * 4 + 8)
+
+typedef struct {
+    uint8_t *buf;
+    size_t   len;
+
+    // rel32 fields to patch once the common epilogue is placed
+    size_t   common_fix[JIT_MAX_BLOCK_INSNS + 4];
+    int      n_common;
+
+    // rel32 fields jumping to the side exit of instruction side_k[i]
+    size_t   side_fix[MAX_FIXUPS];
+    int      side_k[MAX_FIXUPS];
+    int      n_side;
+} Emit;
+
+static void emit8(Emit *e, uint8_t b) {
+    e->buf[e->len++] = b;
+}
+
+static void emit16(Emit *e, uint16_t v) {
+    emit8(e, v & 0xFF);
+    emit8(e, v >> 8);
+}
+
+static void emit32(Emit *e, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        emit8(e, (v >> (8 * i)) & 0xFF);
+    }
+}
+
+// Operand-size prefix and REX for an instruction using 'reg' in
+// ModRM.reg, 'rm' in ModRM.rm and 'index' in SIB.index. Byte
+// operations on registers 4-7 need an empty REX to mean spl..dil.
+static void emit_prefix(Emit *e, int size, int reg, int rm, int index) {
+    if (size == 16) {
+        emit8(e, 0x66);
+    }
+    uint8_t rex = 0x40;
+    if (size == 64)  rex |= 0x08;
+    if (reg & 8)     rex |= 0x04;
+    if (index & 8)   rex |= 0x02;
+    if (rm & 8)      rex |= 0x01;
+    if (rex != 0x40 || (size == 8 && (reg >= 4 || rm >= 4))) {
+        emit8(e, rex);
+    }
+}
+
+// One- or two-byte (0F xx) opcode
+static void emit_op(Emit *e, unsigned op) {
+    if (op > 0xFF) {
+        emit8(e, op >> 8);
+    }
+    emit8(e, op & 0xFF);
+}
+
+// op reg, rm (both registers)
+static void x86_rr(Emit *e, int size, unsigned op, int reg, int rm) {
+    emit_prefix(e, size, reg, rm, 0);
+    emit_op(e, op);
+    emit8(e, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [rdi + disp32] (a CPU struct field)
+static void x86_cpu(Emit *e, int size, unsigned op, int reg, size_t disp) {
+    emit_prefix(e, size, reg, RDI, 0);
+    emit_op(e, op);
+    emit8(e, 0x80 | (reg & 7) << 3 | (RDI & 7));
+    emit32(e, (uint32_t)disp);
+}
+
+// op reg, [rdi + rax + disp32] (guest memory at a dynamic address)
+static void x86_mem(Emit *e, int size, unsigned op, int reg) {
+    emit_prefix(e, size, reg, RDI, RAX);
+    emit_op(e, op);
+    emit8(e, 0x84 | (reg & 7) << 3);
+    emit8(e, (RAX << 3) | (RDI & 7));
+    emit32(e, (uint32_t)offsetof(CPU, memory));
+}
+
+// mov r32, imm32
+static void x86_mov_imm(Emit *e, int reg, uint32_t imm) {
+    if (reg & 8) {
+        emit8(e, 0x41);
+    }
+    emit8(e, 0xB8 + (reg & 7));
+    emit32(e, imm);
+}
+
+// setcc r8
+static void x86_setcc(Emit *e, int cc, int reg) {
+    x86_rr(e, 8, 0x0F90 | cc, 0, reg);
+}
+
+// jcc rel32 / jmp rel32; return the offset of the rel32 field
+static size_t x86_jcc(Emit *e, int cc) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | cc);
+    size_t at = e->len;
+    emit32(e, 0);
+    return at;
+}
+
+static size_t x86_jmp(Emit *e) {
+    emit8(e, 0xE9);
+    size_t at = e->len;
+    emit32(e, 0);
+    return at;
+}
+
+// Point the rel32 field at 'at' to 'target'
+static void patch(Emit *e, size_t at, size_t target) {
+    uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(at + 4));
+    memcpy(&e->buf[at], &rel, 4);
+}
+
+// Conditional jump to the side exit of instruction k
+static void jcc_side(Emit *e, int cc, int k) {
+    e->side_fix[e->n_side] = x86_jcc(e, cc);
+    e->side_k[e->n_side++] = k;
+}
+
+// Leave the block: 'count' more instructions retired, next PC
+// (ax already holds it when pc < 0), return code 'code'
+static void emit_exit(Emit *e, uint32_t count, int32_t pc, int code) {
+    if (count) {
+        x86_rr(e, 32, 0x81, 0, RSI);            // add esi, count
+        emit32(e, count);
+    }
+    if (pc >= 0) {
+        x86_mov_imm(e, RAX, (uint32_t)pc);
+    }
+    x86_mov_imm(e, RCX, (uint32_t)code);
+    e->common_fix[e->n_common++] = x86_jmp(e);
+}
+
+// Fold host flags captured by setcc into bpl: Z in dl, N in r8b and,
+// when present, C in cl and O in r9b. Reserved low bits are kept.
+static void emit_flags_commit(Emit *e, bool carry, bool overflow) {
+    x86_rr(e, 32, 0x0FB6, RDX, RDX);            // movzx edx, dl
+    x86_rr(e, 32, 0xC1, 4, RDX); emit8(e, 7);   // shl edx, 7
+    x86_rr(e, 32, 0x0FB6, R8, R8);
+    x86_rr(e, 32, 0xC1, 4, R8); emit8(e, 5);
+    x86_rr(e, 32, 0x09, R8, RDX);               // or edx, r8d
+    if (carry) {
+        x86_rr(e, 32, 0x0FB6, RCX, RCX);
+        x86_rr(e, 32, 0xC1, 4, RCX); emit8(e, 6);
+        x86_rr(e, 32, 0x09, RCX, RDX);
+    }
+    if (overflow) {
+        x86_rr(e, 32, 0x0FB6, R9, R9);
+        x86_rr(e, 32, 0xC1, 4, R9); emit8(e, 4);
+        x86_rr(e, 32, 0x09, R9, RDX);
+    }
+    x86_rr(e, 32, 0x83, 4, RBP); emit8(e, 0x0F);    // and ebp, 0x0F
+    x86_rr(e, 32, 0x09, RDX, RBP);                  // or ebp, edx
+}
+
+// Capture Z/N (and optionally C/O) right after a host ALU op
+static void emit_flags(Emit *e, bool live, bool carry, bool overflow) {
+    if (!live) {
+        return;
+    }
+    x86_setcc(e, CC_E, RDX);
+    x86_setcc(e, CC_S, R8);
+    if (carry)    x86_setcc(e, CC_B, RCX);
+    if (overflow) x86_setcc(e, CC_O, R9);
+    emit_flags_commit(e, carry, overflow);
+}
+
+// mov byte [rdi + dirty_pages + rcx], 1 (mark the page in ecx written)
+static void emit_mark_dirty(Emit *e) {
+    emit8(e, 0xC6); emit8(e, 0x84); emit8(e, (RCX << 3) | RDI);
+    emit32(e, (uint32_t)offsetof(CPU, dirty_pages));
+    emit8(e, 0x01);
+}
+
+// Side-exit unless both bytes of the word at eax lie outside code
+// pages, and mark their pages dirty
+static void emit_code_page_check(Emit *e, int k) {
+    for (int b = 0; b < 2; b++) {
+        if (b == 0) {
+            x86_rr(e, 32, 0x89, RAX, RCX);          // mov ecx, eax
+        } else {
+            emit8(e, 0x8D); emit8(e, 0x48); emit8(e, 0x01);   // lea ecx, [rax+1]
+        }
+        x86_rr(e, 32, 0xC1, 5, RCX); emit8(e, 8);   // shr ecx, 8
+        emit8(e, 0x41); emit8(e, 0x80); emit8(e, 0x3C); emit8(e, 0x0B);
+        emit8(e, 0x00);                             // cmp byte [r11+rcx], 0
+        jcc_side(e, CC_NE, k);
+        emit_mark_dirty(e);
+    }
+}
+
+// Compute SP - 2 into eax and side-exit if the pushed word would hit
+// the I/O page or translated code
+static void emit_push_addr(Emit *e, int k) {
+    x86_rr(e, 32, 0x89, RBX, RAX);                  // mov eax, ebx
+    x86_rr(e, 32, 0x83, 5, RAX); emit8(e, 2);       // sub eax, 2
+    x86_rr(e, 32, 0x0FB7, RAX, RAX);                // movzx eax, ax
+    emit8(e, 0x3D); emit32(e, JIT_WORD_LIMIT);      // cmp eax, limit
+    jcc_side(e, CC_A, k);
+    emit_code_page_check(e, k);
+}
+
+// Load the word at SP into r9d and pop it, side-exiting if it
+// would touch the I/O page
+static void emit_pop(Emit *e, int k) {
+    x86_rr(e, 32, 0x81, 7, RBX); emit32(e, JIT_WORD_LIMIT);  // cmp ebx, limit
+    jcc_side(e, CC_A, k);
+    x86_rr(e, 32, 0x89, RBX, RAX);                  // mov eax, ebx
+    x86_mem(e, 32, 0x0FB7, R9);                     // movzx r9d, word [mem+rax]
+    x86_rr(e, 32, 0x83, 0, RBX); emit8(e, 2);       // add ebx, 2
+}
+
+// Block-ending branch to a constant target. A branch back to the
+// block start loops in place until JIT_LOOP_LIMIT instructions.
+static void emit_branch(Emit *e, size_t body, uint16_t start, uint32_t n, uint16_t target) {
+    if (target == start) {
+        x86_rr(e, 32, 0x81, 0, RSI); emit32(e, n);  // add esi, n
+        x86_rr(e, 32, 0x81, 7, RSI); emit32(e, JIT_LOOP_LIMIT);
+        patch(e, x86_jcc(e, CC_B), body);
+        emit_exit(e, 0, target, JIT_EXIT_BLOCK);
+    } else {
+        emit_exit(e, n, target, JIT_EXIT_BLOCK);
+    }
+}
+
+// Code for instruction k of the block ('n' instructions in total)
+static void emit_insn(Emit *e, const DecodedInsn *in, int k, uint16_t pc,
+                      bool flags_live, size_t body, uint16_t start, uint32_t n) {
+    int h1 = in->r1 <= REG_SP ? host_reg[in->r1] : RAX;
+    int h2 = in->r2 <= REG_SP ? host_reg[in->r2] : RAX;
+    uint16_t next = pc + in->length;
+
+    switch (in->handler) {
+        case OP_NOP:
+            break;
+
+        case OP_LOAD_IMM:
+            x86_mov_imm(e, h1, in->imm);
+            break;
+
+        case OP_LOAD_MEM:
+            x86_cpu(e, 32, 0x0FB7, h1, offsetof(CPU, memory) + in->imm);
+            break;
+
+        case OP_STORE: {
+            // Constant address: check the (at most two) pages directly
+            unsigned first = in->imm >> 8, last = (in->imm + 1) >> 8;
+            for (unsigned page = first; page <= last; page++) {
+                emit8(e, 0x41); emit8(e, 0x80); emit8(e, 0xBB);
+                emit32(e, page); emit8(e, 0x00);    // cmp byte [r11+page], 0
+                jcc_side(e, CC_NE, k);
+            }
+            for (unsigned page = first; page <= last; page++) {
+                emit8(e, 0xC6); emit8(e, 0x87);     // mov byte [rdi+dirty+page], 1
+                emit32(e, (uint32_t)(offsetof(CPU, dirty_pages) + page));
+                emit8(e, 0x01);
+            }
+            x86_cpu(e, 16, 0x89, h1, offsetof(CPU, memory) + in->imm);
+            break;
+        }
+
+        case OP_MOV:
+            x86_rr(e, 32, 0x89, h2, h1);
+            break;
+
+        case OP_PUSH:
+            emit_push_addr(e, k);
+            x86_rr(e, 32, 0x89, h1, R9);            // value before SP changes
+            x86_rr(e, 32, 0x89, RAX, RBX);
+            x86_mem(e, 16, 0x89, R9);
+            break;
+
+        case OP_POP:
+            emit_pop(e, k);
+            x86_rr(e, 32, 0x89, R9, h1);
+            break;
+
+        case OP_ADD:
+            x86_rr(e, 16, 0x01, h2, h1);
+            emit_flags(e, flags_live, true, true);
+            break;
+
+        case OP_SUB:
+            x86_rr(e, 16, 0x29, h2, h1);
+            emit_flags(e, flags_live, true, true);
+            break;
+
+        case OP_CMP:
+            x86_rr(e, 16, 0x39, h2, h1);
+            emit_flags(e, flags_live, true, true);
+            break;
+
+        case OP_ADDI:
+        case OP_SUBI:
+        case OP_CMPI: {
+            int digit = in->handler == OP_ADDI ? 0 : in->handler == OP_SUBI ? 5 : 7;
+            x86_rr(e, 16, 0x81, digit, h1);
+            emit16(e, in->imm);
+            emit_flags(e, flags_live, true, true);
+            break;
+        }
+
+        case OP_MUL:
+            x86_rr(e, 32, 0x89, h1, RAX);
+            x86_rr(e, 32, 0x89, h2, RCX);
+            x86_rr(e, 32, 0x0FAF, RAX, RCX);        // imul eax, ecx
+            x86_rr(e, 32, 0x0FB7, h1, RAX);
+            if (flags_live) {
+                emit8(e, 0x3D); emit32(e, 0xFFFF);  // carry: result > 0xFFFF
+                x86_setcc(e, CC_A, RCX);
+                x86_rr(e, 16, 0x85, RAX, RAX);
+                x86_setcc(e, CC_E, RDX);
+                x86_setcc(e, CC_S, R8);
+                emit_flags_commit(e, true, false);
+            }
+            break;
+
+        case OP_DIV:
+            x86_rr(e, 32, 0x89, h2, RCX);
+            x86_rr(e, 32, 0x85, RCX, RCX);
+            jcc_side(e, CC_E, k);                   // interpreter reports /0
+            x86_rr(e, 32, 0x89, h1, RAX);
+            x86_rr(e, 32, 0x31, RDX, RDX);
+            x86_rr(e, 32, 0xF7, 6, RCX);            // div ecx
+            x86_rr(e, 32, 0x89, RAX, h1);           // quotient, then remainder
+            x86_rr(e, 32, 0x89, RDX, h2);
+            if (flags_live) {
+                x86_rr(e, 16, 0x85, RAX, RAX);
+            }
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_INC:
+        case OP_DEC:
+            x86_rr(e, 16, 0x83, in->handler == OP_INC ? 0 : 5, h1);
+            emit8(e, 1);
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_AND:
+            x86_rr(e, 16, 0x21, h2, h1);
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_OR:
+            x86_rr(e, 16, 0x09, h2, h1);
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_XOR:
+            x86_rr(e, 16, 0x31, h2, h1);
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_NOT:
+            x86_rr(e, 16, 0xF7, 2, h1);             // not (leaves flags alone)
+            if (flags_live) {
+                x86_rr(e, 16, 0x85, h1, h1);
+            }
+            emit_flags(e, flags_live, false, false);
+            break;
+
+        case OP_SHL:
+        case OP_SHR:
+            x86_rr(e, 16, 0xC1, in->handler == OP_SHL ? 4 : 5, h1);
+            emit8(e, (uint8_t)in->imm);
+            emit_flags(e, flags_live, true, false);
+            break;
+
+        case OP_JMP:
+            emit_branch(e, body, start, n, in->imm);
+            break;
+
+        case OP_JZ:
+        case OP_JNZ:
+        case OP_JC:
+        case OP_JNC: {
+            uint32_t flag = (in->handler == OP_JZ || in->handler == OP_JNZ) ? FLAG_ZERO : FLAG_CARRY;
+            bool on_set = in->handler == OP_JZ || in->handler == OP_JC;
+            x86_rr(e, 32, 0xF7, 0, RBP); emit32(e, flag);    // test ebp, flag
+            size_t taken = x86_jcc(e, on_set ? CC_NE : CC_E);
+            emit_exit(e, n, next, JIT_EXIT_BLOCK);
+            patch(e, taken, e->len);
+            emit_branch(e, body, start, n, in->imm);
+            break;
+        }
+
+        case OP_CALL:
+            emit_push_addr(e, k);
+            x86_rr(e, 32, 0x89, RAX, RBX);
+            x86_mov_imm(e, R9, next);
+            x86_mem(e, 16, 0x89, R9);
+            emit_branch(e, body, start, n, in->imm);
+            break;
+
+        case OP_RET:
+            emit_pop(e, k);
+            x86_rr(e, 32, 0x89, R9, RAX);
+            emit_exit(e, n, -1, JIT_EXIT_BLOCK);
+            break;
+    }
+}
+
+// Translate the block starting at 'start'. Returns false if its first
+// instruction cannot be translated.
+static bool jit_translate(Jit *jit, CPU *cpu, uint16_t start) {
+    DecodedInsn insns[JIT_MAX_BLOCK_INSNS];
+    uint16_t    pcs[JIT_MAX_BLOCK_INSNS];
+    bool        flags_live[JIT_MAX_BLOCK_INSNS];
+    int         n = 0;
+
+    // Collect the block: up to and including the first branch
+    uint16_t pc = start;
+    while (n < JIT_MAX_BLOCK_INSNS && pc <= FETCH_FAST_LIMIT) {
+        decode_insn(cpu->memory, pc, &insns[n]);
+        if (!translatable(&insns[n])) {
+            break;
+        }
+        pcs[n] = pc;
+        pc += insns[n].length;
+        if (ends_block(insns[n++].handler)) {
+            break;
+        }
+    }
+    if (n == 0) {
+        return false;
+    }
+    uint16_t end = pc;
+    bool     falls_through = !ends_block(insns[n - 1].handler);
+
+    // Flag liveness, backwards: flags are visible at every exit, so a
+    // flag-setting instruction only materializes them if an exit or a
+    // conditional branch can observe the result
+    bool live = true;
+    for (int k = n - 1; k >= 0; k--) {
+        flags_live[k] = live;
+        if (sets_flags(insns[k].handler)) {
+            live = false;
+        }
+        if (may_side_exit(insns[k].handler) ||
+            (insns[k].handler >= OP_JZ && insns[k].handler <= OP_JNC)) {
+            live = true;
+        }
+    }
+
+    if (jit->code_size - jit->code_used < JIT_BLOCK_BYTES) {
+        jit_flush(jit);
+    }
+
+    Emit e = { .buf = jit->code + jit->code_used };
+    int  side_pos[JIT_MAX_BLOCK_INSNS];
+
+    // Prologue: save callee-saved registers, load guest state
+    emit8(&e, 0x53);                                    // push rbx
+    emit8(&e, 0x55);                                    // push rbp
+    for (int r = R12; r <= R15; r++) {
+        emit8(&e, 0x41); emit8(&e, 0x50 + (r & 7));
+    }
+    for (int r = 0; r <= REG_SP; r++) {
+        x86_cpu(&e, 32, 0x0FB7, host_reg[r], offsetof(CPU, regs) + 2 * r);
+    }
+    x86_cpu(&e, 32, 0x0FB6, RBP, offsetof(CPU, flags));
+    emit8(&e, 0x49); emit8(&e, 0xBB);                   // mov r11, imm64
+    uint64_t pages = (uint64_t)(uintptr_t)jit->code_pages;
+    for (int i = 0; i < 8; i++) {
+        emit8(&e, (pages >> (8 * i)) & 0xFF);
+    }
+    x86_rr(&e, 32, 0x31, RSI, RSI);                     // xor esi, esi
+    size_t body = e.len;
+
+    for (int k = 0; k < n; k++) {
+        emit_insn(&e, &insns[k], k, pcs[k], flags_live[k], body, start, (uint32_t)n);
+    }
+    if (falls_through) {
+        emit_exit(&e, (uint32_t)n, end, JIT_EXIT_BLOCK);
+    }
+
+    // Side exits: the state is exactly that before instruction k
+    for (int k = 0; k < n; k++) {
+        side_pos[k] = -1;
+    }
+    for (int i = 0; i < e.n_side; i++) {
+        int k = e.side_k[i];
+        if (side_pos[k] < 0) {
+            side_pos[k] = (int)e.len;
+            emit_exit(&e, (uint32_t)k, pcs[k], JIT_EXIT_SIDE);
+        }
+        patch(&e, e.side_fix[i], (size_t)side_pos[k]);
+    }
+
+    // Common epilogue: write back, account, return ecx
+    size_t common = e.len;
+    for (int r = 0; r <= REG_SP; r++) {
+        x86_cpu(&e, 16, 0x89, host_reg[r], offsetof(CPU, regs) + 2 * r);
+    }
+    x86_cpu(&e, 8, 0x88, RBP, offsetof(CPU, flags));
+    x86_cpu(&e, 16, 0x89, RAX, offsetof(CPU, regs) + 2 * REG_PC);
+    x86_cpu(&e, 64, 0x01, RSI, offsetof(CPU, cycles));
+    x86_rr(&e, 32, 0x89, RCX, RAX);                     // return code
+    for (int r = R15; r >= R12; r--) {
+        emit8(&e, 0x41); emit8(&e, 0x58 + (r & 7));
+    }
+    emit8(&e, 0x5D);                                    // pop rbp
+    emit8(&e, 0x5B);                                    // pop rbx
+    emit8(&e, 0xC3);                                    // ret
+    for (int i = 0; i < e.n_common; i++) {
+        patch(&e, e.common_fix[i], common);
+    }
+
+    // Publish: mark code pages first so stores see them
+    for (unsigned page = start >> 8; page <= (unsigned)(end - 1) >> 8; page++) {
+        jit->code_pages[page] = 1;
+    }
+    jit->blocks[start].code = (JitBlockFn)(void *)e.buf;
+    jit->blocks[start].end  = end;
+    jit->blocks[start].span = (uint32_t)n;
+    if (!falls_through && insns[n - 1].handler != OP_RET && insns[n - 1].imm == start) {
+        jit->blocks[start].span += JIT_LOOP_LIMIT;      // see emit_branch
+    }
+    jit->blocks[start].idle = !falls_through && idle_loop_closes(cpu->memory, start, pcs[n - 1]);
+    jit->code_used += (e.len + 15) & ~(size_t)15;
+    return true;
+}
+
+//=========================================================
+// Tiered execution
+//=========================================================
+
+// Interpret from PC through the next block-ending branch. Returns
+// the last cpu_step result.
+static int interpret_block(CPU *cpu) {
+    for (;;) {
+        uint16_t pc   = cpu->regs[REG_PC];
+        bool     last = pc > FETCH_FAST_LIMIT || ends_block(cpu->memory[pc]);
+        int      rc   = cpu_step(cpu);
+        if (rc <= 0 || last || cpu->halted) {
+            return rc;
+        }
+    }
+}
+
+#endif // JIT_HOST_SUPPORTED
+
+// Run until HLT or an error, translating hot blocks
+void cpu_run_jit(CPU *cpu) {
+    cpu_run_jit_limit(cpu, UINT64_MAX);
+}
+
+// The limit is checked between blocks
+void cpu_run_jit_limit(CPU *cpu, uint64_t limit) {
+    Jit *jit = cpu->jit;
+    if (!JIT_HOST_SUPPORTED || !jit || !jit->code) {
+        cpu_run_fast_limit(cpu, limit);
+        return;
+    }
+
+#if JIT_HOST_SUPPORTED
+    // Translated stores do not maintain the decode cache
+    struct DecodeCache *dcache = cpu->dcache;
+    cpu->dcache = NULL;
+
+    cpu->running = true;
+    cpu->halted  = false;
+
+    while (cpu->running && !cpu->halted && cpu->cycles < limit) {
+        uint16_t  pc    = cpu->regs[REG_PC];
+        JitBlock *block = &jit->blocks[pc];
+
+        if (block->code) {
+            if (block->idle && idle_skip(cpu, limit)) {
+                continue;
+            }
+            if (cpu->cycles + block->span > cpu->event_cycle) {
+                // An event falls due inside: single-step to it
+                if (interpret_block(cpu) < 0) {
+                    break;
+                }
+                continue;
+            }
+            // Translated code keeps FLAGS itself
+            flags_sync(cpu);
+            if (block->code(cpu) == JIT_EXIT_SIDE && cpu_step(cpu) < 0) {
+                break;
+            }
+            continue;
+        }
+
+        uint32_t *count = &jit->counters[pc];
+        jit->used_pages[pc >> 8] = 1;
+        if (*count != JIT_NEVER && ++*count >= jit->threshold) {
+            if (jit_translate(jit, cpu, pc)) {
+                continue;
+            }
+            *count = JIT_NEVER;
+        }
+
+        if (interpret_block(cpu) < 0) {
+            break;
+        }
+    }
+
+    if (dcache) {
+        cpu_attach_decode_cache(cpu, dcache);
+    }
+#endif
+}
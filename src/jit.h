@@ -0,0 +1,127 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Basic-block JIT (tiered engine)
+//=========================================================
+//
+// cpu_run_jit interprets code while counting how often each basic
+// block is entered. Blocks end at JMP/JZ/JNZ/JC/JNC/CALL/RET (the
+// branch is part of the block). Once a block has been entered
+// 'threshold' times it is translated to host machine code that keeps
+// A-D, SP and FLAGS in host registers; later entries run the
+// translation directly.
+//
+// Translated code leaves through an exit back to the interpreter for:
+//   - any access to the I/O page 0xFF00-0xFFFF (or a word wrapping
+//     around 0xFFFF): IN/OUT always, LOAD/STORE/PUSH/POP when the
+//     address gets there
+//   - DIV by zero (the interpreter reports the fault)
+//   - a store into a page holding translated code
+// In each case the CPU struct holds the exact state before the
+// instruction, which the interpreter then executes.
+//
+// The CPU struct stays the architectural state: translated blocks
+// load it on entry and write it back on every exit, so cycles and
+// all registers match cpu_step at block boundaries. Translated code
+// does not look at the event queue (cpu_schedule): a block that
+// could reach the next event's cycle, or any block while an
+// interrupt is ready to be taken, is interpreted instead.
+//
+// Only x86-64 hosts get a code generator (JIT_HOST_SUPPORTED). On
+// other hosts cpu_run_jit runs the threaded interpreter instead.
+//
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_HOST_SUPPORTED 1
+#else
+#define JIT_HOST_SUPPORTED 0
+#endif
+
+// Block entries before translation
+#ifndef JIT_DEFAULT_THRESHOLD
+#define JIT_DEFAULT_THRESHOLD 16
+#endif
+
+// Longest block, in guest instructions
+#define JIT_MAX_BLOCK_INSNS 64
+
+// Translated code runs at most this many guest instructions in a
+// self-loop before returning to the dispatcher
+#define JIT_LOOP_LIMIT (1u << 20)
+
+// Most instructions cpu_run_jit runs past an instruction limit (see
+// cpu_internal.h): a translated self-loop, or an interpreted stretch
+#define JIT_RUN_OVERSHOOT (JIT_LOOP_LIMIT + MEMORY_SIZE)
+
+// Counter value marking a block start that cannot be translated
+#define JIT_NEVER UINT32_MAX
+
+// Entry point of a translated block. Returns JIT_EXIT_BLOCK after
+// running to the end of the block, or JIT_EXIT_SIDE when the
+// instruction at the current PC must be executed by the interpreter.
+typedef int (*JitBlockFn)(CPU *cpu);
+
+#define JIT_EXIT_BLOCK 0
+#define JIT_EXIT_SIDE  1
+
+typedef struct {
+    JitBlockFn code;     // NULL = no translation at this PC
+    uint16_t   end;      // one past the last guest byte translated
+    uint32_t   span;     // most guest instructions one call runs
+    bool       idle;     // the block is a loop idle_skip may shorten
+} JitBlock;
+
+typedef struct Jit {
+    uint32_t threshold;
+    uint32_t counters[MEMORY_SIZE];           // block entries per PC
+    JitBlock blocks[MEMORY_SIZE];             // translations per PC
+    uint8_t  code_pages[MEMORY_SIZE >> 8];    // pages holding translated bytes
+    uint8_t  used_pages[MEMORY_SIZE >> 8];    // pages with counters or blocks
+
+    // Executable buffer. Blocks are bump-allocated; when it fills up
+    // every translation is dropped and allocation starts over.
+    uint8_t *code;
+    size_t   code_size;
+    size_t   code_used;
+} Jit;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// jit_create / jit_destroy:
+//   Allocate a JIT with the given translation threshold (0 selects
+//   JIT_DEFAULT_THRESHOLD) / release it. jit_create returns NULL if
+//   memory (or an executable mapping) cannot be obtained.
+//
+// jit_flush:
+//   Drop every translation and reset the block counters (cost
+//   proportional to the pages that were executed).
+//
+// cpu_attach_jit:
+//   Make 'jit' the CPU's JIT (NULL detaches). The JIT is flushed.
+//   Attach after cpu_init; cpu_reset keeps the attachment.
+//
+// jit_invalidate:
+//   Drop every translation covering 'addr'. Called by cpu_write_byte
+//   for pages marked in code_pages.
+//
+// cpu_run_jit:
+//   Run until HLT or an error, translating hot blocks. Results match
+//   cpu_run exactly. Without an attached JIT this is cpu_run_fast.
+//   An attached decode cache is not used meanwhile and is flushed
+//   on return.
+//
+Jit *jit_create(uint32_t threshold);
+void jit_destroy(Jit *jit);
+void jit_flush(Jit *jit);
+void cpu_attach_jit(CPU *cpu, Jit *jit);
+void jit_invalidate(Jit *jit, uint16_t addr);
+void cpu_run_jit(CPU *cpu);
+
+#endif // JIT_H
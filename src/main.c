@@ -1,8 +1,20 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "cpu.h"
+#include "decode.h"
+#include "jit.h"
 #include "assembler.h"
+#include "asm_cache.h"
+#include "image.h"
+#include "batch.h"
+#include "wide.h"
+#include "bench.h"
+#include "trace.h"
+#include "profile.h"
+#include "verify.h"
+#include "snapshot.h"
 
 /**
  * print_usage
@@ -15,10 +27,248 @@ void print_usage(const char *prog_name) {
     printf("SimpleCPU Emulator and Assembler\n\n");
     printf("Usage:\n");
     printf("  %s assemble <input.asm> <output.bin>  - Assemble a program\n", prog_name);
+    printf("  %s assemble <input.asm> <output.scx>  - ... as an executable with symbols\n", prog_name);
     printf("  %s run <program.bin>                  - Run a binary program\n", prog_name);
     printf("  %s debug <program.bin>                - Run with debug output\n", prog_name);
     printf("  %s asm-run <program.asm>              - Assemble and run\n\n", prog_name);
-    printf("  %s trace <program.bin>                - Step with per-cycle state\n\n", prog_name);
+    printf("  %s trace <program.bin>                - Step with per-cycle state\n", prog_name);
+    printf("  %s trace --record=FILE <program.bin>  - ... recorded to a binary trace\n", prog_name);
+    printf("  %s trace-dump [--writes] <FILE>       - Print a recorded trace\n", prog_name);
+    printf("  %s batch <manifest>                   - Run many programs in parallel\n", prog_name);
+    printf("  %s batch --program=<bin> <input>...   - Run one program per input file\n", prog_name);
+    printf("  %s bench <program.bin|.asm>...        - Measure engine speed\n", prog_name);
+    printf("  %s profile [--top=N] <program>        - Count executions per address and label\n", prog_name);
+    printf("  %s verify <program.bin|.asm>          - Check engines against the reference\n", prog_name);
+    printf("  %s verify --fuzz=N                    - ... on N random programs\n\n", prog_name);
+    printf("Options for run/debug/asm-run/asm-debug:\n");
+    printf("  --engine=switch|decoded|threaded|jit  - Execution engine (default: decoded)\n");
+    printf("  --unbuffered                          - Flush program output after every byte\n");
+    printf("  --max-cycles=N                        - Stop after N instructions\n");
+    printf("  --checkpoint=FILE                     - Save the machine there if stopped by --max-cycles\n");
+    printf("  --checkpoint-every=N                  - ... and every N instructions (default FILE: <program>.ckpt)\n");
+    printf("  --checkpoint-compress                 - Run-length encode checkpointed memory\n");
+    printf("  --resume=FILE                         - run/debug: carry on from a checkpoint, no program\n");
+    printf("  --cache-dir=DIR                       - asm-run image cache (default: %s)\n", ASM_CACHE_DIR);
+    printf("  --no-cache                            - Always assemble, never cache\n\n");
+    printf("Options for batch:\n");
+    printf("  --engine=switch|decoded|threaded|jit  - Execution engine (default: threaded)\n");
+    printf("  --threads=N                           - Worker threads (default: one per core)\n");
+    printf("  --max-cycles=N                        - Stop each job after N instructions\n");
+    printf("  --timeout=MS                          - Stop each job after MS milliseconds\n");
+    printf("  --lanes=N                             - Run jobs of one program N at a time in lockstep\n");
+    printf("  --output=FILE                         - Results file (default: stdout)\n\n");
+    printf("Options for bench:\n");
+    printf("  --engine=NAME|all                     - Engine(s) to measure (default: all)\n");
+    printf("  --iterations=N                        - Timed samples per program (default: 20)\n");
+    printf("  --output=FILE                         - Also write a tab-separated summary\n\n");
+    printf("Options for verify:\n");
+    printf("  --engine=NAME|all                     - Engine(s) to check (default: all)\n");
+    printf("  --every=N                             - Compare every N instructions (default: 1)\n");
+    printf("  --max-cycles=N                        - Stop after N instructions\n");
+    printf("  --input=FILE                          - Bytes PORT_STDIN reads (default: none)\n");
+    printf("  --seed=S                              - First fuzz program (default: 1)\n\n");
+}
+
+// Engine names for --engine=NAME, indexed by CpuEngine
+static const char *const engine_names[] = {
+    [CPU_ENGINE_SWITCH]   = "switch",
+    [CPU_ENGINE_DECODED]  = "decoded",
+    [CPU_ENGINE_THREADED] = "threaded",
+    [CPU_ENGINE_JIT]      = "jit",
+};
+
+#define ENGINE_COUNT (sizeof(engine_names) / sizeof(engine_names[0]))
+
+// Parse an engine name. Returns 0 on success, -1 if unknown.
+static int parse_engine(const char *name, CpuEngine *engine) {
+    for (size_t i = 0; i < ENGINE_COUNT; i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = (CpuEngine)i;
+            return 0;
+        }
+    }
+    fprintf(stderr, "Error: unknown engine '%s'\n", name);
+    return -1;
+}
+
+/**
+ * Run options
+ *
+ * Shared by run/debug/asm-run/asm-debug. Program output is line
+ * buffered by default; --unbuffered writes every byte as it comes
+ * (like a terminal), which interactive programs may want.
+ * asm-run/asm-debug take assembled images from the cache in
+ * asm_cache (asm_cache.h); --no-cache sets it to NULL.
+ * --max-cycles=N stops a program that has not halted after N
+ * instructions.
+ *
+ * With --checkpoint=FILE the whole machine is saved to FILE
+ * (snapshot.h) when --max-cycles stops it and, with
+ * --checkpoint-every=N, after every N instructions, so a long run
+ * can be stopped or lost and carried on with run --resume=FILE (in
+ * place of the program), here or on another host.
+ */
+typedef struct {
+    CpuEngine   engine;
+    bool        unbuffered;
+    const char *asm_cache;
+    uint64_t    max_cycles;      // CPU_BUDGET_NONE = no limit
+    const char *checkpoint;      // NULL = no checkpoints
+    uint64_t    checkpoint_every;     // 0 = only at the budget stop
+    bool        checkpoint_compress;
+    const char *resume;          // checkpoint to start from, or NULL
+} RunOptions;
+
+// Size of the program output buffer
+#define OUTPUT_BUFFER_SIZE 4096
+
+// Run for the budget in opts, saving a checkpoint after every
+// checkpoint_every instructions and where the budget stops the run.
+// Returns how the run stopped, or -1 if a checkpoint failed.
+static int run_checkpointed(CPU *cpu, CpuEngine engine, const RunOptions *opts) {
+    uint64_t left = opts->max_cycles;
+    for (;;) {
+        uint64_t slice = left;
+        if (opts->checkpoint_every && opts->checkpoint_every < slice) {
+            slice = opts->checkpoint_every;
+        }
+        CpuStop stop = cpu_run_engine_for(cpu, engine, slice);
+        if (stop != CPU_STOP_BUDGET) {
+            return stop;
+        }
+        if (cpu_save_state(cpu, opts->checkpoint, opts->checkpoint_compress) < 0) {
+            return -1;
+        }
+        if (left != CPU_BUDGET_NONE) {
+            left -= slice;
+            if (left == 0) {
+                return stop;
+            }
+        }
+    }
+}
+
+// Run a loaded CPU to completion with the chosen options. Returns 0,
+// or -1 if a checkpoint could not be saved.
+static int run_engine(CPU *cpu, const RunOptions *opts) {
+    static uint8_t output_buf[OUTPUT_BUFFER_SIZE];
+    if (!opts->unbuffered) {
+        cpu_set_output(cpu, NULL, NULL, output_buf, sizeof(output_buf));
+    }
+
+    CpuEngine engine = opts->engine;
+    DecodeCache *dcache = NULL;
+    if (engine != CPU_ENGINE_SWITCH) {
+        // Without a cache both fast engines degrade to cpu_run
+        dcache = decode_cache_create();
+        cpu_attach_decode_cache(cpu, dcache);
+    }
+
+    Jit *jit = NULL;
+    if (engine == CPU_ENGINE_JIT) {
+        // Without a JIT (or off x86-64) this runs the threaded engine
+        jit = jit_create(0);
+        cpu_attach_jit(cpu, jit);
+    }
+
+    int stop = opts->checkpoint ? run_checkpointed(cpu, engine, opts)
+                                : (int)cpu_run_engine_for(cpu, engine, opts->max_cycles);
+
+    if (jit) {
+        cpu_attach_jit(cpu, NULL);
+        jit_destroy(jit);
+    }
+    if (dcache) {
+        cpu_attach_decode_cache(cpu, NULL);
+        decode_cache_destroy(dcache);
+    }
+
+    // Output still buffered if the run stopped without HLT or a fault
+    cpu_flush_output(cpu);
+    cpu_set_output(cpu, NULL, NULL, NULL, 0);
+    if (stop == CPU_STOP_BUDGET) {
+        fprintf(stderr, "Stopped after %llu cycles: instruction budget used up\n",
+                (unsigned long long)cpu->cycles);
+        if (opts->checkpoint) {
+            fprintf(stderr, "Checkpoint saved to %s\n", opts->checkpoint);
+        }
+    }
+    return stop < 0 ? -1 : 0;
+}
+
+// Parse a positive count for an option; 'what' names it in errors
+static int parse_count(const char *text, const char *what, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (*text == '-' || *end || end == text || n == 0 || errno == ERANGE) {
+        fprintf(stderr, "Error: invalid %s '%s'\n", what, text);
+        return -1;
+    }
+    *value = n;
+    return 0;
+}
+
+// Parse "[--engine=NAME] [--unbuffered] [--max-cycles=N]
+// [--cache-dir=DIR|--no-cache] [--checkpoint=FILE]
+// [--checkpoint-every=N] [--checkpoint-compress]
+// <file>|--resume=FILE" for the run-style commands. Returns 0 on
+// success, -1 on a usage error.
+static int parse_run_args(int argc, char *argv[], const char **file, RunOptions *opts) {
+    static char default_checkpoint[4096];
+
+    *file = NULL;
+    opts->engine = CPU_ENGINE_DECODED;
+    opts->unbuffered = false;
+    opts->asm_cache = ASM_CACHE_DIR;
+    opts->max_cycles = CPU_BUDGET_NONE;
+    opts->checkpoint = NULL;
+    opts->checkpoint_every = 0;
+    opts->checkpoint_compress = false;
+    opts->resume = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (parse_engine(argv[i] + 9, &opts->engine) < 0) return -1;
+        } else if (strcmp(argv[i], "--unbuffered") == 0) {
+            opts->unbuffered = true;
+        } else if (strncmp(argv[i], "--max-cycles=", 13) == 0) {
+            if (parse_count(argv[i] + 13, "cycle count", &opts->max_cycles) < 0) return -1;
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+            opts->asm_cache = argv[i] + 12;
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            opts->asm_cache = NULL;
+        } else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+            opts->checkpoint = argv[i] + 13;
+        } else if (strncmp(argv[i], "--checkpoint-every=", 19) == 0) {
+            if (parse_count(argv[i] + 19, "checkpoint interval", &opts->checkpoint_every) < 0) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--checkpoint-compress") == 0) {
+            opts->checkpoint_compress = true;
+        } else if (strncmp(argv[i], "--resume=", 9) == 0) {
+            opts->resume = argv[i] + 9;
+        } else if (!*file) {
+            *file = argv[i];
+        } else {
+            return -1;
+        }
+    }
+    if (!*file == !opts->resume) {
+        return -1;                      // a program or a checkpoint, not both
+    }
+
+    // Periodic checkpoints go back to the file resumed from, or
+    // beside the program
+    if (opts->checkpoint_every && !opts->checkpoint) {
+        if (opts->resume) {
+            opts->checkpoint = opts->resume;
+        } else {
+            int n = snprintf(default_checkpoint, sizeof(default_checkpoint), "%s.ckpt", *file);
+            if (n < 0 || (size_t)n >= sizeof(default_checkpoint)) return -1;
+            opts->checkpoint = default_checkpoint;
+        }
+    }
+    return 0;
 }
 
 /**
@@ -27,7 +277,9 @@ void print_usage(const char *prog_name) {
  * High-level wrapper around the assembler:
  *   1. Initializes assembler state.
  *   2. Reads and assembles the given .asm file.
- *   3. Writes a flat binary (.bin) suitable for the emulator.
+ *   3. Writes an executable (exe.h) if the output name ends in
+ *      ".scx", otherwise a flat binary (.bin); the emulator runs
+ *      either.
  */
 int cmd_assemble(const char *input_file, const char *output_file) {
     Assembler asm_ctx;
@@ -37,16 +289,25 @@ int cmd_assemble(const char *input_file, const char *output_file) {
     
     // Pass 1 + 2 style assembly handled inside asm_assemble_file
     if (asm_assemble_file(&asm_ctx, input_file) < 0) {
+        asm_free(&asm_ctx);
         fprintf(stderr, "Assembly failed\n");
         return 1;
     }
     
-    // Emit raw machine code bytes to output file
-    if (asm_write_binary(&asm_ctx, output_file) < 0) {
+    // Emit machine code to the output file (executables also carry
+    // the label table, so it is freed only afterwards)
+    size_t len = strlen(output_file);
+    int rc = (len > 4 && strcmp(output_file + len - 4, ".scx") == 0)
+           ? asm_write_executable(&asm_ctx, output_file)
+           : asm_write_binary(&asm_ctx, output_file);
+    size_t size = asm_ctx.output_size;
+    asm_free(&asm_ctx);
+    if (rc < 0) {
         fprintf(stderr, "Failed to write output\n");
         return 1;
     }
     
+    printf("Assembled %zu bytes to %s\n", size, output_file);
     printf("Success! Output written to %s\n", output_file);
     return 0;
 }
@@ -56,54 +317,43 @@ int cmd_assemble(const char *input_file, const char *output_file) {
  *
  * Takes a pre-assembled binary and:
  *   1. Creates a CPU instance.
- *   2. Loads program into memory at 0x0100.
+ *   2. Loads the program (flat binaries at 0x0100, executables
+ *      where their header says).
  *   3. Optionally prints initial CPU state (debug mode).
- *   4. Calls cpu_run(), which repeatedly performs the
+ *   4. Runs the chosen engine, which repeatedly performs the
  *      Fetch–Decode–Execute cycle until HLT or error.
  */
-int cmd_run(const char *binary_file, bool debug) {
+int cmd_run(const char *binary_file, bool debug, const RunOptions *opts) {
     CPU cpu;
     cpu_init(&cpu);
     
-    // ---- Load binary file into buffer ----
-    FILE *f = fopen(binary_file, "rb");
-    if (!f) {
-        fprintf(stderr, "Cannot open file: %s\n", binary_file);
-        return 1;
-    }
-    
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    
-    uint8_t *program = malloc(size);
-    if (!program) {
-        fclose(f);
-        fprintf(stderr, "Out of memory\n");
-        return 1;
-    }
-
-    fread(program, 1, size, f);
-    fclose(f);
-    
-    // Load program bytes into SimpleCPU memory at 0x0100
-    if (cpu_load_program(&cpu, program, size, 0x0100) < 0) {
-        free(program);
+    // Map the binary and load it into SimpleCPU memory, or put the
+    // machine back as a checkpoint left it
+    ImageLayout layout;
+    if (opts->resume) {
+        if (cpu_load_state(&cpu, opts->resume) < 0) {
+            return 1;
+        }
+    } else if (image_load_file(&cpu, binary_file, &layout) < 0) {
         return 1;
     }
     
-    free(program);
-    
     // Optional: show initial register state before running
     if (debug) {
         printf("=== Starting Execution (Debug Mode) ===\n");
-        printf("Program loaded at 0x0100, size: %zu bytes\n\n", size);
+        if (opts->resume) {
+            printf("Resumed from %s at cycle %llu\n\n",
+                   opts->resume, (unsigned long long)cpu.cycles);
+        } else {
+            printf("Program loaded at 0x%04X, size: %zu bytes\n\n",
+                   layout.load_addr, layout.size + layout.bss_size);
+        }
         cpu_dump_registers(&cpu);
     }
     
-    // Main execution: repeatedly executes cpu_step() internally
+    // Main execution: repeatedly executes instructions until HLT
     printf("=== Program Output ===\n");
-    cpu_run(&cpu);
+    int rc = run_engine(&cpu, opts);
     printf("\n=== End Output ===\n\n");
     
     // Optional: show final registers and cycle count
@@ -113,7 +363,7 @@ int cmd_run(const char *binary_file, bool debug) {
                (unsigned long long)cpu.cycles);
     }
     
-    return 0;
+    return rc < 0 ? 1 : 0;
 }
 
 /**
@@ -123,43 +373,45 @@ int cmd_run(const char *binary_file, bool debug) {
  *   CYC, PC, and register values before each cpu_step().
  * This is a very explicit view of the Fetch–Decode–Execute
  * cycle in action and is great for debugging / demonstration.
+ *
+ * With a record file the same steps are written as a binary trace
+ * (trace.h) instead, which is far faster than printing them;
+ * trace-dump prints it afterwards.
  */
-int cmd_trace(const char *binary_file) {
+int cmd_trace(const char *binary_file, const char *record_file) {
     CPU cpu;
     cpu_init(&cpu);
 
-    // ---- Load binary file into buffer ----
-    FILE *f = fopen(binary_file, "rb");
-    if (!f) {
-        fprintf(stderr, "Cannot open file: %s\n", binary_file);
-        return 1;
-    }
-
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    uint8_t *program = malloc(size);
-    if (!program) {
-        fclose(f);
-        fprintf(stderr, "Out of memory\n");
+    // Map the binary and load it into memory
+    if (image_load_file(&cpu, binary_file, NULL) < 0) {
         return 1;
     }
 
-    fread(program, 1, size, f);
-    fclose(f);
+    if (record_file) {
+        static uint8_t output_buf[OUTPUT_BUFFER_SIZE];
+        cpu_set_output(&cpu, NULL, NULL, output_buf, sizeof(output_buf));
 
-    // Load program into memory at 0x0100
-    if (cpu_load_program(&cpu, program, size, 0x0100) < 0) {
-        free(program);
-        return 1;
+        printf("=== Program Output ===\n");
+        uint64_t steps;
+        int rc = trace_record(&cpu, record_file, &steps);
+        cpu_flush_output(&cpu);
+        printf("\n=== End Output ===\n");
+        if (rc < 0) {
+            return 1;
+        }
+        printf("Recorded %llu instructions to %s\n",
+               (unsigned long long)steps, record_file);
+        return 0;
     }
 
-    free(program);
-
     printf("=== Execution Trace ===\n");
     // Step until HLT or error
     while (!cpu.halted) {
+        // Let devices act (and interrupts be taken) before showing
+        // the instruction that will run
+        if (cpu.cycles >= cpu.event_cycle) {
+            cpu_run_events(&cpu);
+        }
         // Show cycle count, PC, and all general-purpose registers
         printf("CYC=%10llu PC=%04X A=%04X B=%04X C=%04X D=%04X\n",
                (unsigned long long)cpu.cycles,
@@ -179,37 +431,55 @@ int cmd_trace(const char *binary_file) {
     return 0;
 }
 
+/**
+ * cmd_trace_dump
+ *
+ * Prints a trace recorded with trace --record=FILE exactly as the
+ * trace command would have, optionally listing every memory and
+ * port write under the instruction that made it.
+ */
+int cmd_trace_dump(const char *trace_file, bool writes) {
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    int rc = trace_dump(trace_file, stdout, writes);
+    fflush(stdout);
+    return rc < 0 ? 1 : 0;
+}
+
 /**
  * cmd_asm_run
  *
  * Convenience command:
- *   1. Assemble a .asm file in memory.
+ *   1. Assemble a .asm file in memory (or map the image a previous
+ *      run left in the assembled-image cache).
  *   2. Load assembled bytes directly into a fresh CPU.
  *   3. Run the program (optionally with debug output).
  *
  * This shows the full toolchain: source → machine code → execution.
  */
-int cmd_asm_run(const char *asm_file, bool debug) {
-    Assembler asm_ctx;
-    asm_init(&asm_ctx);
-    
+int cmd_asm_run(const char *asm_file, bool debug, const RunOptions *opts) {
     printf("Assembling %s...\n", asm_file);
     
-    if (asm_assemble_file(&asm_ctx, asm_file) < 0) {
+    ProgramImage image;
+    bool cached;
+    if (asm_cache_assemble(opts->asm_cache, asm_file, &image, &cached) < 0) {
         fprintf(stderr, "Assembly failed\n");
         return 1;
     }
     
-    printf("Assembled %zu bytes\n\n", asm_ctx.output_size);
-    
     // Create CPU and load assembled program into memory
     CPU cpu;
     cpu_init(&cpu);
     
-    if (cpu_load_program(&cpu, asm_ctx.output, asm_ctx.output_size, 0x0100) < 0) {
+    ImageLayout layout;
+    int rc = image_load(&cpu, &image, &layout);
+    image_release(&image);
+    if (rc < 0) {
         return 1;
     }
     
+    printf("Assembled %zu bytes\n\n", layout.size + layout.bss_size);
+    
     if (debug) {
         printf("=== Starting Execution (Debug Mode) ===\n");
         cpu_dump_registers(&cpu);
@@ -217,7 +487,7 @@ int cmd_asm_run(const char *asm_file, bool debug) {
     
     // Execute until HLT
     printf("=== Program Output ===\n");
-    cpu_run(&cpu);
+    int run_rc = run_engine(&cpu, opts);
     printf("\n=== End Output ===\n\n");
     
     if (debug) {
@@ -226,9 +496,433 @@ int cmd_asm_run(const char *asm_file, bool debug) {
                (unsigned long long)cpu.cycles);
     }
     
+    return run_rc < 0 ? 1 : 0;
+}
+
+/**
+ * cmd_batch
+ *
+ * Runs many jobs in parallel (see batch.h) and writes every job's
+ * final state and captured output to one results file:
+ *   batch [options] <manifest>              - one "<program> [input]" per line
+ *   batch [options] --program=<bin> <in>... - the same binary once per input
+ * A summary goes to stderr. Returns nonzero if any job did not halt.
+ */
+int cmd_batch(int argc, char *argv[]) {
+    BatchOptions opts = { .engine = CPU_ENGINE_THREADED };
+    const char *output_file = NULL;
+    const char *program = NULL;
+    const char *manifest = NULL;
+    int first_input = 0;
+
+    for (int i = 2; i < argc && !first_input; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (parse_engine(argv[i] + 9, &opts.engine) < 0) return 1;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            char *end;
+            unsigned long n = strtoul(argv[i] + 10, &end, 10);
+            if (*end || n == 0 || n > 1024) {
+                fprintf(stderr, "Error: invalid thread count '%s'\n", argv[i] + 10);
+                return 1;
+            }
+            opts.threads = (unsigned)n;
+        } else if (strncmp(argv[i], "--lanes=", 8) == 0) {
+            char *end;
+            unsigned long n = strtoul(argv[i] + 8, &end, 10);
+            if (*end || n == 0 || n > WIDE_LANES) {
+                fprintf(stderr, "Error: lanes must be 1 to %d\n", WIDE_LANES);
+                return 1;
+            }
+            opts.lanes = (unsigned)n;
+        } else if (strncmp(argv[i], "--max-cycles=", 13) == 0) {
+            if (parse_count(argv[i] + 13, "cycle count", &opts.max_instructions) < 0) return 1;
+        } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            uint64_t ms;
+            if (parse_count(argv[i] + 10, "timeout", &ms) < 0) return 1;
+            opts.timeout_ns = ms > UINT64_MAX / 1000000 ? UINT64_MAX : ms * 1000000;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_file = argv[i] + 9;
+        } else if (strncmp(argv[i], "--program=", 10) == 0) {
+            program = argv[i] + 10;
+        } else if (program) {
+            first_input = i;
+        } else if (!manifest) {
+            manifest = argv[i];
+        } else {
+            fprintf(stderr, "Error: unexpected argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if (program ? (manifest || !first_input) : !manifest) {
+        fprintf(stderr, "Error: batch requires a manifest, or --program and input files\n");
+        return 1;
+    }
+
+    BatchJob *jobs;
+    size_t count;
+    if (program) {
+        count = (size_t)(argc - first_input);
+        jobs = malloc(count * sizeof(BatchJob));
+        if (!jobs) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        for (size_t i = 0; i < count; i++) {
+            jobs[i].program = program;
+            jobs[i].input = argv[first_input + i];
+        }
+    } else if (batch_load_manifest(manifest, &jobs, &count) < 0) {
+        return 1;
+    }
+
+    int rc = 1;
+    BatchResult *results = calloc(count ? count : 1, sizeof(BatchResult));
+    FILE *out = output_file ? fopen(output_file, "wb") : stdout;
+    if (!results) {
+        fprintf(stderr, "Out of memory\n");
+    } else if (!out) {
+        fprintf(stderr, "Cannot create file: %s\n", output_file);
+    } else if (batch_run(jobs, count, results, &opts) == 0) {
+        size_t halted = 0, faulted = 0, stopped = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (results[i].status == BATCH_HALTED) halted++;
+            if (results[i].status == BATCH_FAULT) faulted++;
+            if (results[i].status == BATCH_BUDGET) stopped++;
+        }
+        if (batch_write_results(out, jobs, results, count) < 0) {
+            fprintf(stderr, "Failed to write results\n");
+        } else {
+            rc = (halted == count) ? 0 : 1;
+        }
+        fprintf(stderr, "Batch: %zu jobs, %zu halted, %zu faulted, %zu stopped at a limit, "
+                        "%zu failed to load\n",
+                count, halted, faulted, stopped, count - halted - faulted - stopped);
+        batch_free_results(results, count);
+    }
+
+    if (out && out != stdout) fclose(out);
+    free(results);
+    if (program) {
+        free(jobs);
+    } else {
+        batch_free_jobs(jobs, count);
+    }
+    return rc;
+}
+
+// The image of a program: assembled in memory if 'path' ends in
+// .asm (as an executable, so its labels come along), else the file
+// mapped as is. Returns 0 on success, -1 (reported on stderr).
+static int open_program(const char *path, ProgramImage *image) {
+    size_t len = strlen(path);
+    if (len <= 4 || strcmp(path + len - 4, ".asm") != 0) {
+        if (image_map_file(path, image) < 0) {
+            fprintf(stderr, "%s: %s\n", image->error, path);
+            return -1;
+        }
+        return 0;
+    }
+
+    static Assembler asm_ctx;
+    asm_init(&asm_ctx);
+    int rc = asm_assemble_file(&asm_ctx, path);
+    if (rc == 0 && asm_build_image(&asm_ctx, image) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        rc = -1;
+    } else if (rc < 0) {
+        fprintf(stderr, "Assembly failed\n");
+    }
+    asm_free(&asm_ctx);
+    return rc;
+}
+
+/**
+ * cmd_bench
+ *
+ * Measures each program (assembled first if it ends in .asm) on one
+ * or all engines, see bench.h, and prints wall time per run (median
+ * and p99), MIPS and host cycles per guest instruction. --output
+ * writes the same numbers tab-separated, one line per program and
+ * engine, for diffing between builds.
+ */
+int cmd_bench(int argc, char *argv[]) {
+    BenchOptions opts = { 20, CPU_ENGINE_SWITCH };
+    bool all_engines = true;
+    const char *output_file = NULL;
+    int first_program = 0;
+
+    for (int i = 2; i < argc && !first_program; i++) {
+        if (strcmp(argv[i], "--engine=all") == 0) {
+            all_engines = true;
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (parse_engine(argv[i] + 9, &opts.engine) < 0) return 1;
+            all_engines = false;
+        } else if (strncmp(argv[i], "--iterations=", 13) == 0) {
+            char *end;
+            unsigned long n = strtoul(argv[i] + 13, &end, 10);
+            if (*end || n == 0 || n > 1000000) {
+                fprintf(stderr, "Error: invalid iteration count '%s'\n", argv[i] + 13);
+                return 1;
+            }
+            opts.iterations = (unsigned)n;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output_file = argv[i] + 9;
+        } else {
+            first_program = i;
+        }
+    }
+    if (!first_program) {
+        fprintf(stderr, "Error: bench requires at least one program\n");
+        return 1;
+    }
+
+    FILE *summary = NULL;
+    if (output_file) {
+        summary = fopen(output_file, "w");
+        if (!summary) {
+            fprintf(stderr, "Cannot create file: %s\n", output_file);
+            return 1;
+        }
+        fprintf(summary, "# program\tengine\titerations\tinstructions\t"
+                         "median_ns\tp99_ns\tmips\thost_cycles_per_insn\n");
+    }
+
+    printf("%-28s %-9s %10s %12s %12s %9s %10s\n", "program", "engine",
+           "instrs", "median(ns)", "p99(ns)", "MIPS", "cyc/instr");
+
+    int rc = 0;
+    for (int i = first_program; i < argc && rc == 0; i++) {
+        const char *path = argv[i];
+        ProgramImage image;
+
+        if (open_program(path, &image) < 0) {
+            rc = 1;
+            break;
+        }
+
+        for (size_t e = 0; e < ENGINE_COUNT; e++) {
+            if (!all_engines && e != (size_t)opts.engine) continue;
+            BenchOptions run = opts;
+            run.engine = (CpuEngine)e;
+
+            BenchResult r;
+            if (bench_program(&image, &run, &r) < 0) {
+                rc = 1;
+                break;
+            }
+            if (!r.halted) {
+                fprintf(stderr, "Warning: %s faulted; timing covers the run up to the fault\n", path);
+            }
+            printf("%-28s %-9s %10llu %12.1f %12.1f %9.1f %10.2f\n", path, engine_names[e],
+                   (unsigned long long)r.instructions, r.median_ns, r.p99_ns,
+                   r.mips, r.host_cycles);
+            if (summary) {
+                fprintf(summary, "%s\t%s\t%u\t%llu\t%.1f\t%.1f\t%.2f\t%.3f\n",
+                        path, engine_names[e], run.iterations,
+                        (unsigned long long)r.instructions, r.median_ns, r.p99_ns,
+                        r.mips, r.host_cycles);
+            }
+        }
+        image_release(&image);
+    }
+
+    if (summary) {
+        if (fclose(summary) != 0) {
+            fprintf(stderr, "Failed to write %s\n", output_file);
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * cmd_profile
+ *
+ * Runs one program (assembled first if it ends in .asm) to
+ * completion while counting every instruction, then prints where
+ * the time went: per label, per address, per conditional jump, per
+ * call target and per opcode (see profile.h). Labels come from
+ * .asm sources and .scx executables; a flat .bin is reported by
+ * address only.
+ */
+int cmd_profile(int argc, char *argv[]) {
+    unsigned top = PROFILE_TOP;
+    int arg = 2;
+    if (arg < argc && strncmp(argv[arg], "--top=", 6) == 0) {
+        char *end;
+        unsigned long n = strtoul(argv[arg] + 6, &end, 10);
+        if (*end || n == 0 || n > MEMORY_SIZE) {
+            fprintf(stderr, "Error: invalid row count '%s'\n", argv[arg] + 6);
+            return 1;
+        }
+        top = (unsigned)n;
+        arg++;
+    }
+    if (argc != arg + 1) {
+        fprintf(stderr, "Error: profile requires a program\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    ProgramImage image;
+    if (open_program(argv[arg], &image) < 0) {
+        return 1;
+    }
+
+    CPU cpu;
+    cpu_init(&cpu);
+    Profile *prof = profile_create();
+    if (!prof) {
+        fprintf(stderr, "Out of memory\n");
+        image_release(&image);
+        return 1;
+    }
+    if (image_load(&cpu, &image, NULL) < 0) {
+        profile_destroy(prof);
+        image_release(&image);
+        return 1;
+    }
+
+    static uint8_t output_buf[OUTPUT_BUFFER_SIZE];
+    cpu_set_output(&cpu, NULL, NULL, output_buf, sizeof(output_buf));
+    printf("=== Program Output ===\n");
+    profile_run(prof, &cpu);
+    cpu_flush_output(&cpu);
+    printf("\n=== End Output ===\n\n");
+
+    profile_report(prof, &image, top, stdout);
+
+    profile_destroy(prof);
+    image_release(&image);
     return 0;
 }
 
+/**
+ * cmd_verify
+ *
+ * Runs a program (assembled first if it ends in .asm) on the
+ * reference stepper and on each engine checked, comparing their
+ * state as they go (see verify.h), and prints where they first
+ * diverge:
+ *   verify [options] <program>    - one program
+ *   verify [options] --fuzz=N     - N random programs, from --seed=S
+ * A failing fuzz case is reproduced by --fuzz=1 with its seed.
+ * Returns nonzero on a divergence.
+ */
+int cmd_verify(int argc, char *argv[]) {
+    VerifyOptions opts = { .every = 1, .max_cycles = CPU_BUDGET_NONE };
+    bool all_engines = true;
+    const char *path = NULL;
+    const char *input_file = NULL;
+    uint64_t fuzz = 0, seed = 1;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--engine=all") == 0) {
+            all_engines = true;
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (parse_engine(argv[i] + 9, &opts.engine) < 0) return 1;
+            all_engines = false;
+        } else if (strncmp(argv[i], "--every=", 8) == 0) {
+            if (parse_count(argv[i] + 8, "interval", &opts.every) < 0) return 1;
+        } else if (strncmp(argv[i], "--max-cycles=", 13) == 0) {
+            if (parse_count(argv[i] + 13, "cycle count", &opts.max_cycles) < 0) return 1;
+        } else if (strncmp(argv[i], "--input=", 8) == 0) {
+            input_file = argv[i] + 8;
+        } else if (strncmp(argv[i], "--fuzz=", 7) == 0) {
+            if (parse_count(argv[i] + 7, "program count", &fuzz) < 0) return 1;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            char *end;
+            errno = 0;
+            seed = strtoull(argv[i] + 7, &end, 0);
+            if (!argv[i][7] || *end || errno == ERANGE) {
+                fprintf(stderr, "Error: invalid seed '%s'\n", argv[i] + 7);
+                return 1;
+            }
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Error: unknown verify option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!path == !fuzz) {
+        fprintf(stderr, "Error: verify requires a program or --fuzz=N\n");
+        print_usage(argv[0]);
+        return 1;
+    }
+    if (fuzz && opts.max_cycles == CPU_BUDGET_NONE) {
+        opts.max_cycles = VERIFY_FUZZ_CYCLES;
+    }
+
+    ProgramImage input = { 0 };
+    if (input_file) {
+        if (image_map_file(input_file, &input) < 0) {
+            fprintf(stderr, "%s: %s\n", input.error, input_file);
+            return 1;
+        }
+        opts.input = input.data;
+        opts.input_size = input.size;
+    }
+
+    static const char *const stop_names[] = {
+        [CPU_STOP_HALT]   = "halted",
+        [CPU_STOP_FAULT]  = "faulted",
+        [CPU_STOP_BUDGET] = "budget used up",
+    };
+    int rc = 0;
+    uint64_t cases = fuzz ? fuzz : 1;
+    uint64_t checked = 0, instructions = 0;
+    for (uint64_t c = 0; c < cases && rc == 0; c++) {
+        ProgramImage image;
+        if (fuzz ? verify_fuzz_image(seed + c, &image) : open_program(path, &image)) {
+            if (fuzz) fprintf(stderr, "Out of memory\n");
+            rc = 1;
+            break;
+        }
+
+        for (size_t e = CPU_ENGINE_DECODED; e < ENGINE_COUNT && rc == 0; e++) {
+            if (!all_engines && e != (size_t)opts.engine) continue;
+            VerifyOptions run = opts;
+            run.engine = (CpuEngine)e;
+            run.quiet  = fuzz != 0;
+
+            VerifyResult r;
+            if (verify_program(&image, &run, &r) < 0) {
+                rc = 1;
+                break;
+            }
+            if (r.diverged) {
+                if (fuzz) {
+                    // Reproduce it, this time with the report
+                    printf("Fuzz program %llu (--seed=%llu) on %s:\n",
+                           (unsigned long long)c, (unsigned long long)(seed + c),
+                           engine_names[e]);
+                    run.quiet = false;
+                    verify_program(&image, &run, &r);
+                }
+                printf("%s diverged from the reference after %llu instructions\n",
+                       engine_names[e], (unsigned long long)r.instructions);
+                rc = 1;
+            } else if (!fuzz) {
+                printf("%-9s matches the reference: %llu instructions, %llu checkpoints (%s)\n",
+                       engine_names[e], (unsigned long long)r.instructions,
+                       (unsigned long long)r.checkpoints, stop_names[r.stop]);
+            }
+            checked++;
+            instructions += r.instructions;
+        }
+        image_release(&image);
+    }
+    if (fuzz && rc == 0) {
+        printf("%llu random programs from seed %llu: no divergence in %llu runs, %llu instructions\n",
+               (unsigned long long)fuzz, (unsigned long long)seed,
+               (unsigned long long)checked, (unsigned long long)instructions);
+    }
+
+    image_release(&input);
+    return rc;
+}
+
 /**
  * main
  *
@@ -238,6 +932,11 @@ int cmd_asm_run(const char *asm_file, bool debug) {
  * software system, deciding whether we:
  *   - Just assemble (assemble)
  *   - Just emulate (run/debug/trace)
+ *   - Print a recorded trace (trace-dump)
+ *   - Emulate many programs at once (batch)
+ *   - Measure the engines (bench)
+ *   - Profile guest code (profile)
+ *   - Check the engines against the reference (verify)
  *   - Assemble then emulate in one shot (asm-run/asm-debug)
  */
 int main(int argc, char *argv[]) {
@@ -257,44 +956,91 @@ int main(int argc, char *argv[]) {
         return cmd_assemble(argv[2], argv[3]);
     }
     else if (strcmp(command, "run") == 0) {
-        if (argc != 3) {
+        const char *file;
+        RunOptions opts;
+        if (parse_run_args(argc, argv, &file, &opts) < 0) {
             fprintf(stderr, "Error: run requires a binary file\n");
             print_usage(argv[0]);
             return 1;
         }
-        return cmd_run(argv[2], false);
+        return cmd_run(file, false, &opts);
     }
     else if (strcmp(command, "debug") == 0) {
-        if (argc != 3) {
+        const char *file;
+        RunOptions opts;
+        if (parse_run_args(argc, argv, &file, &opts) < 0) {
             fprintf(stderr, "Error: debug requires a binary file\n");
             print_usage(argv[0]);
             return 1;
         }
-        return cmd_run(argv[2], true);
+        return cmd_run(file, true, &opts);
     }
     else if (strcmp(command, "trace") == 0) {
-        if (argc != 3) {
+        const char *record_file = NULL;
+        int arg = 2;
+        if (arg < argc && strncmp(argv[arg], "--record=", 9) == 0) {
+            record_file = argv[arg++] + 9;
+        }
+        if (argc != arg + 1) {
             fprintf(stderr, "Error: trace requires a binary file\n");
             print_usage(argv[0]);
             return 1;
         }
-        return cmd_trace(argv[2]);
+        return cmd_trace(argv[arg], record_file);
+    }
+    else if (strcmp(command, "trace-dump") == 0) {
+        bool writes = false;
+        int arg = 2;
+        if (arg < argc && strcmp(argv[arg], "--writes") == 0) {
+            writes = true;
+            arg++;
+        }
+        if (argc != arg + 1) {
+            fprintf(stderr, "Error: trace-dump requires a trace file\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return cmd_trace_dump(argv[arg], writes);
+    }
+    else if (strcmp(command, "batch") == 0) {
+        return cmd_batch(argc, argv);
+    }
+    else if (strcmp(command, "bench") == 0) {
+        return cmd_bench(argc, argv);
+    }
+    else if (strcmp(command, "profile") == 0) {
+        return cmd_profile(argc, argv);
+    }
+    else if (strcmp(command, "verify") == 0) {
+        return cmd_verify(argc, argv);
     }
     else if (strcmp(command, "asm-run") == 0) {
-        if (argc != 3) {
+        const char *file;
+        RunOptions opts;
+        if (parse_run_args(argc, argv, &file, &opts) < 0) {
             fprintf(stderr, "Error: asm-run requires an assembly file\n");
             print_usage(argv[0]);
             return 1;
         }
-        return cmd_asm_run(argv[2], false);
+        if (opts.resume) {
+            fprintf(stderr, "Error: asm-run cannot --resume; use run or debug\n");
+            return 1;
+        }
+        return cmd_asm_run(file, false, &opts);
     }
     else if (strcmp(command, "asm-debug") == 0) {
-        if (argc != 3) {
+        const char *file;
+        RunOptions opts;
+        if (parse_run_args(argc, argv, &file, &opts) < 0) {
             fprintf(stderr, "Error: asm-debug requires an assembly file\n");
             print_usage(argv[0]);
             return 1;
         }
-        return cmd_asm_run(argv[2], true);
+        if (opts.resume) {
+            fprintf(stderr, "Error: asm-debug cannot --resume; use run or debug\n");
+            return 1;
+        }
+        return cmd_asm_run(file, true, &opts);
     }
     else {
         fprintf(stderr, "Unknown command: %s\n", command);
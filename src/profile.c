@@ -0,0 +1,258 @@
+#include "profile.h"
+#include "exe.h"
+#include "isa.h"
+#include <stdlib.h>
+#include <string.h>
+
+Profile *profile_create(void) {
+    return calloc(1, sizeof(Profile));
+}
+
+void profile_destroy(Profile *prof) {
+    free(prof);
+}
+
+//=========================================================
+// Counting
+//=========================================================
+
+void profile_run(Profile *prof, CPU *cpu) {
+    while (!cpu->halted) {
+        // Count the instruction that runs, not the one an interrupt
+        // is about to preempt
+        if (cpu->cycles >= cpu->event_cycle) {
+            cpu_run_events(cpu);
+        }
+        uint16_t pc = cpu->regs[REG_PC];
+        uint8_t opcode = cpu->memory[pc];
+        prof->counts[pc]++;
+        prof->opcodes[pc] = opcode;
+        prof->opcode_counts[opcode]++;
+        prof->instructions++;
+
+        if (cpu_step(cpu) < 0) {
+            break;
+        }
+
+        switch (opcode) {
+            case OP_JZ: case OP_JNZ: case OP_JC: case OP_JNC:
+                // Not taken falls through to the next instruction
+                if (cpu->regs[REG_PC] != (uint16_t)(pc + isa_length(opcode))) {
+                    prof->taken[pc]++;
+                }
+                break;
+            case OP_CALL:
+                prof->calls[cpu->regs[REG_PC]]++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+//=========================================================
+// Symbols
+//=========================================================
+
+typedef struct {
+    uint16_t    addr;
+    const char *name;            // not NUL-terminated
+    size_t      len;
+} Symbol;
+
+// The labels of an executable image, sorted by address
+typedef struct {
+    Symbol *syms;
+    size_t  count;
+} Symbols;
+
+static void symbols_load(Symbols *s, const ProgramImage *image) {
+    memset(s, 0, sizeof(*s));
+    ExeImage exe;
+    if (!image || !exe_detect(image->data, image->size) ||
+        exe_parse(image->data, image->size, &exe) < 0 || !exe.symbols) {
+        return;
+    }
+
+    size_t pos = 0, n = 0;
+    uint16_t addr;
+    const char *name;
+    size_t len;
+    while (exe_next_symbol(&exe, &pos, &addr, &name, &len)) n++;
+    s->syms = malloc(n * sizeof(Symbol));
+    if (!s->syms) return;              // report addresses only
+
+    pos = 0;
+    while (exe_next_symbol(&exe, &pos, &addr, &name, &len)) {
+        // Several labels on one address: name it by the first
+        if (s->count && s->syms[s->count - 1].addr == addr) continue;
+        s->syms[s->count++] = (Symbol){ addr, name, len };
+    }
+}
+
+// Index of the last symbol at or below 'addr', or s->count if none
+static size_t symbols_find(const Symbols *s, uint16_t addr) {
+    size_t lo = 0, hi = s->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (s->syms[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo ? lo - 1 : s->count;
+}
+
+// "LABEL" or "LABEL+N" for an address, "-" below every label
+static void format_location(const Symbols *s, uint16_t addr, char *buf, size_t size) {
+    size_t i = symbols_find(s, addr);
+    if (i == s->count) {
+        snprintf(buf, size, "-");
+    } else if (s->syms[i].addr == addr) {
+        snprintf(buf, size, "%.*s", (int)s->syms[i].len, s->syms[i].name);
+    } else {
+        snprintf(buf, size, "%.*s+%u", (int)s->syms[i].len, s->syms[i].name,
+                 (unsigned)(addr - s->syms[i].addr));
+    }
+}
+
+//=========================================================
+// Report
+//=========================================================
+
+// One table row: a count and what it counts
+typedef struct {
+    uint64_t count;
+    uint32_t key;
+} Row;
+
+// Highest count first, then lowest key
+static int compare_rows(const void *a, const void *b) {
+    const Row *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+static const char *mnemonic(uint8_t opcode) {
+    const IsaInsn *insn = isa_by_opcode(opcode);
+    return insn ? insn->mnemonic : "???";
+}
+
+static double percent(uint64_t count, uint64_t total) {
+    return total ? 100.0 * (double)count / (double)total : 0.0;
+}
+
+void profile_report(const Profile *prof, const ProgramImage *image,
+                    unsigned top, FILE *out) {
+    Symbols syms;
+    symbols_load(&syms, image);
+    Row *rows = malloc(MEMORY_SIZE * sizeof(Row));
+    if (!rows) {
+        fprintf(stderr, "Out of memory\n");
+        free(syms.syms);
+        return;
+    }
+    uint64_t total = prof->instructions;
+    char where[64];
+    size_t n;
+
+    fprintf(out, "=== Profile ===\n");
+    fprintf(out, "Instructions: %llu\n", (unsigned long long)total);
+
+    // Time per label: every address counts toward the label it
+    // falls under (key syms.count collects those below all labels)
+    if (syms.count) {
+        uint64_t *sums = calloc(syms.count + 1, sizeof(uint64_t));
+        if (sums) {
+            for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+                if (prof->counts[addr]) {
+                    sums[symbols_find(&syms, (uint16_t)addr)] += prof->counts[addr];
+                }
+            }
+            n = 0;
+            for (size_t i = 0; i <= syms.count; i++) {
+                if (sums[i]) rows[n++] = (Row){ sums[i], (uint32_t)i };
+            }
+            qsort(rows, n, sizeof(Row), compare_rows);
+
+            fprintf(out, "\nTime by label:\n");
+            fprintf(out, "%12s %7s  %s\n", "Count", "%", "Label");
+            for (size_t i = 0; i < n && i < top; i++) {
+                const Symbol *sym = rows[i].key < syms.count ? &syms.syms[rows[i].key] : NULL;
+                fprintf(out, "%12llu %6.2f%%  %.*s\n", (unsigned long long)rows[i].count,
+                        percent(rows[i].count, total),
+                        sym ? (int)sym->len : 1, sym ? sym->name : "-");
+            }
+            free(sums);
+        }
+    }
+
+    // Hottest instructions
+    n = 0;
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (prof->counts[addr]) rows[n++] = (Row){ prof->counts[addr], addr };
+    }
+    qsort(rows, n, sizeof(Row), compare_rows);
+    fprintf(out, "\nHottest instructions:\n");
+    fprintf(out, "%12s %7s  %-4s  %-5s  %s\n", "Count", "%", "Addr", "Insn", "Location");
+    for (size_t i = 0; i < n && i < top; i++) {
+        uint16_t addr = (uint16_t)rows[i].key;
+        format_location(&syms, addr, where, sizeof(where));
+        fprintf(out, "%12llu %6.2f%%  %04X  %-5s  %s\n", (unsigned long long)rows[i].count,
+                percent(rows[i].count, total), addr, mnemonic(prof->opcodes[addr]), where);
+    }
+
+    // Conditional jumps, by how often they ran
+    size_t jumps = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t op = prof->opcodes[rows[i].key];
+        if (op == OP_JZ || op == OP_JNZ || op == OP_JC || op == OP_JNC) {
+            rows[jumps++] = rows[i];
+        }
+    }
+    if (jumps) {
+        fprintf(out, "\nConditional jumps:\n");
+        fprintf(out, "%12s %12s %12s  %-4s  %-5s  %s\n",
+                "Count", "Taken", "Not taken", "Addr", "Insn", "Location");
+        for (size_t i = 0; i < jumps && i < top; i++) {
+            uint16_t addr = (uint16_t)rows[i].key;
+            uint64_t taken = prof->taken[addr];
+            format_location(&syms, addr, where, sizeof(where));
+            fprintf(out, "%12llu %12llu %12llu  %04X  %-5s  %s\n",
+                    (unsigned long long)rows[i].count, (unsigned long long)taken,
+                    (unsigned long long)(rows[i].count - taken), addr,
+                    mnemonic(prof->opcodes[addr]), where);
+        }
+    }
+
+    // Call targets
+    n = 0;
+    for (uint32_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (prof->calls[addr]) rows[n++] = (Row){ prof->calls[addr], addr };
+    }
+    if (n) {
+        qsort(rows, n, sizeof(Row), compare_rows);
+        fprintf(out, "\nCall targets:\n");
+        fprintf(out, "%12s  %-6s  %s\n", "Calls", "Target", "Location");
+        for (size_t i = 0; i < n && i < top; i++) {
+            format_location(&syms, (uint16_t)rows[i].key, where, sizeof(where));
+            fprintf(out, "%12llu  %04X    %s\n", (unsigned long long)rows[i].count,
+                    (unsigned)rows[i].key, where);
+        }
+    }
+
+    // Opcodes (all of them: there are few)
+    n = 0;
+    for (uint32_t op = 0; op < 256; op++) {
+        if (prof->opcode_counts[op]) rows[n++] = (Row){ prof->opcode_counts[op], op };
+    }
+    qsort(rows, n, sizeof(Row), compare_rows);
+    fprintf(out, "\nOpcodes:\n");
+    fprintf(out, "%12s %7s  %-4s  %s\n", "Count", "%", "Op", "Insn");
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "%12llu %6.2f%%  0x%02X  %s\n", (unsigned long long)rows[i].count,
+                percent(rows[i].count, total), (unsigned)rows[i].key,
+                mnemonic((uint8_t)rows[i].key));
+    }
+
+    free(rows);
+    free(syms.syms);
+}
@@ -0,0 +1,62 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "cpu.h"
+#include "image.h"
+
+//=========================================================
+// Execution profiler
+//=========================================================
+//
+// Counts how often each instruction runs, per address and per
+// opcode, how often each conditional jump is taken, and how often
+// each CALL target is entered. profile_run steps the program itself
+// (with cpu_step, like the trace command) rather than hooking an
+// engine, so the engines carry no profiling code and run at full
+// speed when no profile is taken.
+//
+// Counts are keyed by the address an instruction starts at, so a
+// report can name them by the label they fall under when the
+// program is an executable with symbols (exe.h). Use the report to
+// find the hot loops worth hand-optimizing.
+//
+
+typedef struct {
+    uint64_t counts[MEMORY_SIZE];        // executions per address
+    uint64_t taken[MEMORY_SIZE];         // conditional jumps there taken
+    uint64_t calls[MEMORY_SIZE];         // CALLs per target
+    uint8_t  opcodes[MEMORY_SIZE];       // opcode last run per address
+    uint64_t opcode_counts[256];
+    uint64_t instructions;
+} Profile;
+
+// Rows shown per table by default
+#define PROFILE_TOP 20
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// profile_create / profile_destroy:
+//   Allocate a zeroed profile (NULL if memory runs out) / free it.
+//
+// profile_run:
+//   Step 'cpu' until it halts or faults, adding every instruction
+//   to 'prof'. Profiles of several runs accumulate.
+//
+// profile_report:
+//   Print the profile to 'out': time per label (when 'image' is an
+//   executable with symbols), the 'top' hottest instructions,
+//   conditional jumps, call targets and opcodes, each sorted by
+//   count. Addresses are named after the nearest label at or below
+//   them.
+//
+Profile *profile_create(void);
+void     profile_destroy(Profile *prof);
+void     profile_run(Profile *prof, CPU *cpu);
+void     profile_report(const Profile *prof, const ProgramImage *image,
+                        unsigned top, FILE *out);
+
+#endif // PROFILE_H
@@ -0,0 +1,529 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+#include "cpu_internal.h"
+#include "decode.h"
+#include "image.h"
+#include "jit.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Snapshot ids are unique per process (0 means "no snapshot")
+static atomic_uint_fast64_t next_snapshot_id = 1;
+
+#define PAGE_SIZE  256
+#define PAGE_COUNT (MEMORY_SIZE / PAGE_SIZE)
+
+// Copy everything architectural except memory
+static void copy_registers(CPU *dst, const CPU *src) {
+    memcpy(dst->regs, src->regs, sizeof(dst->regs));
+    dst->flags         = src->flags;
+    dst->lazy_op       = src->lazy_op;
+    dst->lazy_res      = src->lazy_res;
+    dst->lazy_a        = src->lazy_a;
+    dst->lazy_b        = src->lazy_b;
+    dst->running       = src->running;
+    dst->halted        = src->halted;
+    dst->cycles        = src->cycles;
+    dst->timer_enabled = src->timer_enabled;
+    dst->timer_value   = src->timer_value;
+    dst->timer_start   = src->timer_start;
+    dst->timer_latch   = src->timer_latch;
+    dst->timer_compare = src->timer_compare;
+    dst->timer_armed   = src->timer_armed;
+    dst->timer_status  = src->timer_status;
+    dst->write_addr    = src->write_addr;
+    dst->write_len     = src->write_len;
+    dst->print_value   = src->print_value;
+    dst->dma_src       = src->dma_src;
+    dst->dma_dst       = src->dma_dst;
+    dst->dma_len       = src->dma_len;
+    dst->dma_status    = src->dma_status;
+    dst->dma_rate      = src->dma_rate;
+    dst->irq_enabled   = src->irq_enabled;
+    dst->irq_pending   = src->irq_pending;
+    dst->irq_mask      = src->irq_mask;
+    memcpy(dst->events, src->events, sizeof(dst->events));
+    dst->event_count   = src->event_count;
+    dst->event_cycle   = src->event_cycle;
+}
+
+// Copy one page of memory, dropping whatever dst has cached from it.
+// Pages holding cached code are compared first: restoring identical
+// code must not throw its decodes and translations away.
+static void copy_page(CPU *dst, const CPU *src, size_t page) {
+    uint8_t *to = &dst->memory[page * PAGE_SIZE];
+    const uint8_t *from = &src->memory[page * PAGE_SIZE];
+
+    bool decoded = dst->dcache && dst->dcache->live_pages[page];
+    bool translated = dst->jit && dst->jit->code_pages[page];
+    if (!decoded && !translated) {
+        memcpy(to, from, PAGE_SIZE);
+        return;
+    }
+    if (memcmp(to, from, PAGE_SIZE) == 0) {
+        return;
+    }
+
+    memcpy(to, from, PAGE_SIZE);
+    if (decoded) {
+        decode_invalidate(dst->dcache, (uint16_t)(page * PAGE_SIZE), PAGE_SIZE);
+    }
+    if (translated) {
+        for (size_t i = 0; i < PAGE_SIZE; i++) {
+            jit_invalidate(dst->jit, (uint16_t)(page * PAGE_SIZE + i));
+        }
+    }
+}
+
+CpuSnapshot *cpu_snapshot_create(CPU *cpu) {
+    CpuSnapshot *snap = calloc(1, sizeof(CpuSnapshot));
+    if (!snap) {
+        return NULL;
+    }
+
+    cpu_flush_output(cpu);
+    copy_registers(&snap->state, cpu);
+    memcpy(snap->state.memory, cpu->memory, MEMORY_SIZE);
+
+    // The CPU now equals the snapshot: start tracking from here
+    uint64_t id = atomic_fetch_add(&next_snapshot_id, 1);
+    snap->state.snapshot_id = id;
+    cpu->snapshot_id = id;
+    memset(cpu->dirty_pages, 0, sizeof(cpu->dirty_pages));
+    return snap;
+}
+
+void cpu_snapshot_destroy(CpuSnapshot *snap) {
+    free(snap);
+}
+
+void cpu_snapshot_restore(CPU *cpu, const CpuSnapshot *snap) {
+    // The snapshot's own dirty pages are all clear
+    cpu_fork(cpu, &snap->state);
+}
+
+void cpu_fork(CPU *child, const CPU *parent) {
+    cpu_flush_output(child);
+
+    if (child->snapshot_id != 0 && child->snapshot_id == parent->snapshot_id) {
+        // Both equal the same snapshot outside their dirty pages
+        for (size_t page = 0; page < PAGE_COUNT; page++) {
+            if (child->dirty_pages[page] | parent->dirty_pages[page]) {
+                copy_page(child, parent, page);
+            }
+        }
+    } else {
+        memcpy(child->memory, parent->memory, MEMORY_SIZE);
+        if (child->dcache) {
+            decode_cache_flush(child->dcache);
+        }
+        if (child->jit) {
+            jit_flush(child->jit);
+        }
+    }
+
+    // The child differs from the snapshot where the parent does
+    memcpy(child->dirty_pages, parent->dirty_pages, sizeof(child->dirty_pages));
+    child->snapshot_id = parent->snapshot_id;
+    copy_registers(child, parent);
+}
+
+//=========================================================
+// Checkpoint files
+//=========================================================
+
+#define STATE_HEADER_SIZE 8
+#define STATE_EVENT_SIZE  9
+#define STATE_RECORD_SIZE 4
+#define STATE_HASH_SIZE   8
+
+// Largest file: every page stored raw, every event slot in use
+#define STATE_MAX_SIZE (STATE_HEADER_SIZE + STATE_FIELDS_SIZE + 1 + \
+                        CPU_MAX_EVENTS * STATE_EVENT_SIZE + \
+                        PAGE_COUNT * (STATE_RECORD_SIZE + PAGE_SIZE) + STATE_HASH_SIZE)
+
+// Longest run a repeat byte encodes, and shortest worth one
+#define RLE_MIN_RUN 3
+#define RLE_MAX_RUN (0xFF - 0x7D)
+
+// A checkpoint being written or read: 'pos' moves past each field.
+// Reads past 'size' give zeros and set 'overrun'.
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   pos;
+    bool     overrun;
+} StateBuf;
+
+static void put8(StateBuf *b, uint8_t v) {
+    b->data[b->pos++] = v;
+}
+
+static void put16(StateBuf *b, uint16_t v) {
+    put8(b, v & 0xFF);
+    put8(b, (v >> 8) & 0xFF);
+}
+
+static void put64(StateBuf *b, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        put8(b, (uint8_t)(v >> (8 * i)));
+    }
+}
+
+static uint8_t get8(StateBuf *b) {
+    if (b->pos >= b->size) {
+        b->overrun = true;
+        return 0;
+    }
+    return b->data[b->pos++];
+}
+
+static uint16_t get16(StateBuf *b) {
+    uint16_t lo = get8(b);
+    return (uint16_t)(lo | get8(b) << 8);
+}
+
+static uint64_t get64(StateBuf *b) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)get8(b) << (8 * i);
+    }
+    return v;
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t len) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+// The CPU fields, in file order (STATE_FIELDS_SIZE bytes)
+static void put_fields(StateBuf *b, const CPU *cpu) {
+    for (int r = 0; r < 6; r++) {
+        put16(b, cpu->regs[r]);
+    }
+    put8(b, cpu->flags);
+    put8(b, cpu->lazy_op);
+    put16(b, cpu->lazy_res);
+    put16(b, cpu->lazy_a);
+    put16(b, cpu->lazy_b);
+    put8(b, cpu->running);
+    put8(b, cpu->halted);
+    put64(b, cpu->cycles);
+    put8(b, cpu->timer_enabled);
+    put16(b, cpu->timer_value);
+    put64(b, cpu->timer_start);
+    put8(b, cpu->timer_latch);
+    put16(b, cpu->timer_compare);
+    put8(b, cpu->timer_armed);
+    put8(b, cpu->timer_status);
+    put16(b, cpu->write_addr);
+    put16(b, cpu->write_len);
+    put16(b, cpu->print_value);
+    put16(b, cpu->dma_src);
+    put16(b, cpu->dma_dst);
+    put16(b, cpu->dma_len);
+    put8(b, cpu->dma_status);
+    put16(b, cpu->dma_rate);
+    put8(b, cpu->irq_enabled);
+    put8(b, cpu->irq_pending);
+    put8(b, cpu->irq_mask);
+    put64(b, cpu->event_cycle);
+}
+
+static void get_fields(StateBuf *b, CPU *cpu) {
+    for (int r = 0; r < 6; r++) {
+        cpu->regs[r] = get16(b);
+    }
+    cpu->flags         = get8(b);
+    cpu->lazy_op       = get8(b);
+    cpu->lazy_res      = get16(b);
+    cpu->lazy_a        = get16(b);
+    cpu->lazy_b        = get16(b);
+    cpu->running       = get8(b) != 0;
+    cpu->halted        = get8(b) != 0;
+    cpu->cycles        = get64(b);
+    cpu->timer_enabled = get8(b) != 0;
+    cpu->timer_value   = get16(b);
+    cpu->timer_start   = get64(b);
+    cpu->timer_latch   = get8(b);
+    cpu->timer_compare = get16(b);
+    cpu->timer_armed   = get8(b) != 0;
+    cpu->timer_status  = get8(b);
+    cpu->write_addr    = get16(b);
+    cpu->write_len     = get16(b);
+    cpu->print_value   = get16(b);
+    cpu->dma_src       = get16(b);
+    cpu->dma_dst       = get16(b);
+    cpu->dma_len       = get16(b);
+    cpu->dma_status    = get8(b);
+    cpu->dma_rate      = get16(b);
+    cpu->irq_enabled   = get8(b) != 0;
+    cpu->irq_pending   = get8(b);
+    cpu->irq_mask      = get8(b);
+    cpu->event_cycle   = get64(b);
+}
+
+// Append page[from, to) to 'out' as literal blocks; false once the
+// encoding would be no shorter than the page
+static bool rle_literals(const uint8_t *page, size_t from, size_t to,
+                         uint8_t *out, size_t *len) {
+    while (from < to) {
+        size_t n = to - from > 0x80 ? 0x80 : to - from;
+        if (*len + 1 + n >= PAGE_SIZE) return false;
+        out[(*len)++] = (uint8_t)(n - 1);
+        memcpy(&out[*len], &page[from], n);
+        *len += n;
+        from += n;
+    }
+    return true;
+}
+
+// Run-length encode one page into 'out' (room for PAGE_SIZE bytes).
+// Returns the encoded length, or 0 if that would not be shorter.
+static size_t rle_encode(const uint8_t *page, uint8_t *out) {
+    size_t len = 0;
+    size_t literal = 0;       // start of the bytes not yet encoded
+    size_t i = 0;
+    while (i < PAGE_SIZE) {
+        size_t run = 1;
+        while (i + run < PAGE_SIZE && run < RLE_MAX_RUN && page[i + run] == page[i]) {
+            run++;
+        }
+        if (run < RLE_MIN_RUN) {
+            i++;
+            continue;
+        }
+        if (!rle_literals(page, literal, i, out, &len) || len + 2 >= PAGE_SIZE) {
+            return 0;
+        }
+        out[len++] = (uint8_t)(run + 0x7D);
+        out[len++] = page[i];
+        i += run;
+        literal = i;
+    }
+    return rle_literals(page, literal, PAGE_SIZE, out, &len) ? len : 0;
+}
+
+// Decode 'len' bytes into exactly one page; -1 if they do not make one
+static int rle_decode(const uint8_t *in, size_t len, uint8_t *page) {
+    size_t out = 0;
+    size_t i = 0;
+    while (i < len) {
+        uint8_t c = in[i++];
+        if (c < 0x80) {
+            size_t n = (size_t)c + 1;
+            if (i + n > len || out + n > PAGE_SIZE) return -1;
+            memcpy(&page[out], &in[i], n);
+            i += n;
+            out += n;
+        } else {
+            size_t n = (size_t)c - 0x7D;
+            if (i >= len || out + n > PAGE_SIZE) return -1;
+            memset(&page[out], in[i++], n);
+            out += n;
+        }
+    }
+    return out == PAGE_SIZE ? 0 : -1;
+}
+
+static bool page_is_zero(const uint8_t *page) {
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        if (page[i]) return false;
+    }
+    return true;
+}
+
+// Write 'len' bytes to a new file renamed over 'path'; -1 on error
+static int write_file(const char *path, const uint8_t *data, size_t len) {
+    size_t n = strlen(path) + 32;
+    char *tmp = malloc(n);
+    if (!tmp) return -1;
+    snprintf(tmp, n, "%s.%ld.tmp", path, (long)getpid());
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = write(fd, data + done, len - done);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += (size_t)w;
+    }
+    // Synced before the rename, so the name never points at a torn file
+    bool ok = done == len && fsync(fd) == 0;
+    if (close(fd) < 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+int cpu_save_state(CPU *cpu, const char *path, bool compress) {
+    for (unsigned i = 0; i < cpu->event_count; i++) {
+        if (cpu_event_id(cpu->events[i].fn) < 0 || cpu->events[i].ctx) {
+            cpu_error(cpu, "Cannot checkpoint %s: a device event is pending", path);
+            return -1;
+        }
+    }
+
+    StateBuf b = { malloc(STATE_MAX_SIZE), STATE_MAX_SIZE, 0, false };
+    if (!b.data) {
+        cpu_error(cpu, "Out of memory writing checkpoint %s", path);
+        return -1;
+    }
+    cpu_flush_output(cpu);
+
+    memcpy(b.data, STATE_MAGIC, 4);
+    b.pos = 4;
+    put16(&b, STATE_VERSION);
+    size_t pages_pos = b.pos;
+    put16(&b, 0);                       // page count, filled in below
+    put_fields(&b, cpu);
+    put8(&b, cpu->event_count);
+    for (unsigned i = 0; i < cpu->event_count; i++) {
+        put64(&b, cpu->events[i].cycle);
+        put8(&b, (uint8_t)cpu_event_id(cpu->events[i].fn));
+    }
+
+    uint16_t pages = 0;
+    for (size_t page = 0; page < PAGE_COUNT; page++) {
+        const uint8_t *data = &cpu->memory[page * PAGE_SIZE];
+        if (page_is_zero(data)) continue;
+
+        uint8_t *record = &b.data[b.pos];
+        size_t len = compress ? rle_encode(data, record + STATE_RECORD_SIZE) : 0;
+        put8(&b, (uint8_t)page);
+        put8(&b, len ? STATE_PAGE_RLE : STATE_PAGE_RAW);
+        if (!len) {
+            len = PAGE_SIZE;
+            memcpy(record + STATE_RECORD_SIZE, data, PAGE_SIZE);
+        }
+        put16(&b, (uint16_t)len);
+        b.pos += len;
+        pages++;
+    }
+    size_t end = b.pos;
+    b.pos = pages_pos;
+    put16(&b, pages);
+    b.pos = end;
+    put64(&b, fnv1a(b.data, end));
+
+    int rc = write_file(path, b.data, b.pos);
+    free(b.data);
+    if (rc < 0) {
+        cpu_error(cpu, "Cannot write checkpoint %s", path);
+    }
+    return rc;
+}
+
+// Parse checkpoint 'b' into 'state'; NULL on success, else what is wrong
+static const char *parse_state(StateBuf *b, CPU *state) {
+    if (b->size < STATE_HEADER_SIZE + STATE_HASH_SIZE ||
+        memcmp(b->data, STATE_MAGIC, 4) != 0) {
+        return "not a checkpoint";
+    }
+    StateBuf hash = { b->data, b->size, b->size - STATE_HASH_SIZE, false };
+    if (get64(&hash) != fnv1a(b->data, b->size - STATE_HASH_SIZE)) {
+        return "checksum mismatch";
+    }
+    b->size -= STATE_HASH_SIZE;
+
+    b->pos = 4;
+    if (get16(b) != STATE_VERSION) {
+        return "unsupported version";
+    }
+    unsigned pages = get16(b);
+    get_fields(b, state);
+
+    state->event_count = get8(b);
+    if (state->event_count > CPU_MAX_EVENTS) {
+        return "too many events";
+    }
+    for (unsigned i = 0; i < state->event_count; i++) {
+        state->events[i].cycle = get64(b);
+        state->events[i].fn = cpu_event_fn(get8(b));
+        state->events[i].ctx = NULL;
+        if (!state->events[i].fn && !b->overrun) {
+            return "unknown event";
+        }
+    }
+
+    for (unsigned p = 0; p < pages && !b->overrun; p++) {
+        size_t page = get8(b);
+        uint8_t encoding = get8(b);
+        size_t len = get16(b);
+        if (b->overrun || len > b->size - b->pos) {
+            b->overrun = true;
+            break;
+        }
+        uint8_t *to = &state->memory[page * PAGE_SIZE];
+        const uint8_t *from = &b->data[b->pos];
+        if (encoding == STATE_PAGE_RAW) {
+            if (len != PAGE_SIZE) return "bad page length";
+            memcpy(to, from, PAGE_SIZE);
+        } else if (encoding != STATE_PAGE_RLE || rle_decode(from, len, to) < 0) {
+            return "bad page encoding";
+        }
+        b->pos += len;
+    }
+    if (b->overrun) {
+        return "truncated";
+    }
+    if (b->pos != b->size) {
+        return "trailing bytes";
+    }
+    return NULL;
+}
+
+int cpu_load_state(CPU *cpu, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        cpu_error(cpu, "Cannot open checkpoint %s", path);
+        return -1;
+    }
+    ProgramImage file;
+    int rc = image_map_fd(fd, &file);
+    close(fd);
+    if (rc < 0) {
+        cpu_error(cpu, "Cannot read checkpoint %s", path);
+        return -1;
+    }
+
+    // Parsed aside, so a bad file leaves the CPU as it was
+    CPU *state = calloc(1, sizeof(CPU));
+    if (!state) {
+        image_release(&file);
+        cpu_error(cpu, "Out of memory reading checkpoint %s", path);
+        return -1;
+    }
+    StateBuf b = { (uint8_t *)file.data, file.size, 0, false };
+    const char *problem = parse_state(&b, state);
+    image_release(&file);
+    if (problem) {
+        free(state);
+        cpu_error(cpu, "Bad checkpoint %s: %s", path, problem);
+        return -1;
+    }
+
+    // Not derived from any snapshot: gives cpu_fork a full copy later
+    state->snapshot_id = 0;
+    cpu_fork(cpu, state);
+    free(state);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+
+//=========================================================
+// Snapshots and fork
+//=========================================================
+//
+// A snapshot holds a CPU's architectural state: registers, flags,
+// memory, execution status, cycles, timer and pending events (their
+// ctx pointers are copied as they are). It does not hold the
+// device map, output sink, decode cache or JIT; those belong to the
+// CPU a state is restored into and stay as they are.
+//
+// Taking a snapshot starts dirty tracking on the CPU: every RAM write
+// since marks its 256-byte page in dirty_pages. Restoring the same
+// snapshot later copies back only those pages (plus the registers)
+// instead of clearing and reloading all 64 KB, and drops cached
+// decodes / translations only for the pages it rewrites. Restoring
+// a snapshot the CPU did not come from copies everything once, after
+// which restores of that snapshot are incremental again.
+//
+// cpu_fork makes one CPU a copy of another in the same way: when both
+// descend from the same snapshot only pages either of them wrote are
+// copied, every other page being equal already. (memory[] lives
+// inside struct CPU and every engine addresses it directly, so pages
+// are copied rather than shared between CPUs.)
+//
+
+typedef struct CpuSnapshot {
+    CPU state;               // only the architectural fields are used
+} CpuSnapshot;
+
+//=========================================================
+// Checkpoint files
+//=========================================================
+//
+// cpu_save_state writes the state a snapshot holds to a file that
+// cpu_load_state reads back, in this process or another, on this
+// host or another: a long run can stop and carry on later or
+// elsewhere. The file stands alone. All fields are little-endian:
+//
+//   0   "SCPS"              magic
+//   4   u16 version         STATE_VERSION
+//   6   u16 pages           number of page records
+//   8   CPU fields          STATE_FIELDS_SIZE bytes: A-D, SP, PC,
+//                           FLAGS and the lazy-flag record, running,
+//                           halted, cycles, the timer, bulk output,
+//                           DMA and interrupt registers, event_cycle
+//  80   u8 events           then per event: u64 cycle, u8 number
+//       page records        u8 page, u8 STATE_PAGE_*, u16 length,
+//                           'length' bytes
+//       u64                 FNV-1a hash of every byte before it
+//
+// Only pages holding a non-zero byte are stored, so the size follows
+// the memory a program uses; the rest load as zeros. Compressed, a
+// page is stored run-length encoded where that is smaller
+// (STATE_PAGE_RLE: a byte c < 0x80 copies the next c + 1 bytes, one
+// c >= 0x80 repeats the next byte c - 0x7D times).
+//
+// Events are saved by number, so only the built-in devices' can be
+// (console input, timer compare, DMA): another device's events hold
+// host pointers. Saving writes a new file beside 'path' and renames
+// it over the old one, so a crash mid-write leaves the previous
+// checkpoint whole.
+//
+
+#define STATE_MAGIC       "SCPS"
+#define STATE_VERSION     1
+#define STATE_FIELDS_SIZE 72
+
+#define STATE_PAGE_RAW 0
+#define STATE_PAGE_RLE 1
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// cpu_snapshot_create / cpu_snapshot_destroy:
+//   Capture the state of 'cpu' (its pending output is flushed first),
+//   or NULL if out of memory / release a snapshot. The CPU's dirty
+//   pages are cleared.
+//
+// cpu_snapshot_restore:
+//   Put 'cpu' back into the snapshot's state. Pending output is
+//   flushed first.
+//
+// cpu_fork:
+//   Make 'child' a copy of the state of 'parent' (a different CPU).
+//   The child keeps its own devices, output sink and caches; pending
+//   child output is flushed first.
+//
+// cpu_save_state:
+//   Write the state of 'cpu' to the checkpoint file 'path' (pending
+//   output is flushed first), run-length encoding pages if
+//   'compress'. Returns 0 on success, -1 (reported to the CPU's
+//   error handler) if the file cannot be written or an event is not
+//   a built-in one.
+//
+// cpu_load_state:
+//   Put 'cpu' into the state saved in 'path', as cpu_snapshot_restore
+//   would: devices, output sink and caches stay, decodes and
+//   translations of memory are dropped. Returns 0 on success, -1
+//   (reported to the CPU's error handler, the CPU unchanged) if the
+//   file cannot be read or is not a whole checkpoint of this version.
+//
+CpuSnapshot *cpu_snapshot_create(CPU *cpu);
+void         cpu_snapshot_destroy(CpuSnapshot *snap);
+void         cpu_snapshot_restore(CPU *cpu, const CpuSnapshot *snap);
+void         cpu_fork(CPU *child, const CPU *parent);
+int          cpu_save_state(CPU *cpu, const char *path, bool compress);
+int          cpu_load_state(CPU *cpu, const char *path);
+
+#endif // SNAPSHOT_H
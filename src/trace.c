@@ -0,0 +1,539 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "cpu_internal.h"
+#include "image.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+//=========================================================
+// Trace writer
+//=========================================================
+//
+// The stepping thread fills one chunk at a time and hands it to the
+// drain thread, which writes it out while the next one fills. The
+// stepping thread only waits when all TRACE_CHUNKS are queued, i.e.
+// when the disk cannot keep up.
+//
+
+#define TRACE_CHUNK_SIZE  (256u * 1024)
+#define TRACE_CHUNKS      8
+
+// Room reserved per record: the largest (tag, 3-byte PC delta, five
+// registers, flags and a word write) is 19 bytes
+#define TRACE_RECORD_MAX  32
+
+typedef struct {
+    FILE           *file;
+    uint8_t        *chunks;              // TRACE_CHUNKS * TRACE_CHUNK_SIZE
+    size_t          lens[TRACE_CHUNKS];
+    uint64_t        filled;              // chunks handed over ...
+    uint64_t        drained;             // ... and written (under lock)
+    bool            closing;
+    bool            failed;              // a write failed
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    pthread_t       thread;
+
+    // Stepping thread's current chunk
+    uint8_t        *cur;
+    size_t          len;
+} TraceWriter;
+
+static void *drain_main(void *arg) {
+    TraceWriter *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->drained == w->filled && !w->closing) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        if (w->drained == w->filled) break;
+        size_t i = w->drained % TRACE_CHUNKS;
+        size_t len = w->lens[i];
+        pthread_mutex_unlock(&w->lock);
+
+        bool ok = fwrite(w->chunks + i * TRACE_CHUNK_SIZE, 1, len, w->file) == len;
+
+        pthread_mutex_lock(&w->lock);
+        if (!ok) w->failed = true;
+        w->drained++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static int writer_open(TraceWriter *w, const char *path) {
+    memset(w, 0, sizeof(*w));
+    w->chunks = malloc((size_t)TRACE_CHUNKS * TRACE_CHUNK_SIZE);
+    if (!w->chunks) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    w->file = fopen(path, "wb");
+    if (!w->file) {
+        fprintf(stderr, "Cannot create file: %s\n", path);
+        free(w->chunks);
+        return -1;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, drain_main, w) != 0) {
+        fprintf(stderr, "Cannot start trace writer\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        fclose(w->file);
+        free(w->chunks);
+        return -1;
+    }
+    w->cur = w->chunks;
+    return 0;
+}
+
+// Queue the current chunk and move to the next free one
+static void writer_submit(TraceWriter *w) {
+    pthread_mutex_lock(&w->lock);
+    w->lens[w->filled % TRACE_CHUNKS] = w->len;
+    w->filled++;
+    pthread_cond_broadcast(&w->cond);
+    while (w->filled - w->drained == TRACE_CHUNKS) {
+        pthread_cond_wait(&w->cond, &w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+    w->cur = w->chunks + (w->filled % TRACE_CHUNKS) * TRACE_CHUNK_SIZE;
+    w->len = 0;
+}
+
+// Room for one more record
+static inline uint8_t *writer_reserve(TraceWriter *w) {
+    if (w->len > TRACE_CHUNK_SIZE - TRACE_RECORD_MAX) {
+        writer_submit(w);
+    }
+    return w->cur + w->len;
+}
+
+// Append 'len' bytes of any size, across chunks if need be
+static void writer_append(TraceWriter *w, const uint8_t *data, size_t len) {
+    while (len) {
+        if (w->len == TRACE_CHUNK_SIZE) {
+            writer_submit(w);
+        }
+        size_t n = TRACE_CHUNK_SIZE - w->len;
+        if (n > len) n = len;
+        memcpy(w->cur + w->len, data, n);
+        w->len += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// Flush what is left and stop the drain thread
+static int writer_close(TraceWriter *w, const char *path) {
+    if (w->len) writer_submit(w);
+    pthread_mutex_lock(&w->lock);
+    w->closing = true;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    bool failed = w->failed;
+    if (fclose(w->file) != 0) failed = true;
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->chunks);
+    if (failed) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+//=========================================================
+// Encoding
+//=========================================================
+
+static inline uint8_t *put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+// A signed 16-bit PC step as a small unsigned number
+static inline uint16_t zigzag(uint16_t delta) {
+    int16_t d = (int16_t)delta;
+    return (uint16_t)((uint16_t)d << 1) ^ (uint16_t)(d >> 15);
+}
+
+static inline uint16_t unzigzag(uint16_t z) {
+    return (uint16_t)(z >> 1) ^ (uint16_t)-(z & 1);
+}
+
+// The write the instruction at the CPU's PC is about to make, as a
+// tag bit (0 if none). Operands are read from RAM, which is where
+// every engine fetches them below the I/O page.
+static uint8_t pending_write(CPU *cpu, uint16_t *addr, uint16_t *value) {
+    const uint8_t *mem = cpu->memory;
+    uint16_t pc = cpu->regs[REG_PC];
+    uint16_t operand = (uint16_t)(mem[(uint16_t)(pc + 1)] |
+                                  mem[(uint16_t)(pc + 2)] << 8);
+
+    switch (mem[pc]) {
+        case OP_STORE:
+            *addr  = operand;
+            *value = cpu_get_reg(cpu, mem[(uint16_t)(pc + 3)]);
+            return TRACE_TAG_WRITE_WORD;
+        case OP_PUSH:
+            *addr  = cpu->regs[REG_SP] - 2;
+            *value = cpu_get_reg(cpu, mem[(uint16_t)(pc + 1)]);
+            return TRACE_TAG_WRITE_WORD;
+        case OP_CALL:
+            *addr  = cpu->regs[REG_SP] - 2;
+            *value = pc + 3;
+            return TRACE_TAG_WRITE_WORD;
+        case OP_OUT:
+            *addr  = operand;
+            *value = cpu_get_reg(cpu, mem[(uint16_t)(pc + 3)]) & 0xFF;
+            return TRACE_TAG_WRITE_BYTE;
+        default:
+            return 0;
+    }
+}
+
+//=========================================================
+// Recording
+//=========================================================
+
+// Console output of the instruction being stepped, passed on to the
+// sink the CPU had before recording
+typedef struct {
+    CpuOutput sink;
+    uint8_t  *buf;
+    size_t    len;
+    size_t    cap;
+    bool      failed;            // out of memory: bytes were lost
+} TraceOutput;
+
+static void output_capture(void *ctx, const uint8_t *data, size_t len) {
+    TraceOutput *o = ctx;
+    if (o->sink.write) {
+        o->sink.write(o->sink.ctx, data, len);
+    } else {
+        fwrite(data, 1, len, stdout);
+    }
+
+    if (o->len + len > o->cap) {
+        size_t cap = o->cap ? o->cap : 256;
+        while (cap < o->len + len) cap *= 2;
+        uint8_t *buf = realloc(o->buf, cap);
+        if (!buf) {
+            o->failed = true;
+            return;
+        }
+        o->buf = buf;
+        o->cap = cap;
+    }
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+}
+
+// Append the output captured since the last call, if any
+static void record_output(TraceWriter *w, TraceOutput *o) {
+    if (!o->len) return;
+    uint8_t *q = writer_reserve(w);
+    *q++ = TRACE_TAG_OUTPUT;
+    q = put_varint(q, o->len);
+    w->len = (size_t)(q - w->cur);
+    writer_append(w, o->buf, o->len);
+    o->len = 0;
+}
+
+// The interrupt entry that just moved SP down from 'sp': the words
+// it pushed, in push order
+static void record_pushes(TraceWriter *w, const CPU *cpu, uint16_t sp) {
+    while (sp != cpu->regs[REG_SP]) {
+        sp -= 2;
+        uint8_t *q = writer_reserve(w);
+        *q++ = TRACE_TAG_PUSH;
+        q = put_u16(q, sp);
+        q = put_u16(q, (uint16_t)(cpu->memory[sp] | cpu->memory[(uint16_t)(sp + 1)] << 8));
+        w->len = (size_t)(q - w->cur);
+    }
+}
+
+// The DMA command byte a write puts in PORT_DMA_CTRL, or 0 if the
+// write does not reach it
+static uint8_t dma_command(uint8_t write, uint16_t addr, uint16_t value) {
+    if (addr == PORT_DMA_CTRL) return value & 0xFF;
+    if (write == TRACE_TAG_WRITE_WORD && addr == PORT_DMA_CTRL - 1) return value >> 8;
+    return 0;
+}
+
+// The block a DMA transfer just wrote, if 'cmd' started one
+static void record_dma(TraceWriter *w, const CPU *cpu, uint8_t cmd) {
+    if ((cmd != DMA_CMD_COPY && cmd != DMA_CMD_FILL) ||
+        (cpu->dma_status & DMA_STATUS_ERROR) || cpu->dma_len == 0) {
+        return;
+    }
+    uint8_t *q = writer_reserve(w);
+    *q++ = TRACE_TAG_BLOCK;
+    q = put_u16(q, cpu->dma_dst);
+    q = put_varint(q, cpu->dma_len);
+    w->len = (size_t)(q - w->cur);
+    writer_append(w, &cpu->memory[cpu->dma_dst], cpu->dma_len);
+}
+
+int trace_record(CPU *cpu, const char *path, uint64_t *instructions) {
+    *instructions = 0;
+    TraceWriter w;
+    if (writer_open(&w, path) < 0) return -1;
+
+    // Unbuffered, so each instruction's output is seen as it runs
+    cpu_flush_output(cpu);
+    TraceOutput output = { .sink = cpu->output };
+    cpu_set_output(cpu, output_capture, &output, NULL, 0);
+
+    // Header: the state the first record's deltas start from
+    uint16_t prev[6];
+    memcpy(prev, cpu->regs, sizeof(prev));
+    uint8_t prev_flags = cpu_get_flags(cpu);
+
+    uint8_t *p = w.cur;
+    memcpy(p, TRACE_MAGIC, 4);
+    put_u16(p + 4, TRACE_VERSION);
+    put_u16(p + 6, 0);
+    for (int i = 0; i < 8; i++) {
+        p[8 + i] = (uint8_t)(cpu->cycles >> (8 * i));
+    }
+    for (int r = 0; r < 6; r++) {
+        put_u16(p + 16 + 2 * r, prev[r]);
+    }
+    p[28] = prev_flags;
+    memset(p + 29, 0, 3);
+    w.len = TRACE_HEADER_SIZE;
+
+    // Step until HLT or error, as the trace command does: cpu_step
+    // counts one cycle per instruction, so cycles are implied
+    uint64_t count = 0;
+    while (!cpu->halted) {
+        // Record the state the instruction really starts from
+        // (and list the words an interrupt entry pushes)
+        if (cpu->cycles >= cpu->event_cycle) {
+            uint16_t sp = cpu->regs[REG_SP];
+            cpu_run_events(cpu);
+            record_pushes(&w, cpu, sp);
+        }
+        uint8_t *rec = writer_reserve(&w);
+        uint8_t *q = rec + 1;
+        uint8_t tag = 0;
+
+        uint16_t pc = cpu->regs[REG_PC];
+        q = put_varint(q, zigzag(pc - prev[REG_PC]));
+        prev[REG_PC] = pc;
+        for (int r = REG_A; r <= REG_SP; r++) {
+            if (cpu->regs[r] != prev[r]) {
+                tag |= 1u << r;
+                prev[r] = cpu->regs[r];
+                q = put_u16(q, prev[r]);
+            }
+        }
+        uint8_t flags = cpu_get_flags(cpu);
+        if (flags != prev_flags) {
+            tag |= TRACE_TAG_FLAGS;
+            prev_flags = flags;
+            *q++ = flags;
+        }
+
+        // A transfer starts only if the built-in controller is idle
+        // when the command reaches it
+        uint16_t addr = 0, value = 0;
+        uint8_t write = pending_write(cpu, &addr, &value);
+        uint8_t dma_cmd = write && cpu_builtin_port(cpu, PORT_DMA_CTRL) &&
+                          !(cpu->dma_status & DMA_STATUS_BUSY)
+                          ? dma_command(write, addr, value) : 0;
+        int rc = cpu_step(cpu);
+        if (rc < 0) {
+            write = 0;                  // faulted before writing
+        }
+        if (write) {
+            tag |= write;
+            q = put_u16(q, addr);
+            if (write == TRACE_TAG_WRITE_WORD) {
+                q = put_u16(q, value);
+            } else {
+                *q++ = (uint8_t)value;
+            }
+        }
+
+        rec[0] = tag;
+        w.len = (size_t)(q - w.cur);
+        if (dma_cmd && rc >= 0) {
+            record_dma(&w, cpu, dma_cmd);
+        }
+        record_output(&w, &output);
+        count++;
+        if (rc < 0) break;
+    }
+    cpu_set_output(cpu, output.sink.write, output.sink.ctx, output.sink.buf, output.sink.size);
+    free(output.buf);
+
+    uint8_t *q = writer_reserve(&w);
+    *q++ = TRACE_TAG_END;
+    q = put_varint(q, cpu->cycles);
+    w.len = (size_t)(q - w.cur);
+
+    *instructions = count;
+    int rc = writer_close(&w, path);
+    if (rc == 0 && output.failed) {
+        fprintf(stderr, "Out of memory: console output missing from %s\n", path);
+        rc = -1;
+    }
+    return rc;
+}
+
+//=========================================================
+// Rendering
+//=========================================================
+
+// Read a varint of at most 'max_bits' from [*p, end)
+static bool get_varint(const uint8_t **p, const uint8_t *end, unsigned max_bits,
+                       uint64_t *value) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < max_bits; shift += 7) {
+        if (*p == end) return false;
+        uint8_t b = *(*p)++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+int trace_dump(const char *path, FILE *out, bool writes) {
+    ProgramImage file;
+    if (image_map_file(path, &file) < 0) {
+        fprintf(stderr, "%s: %s\n", file.error, path);
+        return -1;
+    }
+
+    const uint8_t *p = file.data, *end = file.data + file.size;
+    if (file.size < TRACE_HEADER_SIZE || memcmp(p, TRACE_MAGIC, 4) != 0 ||
+        get_u16(p + 4) != TRACE_VERSION) {
+        fprintf(stderr, "Not a trace file: %s\n", path);
+        image_release(&file);
+        return -1;
+    }
+
+    uint64_t cycles = 0;
+    for (int i = 0; i < 8; i++) {
+        cycles |= (uint64_t)p[8 + i] << (8 * i);
+    }
+    uint16_t regs[6];
+    for (int r = 0; r < 6; r++) {
+        regs[r] = get_u16(p + 16 + 2 * r);
+    }
+    p += TRACE_HEADER_SIZE;
+
+    fprintf(out, "=== Execution Trace ===\n");
+    int rc = -1;
+    while (p < end) {
+        uint8_t tag = *p++;
+        if (tag == TRACE_TAG_END) {
+            uint64_t total;
+            if (!get_varint(&p, end, 64, &total)) break;
+            fprintf(out, "=== End Trace ===\n");
+            fprintf(out, "Total cycles: %llu\n", (unsigned long long)total);
+            rc = 0;
+            break;
+        }
+        if (tag == TRACE_TAG_OUTPUT) {
+            // The console bytes the trace command showed here
+            uint64_t len;
+            if (!get_varint(&p, end, 64, &len) || (uint64_t)(end - p) < len) break;
+            fwrite(p, 1, (size_t)len, out);
+            p += len;
+            continue;
+        }
+        if (tag == TRACE_TAG_BLOCK) {
+            uint64_t len;
+            if ((size_t)(end - p) < 2) break;
+            uint16_t addr = get_u16(p);
+            p += 2;
+            if (!get_varint(&p, end, 64, &len) || (uint64_t)(end - p) < len) break;
+            for (uint64_t i = 0; writes && i < len; i += 16) {
+                fprintf(out, "    [%04X] <-", (uint16_t)(addr + i));
+                for (uint64_t j = i; j < len && j < i + 16; j++) {
+                    fprintf(out, " %02X", p[j]);
+                }
+                fputc('\n', out);
+            }
+            p += len;
+            continue;
+        }
+        if (tag == TRACE_TAG_PUSH) {
+            if ((size_t)(end - p) < 4) break;
+            if (writes) {
+                fprintf(out, "    [%04X] <- %04X (interrupt entry)\n",
+                        get_u16(p), get_u16(p + 2));
+            }
+            p += 4;
+            continue;
+        }
+        if ((tag & TRACE_TAG_END) == TRACE_TAG_END) {
+            break;                          // no such entry
+        }
+
+        uint64_t delta;
+        if (!get_varint(&p, end, 21, &delta)) break;
+        regs[REG_PC] += unzigzag((uint16_t)delta);
+
+        unsigned write = tag & TRACE_TAG_END;
+        size_t need = 2u * __builtin_popcount(tag & 0x1F) + !!(tag & TRACE_TAG_FLAGS) +
+                      (write ? 2u + (write == TRACE_TAG_WRITE_WORD ? 2u : 1u) : 0u);
+        if ((size_t)(end - p) < need) break;
+        for (int r = REG_A; r <= REG_SP; r++) {
+            if (tag & (1u << r)) {
+                regs[r] = get_u16(p);
+                p += 2;
+            }
+        }
+        if (tag & TRACE_TAG_FLAGS) p++;    // not shown
+
+        fprintf(out, "CYC=%10llu PC=%04X A=%04X B=%04X C=%04X D=%04X\n",
+                (unsigned long long)cycles,
+                regs[REG_PC], regs[REG_A], regs[REG_B], regs[REG_C], regs[REG_D]);
+        cycles++;
+
+        if (write) {
+            uint16_t addr = get_u16(p);
+            unsigned width = write == TRACE_TAG_WRITE_WORD ? 2 : 1;
+            uint16_t value = width == 2 ? get_u16(p + 2) : p[2];
+            p += 2 + width;
+            if (writes) {
+                fprintf(out, width == 2 ? "    [%04X] <- %04X\n" : "    [%04X] <- %02X\n",
+                        addr, value);
+            }
+        }
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "Trace ends early: %s\n", path);
+    }
+    image_release(&file);
+    return rc;
+}
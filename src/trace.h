@@ -0,0 +1,86 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "cpu.h"
+
+//=========================================================
+// Binary execution traces
+//=========================================================
+//
+// The trace command prints a line per instruction, which limits it
+// to the speed of printf. A recorded trace instead stores one
+// compact record per instruction in a ring of buffers that a
+// background thread drains to disk, so the CPU only pays for the
+// encoding; trace_dump renders the file as text afterwards.
+//
+// File layout (16-bit fields little-endian):
+//
+//   header   "SCTR", u16 version, u16 0, u64 cycles,
+//            u16 A, B, C, D, SP, PC, u8 flags, 3 bytes 0
+//   records  one per instruction, giving the state before it runs:
+//            u8 tag, PC delta, changed registers, then the write it
+//            made, if any
+//   output   after the record of an instruction that printed:
+//            u8 TRACE_TAG_OUTPUT, length (varint), the console bytes
+//   block    after the record of an instruction that started a DMA
+//            transfer: u8 TRACE_TAG_BLOCK, u16 address, length
+//            (varint), the bytes it wrote there
+//   push     before the record of an interrupt handler's first
+//            instruction, one per word interrupt entry pushed:
+//            u8 TRACE_TAG_PUSH, u16 address, u16 value
+//   end      u8 TRACE_TAG_END, total cycles (varint)
+//
+// Tag bits 0-4 mark A, B, C, D and SP as changed since the previous
+// record; each changed register follows as a u16, then FLAGS as a u8
+// if bit 5 is set. The PC delta is the signed 16-bit distance from
+// the previous record's PC, zigzag-encoded as a varint, so straight
+// line code takes one byte. Bit 6 (a byte) or bit 7 (a word) says
+// the instruction wrote memory or a port: a u16 address and the
+// value follow. Records are one cycle apart, starting at the
+// header's cycle count. Tags with both write bits set are not
+// records but the other entries above.
+//
+// Console output is taken from the CPU's output sink while
+// recording, not inferred from writes, so every output port (single
+// bytes, strings, decimals) is rendered as the program printed it.
+//
+
+#define TRACE_MAGIC        "SCTR"
+#define TRACE_VERSION      2
+#define TRACE_HEADER_SIZE  32
+
+#define TRACE_TAG_FLAGS      0x20
+#define TRACE_TAG_WRITE_BYTE 0x40
+#define TRACE_TAG_WRITE_WORD 0x80
+#define TRACE_TAG_END        (TRACE_TAG_WRITE_BYTE | TRACE_TAG_WRITE_WORD)
+#define TRACE_TAG_OUTPUT     (TRACE_TAG_END | 0x01)
+#define TRACE_TAG_BLOCK      (TRACE_TAG_END | 0x02)
+#define TRACE_TAG_PUSH       (TRACE_TAG_END | 0x03)
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// trace_record:
+//   Step 'cpu' with cpu_step until it halts or faults, like the
+//   trace command, writing a record per instruction to 'path'.
+//   Console output still reaches the CPU's output sink as well.
+//   *instructions receives the number recorded. Returns 0 on
+//   success, -1 (reported on stderr) if the file cannot be written.
+//
+// trace_dump:
+//   Render the trace at 'path' to 'out' exactly as the trace command
+//   prints it, console output included. With 'writes', every memory
+//   and port write is also listed under its instruction, DMA
+//   transfers included; the words interrupt entry pushes are listed
+//   just before the handler's first instruction. Returns 0
+//   on success, -1 (reported on stderr) if the file is not a trace
+//   or ends early.
+//
+int trace_record(CPU *cpu, const char *path, uint64_t *instructions);
+int trace_dump(const char *path, FILE *out, bool writes);
+
+#endif // TRACE_H
@@ -0,0 +1,449 @@
+#include "verify.h"
+#include "cpu_internal.h"
+#include "decode.h"
+#include "isa.h"
+#include "jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAGE_SIZE  256
+#define PAGE_COUNT (MEMORY_SIZE / PAGE_SIZE)
+
+//=========================================================
+// Console replay
+//=========================================================
+
+// One CPU's view of the shared input, and a hash of its output
+typedef struct {
+    const uint8_t *data;
+    size_t         size;
+    size_t         pos;
+    uint64_t       out_hash;     // FNV-1a over every output byte
+    uint64_t       out_bytes;
+} Console;
+
+#define FNV_OFFSET 0xCBF29CE484222325ull
+#define FNV_PRIME  0x00000100000001B3ull
+
+static void hash_write(void *ctx, const uint8_t *data, size_t len) {
+    Console *con = ctx;
+    for (size_t i = 0; i < len; i++) {
+        con->out_hash = (con->out_hash ^ data[i]) * FNV_PRIME;
+    }
+    con->out_bytes += len;
+}
+
+// PORT_STDIN: the next input byte, 0 at EOF
+static uint8_t replay_read(CPU *cpu, uint16_t port, void *ctx) {
+    (void)port;
+    Console *con = ctx;
+    if (con->pos == con->size) {
+        return 0;
+    }
+    uint8_t ch = con->data[con->pos++];
+    if ((cpu->irq_mask & (1u << IRQ_STDIN)) && con->pos < con->size) {
+        cpu_raise_irq(cpu, IRQ_STDIN);
+    }
+    return ch;
+}
+
+// PORT_STDIN_STATUS: READY while input is left, then EOF
+static uint8_t replay_status(CPU *cpu, uint16_t port, void *ctx) {
+    (void)cpu; (void)port;
+    const Console *con = ctx;
+    return con->pos < con->size ? STDIN_STATUS_READY : STDIN_STATUS_EOF;
+}
+
+static void console_attach(CPU *cpu, Console *con, const VerifyOptions *opts) {
+    *con = (Console){ opts->input, opts->input_size, 0, FNV_OFFSET, 0 };
+    cpu_register_device(cpu, PORT_STDIN,        1, replay_read,   NULL, con);
+    cpu_register_device(cpu, PORT_STDIN_STATUS, 1, replay_status, NULL, con);
+    cpu_set_output(cpu, hash_write, con, NULL, 0);
+}
+
+//=========================================================
+// State comparison
+//=========================================================
+
+// Parts of the state a checkpoint compares
+enum {
+    DIFF_REGS    = 1u << 0,
+    DIFF_FLAGS   = 1u << 1,
+    DIFF_STATUS  = 1u << 2,      // cycles, halted, faulted
+    DIFF_TIMER   = 1u << 3,
+    DIFF_IRQ     = 1u << 4,
+    DIFF_DEVICES = 1u << 5,      // DMA and bulk output registers
+    DIFF_EVENTS  = 1u << 6,
+    DIFF_OUTPUT  = 1u << 7,
+    DIFF_MEMORY  = 1u << 8,
+};
+
+static const char *const diff_names[] = {
+    "registers", "flags", "cycles/status", "timer", "interrupts",
+    "devices", "events", "output", "memory",
+};
+
+#define DIFF_NAME_COUNT (sizeof(diff_names) / sizeof(diff_names[0]))
+
+// First differing byte of one page, or -1
+static int32_t page_diff(const CPU *a, const CPU *b, size_t page) {
+    const uint8_t *x = &a->memory[page * PAGE_SIZE];
+    const uint8_t *y = &b->memory[page * PAGE_SIZE];
+    if (memcmp(x, y, PAGE_SIZE) == 0) {
+        return -1;
+    }
+    size_t i = 0;
+    while (x[i] == y[i]) i++;
+    return (int32_t)(page * PAGE_SIZE + i);
+}
+
+// Compare 'ref' and 'test' (every page when 'all_pages', otherwise
+// those either wrote) and return the DIFF_* bits that differ;
+// '*mem_addr' gets the first differing address
+static unsigned compare(CPU *ref, CPU *test, const Console *ref_con,
+                        const Console *test_con, bool all_pages,
+                        int32_t *mem_addr) {
+    unsigned diff = 0;
+    if (memcmp(ref->regs, test->regs, sizeof(ref->regs)) != 0) diff |= DIFF_REGS;
+    if (cpu_get_flags(ref) != cpu_get_flags(test)) diff |= DIFF_FLAGS;
+    if (ref->cycles != test->cycles || ref->halted != test->halted ||
+        ref->running != test->running) {
+        diff |= DIFF_STATUS;
+    }
+    if (ref->timer_enabled != test->timer_enabled ||
+        cpu_timer_value(ref) != cpu_timer_value(test) ||
+        ref->timer_latch   != test->timer_latch   ||
+        ref->timer_compare != test->timer_compare ||
+        ref->timer_armed   != test->timer_armed   ||
+        ref->timer_status  != test->timer_status) {
+        diff |= DIFF_TIMER;
+    }
+    if (ref->irq_enabled != test->irq_enabled || ref->irq_pending != test->irq_pending ||
+        ref->irq_mask != test->irq_mask) {
+        diff |= DIFF_IRQ;
+    }
+    if (ref->dma_src != test->dma_src || ref->dma_dst != test->dma_dst ||
+        ref->dma_len != test->dma_len || ref->dma_status != test->dma_status ||
+        ref->write_addr != test->write_addr || ref->write_len != test->write_len ||
+        ref->print_value != test->print_value) {
+        diff |= DIFF_DEVICES;
+    }
+    // Event contexts are per CPU (e.g. a console); compare what runs when
+    if (ref->event_count != test->event_count) {
+        diff |= DIFF_EVENTS;
+    } else {
+        for (unsigned i = 0; i < ref->event_count; i++) {
+            if (ref->events[i].cycle != test->events[i].cycle ||
+                ref->events[i].fn != test->events[i].fn) {
+                diff |= DIFF_EVENTS;
+            }
+        }
+    }
+    if (ref_con->out_hash != test_con->out_hash || ref_con->out_bytes != test_con->out_bytes) {
+        diff |= DIFF_OUTPUT;
+    }
+
+    *mem_addr = -1;
+    for (size_t page = 0; page < PAGE_COUNT; page++) {
+        if (!all_pages && !ref->dirty_pages[page] && !test->dirty_pages[page]) {
+            continue;
+        }
+        int32_t at = page_diff(ref, test, page);
+        if (at >= 0) {
+            diff |= DIFF_MEMORY;
+            *mem_addr = at;
+            break;
+        }
+    }
+    return diff;
+}
+
+// One side of a divergence report
+static void dump_side(const char *title, CPU *cpu, const Console *con, int32_t mem_addr) {
+    printf("--- %s ---", title);
+    cpu_dump_registers(cpu);
+    printf("Status: %s  Timer: %s 0x%04X (compare 0x%04X%s, status 0x%02X)\n",
+           !cpu->halted ? "running" : cpu->running ? "faulted" : "halted",
+           cpu->timer_enabled ? "on" : "off", cpu_timer_value(cpu), cpu->timer_compare,
+           cpu->timer_armed ? " armed" : "", cpu->timer_status);
+    printf("Interrupts: %s pending 0x%02X mask 0x%02X  DMA status 0x%02X  Events: %u\n",
+           cpu->irq_enabled ? "on" : "off", cpu->irq_pending, cpu->irq_mask,
+           cpu->dma_status, cpu->event_count);
+    printf("Output: %llu bytes, hash %016llX\n",
+           (unsigned long long)con->out_bytes, (unsigned long long)con->out_hash);
+    if (mem_addr >= 0) {
+        uint16_t start = (uint16_t)(mem_addr & ~0xF);
+        uint16_t end   = start <= 0xFFE0 ? (uint16_t)(start + 0x1F) : 0xFFFF;
+        cpu_dump_memory(cpu, start, end);
+    }
+}
+
+static void report(CPU *ref, CPU *test, const Console *ref_con, const Console *test_con,
+                   unsigned diff, int32_t mem_addr, uint64_t from, uint16_t from_pc) {
+    printf("Divergence in instructions %llu-%llu (the window started at PC=0x%04X):",
+           (unsigned long long)from, (unsigned long long)test->cycles, from_pc);
+    for (size_t i = 0; i < DIFF_NAME_COUNT; i++) {
+        if (diff & (1u << i)) printf(" %s", diff_names[i]);
+    }
+    if (mem_addr >= 0) {
+        printf(" (first at 0x%04X)", (unsigned)mem_addr);
+    }
+    printf("\n\n");
+    dump_side("reference (switch)", ref, ref_con, mem_addr);
+    dump_side("engine under test", test, test_con, mem_addr);
+}
+
+//=========================================================
+// Lockstep run
+//=========================================================
+
+// The engine's own entry point, stopping at or shortly after 'limit'
+static void run_test_engine(CPU *cpu, CpuEngine engine, uint64_t limit) {
+    switch (engine) {
+    case CPU_ENGINE_JIT:      cpu_run_jit_limit(cpu, limit);  break;
+    case CPU_ENGINE_THREADED: cpu_run_fast_limit(cpu, limit); break;
+    default:                  cpu_run_limit(cpu, limit);      break;
+    }
+}
+
+static void settle_events(CPU *cpu) {
+    if (!cpu->halted && cpu->cycles >= cpu->event_cycle) {
+        cpu_run_events(cpu);
+    }
+}
+
+static CpuStop stop_reason(const CPU *cpu) {
+    if (!cpu->halted) {
+        return CPU_STOP_BUDGET;
+    }
+    return cpu->running ? CPU_STOP_FAULT : CPU_STOP_HALT;
+}
+
+int verify_program(const ProgramImage *image, const VerifyOptions *opts,
+                   VerifyResult *result) {
+    memset(result, 0, sizeof(*result));
+    uint64_t every = opts->every ? opts->every : 1;
+
+    CPU *ref  = malloc(sizeof(CPU));
+    CPU *test = malloc(sizeof(CPU));
+    Console *cons = malloc(2 * sizeof(Console));
+    DecodeCache *dcache = NULL;
+    Jit *jit = NULL;
+    int rc = -1;
+
+    if (!ref || !test || !cons) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    cpu_init(ref);
+    cpu_init(test);
+    if (opts->engine != CPU_ENGINE_SWITCH) {
+        dcache = decode_cache_create();
+        cpu_attach_decode_cache(test, dcache);
+    }
+    if (opts->engine == CPU_ENGINE_JIT) {
+        jit = jit_create(0);
+        cpu_attach_jit(test, jit);
+    }
+    console_attach(ref, &cons[0], opts);
+    console_attach(test, &cons[1], opts);
+    if (image_load(ref, image, NULL) < 0 || image_load(test, image, NULL) < 0) {
+        goto done;
+    }
+
+    int32_t  mem_addr;
+    uint64_t from    = 0;
+    uint16_t from_pc = ref->regs[REG_PC];
+    unsigned diff    = compare(ref, test, &cons[0], &cons[1], true, &mem_addr);
+
+    while (!diff) {
+        memset(ref->dirty_pages, 0, sizeof(ref->dirty_pages));
+        memset(test->dirty_pages, 0, sizeof(test->dirty_pages));
+        result->checkpoints++;
+        if (ref->halted || test->cycles >= opts->max_cycles) {
+            break;
+        }
+
+        // The engine runs ahead, the reference catches up with it
+        uint64_t limit = opts->max_cycles - test->cycles > every
+                       ? test->cycles + every : opts->max_cycles;
+        run_test_engine(test, opts->engine, limit);
+        cpu_run_limit(ref, test->cycles);
+        if (test->halted && !ref->halted && ref->cycles == test->cycles) {
+            // A fault does not count an instruction: see that the
+            // reference faults (or halts) at the same one
+            cpu_step(ref);
+        }
+
+        // Engines differ in whether they run events due at the
+        // limit before returning or only on entry; settle them so
+        // both states are those the next instruction would see
+        settle_events(ref);
+        settle_events(test);
+
+        diff = compare(ref, test, &cons[0], &cons[1], false, &mem_addr);
+        if (diff) {
+            break;
+        }
+        from    = test->cycles;
+        from_pc = test->regs[REG_PC];
+    }
+
+    result->diverged     = diff != 0;
+    result->stop         = stop_reason(ref);
+    result->instructions = ref->cycles < test->cycles ? ref->cycles : test->cycles;
+    if (diff && !opts->quiet) {
+        report(ref, test, &cons[0], &cons[1], diff, mem_addr, from, from_pc);
+    }
+    rc = 0;
+
+done:
+    if (test) {
+        cpu_attach_jit(test, NULL);
+        cpu_attach_decode_cache(test, NULL);
+    }
+    if (jit) jit_destroy(jit);
+    if (dcache) decode_cache_destroy(dcache);
+    free(cons);
+    free(test);
+    free(ref);
+    return rc;
+}
+
+//=========================================================
+// Random programs
+//=========================================================
+
+// Where fuzz loads and stores go besides code and ports
+#define FUZZ_DATA 0x8000
+
+// Ports worth poking: every built-in device register
+static const uint16_t fuzz_ports[] = {
+    PORT_STDOUT, PORT_STDIN, PORT_TIMER_CTRL, PORT_TIMER_VALUE, PORT_TIMER_HIGH,
+    PORT_TIMER_CMP, PORT_TIMER_CMP_HIGH, PORT_TIMER_STATUS, PORT_IRQ_PENDING,
+    PORT_IRQ_MASK, PORT_STDIN_STATUS, PORT_DMA_SRC, PORT_DMA_SRC + 1,
+    PORT_DMA_DST, PORT_DMA_DST + 1, PORT_DMA_LEN, PORT_DMA_LEN + 1, PORT_DMA_CTRL,
+    PORT_WRITE_ADDR, PORT_WRITE_ADDR + 1, PORT_WRITE_LEN, PORT_WRITE_LEN + 1,
+    PORT_PRINT_DEC, PORT_PRINT_DEC + 1,
+};
+
+#define FUZZ_PORT_COUNT (sizeof(fuzz_ports) / sizeof(fuzz_ports[0]))
+
+// splitmix64
+static uint64_t rng_next(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// A register A-D
+static uint8_t fuzz_reg(uint64_t *rng) {
+    return (uint8_t)(rng_next(rng) & 3);
+}
+
+// A 16-bit operand, often small so compares and counts can meet
+static uint16_t fuzz_imm(uint64_t *rng) {
+    uint64_t r = rng_next(rng);
+    return (r & 3) ? (uint16_t)(r >> 8) : (uint16_t)((r >> 8) & 7);
+}
+
+// A data address: mostly the data window, sometimes a port or the
+// program's own code
+static uint16_t fuzz_addr(uint64_t *rng, size_t code_size) {
+    uint64_t r = rng_next(rng);
+    switch (r & 7) {
+    case 0:  return (uint16_t)(PROGRAM_BASE + (r >> 8) % code_size);
+    case 1:  return fuzz_ports[(r >> 8) % FUZZ_PORT_COUNT];
+    default: return (uint16_t)(FUZZ_DATA + ((r >> 8) & 0xFF));
+    }
+}
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+int verify_fuzz_image(uint64_t seed, ProgramImage *image) {
+    memset(image, 0, sizeof(*image));
+    uint64_t rng = seed;
+
+    // Pick the instructions first: jumps need every start address
+    const IsaInsn *insns[VERIFY_FUZZ_INSNS];
+    uint16_t starts[VERIFY_FUZZ_INSNS + 1];
+    size_t size = 4 * isa_by_opcode(OP_LOAD_IMM)->length;     // register setup
+    for (size_t i = 0; i < VERIFY_FUZZ_INSNS; i++) {
+        const IsaInsn *insn;
+        do {
+            insn = &isa_insns[rng_next(&rng) % isa_insn_count];
+        } while (insn->opcode == OP_HLT);
+        insns[i]  = insn;
+        starts[i] = (uint16_t)(PROGRAM_BASE + size);
+        size += insn->length;
+    }
+    starts[VERIFY_FUZZ_INSNS] = (uint16_t)(PROGRAM_BASE + size);
+    size += 1;                                                // HLT
+
+    uint8_t *code = malloc(size);
+    if (!code) {
+        return -1;
+    }
+
+    uint8_t *p = code;
+    for (uint8_t r = REG_A; r <= REG_D; r++) {
+        p[0] = OP_LOAD_IMM;
+        p[1] = r;
+        put16(p + 2, (uint16_t)rng_next(&rng));
+        p += 4;
+    }
+    for (size_t i = 0; i < VERIFY_FUZZ_INSNS; i++) {
+        const IsaInsn *insn = insns[i];
+        p[0] = insn->opcode;
+        switch ((IsaFormat)insn->format) {
+        case ISA_FMT_NONE:
+            break;
+        case ISA_FMT_REG:
+            p[1] = fuzz_reg(&rng);
+            break;
+        case ISA_FMT_REG_REG:
+            p[1] = (uint8_t)(fuzz_reg(&rng) << 4 | fuzz_reg(&rng));
+            break;
+        case ISA_FMT_REG_IMM8:
+            p[1] = fuzz_reg(&rng);
+            p[2] = (uint8_t)(rng_next(&rng) % 20);
+            break;
+        case ISA_FMT_ADDR:
+            put16(p + 1, starts[rng_next(&rng) % (VERIFY_FUZZ_INSNS + 1)]);
+            break;
+        case ISA_FMT_REG_IMM16:
+            p[1] = fuzz_reg(&rng);
+            put16(p + 2, fuzz_imm(&rng));
+            break;
+        case ISA_FMT_REG_MEM:
+            p[1] = fuzz_reg(&rng);
+            put16(p + 2, fuzz_addr(&rng, size));
+            break;
+        case ISA_FMT_MEM_REG:
+            put16(p + 1, fuzz_addr(&rng, size));
+            p[3] = fuzz_reg(&rng);
+            break;
+        case ISA_FMT_REG_PORT:
+            p[1] = fuzz_reg(&rng);
+            put16(p + 2, fuzz_ports[rng_next(&rng) % FUZZ_PORT_COUNT]);
+            break;
+        case ISA_FMT_PORT_REG:
+            put16(p + 1, fuzz_ports[rng_next(&rng) % FUZZ_PORT_COUNT]);
+            p[3] = fuzz_reg(&rng);
+            break;
+        }
+        p += insn->length;
+    }
+    *p = OP_HLT;
+
+    image->data  = code;
+    image->size  = size;
+    image->owned = code;
+    return 0;
+}
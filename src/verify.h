@@ -0,0 +1,90 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "image.h"
+
+//=========================================================
+// Differential engine verification
+//=========================================================
+//
+// Runs a program on the reference stepper (cpu_step, the switch
+// engine) and on one of the faster engines side by side, and stops
+// at the first point where their architectural state differs.
+//
+// The engine under test goes first: it is asked to run 'every' more
+// instructions through its own entry point, so the threaded engine
+// and the JIT execute whole blocks exactly as they would in a normal
+// run and return at the first block end at or past that point. The
+// reference then steps to the same cycle count and the two CPUs are
+// compared: registers, FLAGS, cycles, halt/fault status, timer,
+// interrupt and DMA state, pending events, a running hash of all
+// console output, and every memory page either CPU wrote since the
+// last checkpoint (their dirty_pages, which every engine maintains;
+// verify clears them at each checkpoint, so the CPUs it runs are not
+// snapshotted). With 'every' == 1 the decoded engine is compared after
+// every instruction and the block engines after every block.
+//
+// On a divergence both states are printed to stdout (registers as
+// cpu_dump_registers shows them, plus the rows of memory where they
+// first differ), together with the window of instructions it arose
+// in and the PC at its start.
+//
+// Console input is replayed: both CPUs read the same bytes
+// (VerifyOptions.input) through PORT_STDIN and PORT_STDIN_STATUS, and
+// IRQ_STDIN is raised while a byte is left, so input-driven programs
+// stay deterministic. Console output is hashed, not printed.
+//
+// verify_fuzz_image builds random programs for differential testing
+// from the instruction table (isa.h): valid encodings of every
+// instruction with registers A-D, jumps and calls to instruction
+// boundaries, loads and stores to a data window, the program's own
+// code (self-modifying code) and the built-in device ports.
+//
+
+// Instructions a fuzz case may run before it counts as finished
+#define VERIFY_FUZZ_CYCLES 100000
+
+// Random instructions per fuzz program
+#define VERIFY_FUZZ_INSNS 64
+
+typedef struct {
+    CpuEngine      engine;       // engine compared against the reference
+    uint64_t       every;        // instructions between comparisons (>= 1)
+    uint64_t       max_cycles;   // CPU_BUDGET_NONE = run to HLT or a fault
+    const uint8_t *input;        // bytes PORT_STDIN reads, then EOF
+    size_t         input_size;
+    bool           quiet;        // no report on a divergence
+} VerifyOptions;
+
+typedef struct {
+    bool     diverged;
+    CpuStop  stop;               // how the reference stopped
+    uint64_t instructions;       // instructions both ran (to the divergence)
+    uint64_t checkpoints;        // comparisons made
+} VerifyResult;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// verify_program:
+//   Load 'image' into a reference CPU and one for opts->engine and
+//   compare them as above until both halt or fault, max_cycles
+//   instructions have run, or they diverge. Returns 0 when the check
+//   ran (see result->diverged), -1 if the image cannot be loaded or
+//   memory runs out.
+//
+// verify_fuzz_image:
+//   Fill 'image' with the random program numbered 'seed' (the same
+//   seed always gives the same program; release it with
+//   image_release). Returns -1 if out of memory.
+//
+int verify_program(const ProgramImage *image, const VerifyOptions *opts,
+                   VerifyResult *result);
+int verify_fuzz_image(uint64_t seed, ProgramImage *image);
+
+#endif // VERIFY_H
@@ -0,0 +1,574 @@
+#include "wide.h"
+#include "cpu_internal.h"
+#include "jit.h"
+#include <string.h>
+
+//=========================================================
+// Lane state
+//=========================================================
+//
+// Columns are indexed by lane. A lane mask holds 0xFFFF for lanes
+// that take part and 0 for the rest, so a masked update is
+// (new & m) | (old & ~m) on every lane at once and needs no branch.
+//
+
+// Registers kept in columns: A, B, C, D and SP (PC has its own)
+#define WIDE_REGS REG_PC
+
+typedef uint16_t LaneMask[WIDE_LANES];
+
+// Step results besides a PC
+#define WIDE_FALLBACK  (-1)          // run per lane; nothing changed
+#define WIDE_PC_VARIES 0x10000       // the lanes went different ways
+
+// All ones where 'cond' holds
+#define LANE_MASK(cond) ((uint16_t)-(uint16_t)((cond) != 0))
+
+typedef struct {
+    uint16_t regs[WIDE_REGS][WIDE_LANES];
+    uint16_t pc[WIDE_LANES];
+    uint16_t flags[WIDE_LANES];
+    uint16_t lazy_op[WIDE_LANES];        // FLAGS_LAZY_*
+    uint16_t lazy_res[WIDE_LANES];
+    uint16_t lazy_a[WIDE_LANES];
+    uint16_t lazy_b[WIDE_LANES];
+    uint16_t ran[WIDE_LANES];            // instructions since 'cycles'
+    uint64_t cycles[WIDE_LANES];
+
+    LaneMask live;                       // lanes still running
+    unsigned live_count;
+    uint64_t limit[WIDE_LANES];          // budget end
+    uint64_t stop_at[WIDE_LANES];        // min(limit, the lane's event_cycle)
+
+    CPU         *cpu[WIDE_LANES];
+    DecodeCache *own[WIDE_LANES];        // the lane's decode cache before
+    CpuStop     *stops;
+    unsigned     count;
+    DecodeCache *cache;
+} Wide;
+
+// Copy lane i's CPU into the columns
+static void gather(Wide *w, unsigned i) {
+    const CPU *cpu = w->cpu[i];
+    for (unsigned r = 0; r < WIDE_REGS; r++) {
+        w->regs[r][i] = cpu->regs[r];
+    }
+    w->pc[i]       = cpu->regs[REG_PC];
+    w->flags[i]    = cpu->flags;
+    w->lazy_op[i]  = cpu->lazy_op;
+    w->lazy_res[i] = cpu->lazy_res;
+    w->lazy_a[i]   = cpu->lazy_a;
+    w->lazy_b[i]   = cpu->lazy_b;
+    w->cycles[i]   = cpu->cycles;
+    w->ran[i]      = 0;
+    w->stop_at[i]  = cpu->event_cycle < w->limit[i] ? cpu->event_cycle : w->limit[i];
+}
+
+// Write lane i's columns back to its CPU
+static void spill(Wide *w, unsigned i) {
+    CPU *cpu = w->cpu[i];
+    for (unsigned r = 0; r < WIDE_REGS; r++) {
+        cpu->regs[r] = w->regs[r][i];
+    }
+    cpu->regs[REG_PC] = w->pc[i];
+    cpu->flags    = (uint8_t)w->flags[i];
+    cpu->lazy_op  = (uint8_t)w->lazy_op[i];
+    cpu->lazy_res = w->lazy_res[i];
+    cpu->lazy_a   = w->lazy_a[i];
+    cpu->lazy_b   = w->lazy_b[i];
+    cpu->cycles   = w->cycles[i] + w->ran[i];
+}
+
+// Lane i stops; its CPU already holds its final state
+static void retire(Wide *w, unsigned i, CpuStop stop) {
+    w->live[i] = 0;
+    w->live_count--;
+    w->stops[i] = stop;
+}
+
+// How a CPU that cpu_step stopped stopped: HLT clears running, a
+// fault leaves it set
+static CpuStop step_stop(const CPU *cpu) {
+    return cpu->running ? CPU_STOP_FAULT : CPU_STOP_HALT;
+}
+
+//=========================================================
+// Column operations
+//=========================================================
+
+static inline void col_fill(uint16_t *dst, uint16_t value) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) dst[i] = value;
+}
+
+static inline void col_copy(uint16_t *dst, const uint16_t *src) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) dst[i] = src[i];
+}
+
+// dst = value in the lanes of 'm', unchanged elsewhere
+static inline void col_put(uint16_t *dst, const uint16_t *value, const uint16_t *m) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        dst[i] = (uint16_t)((value[i] & m[i]) | (dst[i] & ~m[i]));
+    }
+}
+
+static inline void col_put_scalar(uint16_t *dst, uint16_t value, const uint16_t *m) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        dst[i] = (uint16_t)((value & m[i]) | (dst[i] & ~m[i]));
+    }
+}
+
+// Record lazy flags (cpu_internal.h) in the lanes of 'm'. FLAGS_LAZY_
+// RESULT keeps lazy_b, as flags_lazy_result does.
+static inline void put_flags(Wide *w, uint16_t op, const uint16_t *a, const uint16_t *b,
+                             const uint16_t *res, const uint16_t *m) {
+    col_put_scalar(w->lazy_op, op, m);
+    col_put(w->lazy_a, a, m);
+    if (op != FLAGS_LAZY_RESULT) col_put(w->lazy_b, b, m);
+    col_put(w->lazy_res, res, m);
+}
+
+// The lanes of 'm' move on to 'next', one cycle each
+static inline void advance(Wide *w, const uint16_t *m, uint16_t next) {
+    col_put_scalar(w->pc, next, m);
+    for (unsigned i = 0; i < WIDE_LANES; i++) w->ran[i] += m[i] & 1;
+}
+
+// Whether every lane of 'm' holds 'value' in 'col'
+static inline bool col_uniform(const uint16_t *col, const uint16_t *m, uint16_t value) {
+    uint16_t differ = 0;
+    for (unsigned i = 0; i < WIDE_LANES; i++) differ |= (uint16_t)((col[i] ^ value) & m[i]);
+    return differ == 0;
+}
+
+// ... or, in the lanes 'taken' holds, to 'target'. Returns the PC
+// the lanes of 'm' are now all at, or WIDE_PC_VARIES.
+static inline int32_t branch(Wide *w, const uint16_t *m, const uint16_t *taken,
+                             uint16_t target, uint16_t next) {
+    uint16_t any = 0, all = 0xFFFF;
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        uint16_t to = (uint16_t)((target & taken[i]) | (next & ~taken[i]));
+        w->pc[i] = (uint16_t)((to & m[i]) | (w->pc[i] & ~m[i]));
+        w->ran[i] += m[i] & 1;
+        any |= taken[i] & m[i];
+        all &= taken[i] | ~m[i];
+    }
+    return all ? target : any ? WIDE_PC_VARIES : next;
+}
+
+// Z and C per lane as masks, evaluated like flag_zero / flag_carry
+// but computing every case and selecting, which vectorises
+static inline void col_zero(const Wide *w, uint16_t *z) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        uint16_t lazy = LANE_MASK(w->lazy_op[i] != FLAGS_LAZY_NONE);
+        z[i] = (uint16_t)((LANE_MASK(w->lazy_res[i] == 0) & lazy) |
+                          (LANE_MASK(w->flags[i] & FLAG_ZERO) & ~lazy));
+    }
+}
+
+static inline void col_carry(const Wide *w, uint16_t *c) {
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        uint16_t op = w->lazy_op[i];
+        uint16_t none = LANE_MASK(op == FLAGS_LAZY_NONE);
+        uint16_t add  = LANE_MASK(op == FLAGS_LAZY_ADD);
+        uint16_t sub  = LANE_MASK(op == FLAGS_LAZY_SUB);
+        c[i] = (uint16_t)((LANE_MASK(w->flags[i] & FLAG_CARRY) & none) |
+                          (LANE_MASK(w->lazy_res[i] < w->lazy_a[i]) & add) |
+                          (LANE_MASK(w->lazy_a[i] < w->lazy_b[i]) & sub) |
+                          (LANE_MASK(w->lazy_a[i] != 0) & ~(none | add | sub)));
+    }
+}
+
+//=========================================================
+// Lockstep step
+//=========================================================
+
+// Highest address at which a word lies wholly below the I/O page
+#define WIDE_RAM_LIMIT (IO_PAGE_BASE - 2)
+
+// The lanes at the lowest PC any running lane is at. Returns that
+// PC; m gets the lanes, *n their number and *wait the lowest PC of
+// the other running lanes (WIDE_PC_VARIES if none).
+static uint16_t select_lanes(const Wide *w, uint16_t *m, unsigned *n, int32_t *wait) {
+    uint16_t pc = 0xFFFF;
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        uint16_t at = w->pc[i] | (uint16_t)~w->live[i];
+        pc = at < pc ? at : pc;
+    }
+    unsigned count = 0;
+    int32_t  next = WIDE_PC_VARIES;
+    for (unsigned i = 0; i < WIDE_LANES; i++) {
+        m[i] = w->live[i] & LANE_MASK(w->pc[i] == pc);
+        count += m[i] & 1;
+        int32_t at = (w->live[i] & ~m[i]) ? w->pc[i] : WIDE_PC_VARIES;
+        next = at < next ? at : next;
+    }
+    *n = count;
+    *wait = next;
+    return pc;
+}
+
+// The decoded instruction at 'pc', or NULL if it must run per lane.
+// An entry is cached only when every running lane holds the same
+// bytes there; any lane writing them afterwards drops it (the cache
+// is attached to all of them), so a cached entry is always right
+// for every lane.
+static const DecodedInsn *lookup(Wide *w, uint16_t pc) {
+    if (pc > FETCH_FAST_LIMIT) {
+        return NULL;
+    }
+    DecodedInsn *in = &w->cache->insns[pc];
+    if (in->length) {
+        return in;
+    }
+
+    const uint8_t *code = NULL;
+    DecodedInsn fresh;
+    for (unsigned i = 0; i < w->count; i++) {
+        if (!w->live[i]) continue;
+        const uint8_t *mem = w->cpu[i]->memory;
+        if (!code) {
+            code = &mem[pc];
+            decode_insn(mem, pc, &fresh);
+        } else if (memcmp(&mem[pc], code, fresh.length) != 0) {
+            return NULL;
+        }
+    }
+    *in = fresh;
+    w->cache->live_pages[pc >> 8] = 1;
+    w->cache->live_pages[(pc + in->length - 1) >> 8] = 1;
+    return in;
+}
+
+// Execute 'in' at 'pc' for the lanes of 'm'. Returns the PC they are
+// all at afterwards, WIDE_PC_VARIES, or WIDE_FALLBACK if it has to
+// run per lane instead.
+static int32_t execute(Wide *w, const DecodedInsn *in, uint16_t pc, const uint16_t *m) {
+    // The instruction's own bytes may be overwritten below
+    uint8_t  op  = in->handler, r1 = in->r1, r2 = in->r2;
+    uint16_t imm = in->imm;
+    uint16_t next = (uint16_t)(pc + in->length);
+
+    uint16_t a[WIDE_LANES], b[WIDE_LANES], res[WIDE_LANES], c[WIDE_LANES];
+    uint16_t *sp = w->regs[REG_SP];
+
+    switch (op) {
+        case OP_NOP:
+            break;
+
+        case OP_LOAD_IMM:
+            if (r1 >= WIDE_REGS) return WIDE_FALLBACK;
+            col_put_scalar(w->regs[r1], imm, m);
+            break;
+
+        case OP_MOV:
+            if (r1 >= WIDE_REGS || r2 >= WIDE_REGS) return WIDE_FALLBACK;
+            col_copy(res, w->regs[r2]);
+            col_put(w->regs[r1], res, m);
+            break;
+
+        // Two operands: a = r1, b = r2 or the immediate
+        case OP_ADD: case OP_ADDI: case OP_SUB: case OP_SUBI:
+        case OP_CMP: case OP_CMPI: case OP_MUL:
+        case OP_AND: case OP_OR:   case OP_XOR: {
+            bool immediate = op == OP_ADDI || op == OP_SUBI || op == OP_CMPI;
+            if (r1 >= WIDE_REGS || (!immediate && r2 >= WIDE_REGS)) return WIDE_FALLBACK;
+            col_copy(a, w->regs[r1]);
+            if (immediate) {
+                col_fill(b, imm);
+            } else {
+                col_copy(b, w->regs[r2]);
+            }
+
+            if (op == OP_ADD || op == OP_ADDI) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = (uint16_t)(a[i] + b[i]);
+                put_flags(w, FLAGS_LAZY_ADD, a, b, res, m);
+            } else if (op == OP_MUL) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) {
+                    uint32_t product = (uint32_t)a[i] * b[i];
+                    res[i] = (uint16_t)product;
+                    c[i]   = product > 0xFFFF;
+                }
+                put_flags(w, FLAGS_LAZY_RESULT, c, NULL, res, m);
+            } else if (op == OP_AND || op == OP_OR || op == OP_XOR) {
+                if (op == OP_AND) {
+                    for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = a[i] & b[i];
+                } else if (op == OP_OR) {
+                    for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = a[i] | b[i];
+                } else {
+                    for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = a[i] ^ b[i];
+                }
+                col_fill(c, 0);
+                put_flags(w, FLAGS_LAZY_RESULT, c, NULL, res, m);
+            } else {
+                for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = (uint16_t)(a[i] - b[i]);
+                put_flags(w, FLAGS_LAZY_SUB, a, b, res, m);
+                if (op == OP_CMP || op == OP_CMPI) break;    // no writeback
+            }
+            col_put(w->regs[r1], res, m);
+            break;
+        }
+
+        // One operand, Z/N from the result
+        case OP_INC: case OP_DEC: case OP_NOT: case OP_SHL: case OP_SHR:
+            if (r1 >= WIDE_REGS) return WIDE_FALLBACK;
+            col_copy(a, w->regs[r1]);
+            col_fill(c, 0);
+            if (op == OP_INC) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = (uint16_t)(a[i] + 1);
+            } else if (op == OP_DEC) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = (uint16_t)(a[i] - 1);
+            } else if (op == OP_NOT) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) res[i] = (uint16_t)~a[i];
+            } else {
+                for (unsigned i = 0; i < WIDE_LANES; i++) {
+                    bool carry;
+                    res[i] = op == OP_SHL ? shift_left(a[i], (uint8_t)imm, &carry)
+                                          : shift_right(a[i], (uint8_t)imm, &carry);
+                    c[i] = carry;
+                }
+            }
+            put_flags(w, FLAGS_LAZY_RESULT, c, NULL, res, m);
+            col_put(w->regs[r1], res, m);
+            break;
+
+        case OP_JMP:
+            col_fill(c, 0xFFFF);
+            return branch(w, m, c, imm, next);
+
+        case OP_JZ: case OP_JNZ:
+            col_zero(w, c);
+            if (op == OP_JNZ) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) c[i] = (uint16_t)~c[i];
+            }
+            return branch(w, m, c, imm, next);
+
+        case OP_JC: case OP_JNC:
+            col_carry(w, c);
+            if (op == OP_JNC) {
+                for (unsigned i = 0; i < WIDE_LANES; i++) c[i] = (uint16_t)~c[i];
+            }
+            return branch(w, m, c, imm, next);
+
+        // Memory: each lane's own RAM, one lane at a time
+        case OP_LOAD_MEM:
+            if (r1 >= WIDE_REGS || imm > WIDE_RAM_LIMIT) return WIDE_FALLBACK;
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                res[i] = m[i] ? cpu_read_word(w->cpu[i], imm) : 0;
+            }
+            col_put(w->regs[r1], res, m);
+            break;
+
+        case OP_STORE:
+            if (r1 >= WIDE_REGS || imm > WIDE_RAM_LIMIT) return WIDE_FALLBACK;
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                if (m[i]) cpu_write_word(w->cpu[i], imm, w->regs[r1][i]);
+            }
+            break;
+
+        case OP_PUSH: case OP_CALL:
+            if (op == OP_PUSH && r1 >= WIDE_REGS) return WIDE_FALLBACK;
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                if (m[i] && (uint16_t)(sp[i] - 2) > WIDE_RAM_LIMIT) return WIDE_FALLBACK;
+            }
+            // PUSH SP pushes the value from before the decrement
+            if (op == OP_PUSH) {
+                col_copy(res, w->regs[r1]);
+            } else {
+                col_fill(res, next);
+            }
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                if (!m[i]) continue;
+                sp[i] -= 2;
+                cpu_write_word(w->cpu[i], sp[i], res[i]);
+            }
+            if (op == OP_CALL) {
+                col_fill(c, 0xFFFF);
+                return branch(w, m, c, imm, next);
+            }
+            break;
+
+        case OP_POP: case OP_RET:
+            if (op == OP_POP && r1 >= WIDE_REGS) return WIDE_FALLBACK;
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                if (m[i] && sp[i] > WIDE_RAM_LIMIT) return WIDE_FALLBACK;
+            }
+            uint16_t popped = 0;     // any lane's
+            for (unsigned i = 0; i < WIDE_LANES; i++) {
+                res[i] = 0;
+                if (!m[i]) continue;
+                res[i] = popped = cpu_read_word(w->cpu[i], sp[i]);
+                sp[i] += 2;
+            }
+            if (op == OP_RET) {
+                col_put(w->pc, res, m);
+                for (unsigned i = 0; i < WIDE_LANES; i++) w->ran[i] += m[i] & 1;
+                return col_uniform(res, m, popped) ? popped : WIDE_PC_VARIES;
+            }
+            // POP SP: the popped value replaces the incremented SP
+            col_put(w->regs[r1], res, m);
+            break;
+
+        default:
+            return WIDE_FALLBACK;
+    }
+
+    advance(w, m, next);
+    return next;
+}
+
+//=========================================================
+// Per-lane work
+//=========================================================
+
+// Run the instruction at each masked lane's PC through cpu_step
+static void step_lanes(Wide *w, const uint16_t *m) {
+    for (unsigned i = 0; i < w->count; i++) {
+        if (!m[i]) continue;
+        CPU *cpu = w->cpu[i];
+        spill(w, i);
+        cpu_step(cpu);
+        gather(w, i);
+        if (cpu->halted) retire(w, i, step_stop(cpu));
+    }
+}
+
+// Stop lanes at their budget and run due events (which may take an
+// interrupt, moving PC). Returns how many steps may run before a
+// lane must be looked at again, at most UINT16_MAX so that 'ran'
+// cannot wrap.
+static uint64_t settle(Wide *w) {
+    uint64_t quiet = UINT16_MAX;
+    for (unsigned i = 0; i < w->count; i++) {
+        if (!w->live[i]) continue;
+        w->cycles[i] += w->ran[i];
+        w->ran[i] = 0;
+        if (w->cycles[i] >= w->stop_at[i]) {
+            spill(w, i);
+            if (w->cycles[i] >= w->limit[i]) {
+                retire(w, i, CPU_STOP_BUDGET);
+                continue;
+            }
+            cpu_run_events(w->cpu[i]);
+            gather(w, i);
+        }
+        uint64_t room = w->stop_at[i] > w->cycles[i] ? w->stop_at[i] - w->cycles[i] : 1;
+        quiet = room < quiet ? room : quiet;
+    }
+    return quiet;
+}
+
+// Finish every running lane on its own. Lanes without a JIT borrow
+// one a lane has, in turn, and return it flushed.
+static void split(Wide *w, const WideOptions *opts) {
+    Jit *jit = NULL;
+    for (unsigned i = 0; i < w->count && !jit; i++) {
+        jit = w->cpu[i]->jit;
+    }
+
+    for (unsigned i = 0; i < w->count; i++) {
+        if (!w->live[i]) continue;
+        CPU *cpu = w->cpu[i];
+        spill(w, i);
+        // Its own cache may hold another lane's decodes: attaching
+        // flushes it
+        cpu_attach_decode_cache(cpu, w->own[i]);
+        bool borrow = jit && !cpu->jit && opts->engine == CPU_ENGINE_JIT;
+        if (borrow) cpu_attach_jit(cpu, jit);
+
+        uint64_t left = w->limit[i] - cpu->cycles;
+        CpuStop stop = opts->deadline_ns
+            ? cpu_run_engine_until(cpu, opts->engine, left, opts->deadline_ns)
+            : cpu_run_engine_for(cpu, opts->engine, left);
+        if (borrow) {
+            cpu_attach_jit(cpu, NULL);
+            jit_flush(jit);
+        }
+        retire(w, i, stop);
+    }
+}
+
+//=========================================================
+// Public API
+//=========================================================
+
+void wide_run(CPU *const *lanes, unsigned count, DecodeCache *cache,
+              const WideOptions *opts, CpuStop *stops) {
+    Wide w;
+    memset(&w, 0, sizeof(w));
+    w.count = count < WIDE_LANES ? count : WIDE_LANES;
+    w.cache = cache;
+    w.stops = stops;
+
+    for (unsigned i = 0; i < w.count; i++) {
+        CPU *cpu = lanes[i];
+        w.cpu[i] = cpu;
+        w.own[i] = cpu->dcache;
+        cpu_attach_decode_cache(cpu, cache);
+        cpu->running = true;
+        cpu->halted  = false;
+        w.limit[i] = cpu->cycles + opts->max_instructions;
+        if (w.limit[i] < cpu->cycles) w.limit[i] = UINT64_MAX;
+        w.live[i] = 0xFFFF;
+        w.live_count++;
+        gather(&w, i);
+    }
+
+    // The lanes stepping, at 'pc', stay the same until they reach a
+    // lane waiting further on ('wait') or go different ways
+    LaneMask m;
+    unsigned n = 0;
+    uint16_t pc = 0;
+    int32_t  wait = 0;
+    bool     select = true;
+
+    uint64_t quiet = 0;              // steps before settle must run
+    uint64_t steps = 0, used = 0;    // this split window's steps and lanes
+    uint64_t clock = 0;
+    while (w.live_count) {
+        if (quiet == 0) {
+            quiet = settle(&w);
+            select = true;
+            continue;
+        }
+        if (opts->deadline_ns && ++clock % CPU_CLOCK_SLICE == 0 &&
+            cpu_clock_ns() >= opts->deadline_ns) {
+            for (unsigned i = 0; i < w.count; i++) {
+                if (w.live[i]) {
+                    spill(&w, i);
+                    retire(&w, i, CPU_STOP_BUDGET);
+                }
+            }
+            break;
+        }
+
+        if (select) {
+            pc = select_lanes(&w, m, &n, &wait);
+            select = false;
+        }
+        used += n;
+        if (++steps == WIDE_SPLIT_WINDOW) {
+            if (used < (uint64_t)WIDE_MIN_LANES * WIDE_SPLIT_WINDOW) {
+                split(&w, opts);
+                break;
+            }
+            steps = used = 0;
+        }
+
+        const DecodedInsn *in = lookup(&w, pc);
+        int32_t to = in ? execute(&w, in, pc, m) : WIDE_FALLBACK;
+        if (to == WIDE_FALLBACK) {
+            step_lanes(&w, m);
+            quiet = 0;               // the lanes' events may have changed
+        } else if (to < wait) {
+            pc = (uint16_t)to;
+            quiet--;
+        } else {
+            select = true;
+            quiet--;
+        }
+    }
+
+    for (unsigned i = 0; i < w.count; i++) {
+        if (lanes[i]->dcache == cache) cpu_attach_decode_cache(lanes[i], w.own[i]);
+    }
+}
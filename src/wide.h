@@ -0,0 +1,79 @@
+#ifndef WIDE_H
+#define WIDE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "decode.h"
+
+//=========================================================
+// Lockstep (wide) execution
+//=========================================================
+//
+// Runs up to WIDE_LANES CPUs holding the same program, typically one
+// per input of a batch, as lanes of one machine: each instruction is
+// decoded once and executed for every lane at that PC. Registers A-D
+// and SP, PC, the lazy-flag records and cycles are kept in
+// struct-of-arrays form, one WIDE_LANES-wide column each, and every
+// ALU operation, compare and branch is a fixed-length loop over a
+// column under a lane mask, which the compiler turns into SSE/AVX2/
+// NEON code for the target it builds for. Loads, stores and the stack
+// instructions go to each lane's own memory (cpu_read_word /
+// cpu_write_word, so dirty pages and cached code stay coherent).
+//
+// Lanes diverge at conditional branches (and RET). Each step runs
+// the lanes at the lowest PC among those still running and masks
+// off the rest, so lanes that took the short way wait at the join
+// for the others and continue together from there: a loop whose
+// trip count differs per lane runs with fewer lanes until the last
+// lane leaves it, an if/else runs one side, then the other.
+//
+// Instructions that touch devices or the run state (IN, OUT, DIV,
+// EI, DI, IRET, HLT, unknown opcodes), operands naming PC, memory
+// operands in the I/O page and code with different bytes in
+// different lanes run per lane through cpu_step, on the lane's own
+// CPU. Scheduled events and interrupts are taken per lane before
+// its next instruction, as every engine does.
+//
+// When divergence persists, so that fewer than WIDE_MIN_LANES lanes
+// share the average step over WIDE_SPLIT_WINDOW steps, the group
+// splits: each lane still running finishes on its own with
+// opts->engine. Every lane ends in exactly the state running it
+// alone on any engine would give.
+//
+
+// Lanes per group: 16 x 16-bit values fill one AVX2 register
+#define WIDE_LANES 16
+
+// Steps over which the lanes in use are averaged
+#define WIDE_SPLIT_WINDOW 4096
+
+// Fewest lanes per step, on average, worth keeping in lockstep: a
+// step costs about as much as five threaded-engine instructions
+#define WIDE_MIN_LANES 6
+
+typedef struct {
+    CpuEngine engine;            // engine lanes finish on after a split
+    uint64_t  max_instructions;  // per lane, CPU_BUDGET_NONE = no limit
+    uint64_t  deadline_ns;       // cpu_clock_ns() deadline, 0 = none
+} WideOptions;
+
+//=========================================================
+// Public API
+//=========================================================
+//
+// wide_run:
+//   Run 'count' (1 to WIDE_LANES) CPUs in lockstep until each halts,
+//   faults or uses up its budget, and store how each stopped in
+//   stops[i]. The lanes may hold different data and registers but
+//   are expected to run the same code. 'cache' is the group's decode
+//   cache: it is attached to every lane while they run together, and
+//   each lane gets its own decode cache back before it runs alone or
+//   when wide_run returns (the lanes may share one). A JIT attached
+//   to a lane stays attached and is used only after a split, when
+//   lanes without one borrow it in turn (opts->engine JIT only).
+//
+void wide_run(CPU *const *lanes, unsigned count, DecodeCache *cache,
+              const WideOptions *opts, CpuStop *stops);
+
+#endif // WIDE_H